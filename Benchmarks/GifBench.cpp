@@ -0,0 +1,1483 @@
+// gifbench: micro and end to end benchmarks of the decoder and compositor on
+// a corpus of synthetic gifs.  Results are printed as a table and can be
+// written as JSON (in the layout Google Benchmark uses) and compared against
+// a baseline to catch regressions.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "GifAssetCache.h"
+#include "GifAtlasCompositor.h"
+#include "GifBatchProcessor.h"
+#include "GifCompositor.h"
+#include "GifDecoder.h"
+#include "GifEncoder.h"
+#include "GifKernels.h"
+#include "GifParallelDecoder.h"
+#include "GifPixelBackend.h"
+#include "GifSynthesizer.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    // The synthetic corpus.  Every scenario is benchmarked by each of the
+    // benchmarks in RunScenario.
+    const GifSynthSpec SCENARIOS[] =
+    {
+        //  name                    cx    cy    frames disposal                 cover tiles  local  interl transp delay seed
+        { "full_480p",              640,  480,  24,    1,                        100,  1,    false, false, false, 4,    1 },
+        { "local_palettes_480p",    640,  480,  24,    1,                        100,  1,    true,  false, false, 4,    2 },
+        { "interlaced_480p",        640,  480,  24,    1,                        100,  1,    false, true,  false, 4,    3 },
+        { "transparent_480p",       640,  480,  24,    1,                        100,  1,    false, false, true,  4,    4 },
+        { "sprite_d0_720p",         1280, 720,  32,    0,                        25,   1,    false, false, true,  4,    5 },
+        { "sprite_d1_720p",         1280, 720,  32,    1,                        25,   1,    false, false, true,  4,    6 },
+        { "sprite_d2_720p",         1280, 720,  32,    2,                        25,   1,    false, false, true,  4,    7 },
+        { "sprite_d3_720p",         1280, 720,  32,    3,                        25,   1,    false, false, true,  4,    8 },
+        { "mixed_720p",             1280, 720,  32,    GIF_SYNTH_MIXED_DISPOSAL, 50,   1,    true,  true,  true,  4,    9 },
+        { "tiles_480p",             640,  480,  12,    1,                        100,  16,   false, false, false, 4,    10 },
+        { "sprite_d3_1080p",        1920, 1080, 32,    3,                        5,    1,    false, false, true,  4,    11 },
+        { "small_128",              128,  128,  64,    GIF_SYNTH_MIXED_DISPOSAL, 100,  1,    true,  false, true,  2,    12 },
+    };
+
+    // Gifs of growing length for the time to the first composed frame,
+    // which should not grow with the frame count when opening lazily
+    const GifSynthSpec OPEN_SCENARIOS[] =
+    {
+        //  name                    cx    cy    frames disposal                 cover tiles  local  interl transp delay seed
+        { "frames_10",              160,  120,  10,    1,                        25,   1,    false, false, true,  4,    21 },
+        { "frames_100",             160,  120,  100,   1,                        25,   1,    false, false, true,  4,    22 },
+        { "frames_1000",            160,  120,  1000,  1,                        25,   1,    false, false, true,  4,    23 },
+        { "frames_5000",            160,  120,  5000,  1,                        25,   1,    false, false, true,  4,    24 },
+    };
+
+    // Benchmarks run on every open scenario, named <benchmark>/<scenario>.
+    // The code refers to them by these indices, so the two must match.
+    enum OPEN_BENCHMARK
+    {
+        OB_FULL,
+        OB_LAZY,
+        OB_COUNT
+    };
+
+    const char* const OPEN_BENCHMARKS[] =
+    {
+        "first_frame/full",
+        "first_frame/lazy",
+    };
+    static_assert(sizeof(OPEN_BENCHMARKS) / sizeof(OPEN_BENCHMARKS[0]) == OB_COUNT, "OPEN_BENCHMARKS does not match OPEN_BENCHMARK");
+
+    // Many small animations playing at once, as on a page of stickers.  The
+    // atlas plays ATLAS_ANIMATIONS of them, made from ATLAS_VARIANTS gifs
+    // with different seeds and delays.
+    const GifSynthSpec ATLAS_SCENARIO =
+        //  name                    cx    cy    frames disposal                 cover tiles  local  interl transp delay seed
+        { "small_96",               96,   96,   24,    GIF_SYNTH_MIXED_DISPOSAL, 50,   1,    false, false, true,  2,    31 };
+    const unsigned int ATLAS_ANIMATIONS = 1000;
+    const unsigned int ATLAS_VARIANTS = 16;
+    const unsigned int ATLAS_THREADS = 4;
+
+    // Benchmarks run on the atlas scenario, named <benchmark>/<scenario>.
+    // With distinct keys every animation has its own decoder and slot, with
+    // shared keys the animations of a variant share them.
+    enum ATLAS_BENCHMARK
+    {
+        AB_DISTINCT,
+        AB_SHARED,
+        AB_COUNT
+    };
+
+    const char* const ATLAS_BENCHMARKS[] =
+    {
+        "atlas/distinct",
+        "atlas/shared",
+    };
+    static_assert(sizeof(ATLAS_BENCHMARKS) / sizeof(ATLAS_BENCHMARKS[0]) == AB_COUNT, "ATLAS_BENCHMARKS does not match ATLAS_BENCHMARK");
+
+    // A popular gif opened by many players, each playing it through once,
+    // as in chat sessions showing the same gif
+    const GifSynthSpec SHARED_SCENARIO =
+        //  name                    cx    cy    frames disposal                 cover tiles  local  interl transp delay seed
+        { "chat_240p",              320,  240,  24,    GIF_SYNTH_MIXED_DISPOSAL, 50,   1,    false, false, true,  4,    41 };
+    const unsigned int SHARED_PLAYERS = 16;
+
+    // Benchmarks run on the shared scenario, named <benchmark>/<scenario>.
+    // Independent players each open the gif with a decoder of their own,
+    // shared players get it from a GifAssetCache that outlives them.
+    enum SHARED_BENCHMARK
+    {
+        SB_INDEPENDENT,
+        SB_SHARED,
+        SB_COUNT
+    };
+
+    const char* const SHARED_BENCHMARKS[] =
+    {
+        "players/independent",
+        "players/shared",
+    };
+    static_assert(sizeof(SHARED_BENCHMARKS) / sizeof(SHARED_BENCHMARKS[0]) == SB_COUNT, "SHARED_BENCHMARKS does not match SHARED_BENCHMARK");
+
+    // A long gif transcoded in bulk: one loop composed without the frame
+    // cache, with the frames decoded one at a time and decoded ahead on a
+    // growing number of threads
+    const GifSynthSpec TRANSCODE_SCENARIO =
+        //  name                    cx    cy    frames disposal                 cover tiles  local  interl transp delay seed
+        { "long_360p",              480,  360,  1000,  GIF_SYNTH_MIXED_DISPOSAL, 50,   1,    true,  false, true,  4,    51 };
+
+    // Benchmarks run on the transcode scenario, named <benchmark>/<scenario>,
+    // and the decode threads of each, 0 for GifDecoder
+    const char* const TRANSCODE_BENCHMARKS[] =
+    {
+        "transcode/serial",
+        "transcode/threads_1",
+        "transcode/threads_2",
+        "transcode/threads_4",
+        "transcode/threads_8",
+    };
+    const unsigned int TRANSCODE_THREADS[] = { 0, 1, 2, 4, 8 };
+    static_assert(sizeof(TRANSCODE_THREADS) / sizeof(TRANSCODE_THREADS[0]) == sizeof(TRANSCODE_BENCHMARKS) / sizeof(TRANSCODE_BENCHMARKS[0]),
+        "TRANSCODE_THREADS does not match TRANSCODE_BENCHMARKS");
+
+    // Many gifs processed by GifBatchProcessor, as when generating previews
+    // for an upload queue: each gif's first frame is returned and its first
+    // loop composed.  BATCH_GIFS gifs made from the batch scenario with
+    // different seeds.
+    const GifSynthSpec BATCH_SCENARIO =
+        //  name                    cx    cy    frames disposal                 cover tiles  local  interl transp delay seed
+        { "previews_240p",          320,  240,  24,    GIF_SYNTH_MIXED_DISPOSAL, 50,   1,    true,  false, true,  4,    61 };
+    const unsigned int BATCH_GIFS = 64;
+
+    // Benchmarks run on the batch scenario, named <benchmark>/<scenario>,
+    // and the worker threads of each
+    const char* const BATCH_BENCHMARKS[] =
+    {
+        "batch/threads_1",
+        "batch/threads_2",
+        "batch/threads_4",
+        "batch/threads_8",
+        "batch/threads_16",
+    };
+    const unsigned int BATCH_THREADS[] = { 1, 2, 4, 8, 16 };
+    static_assert(sizeof(BATCH_THREADS) / sizeof(BATCH_THREADS[0]) == sizeof(BATCH_BENCHMARKS) / sizeof(BATCH_BENCHMARKS[0]),
+        "BATCH_THREADS does not match BATCH_BENCHMARKS");
+
+    // A long gif read from a file, written to the --io-dir directory for the
+    // run.  Cold runs drop the file from the page cache before each
+    // iteration, which needs a disk-backed directory: on tmpfs they read
+    // from memory like the warm runs.
+    const GifSynthSpec IO_SCENARIO =
+        //  name                    cx    cy    frames disposal                 cover tiles  local  interl transp delay seed
+        { "file_480p",              640,  480,  200,   GIF_SYNTH_MIXED_DISPOSAL, 50,   1,    true,  false, true,  4,    71 };
+
+    enum IO_SOURCE
+    {
+        IOS_MEMORY,     // GifByteSource::FromSpan over bytes already in memory
+        IOS_READ,       // GifByteSource::ReadFile, buffered
+        IOS_MAP,        // GifByteSource::MapFile
+    };
+
+    // Benchmarks run on the io scenario, named <benchmark>/<scenario>.
+    // first_frame opens the gif lazily and composes its first frame, loop
+    // composes every frame.
+    struct IoBenchmark
+    {
+        const char*     pszName;
+        IO_SOURCE       source;
+        bool            fCold;          // The file is dropped from the page cache before each iteration
+        bool            fLoop;
+    };
+
+    const IoBenchmark IO_BENCHMARKS[] =
+    {
+        { "io/memory/first_frame",      IOS_MEMORY, false, false },
+        { "io/read/warm/first_frame",   IOS_READ,   false, false },
+        { "io/read/cold/first_frame",   IOS_READ,   true,  false },
+        { "io/mmap/warm/first_frame",   IOS_MAP,    false, false },
+        { "io/mmap/cold/first_frame",   IOS_MAP,    true,  false },
+        { "io/memory/loop",             IOS_MEMORY, false, true },
+        { "io/read/warm/loop",          IOS_READ,   false, true },
+        { "io/read/cold/loop",          IOS_READ,   true,  true },
+        { "io/mmap/warm/loop",          IOS_MAP,    false, true },
+        { "io/mmap/cold/loop",          IOS_MAP,    true,  true },
+    };
+
+    // Dropping a file from the page cache has no equivalent that works
+    // without privileges on Windows, so the cold runs are left out there
+#if defined(_WIN32)
+    const bool IO_COLD_SUPPORTED = false;
+#else
+    const bool IO_COLD_SUPPORTED = true;
+#endif
+
+    // Benchmarks run on every scenario, named <benchmark>/<scenario>.  The
+    // code refers to them by these indices, so the two must match.
+    enum BENCHMARK
+    {
+        B_DECODE_RAW_FRAME,
+        B_DECODE_DRAW_RAW_FRAME,
+        B_OVERLAY,
+        B_DISPOSE_CLEAR,
+        B_SAVE,
+        B_SAVE_RESTORE,
+        B_COMPOSE,
+        B_COMPOSE_THUMBNAIL,
+        B_REPLAY,
+        B_REPLAY_PACKED,
+        B_ENCODE,
+        B_COUNT
+    };
+
+    const char* const BENCHMARKS[] =
+    {
+        "decode/GetRawFrame",
+        "decode/DrawRawFrame",
+        "overlay",
+        "dispose/clear",
+        "save",
+        "save_restore",
+        "compose",
+        "compose/thumbnail",
+        "replay",
+        "replay/packed",
+        "encode/threads_8",
+    };
+    static_assert(sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]) == B_COUNT, "BENCHMARKS does not match BENCHMARK");
+
+    // Seeking, run on every scenario with each seek interval and named
+    // <benchmark>/<scenario>.  k_0 only has restart points.
+    const char* const SEEK_BENCHMARKS[] =
+    {
+        "seek/k_0",
+        "seek/k_4",
+        "seek/k_16",
+        "seek/k_64",
+    };
+    const unsigned int SEEK_INTERVALS[] = { 0, 4, 16, 64 };
+    static_assert(sizeof(SEEK_INTERVALS) / sizeof(SEEK_INTERVALS[0]) == sizeof(SEEK_BENCHMARKS) / sizeof(SEEK_BENCHMARKS[0]),
+        "SEEK_INTERVALS does not match SEEK_BENCHMARKS");
+
+    // Threads of encode/threads_8, and the composed megapixels per second it
+    // is meant to reach with them
+    const unsigned int ENCODE_THREADS = 8;
+    const double ENCODE_TARGET_MPIX = 100.;
+
+    // Largest size of the compose/thumbnail canvas, as in a grid of previews
+    const unsigned int THUMBNAIL_SIZE = 128;
+
+    struct BenchOptions
+    {
+        std::string     filter;
+        double          minTime;            // Seconds per repetition
+        unsigned int    cRepetitions;
+        std::string     jsonPath;           // "-" for stdout
+        std::string     baselinePath;
+        double          threshold;          // Percent slower than the baseline that fails
+        std::string     corpusPath;
+        std::string     ioPath;             // Directory of the io scenario's file
+        bool            fList;
+    };
+
+    struct BenchResult
+    {
+        std::string     name;
+        uint64_t        cIterations;
+        double          nsMedian;           // Per iteration
+        double          nsMin;
+        double          nsMax;
+        double          cItems;             // Per iteration
+        double          cbProcessed;        // Per iteration
+    };
+
+    /******************************************************************
+    *                                                                 *
+    *  BenchRunner                                                    *
+    *                                                                 *
+    *  Times a benchmark body: the iteration count grows until one   *
+    *  run takes minTime, then the run is repeated and the median     *
+    *  time per iteration is kept.                                    *
+    *                                                                 *
+    ******************************************************************/
+
+    class BenchRunner
+    {
+    public:
+
+        using Body = std::function<void(uint64_t cIterations)>;
+
+        // The table of results goes to pLog
+        BenchRunner(const BenchOptions& options, std::FILE* pLog) :
+            m_options(options),
+            m_pLog(pLog)
+        {
+        }
+
+        bool Matches(const std::string& name) const
+        {
+            return m_options.filter.empty() || name.find(m_options.filter) != std::string::npos;
+        }
+
+        // cItems and cbProcessed are the frames and bytes one iteration handles
+        void Run(const std::string& name, double cItems, double cbProcessed, const Body& body)
+        {
+            if (!Matches(name))
+            {
+                return;
+            }
+
+            // Warm up and calibrate
+            uint64_t cIterations = 1;
+            for (;;)
+            {
+                double seconds = Time(body, cIterations);
+                if (seconds >= m_options.minTime || cIterations >= (1ull << 40))
+                {
+                    break;
+                }
+                double factor = seconds > 0. ? m_options.minTime * 1.4 / seconds : 10.;
+                cIterations = static_cast<uint64_t>(cIterations * (std::min)((std::max)(factor, 2.), 10.));
+            }
+
+            std::vector<double> times;
+            for (unsigned int i = 0; i < m_options.cRepetitions; i++)
+            {
+                times.push_back(Time(body, cIterations) * 1e9 / cIterations);
+            }
+            std::sort(times.begin(), times.end());
+
+            BenchResult result;
+            result.name = name;
+            result.cIterations = cIterations;
+            result.nsMedian = times[times.size() / 2];
+            result.nsMin = times.front();
+            result.nsMax = times.back();
+            result.cItems = cItems;
+            result.cbProcessed = cbProcessed;
+            m_results.push_back(result);
+
+            std::fprintf(m_pLog, "%-48s %14.0f ns %12.1f frames/s %10.1f MB/s\n",
+                name.c_str(),
+                result.nsMedian,
+                cItems * 1e9 / result.nsMedian,
+                cbProcessed * 1e9 / result.nsMedian / (1024. * 1024.));
+            std::fflush(m_pLog);
+        }
+
+        const std::vector<BenchResult>& GetResults() const
+        {
+            return m_results;
+        }
+
+    private:
+
+        static double Time(const Body& body, uint64_t cIterations)
+        {
+            auto start = Clock::now();
+            body(cIterations);
+            return std::chrono::duration<double>(Clock::now() - start).count();
+        }
+
+    private:
+
+        const BenchOptions&         m_options;
+        std::FILE*                  m_pLog;
+        std::vector<BenchResult>    m_results;
+    };
+
+    // Keeps the compiler from dropping work whose result is unused
+    volatile uint32_t g_sink;
+
+    struct DecodedFrame
+    {
+        GifFrameInfo    info;
+        GifBitmap       pixels;
+    };
+
+    std::string GetBenchmarkName(size_t iBenchmark, const GifSynthSpec& spec)
+    {
+        return std::string(BENCHMARKS[iBenchmark]) + "/" + spec.name;
+    }
+
+    std::string GetSeekBenchmarkName(size_t iBenchmark, const GifSynthSpec& spec)
+    {
+        return std::string(SEEK_BENCHMARKS[iBenchmark]) + "/" + spec.name;
+    }
+
+    std::string GetOpenBenchmarkName(size_t iBenchmark, const GifSynthSpec& spec)
+    {
+        return std::string(OPEN_BENCHMARKS[iBenchmark]) + "/" + spec.name;
+    }
+
+    std::string GetAtlasBenchmarkName(size_t iBenchmark, const GifSynthSpec& spec)
+    {
+        return std::string(ATLAS_BENCHMARKS[iBenchmark]) + "/" + spec.name;
+    }
+
+    std::string GetSharedBenchmarkName(size_t iBenchmark, const GifSynthSpec& spec)
+    {
+        return std::string(SHARED_BENCHMARKS[iBenchmark]) + "/" + spec.name;
+    }
+
+    std::string GetTranscodeBenchmarkName(size_t iBenchmark, const GifSynthSpec& spec)
+    {
+        return std::string(TRANSCODE_BENCHMARKS[iBenchmark]) + "/" + spec.name;
+    }
+
+    std::string GetBatchBenchmarkName(size_t iBenchmark, const GifSynthSpec& spec)
+    {
+        return std::string(BATCH_BENCHMARKS[iBenchmark]) + "/" + spec.name;
+    }
+
+    std::string GetIoBenchmarkName(size_t iBenchmark, const GifSynthSpec& spec)
+    {
+        return std::string(IO_BENCHMARKS[iBenchmark].pszName) + "/" + spec.name;
+    }
+
+    bool IsIoBenchmarkSupported(size_t iBenchmark)
+    {
+        return IO_COLD_SUPPORTED || !IO_BENCHMARKS[iBenchmark].fCold;
+    }
+
+    // Asks the kernel to drop the file's clean pages from the page cache,
+    // so that the next read goes to the disk
+    void DropFromPageCache(const std::filesystem::path& path)
+    {
+#if !defined(_WIN32)
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Cannot open " + path.string());
+        }
+        int error = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+        if (error != 0)
+        {
+            throw std::runtime_error("Cannot drop " + path.string() + " from the page cache");
+        }
+#else
+        (void)path;
+#endif
+    }
+
+    // Opening the gif and composing its first frame, as a player does
+    // before it can show anything.  GOM_FULL walks every block of the gif
+    // first, GOM_LAZY only as far as the first frame.
+    void RunOpenScenario(BenchRunner& runner, const GifSynthSpec& spec)
+    {
+        if (!runner.Matches(GetOpenBenchmarkName(OB_FULL, spec)) && !runner.Matches(GetOpenBenchmarkName(OB_LAZY, spec)))
+        {
+            return;
+        }
+
+        auto gifData = SynthesizeGif(spec);
+
+        for (size_t i = 0; i < OB_COUNT; i++)
+        {
+            auto mode = (i == OB_LAZY) ? GOM_LAZY : GOM_FULL;
+            runner.Run(GetOpenBenchmarkName(i, spec), 1., static_cast<double>(gifData.size()), [&](uint64_t cIterations)
+            {
+                for (uint64_t iIteration = 0; iIteration < cIterations; iIteration++)
+                {
+                    auto decoder = std::make_shared<GifDecoder>();
+                    decoder->SetOpenMode(mode);
+                    decoder->Open(gifData.data(), gifData.size());
+
+                    GifCompositor compositor(decoder, std::make_unique<CpuPixelBackend>());
+                    compositor.ComposeNextFrame();
+                    g_sink = compositor.GetComposedFrame().pPixels[0];
+                }
+            });
+        }
+    }
+
+    // One second of playback of the atlas scenario, ticking the atlas
+    // whenever an animation is due.  Time is simulated, so an iteration
+    // takes as long as the composing does.
+    void RunAtlasScenario(BenchRunner& runner, const GifSynthSpec& spec)
+    {
+        std::vector<std::shared_ptr<GifByteSource>> variants;
+        for (size_t i = 0; i < sizeof(ATLAS_BENCHMARKS) / sizeof(ATLAS_BENCHMARKS[0]); i++)
+        {
+            if (!runner.Matches(GetAtlasBenchmarkName(i, spec)))
+            {
+                continue;
+            }
+
+            if (variants.empty())
+            {
+                for (unsigned int uVariant = 0; uVariant < ATLAS_VARIANTS; uVariant++)
+                {
+                    GifSynthSpec variantSpec = spec;
+                    variantSpec.uDelay = spec.uDelay + uVariant % 4;
+                    variantSpec.seed = spec.seed + uVariant;
+                    variants.push_back(GifByteSource::FromVector(SynthesizeGif(variantSpec)));
+                }
+            }
+
+            GifAtlasCompositor atlas(DEFAULT_ATLAS_PAGE_SIZE, DEFAULT_ATLAS_PAGE_SIZE, DEFAULT_ATLAS_MAX_PAGES, ATLAS_THREADS);
+            for (unsigned int uAnimation = 0; uAnimation < ATLAS_ANIMATIONS; uAnimation++)
+            {
+                unsigned int uVariant = uAnimation % ATLAS_VARIANTS;
+                unsigned int uKey = (i == AB_DISTINCT) ? uAnimation : uVariant;
+                atlas.Add(std::to_string(uKey), variants[uVariant]);
+            }
+
+            auto now = GifAtlasCompositor::Clock::time_point();
+            std::vector<GifAtlasUpdate> updates;
+            auto playSecond = [&]()
+            {
+                auto end = now + std::chrono::seconds(1);
+                while (now < end)
+                {
+                    updates.clear();
+                    atlas.Tick(now, updates);
+                    now = atlas.GetNextDueTime();
+                }
+            };
+
+            playSecond();
+            auto cFramesBefore = atlas.GetStats().cFramesComposed;
+            playSecond();
+            double cFrames = static_cast<double>(atlas.GetStats().cFramesComposed - cFramesBefore);
+
+            runner.Run(GetAtlasBenchmarkName(i, spec), cFrames, cFrames * spec.cx * spec.cy * 4, [&](uint64_t cIterations)
+            {
+                for (uint64_t iIteration = 0; iIteration < cIterations; iIteration++)
+                {
+                    playSecond();
+                }
+                g_sink = atlas.GetPage(0).pPixels[0];
+            });
+        }
+    }
+
+    // SHARED_PLAYERS players opening the gif one after another and each
+    // composing one loop
+    void RunSharedScenario(BenchRunner& runner, const GifSynthSpec& spec)
+    {
+        if (!runner.Matches(GetSharedBenchmarkName(SB_INDEPENDENT, spec)) && !runner.Matches(GetSharedBenchmarkName(SB_SHARED, spec)))
+        {
+            return;
+        }
+
+        auto gifData = SynthesizeGif(spec);
+        auto playLoop = [](GifCompositor& compositor)
+        {
+            unsigned int cDisplayed = 0;
+            do
+            {
+                compositor.ComposeNextFrame();
+                cDisplayed++;
+            } while (!compositor.IsLastFrame());
+            g_sink = compositor.GetComposedFrame().pPixels[0];
+            return cDisplayed;
+        };
+
+        auto decoder = std::make_shared<GifDecoder>();
+        decoder->Open(gifData.data(), gifData.size());
+        GifCompositor compositor(decoder, std::make_unique<CpuPixelBackend>());
+        double cFrames = static_cast<double>(SHARED_PLAYERS) * playLoop(compositor);
+        double cbFrames = cFrames * spec.cx * spec.cy * 4;
+
+        runner.Run(GetSharedBenchmarkName(SB_INDEPENDENT, spec), cFrames, cbFrames, [&](uint64_t cIterations)
+        {
+            for (uint64_t i = 0; i < cIterations * SHARED_PLAYERS; i++)
+            {
+                auto playerDecoder = std::make_shared<GifDecoder>();
+                playerDecoder->Open(GifByteSource::FromSpan(gifData.data(), gifData.size()));
+                GifCompositor player(playerDecoder, std::make_unique<CpuPixelBackend>());
+                playLoop(player);
+            }
+        });
+
+        GifAssetCache cache;
+        runner.Run(GetSharedBenchmarkName(SB_SHARED, spec), cFrames, cbFrames, [&](uint64_t cIterations)
+        {
+            for (uint64_t i = 0; i < cIterations * SHARED_PLAYERS; i++)
+            {
+                auto asset = cache.Acquire(GifByteSource::FromSpan(gifData.data(), gifData.size()));
+                GifCompositor player(asset->CreateFrameSource(), std::make_unique<CpuPixelBackend>());
+                player.SetFrameCacheMode(FCM_OFF);
+                player.SetSharedFrameStore(asset->GetComposedFrameStore());
+                playLoop(player);
+            }
+        });
+    }
+
+    // Composing one loop after another, the frame cache off, with the
+    // frames decoded by GifDecoder or GifParallelDecoder
+    void RunTranscodeScenario(BenchRunner& runner, const GifSynthSpec& spec)
+    {
+        std::vector<uint8_t> gifData;
+        for (size_t i = 0; i < sizeof(TRANSCODE_BENCHMARKS) / sizeof(TRANSCODE_BENCHMARKS[0]); i++)
+        {
+            if (!runner.Matches(GetTranscodeBenchmarkName(i, spec)))
+            {
+                continue;
+            }
+
+            if (gifData.empty())
+            {
+                gifData = SynthesizeGif(spec);
+            }
+
+            std::shared_ptr<IGifFrameSource> source;
+            if (TRANSCODE_THREADS[i] == 0)
+            {
+                auto decoder = std::make_shared<GifDecoder>();
+                decoder->Open(gifData.data(), gifData.size());
+                source = decoder;
+            }
+            else
+            {
+                source = std::make_shared<GifParallelDecoder>(GifByteSource::FromSpan(gifData.data(), gifData.size()), TRANSCODE_THREADS[i]);
+            }
+
+            GifCompositor compositor(source, std::make_unique<CpuPixelBackend>());
+            compositor.SetFrameCacheMode(FCM_OFF, 0);
+            unsigned int cDisplayed = 0;
+            do
+            {
+                compositor.ComposeNextFrame();
+                cDisplayed++;
+            } while (!compositor.IsLastFrame());
+
+            runner.Run(GetTranscodeBenchmarkName(i, spec), cDisplayed, cDisplayed * spec.cx * spec.cy * 4., [&](uint64_t cIterations)
+            {
+                for (uint64_t iIteration = 0; iIteration < cIterations; iIteration++)
+                {
+                    do
+                    {
+                        compositor.ComposeNextFrame();
+                    } while (!compositor.IsLastFrame());
+                }
+                g_sink = compositor.GetComposedFrame().pPixels[0];
+            });
+        }
+    }
+
+    // The batch of gifs submitted to a GifBatchProcessor with a growing
+    // number of threads, waiting for all of them.  The processor is kept
+    // between iterations, as a service would, so its workers reuse their
+    // decoders and compositors.
+    void RunBatchScenario(BenchRunner& runner, const GifSynthSpec& spec)
+    {
+        std::vector<std::vector<uint8_t>> gifs;
+        unsigned int cDisplayed = 0;
+        for (size_t i = 0; i < sizeof(BATCH_BENCHMARKS) / sizeof(BATCH_BENCHMARKS[0]); i++)
+        {
+            if (!runner.Matches(GetBatchBenchmarkName(i, spec)))
+            {
+                continue;
+            }
+
+            if (gifs.empty())
+            {
+                for (unsigned int uGif = 0; uGif < BATCH_GIFS; uGif++)
+                {
+                    GifSynthSpec gifSpec = spec;
+                    gifSpec.seed = spec.seed + uGif;
+                    gifs.push_back(SynthesizeGif(gifSpec));
+                }
+            }
+
+            // Frame 0 is returned; asking for a frame past the end composes
+            // the whole first loop
+            auto submitBatch = [&](GifBatchProcessor& processor)
+            {
+                for (unsigned int uGif = 0; uGif < BATCH_GIFS; uGif++)
+                {
+                    GifBatchInput input;
+                    input.data = gifs[uGif];
+                    input.composedFrames = { 0, ~0u };
+                    input.uTag = uGif;
+                    processor.Submit(std::move(input));
+                }
+                processor.Wait();
+            };
+
+            std::mutex lock;
+            unsigned int cFailed = 0;
+            unsigned int cBatchDisplayed = 0;
+            GifBatchProcessor processor([&](GifBatchResult&& result)
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    cFailed += result.fSucceeded ? 0 : 1;
+                    cBatchDisplayed += result.cDisplayedFrames;
+                    g_sink = result.frames.empty() ? 0 : result.frames[0].composedFrame.Pixels()[0];
+                }, BATCH_THREADS[i]);
+
+            submitBatch(processor);
+            if (cFailed != 0)
+            {
+                throw std::runtime_error("A gif of the batch scenario failed to process");
+            }
+            cDisplayed = cBatchDisplayed;
+
+            runner.Run(GetBatchBenchmarkName(i, spec), cDisplayed, cDisplayed * spec.cx * spec.cy * 4., [&](uint64_t cIterations)
+            {
+                for (uint64_t iIteration = 0; iIteration < cIterations; iIteration++)
+                {
+                    submitBatch(processor);
+                }
+            });
+        }
+    }
+
+    // The gif opened from a file with each kind of byte source, and from
+    // memory for comparison.  A cold iteration includes the call dropping
+    // the file from the page cache, which is small next to reading it back.
+    void RunIoScenario(BenchRunner& runner, const GifSynthSpec& spec, const std::string& directory)
+    {
+        std::vector<uint8_t> gifData;
+        std::filesystem::path path;
+        unsigned int cFrames = 0;
+
+        for (size_t i = 0; i < sizeof(IO_BENCHMARKS) / sizeof(IO_BENCHMARKS[0]); i++)
+        {
+            if (!IsIoBenchmarkSupported(i) || !runner.Matches(GetIoBenchmarkName(i, spec)))
+            {
+                continue;
+            }
+
+            if (gifData.empty())
+            {
+                gifData = SynthesizeGif(spec);
+                path = std::filesystem::path(directory) / (std::string("gifbench-") + spec.name + ".gif");
+                std::ofstream file(path, std::ios::binary);
+                file.write(reinterpret_cast<const char*>(gifData.data()), gifData.size());
+                if (!file)
+                {
+                    throw std::runtime_error("Writing " + path.string() + " failed");
+                }
+
+                auto decoder = std::make_shared<GifDecoder>();
+                decoder->Open(gifData.data(), gifData.size());
+                GifGlobalInfo globalInfo;
+                decoder->GetGlobalInfo(globalInfo);
+                cFrames = globalInfo.cFrames;
+            }
+
+            const auto& benchmark = IO_BENCHMARKS[i];
+            auto openSource = [&]()
+            {
+                switch (benchmark.source)
+                {
+                case IOS_READ:
+                    return GifByteSource::ReadFile(path);
+                case IOS_MAP:
+                    return GifByteSource::MapFile(path);
+                default:
+                    return GifByteSource::FromSpan(gifData.data(), gifData.size());
+                }
+            };
+
+            double cItems = benchmark.fLoop ? cFrames : 1.;
+            runner.Run(GetIoBenchmarkName(i, spec), cItems, static_cast<double>(gifData.size()), [&](uint64_t cIterations)
+            {
+                for (uint64_t iIteration = 0; iIteration < cIterations; iIteration++)
+                {
+                    if (benchmark.fCold)
+                    {
+                        DropFromPageCache(path);
+                    }
+
+                    auto decoder = std::make_shared<GifDecoder>();
+                    decoder->SetOpenMode(GOM_LAZY);
+                    decoder->Open(openSource());
+
+                    GifCompositor compositor(decoder, std::make_unique<CpuPixelBackend>());
+                    compositor.SetFrameCacheMode(FCM_OFF);
+                    do
+                    {
+                        compositor.ComposeNextFrame();
+                    } while (benchmark.fLoop && !compositor.IsLastFrame());
+                    g_sink = compositor.GetComposedFrame().pPixels[0];
+                }
+            });
+        }
+
+        if (!path.empty())
+        {
+            std::error_code error;
+            std::filesystem::remove(path, error);
+        }
+    }
+
+    void RunScenario(BenchRunner& runner, const GifSynthSpec& spec)
+    {
+        bool fSelected = false;
+        for (size_t i = 0; i < B_COUNT; i++)
+        {
+            fSelected = fSelected || runner.Matches(GetBenchmarkName(i, spec));
+        }
+        for (size_t i = 0; i < sizeof(SEEK_BENCHMARKS) / sizeof(SEEK_BENCHMARKS[0]); i++)
+        {
+            fSelected = fSelected || runner.Matches(GetSeekBenchmarkName(i, spec));
+        }
+        if (!fSelected)
+        {
+            return;
+        }
+
+        auto gifData = SynthesizeGif(spec);
+
+        auto decoder = std::make_shared<GifDecoder>();
+        decoder->Open(gifData.data(), gifData.size());
+        GifGlobalInfo globalInfo;
+        decoder->GetGlobalInfo(globalInfo);
+
+        // Raw frames decoded once, for the pixel operations
+        std::vector<DecodedFrame> frames(globalInfo.cFrames);
+        double cbRawFrames = 0.;
+        for (unsigned int i = 0; i < globalInfo.cFrames; i++)
+        {
+            GifRawFrame rawFrame;
+            decoder->GetRawFrame(i, rawFrame);
+            frames[i].info = rawFrame.info;
+            frames[i].pixels.Resize(rawFrame.pixels.cx, rawFrame.pixels.cy);
+            auto dest = frames[i].pixels.Surface();
+            for (unsigned int y = 0; y < rawFrame.pixels.cy; y++)
+            {
+                std::copy_n(rawFrame.pixels.Row(y), rawFrame.pixels.cx, dest.Row(y));
+            }
+            cbRawFrames += frames[i].pixels.SizeInBytes();
+        }
+        double cFrames = globalInfo.cFrames;
+        double cbCanvas = static_cast<double>(globalInfo.cxGifImage) * globalInfo.cyGifImage * 4;
+
+        // GetRawFrame: decoding into the decoder's own raw frame
+        runner.Run(GetBenchmarkName(B_DECODE_RAW_FRAME, spec), cFrames, cbRawFrames, [&](uint64_t cIterations)
+        {
+            GifRawFrame rawFrame;
+            for (uint64_t i = 0; i < cIterations; i++)
+            {
+                for (unsigned int uFrame = 0; uFrame < globalInfo.cFrames; uFrame++)
+                {
+                    decoder->GetRawFrame(uFrame, rawFrame);
+                }
+            }
+            g_sink = rawFrame.pixels.IsEmpty() ? 0 : rawFrame.pixels.pPixels[0];
+        });
+
+        // DrawRawFrame: decoding straight onto the composed frame, as the
+        // compositor does with the native decoder
+        runner.Run(GetBenchmarkName(B_DECODE_DRAW_RAW_FRAME, spec), cFrames, cbRawFrames, [&](uint64_t cIterations)
+        {
+            GifBitmap canvas(globalInfo.cxGifImage, globalInfo.cyGifImage);
+            for (uint64_t i = 0; i < cIterations; i++)
+            {
+                for (unsigned int uFrame = 0; uFrame < globalInfo.cFrames; uFrame++)
+                {
+                    decoder->DrawRawFrame(uFrame, canvas.Surface());
+                }
+            }
+            g_sink = canvas.Pixels()[0];
+        });
+
+        CpuPixelBackend backend;
+        backend.Initialize(globalInfo.cxGifImage, globalInfo.cyGifImage);
+        backend.Clear({ 0, 0, globalInfo.cxGifImage, globalInfo.cyGifImage }, globalInfo.backgroundColor);
+
+        // OverlayNextFrame: blending decoded raw frames onto the composed frame
+        runner.Run(GetBenchmarkName(B_OVERLAY, spec), cFrames, cbRawFrames, [&](uint64_t cIterations)
+        {
+            for (uint64_t i = 0; i < cIterations; i++)
+            {
+                for (auto& frame : frames)
+                {
+                    GifRawFrame rawFrame;
+                    rawFrame.info = frame.info;
+                    rawFrame.pixels = frame.pixels.Surface();
+                    backend.DrawFrame(rawFrame);
+                }
+            }
+            g_sink = backend.GetSurface().pPixels[0];
+        });
+
+        // DisposeCurrentFrame with disposal 2: clearing the frame's rect
+        runner.Run(GetBenchmarkName(B_DISPOSE_CLEAR, spec), cFrames, cbRawFrames, [&](uint64_t cIterations)
+        {
+            for (uint64_t i = 0; i < cIterations; i++)
+            {
+                for (auto& frame : frames)
+                {
+                    backend.Clear(frame.info.rect, globalInfo.backgroundColor);
+                }
+            }
+            g_sink = backend.GetSurface().pPixels[0];
+        });
+
+        // SaveComposedFrame: saving the area a disposal 3 frame draws over
+        runner.Run(GetBenchmarkName(B_SAVE, spec), cFrames, cbRawFrames, [&](uint64_t cIterations)
+        {
+            for (uint64_t i = 0; i < cIterations; i++)
+            {
+                for (auto& frame : frames)
+                {
+                    backend.SaveFrame(frame.info.rect);
+                }
+            }
+        });
+
+        // DisposeCurrentFrame with disposal 3: save plus restore, so the
+        // restore costs the difference to save/
+        runner.Run(GetBenchmarkName(B_SAVE_RESTORE, spec), cFrames, 2 * cbRawFrames, [&](uint64_t cIterations)
+        {
+            for (uint64_t i = 0; i < cIterations; i++)
+            {
+                for (auto& frame : frames)
+                {
+                    backend.SaveFrame(frame.info.rect);
+                    backend.RestoreFrame();
+                }
+            }
+            g_sink = backend.GetSurface().pPixels[0];
+        });
+
+        // The whole state machine for one loop, without the frame cache.
+        // Runs of zero delay tiles count as one displayed frame.
+        GifCompositor compositor(decoder, std::make_unique<CpuPixelBackend>());
+        compositor.SetFrameCacheMode(FCM_OFF, 0);
+        unsigned int cDisplayed = 0;
+        do
+        {
+            compositor.ComposeNextFrame();
+            cDisplayed++;
+        } while (!compositor.IsLastFrame());
+
+        runner.Run(GetBenchmarkName(B_COMPOSE, spec), cDisplayed, cDisplayed * cbCanvas, [&](uint64_t cIterations)
+        {
+            for (uint64_t i = 0; i < cIterations; i++)
+            {
+                do
+                {
+                    compositor.ComposeNextFrame();
+                } while (!compositor.IsLastFrame());
+            }
+            g_sink = compositor.GetComposedFrame().pPixels[0];
+        });
+
+        // Random access: seeking to every frame in a scattered order.  Seek
+        // points recorded by the first seeks are reused afterwards, so this
+        // is the cost of replaying up to the seek interval's raw frames.
+        for (size_t iSeek = 0; iSeek < sizeof(SEEK_BENCHMARKS) / sizeof(SEEK_BENCHMARKS[0]); iSeek++)
+        {
+            if (!runner.Matches(GetSeekBenchmarkName(iSeek, spec)))
+            {
+                continue;
+            }
+
+            compositor.SetSeekInterval(SEEK_INTERVALS[iSeek]);
+            runner.Run(GetSeekBenchmarkName(iSeek, spec), cFrames, cFrames * cbCanvas, [&](uint64_t cIterations)
+            {
+                for (uint64_t i = 0; i < cIterations; i++)
+                {
+                    for (unsigned int uFrame = 0; uFrame < globalInfo.cFrames; uFrame++)
+                    {
+                        compositor.SeekToFrame((uFrame * 7919u) % globalInfo.cFrames);
+                    }
+                }
+                g_sink = compositor.GetComposedFrame().pPixels[0];
+            });
+        }
+
+        // The same loop on a canvas scaled down while decoding
+        auto thumbnailDecoder = std::make_shared<GifDecoder>();
+        thumbnailDecoder->SetTargetSize(THUMBNAIL_SIZE, THUMBNAIL_SIZE);
+        thumbnailDecoder->Open(gifData.data(), gifData.size());
+        GifCompositor thumbnailCompositor(thumbnailDecoder, std::make_unique<CpuPixelBackend>());
+        thumbnailCompositor.SetFrameCacheMode(FCM_OFF, 0);
+        const auto& thumbnailInfo = thumbnailCompositor.GetGlobalInfo();
+        double cbThumbnail = static_cast<double>(thumbnailInfo.cxGifImage) * thumbnailInfo.cyGifImage * 4;
+
+        runner.Run(GetBenchmarkName(B_COMPOSE_THUMBNAIL, spec), cDisplayed, cDisplayed * cbThumbnail, [&](uint64_t cIterations)
+        {
+            for (uint64_t i = 0; i < cIterations; i++)
+            {
+                do
+                {
+                    thumbnailCompositor.ComposeNextFrame();
+                } while (!thumbnailCompositor.IsLastFrame());
+            }
+            g_sink = thumbnailCompositor.GetComposedFrame().pPixels[0];
+        });
+
+        // Loops restored from a frame cache holding the whole animation, as
+        // composed frames and packed with every codec
+        struct ReplayBenchmark
+        {
+            BENCHMARK       benchmark;
+            unsigned int    codec;
+        };
+        const ReplayBenchmark replays[] = { { B_REPLAY, GFC_NONE }, { B_REPLAY_PACKED, GFC_ALL } };
+        for (const auto& replay : replays)
+        {
+            if (!runner.Matches(GetBenchmarkName(replay.benchmark, spec)))
+            {
+                continue;
+            }
+
+            GifCompositor replayCompositor(decoder, std::make_unique<CpuPixelBackend>());
+            replayCompositor.SetFrameCacheMode(FCM_FULL, static_cast<size_t>(2 * cDisplayed * cbCanvas));
+            replayCompositor.SetFrameCacheCodec(replay.codec);
+            do
+            {
+                replayCompositor.ComposeNextFrame();
+            } while (!replayCompositor.IsLastFrame());
+
+            runner.Run(GetBenchmarkName(replay.benchmark, spec), cDisplayed, cDisplayed * cbCanvas, [&](uint64_t cIterations)
+            {
+                for (uint64_t i = 0; i < cIterations; i++)
+                {
+                    do
+                    {
+                        replayCompositor.ComposeNextFrame();
+                    } while (!replayCompositor.IsLastFrame());
+                }
+                g_sink = replayCompositor.GetComposedFrame().pPixels[0];
+            });
+        }
+
+        // Encoding one loop of composed frames as a new gif, with the LZW
+        // compression spread over ENCODE_THREADS threads
+        if (runner.Matches(GetBenchmarkName(B_ENCODE, spec)))
+        {
+            GifCompositor encodeCompositor(decoder, std::make_unique<CpuPixelBackend>());
+            encodeCompositor.SetFrameCacheMode(FCM_OFF, 0);
+            std::vector<GifBitmap> composedFrames(cDisplayed);
+            std::vector<unsigned int> delays(cDisplayed);
+            for (unsigned int i = 0; i < cDisplayed; i++)
+            {
+                encodeCompositor.ComposeNextFrame();
+                auto composed = encodeCompositor.GetComposedFrame();
+                composedFrames[i].Resize(composed.cx, composed.cy);
+                auto dest = composedFrames[i].Surface();
+                for (unsigned int y = 0; y < composed.cy; y++)
+                {
+                    std::copy_n(composed.Row(y), composed.cx, dest.Row(y));
+                }
+                delays[i] = encodeCompositor.GetFrameDelay();
+            }
+
+            runner.Run(GetBenchmarkName(B_ENCODE, spec), cDisplayed, cDisplayed * cbCanvas, [&](uint64_t cIterations)
+            {
+                for (uint64_t i = 0; i < cIterations; i++)
+                {
+                    GifEncoder encoder(globalInfo.cxGifImage, globalInfo.cyGifImage, ENCODE_THREADS);
+                    for (unsigned int iFrame = 0; iFrame < cDisplayed; iFrame++)
+                    {
+                        encoder.AddFrame(composedFrames[iFrame].Surface(), delays[iFrame]);
+                    }
+                    g_sink = static_cast<uint32_t>(encoder.Finish().size());
+                }
+            });
+        }
+    }
+
+    // Composed megapixels per second of each encode run against
+    // ENCODE_TARGET_MPIX.  Missing the target is reported, not failed: it
+    // assumes ENCODE_THREADS cores to run on.
+    void ReportEncodeTarget(const std::vector<BenchResult>& results, std::FILE* pLog)
+    {
+        const std::string prefix = std::string(BENCHMARKS[B_ENCODE]) + "/";
+        bool fHeader = false;
+        for (const auto& result : results)
+        {
+            if (result.name.compare(0, prefix.size(), prefix) != 0)
+            {
+                continue;
+            }
+
+            if (!fHeader)
+            {
+                std::fprintf(pLog, "\n%-48s %14s %14s\n", "encode against the target", "MPix/s", "target MPix/s");
+                fHeader = true;
+            }
+            double mpix = result.cbProcessed / 4. * 1e9 / result.nsMedian / 1e6;
+            std::fprintf(pLog, "%-48s %14.1f %14.1f%s\n",
+                result.name.c_str(),
+                mpix,
+                ENCODE_TARGET_MPIX,
+                mpix < ENCODE_TARGET_MPIX ? "  below" : "");
+        }
+    }
+
+    void PrintUsage()
+    {
+        std::fprintf(stderr,
+            "usage: gifbench [options]\n"
+            "\n"
+            "  --filter TEXT         Only run benchmarks whose name contains TEXT\n"
+            "  --min-time SECONDS    Minimum time of one repetition (default 0.2)\n"
+            "  --repetitions N       Repetitions, the median is reported (default 3)\n"
+            "  --json PATH           Write the results as JSON, - for stdout\n"
+            "  --baseline PATH       Compare with the JSON of an earlier run\n"
+            "  --threshold PERCENT   Slowdown against the baseline that fails (default 10)\n"
+            "  --write-corpus DIR    Write the synthetic gifs to DIR and exit\n"
+            "  --io-dir DIR          Directory of the file the io benchmarks read (default: the temp directory)\n"
+            "  --list                List the benchmarks without running them\n");
+    }
+
+    BenchOptions ParseOptions(int argc, char** argv)
+    {
+        BenchOptions options;
+        options.minTime = 0.2;
+        options.cRepetitions = 3;
+        options.threshold = 10.;
+        options.fList = false;
+
+        for (int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            if (arg == "--list")
+            {
+                options.fList = true;
+                continue;
+            }
+
+            if (i + 1 >= argc)
+            {
+                throw std::invalid_argument("Unknown option or missing value: " + arg);
+            }
+            std::string value = argv[++i];
+
+            if (arg == "--filter")
+            {
+                options.filter = value;
+            }
+            else if (arg == "--min-time")
+            {
+                options.minTime = std::atof(value.c_str());
+            }
+            else if (arg == "--repetitions")
+            {
+                options.cRepetitions = static_cast<unsigned int>(std::atoi(value.c_str()));
+            }
+            else if (arg == "--json")
+            {
+                options.jsonPath = value;
+            }
+            else if (arg == "--baseline")
+            {
+                options.baselinePath = value;
+            }
+            else if (arg == "--threshold")
+            {
+                options.threshold = std::atof(value.c_str());
+            }
+            else if (arg == "--write-corpus")
+            {
+                options.corpusPath = value;
+            }
+            else if (arg == "--io-dir")
+            {
+                options.ioPath = value;
+            }
+            else
+            {
+                throw std::invalid_argument("Unknown option: " + arg);
+            }
+        }
+
+        if (options.minTime <= 0. || options.cRepetitions == 0)
+        {
+            throw std::invalid_argument("--min-time and --repetitions must be positive");
+        }
+        return options;
+    }
+
+    const char* GetIsaName(GIF_KERNEL_ISA isa)
+    {
+        switch (isa)
+        {
+        case GKI_SSE2:
+            return "sse2";
+        case GKI_AVX2:
+            return "avx2";
+        case GKI_NEON:
+            return "neon";
+        default:
+            return "scalar";
+        }
+    }
+
+    // One benchmark per line, so that ReadBaseline does not need a JSON parser
+    void WriteJson(const BenchOptions& options, const std::vector<BenchResult>& results)
+    {
+        std::FILE* pFile = options.jsonPath == "-" ? stdout : std::fopen(options.jsonPath.c_str(), "w");
+        if (pFile == nullptr)
+        {
+            throw std::runtime_error("Cannot create " + options.jsonPath);
+        }
+
+        char szDate[32] = {};
+        auto now = std::time(nullptr);
+        std::strftime(szDate, sizeof(szDate), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+        std::fprintf(pFile, "{\n");
+        std::fprintf(pFile, "  \"context\": {\"date\": \"%s\", \"kernels\": \"%s\", \"min_time\": %g, \"repetitions\": %u},\n",
+            szDate, GetIsaName(GetGifKernels().isa), options.minTime, options.cRepetitions);
+        std::fprintf(pFile, "  \"benchmarks\": [\n");
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const auto& result = results[i];
+            std::fprintf(pFile,
+                "    {\"name\": \"%s\", \"iterations\": %llu, \"real_time\": %.1f, \"min_time\": %.1f, \"max_time\": %.1f, "
+                "\"time_unit\": \"ns\", \"items_per_second\": %.1f, \"bytes_per_second\": %.1f}%s\n",
+                result.name.c_str(),
+                static_cast<unsigned long long>(result.cIterations),
+                result.nsMedian,
+                result.nsMin,
+                result.nsMax,
+                result.cItems * 1e9 / result.nsMedian,
+                result.cbProcessed * 1e9 / result.nsMedian,
+                i + 1 < results.size() ? "," : "");
+        }
+        std::fprintf(pFile, "  ]\n}\n");
+
+        if (pFile != stdout && std::fclose(pFile) != 0)
+        {
+            throw std::runtime_error("Writing " + options.jsonPath + " failed");
+        }
+    }
+
+    // Reads name and real_time from each benchmark line of a file written by
+    // WriteJson
+    std::vector<std::pair<std::string, double>> ReadBaseline(const std::string& path)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            throw std::runtime_error("Cannot open " + path);
+        }
+
+        std::vector<std::pair<std::string, double>> baseline;
+        std::string line;
+        while (std::getline(file, line))
+        {
+            const std::string NAME_KEY = "\"name\": \"";
+            const std::string TIME_KEY = "\"real_time\": ";
+
+            auto offName = line.find(NAME_KEY);
+            auto offTime = line.find(TIME_KEY);
+            if (offName == std::string::npos || offTime == std::string::npos)
+            {
+                continue;
+            }
+
+            offName += NAME_KEY.size();
+            auto offNameEnd = line.find('"', offName);
+            if (offNameEnd == std::string::npos)
+            {
+                continue;
+            }
+            baseline.emplace_back(
+                line.substr(offName, offNameEnd - offName),
+                std::atof(line.c_str() + offTime + TIME_KEY.size()));
+        }
+        return baseline;
+    }
+
+    // Returns the number of benchmarks slower than the baseline by more
+    // than the threshold
+    int CompareWithBaseline(const BenchOptions& options, const std::vector<BenchResult>& results, std::FILE* pLog)
+    {
+        auto baseline = ReadBaseline(options.baselinePath);
+        int cRegressions = 0;
+
+        std::fprintf(pLog, "\n%-48s %14s %14s %8s\n", "compared with baseline", "baseline ns", "current ns", "change");
+        for (const auto& result : results)
+        {
+            auto it = std::find_if(baseline.begin(), baseline.end(),
+                [&](const std::pair<std::string, double>& entry) { return entry.first == result.name; });
+            if (it == baseline.end() || it->second <= 0.)
+            {
+                continue;
+            }
+
+            double change = (result.nsMedian / it->second - 1.) * 100.;
+            bool fRegressed = change > options.threshold;
+            if (fRegressed)
+            {
+                cRegressions++;
+            }
+            std::fprintf(pLog, "%-48s %14.0f %14.0f %+7.1f%%%s\n",
+                result.name.c_str(), it->second, result.nsMedian, change, fRegressed ? "  REGRESSION" : "");
+        }
+        return cRegressions;
+    }
+
+    void WriteCorpus(const std::string& directory)
+    {
+        std::vector<GifSynthSpec> specs(std::begin(SCENARIOS), std::end(SCENARIOS));
+        specs.insert(specs.end(), std::begin(OPEN_SCENARIOS), std::end(OPEN_SCENARIOS));
+
+        for (const auto& spec : specs)
+        {
+            auto path = directory + "/" + spec.name + ".gif";
+            auto data = SynthesizeGif(spec);
+
+            std::ofstream file(path, std::ios::binary);
+            file.write(reinterpret_cast<const char*>(data.data()), data.size());
+            if (!file)
+            {
+                throw std::runtime_error("Writing " + path + " failed");
+            }
+            std::printf("%s (%zu bytes)\n", path.c_str(), data.size());
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    try
+    {
+        options = ParseOptions(argc, argv);
+    }
+    catch (const std::exception& e)
+    {
+        std::fprintf(stderr, "gifbench: %s\n\n", e.what());
+        PrintUsage();
+        return 2;
+    }
+
+    try
+    {
+        if (!options.corpusPath.empty())
+        {
+            WriteCorpus(options.corpusPath);
+            return 0;
+        }
+
+        if (options.fList)
+        {
+            for (const auto& spec : SCENARIOS)
+            {
+                for (size_t i = 0; i < B_COUNT; i++)
+                {
+                    auto name = GetBenchmarkName(i, spec);
+                    if (options.filter.empty() || name.find(options.filter) != std::string::npos)
+                    {
+                        std::printf("%s\n", name.c_str());
+                    }
+                }
+                for (size_t i = 0; i < sizeof(SEEK_BENCHMARKS) / sizeof(SEEK_BENCHMARKS[0]); i++)
+                {
+                    auto name = GetSeekBenchmarkName(i, spec);
+                    if (options.filter.empty() || name.find(options.filter) != std::string::npos)
+                    {
+                        std::printf("%s\n", name.c_str());
+                    }
+                }
+            }
+            for (const auto& spec : OPEN_SCENARIOS)
+            {
+                for (size_t i = 0; i < sizeof(OPEN_BENCHMARKS) / sizeof(OPEN_BENCHMARKS[0]); i++)
+                {
+                    auto name = GetOpenBenchmarkName(i, spec);
+                    if (options.filter.empty() || name.find(options.filter) != std::string::npos)
+                    {
+                        std::printf("%s\n", name.c_str());
+                    }
+                }
+            }
+            for (size_t i = 0; i < sizeof(ATLAS_BENCHMARKS) / sizeof(ATLAS_BENCHMARKS[0]); i++)
+            {
+                auto name = GetAtlasBenchmarkName(i, ATLAS_SCENARIO);
+                if (options.filter.empty() || name.find(options.filter) != std::string::npos)
+                {
+                    std::printf("%s\n", name.c_str());
+                }
+            }
+            for (size_t i = 0; i < sizeof(SHARED_BENCHMARKS) / sizeof(SHARED_BENCHMARKS[0]); i++)
+            {
+                auto name = GetSharedBenchmarkName(i, SHARED_SCENARIO);
+                if (options.filter.empty() || name.find(options.filter) != std::string::npos)
+                {
+                    std::printf("%s\n", name.c_str());
+                }
+            }
+            for (size_t i = 0; i < sizeof(TRANSCODE_BENCHMARKS) / sizeof(TRANSCODE_BENCHMARKS[0]); i++)
+            {
+                auto name = GetTranscodeBenchmarkName(i, TRANSCODE_SCENARIO);
+                if (options.filter.empty() || name.find(options.filter) != std::string::npos)
+                {
+                    std::printf("%s\n", name.c_str());
+                }
+            }
+            for (size_t i = 0; i < sizeof(BATCH_BENCHMARKS) / sizeof(BATCH_BENCHMARKS[0]); i++)
+            {
+                auto name = GetBatchBenchmarkName(i, BATCH_SCENARIO);
+                if (options.filter.empty() || name.find(options.filter) != std::string::npos)
+                {
+                    std::printf("%s\n", name.c_str());
+                }
+            }
+            for (size_t i = 0; i < sizeof(IO_BENCHMARKS) / sizeof(IO_BENCHMARKS[0]); i++)
+            {
+                auto name = GetIoBenchmarkName(i, IO_SCENARIO);
+                if (IsIoBenchmarkSupported(i) && (options.filter.empty() || name.find(options.filter) != std::string::npos))
+                {
+                    std::printf("%s\n", name.c_str());
+                }
+            }
+            return 0;
+        }
+
+        // With the JSON on stdout the table goes to stderr
+        auto pLog = options.jsonPath == "-" ? stderr : stdout;
+
+        BenchRunner runner(options, pLog);
+        for (const auto& spec : SCENARIOS)
+        {
+            RunScenario(runner, spec);
+        }
+        for (const auto& spec : OPEN_SCENARIOS)
+        {
+            RunOpenScenario(runner, spec);
+        }
+        RunAtlasScenario(runner, ATLAS_SCENARIO);
+        RunSharedScenario(runner, SHARED_SCENARIO);
+        RunTranscodeScenario(runner, TRANSCODE_SCENARIO);
+        RunBatchScenario(runner, BATCH_SCENARIO);
+        RunIoScenario(runner, IO_SCENARIO, options.ioPath.empty() ? std::filesystem::temp_directory_path().string() : options.ioPath);
+
+        ReportEncodeTarget(runner.GetResults(), pLog);
+
+        if (!options.jsonPath.empty())
+        {
+            WriteJson(options, runner.GetResults());
+        }
+        if (!options.baselinePath.empty() && CompareWithBaseline(options, runner.GetResults(), pLog) > 0)
+        {
+            return 1;
+        }
+        return 0;
+    }
+    catch (const std::exception& e)
+    {
+        std::fprintf(stderr, "gifbench: %s\n", e.what());
+        return 1;
+    }
+}
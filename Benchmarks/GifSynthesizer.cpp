@@ -0,0 +1,238 @@
+#include "GifSynthesizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace
+{
+    const uint8_t TRANSPARENT_INDEX = 255;
+
+    // xorshift32, so that the output does not depend on the standard library
+    class SynthRandom
+    {
+    public:
+
+        explicit SynthRandom(uint32_t seed) :
+            m_state(seed != 0 ? seed : 0x9E3779B9u)
+        {
+        }
+
+        uint32_t Next()
+        {
+            m_state ^= m_state << 13;
+            m_state ^= m_state >> 17;
+            m_state ^= m_state << 5;
+            return m_state;
+        }
+
+    private:
+
+        uint32_t m_state;
+    };
+
+    struct SynthRect
+    {
+        unsigned int left;
+        unsigned int top;
+        unsigned int cx;
+        unsigned int cy;
+    };
+
+    void AppendUInt16(std::vector<uint8_t>& data, unsigned int value)
+    {
+        data.push_back(static_cast<uint8_t>(value));
+        data.push_back(static_cast<uint8_t>(value >> 8));
+    }
+
+    // Smooth ramps, shifted per variant so that local palettes differ
+    void AppendPalette(std::vector<uint8_t>& data, unsigned int uVariant)
+    {
+        for (unsigned int i = 0; i < 256; i++)
+        {
+            data.push_back(static_cast<uint8_t>(i * 3 + uVariant * 17));
+            data.push_back(static_cast<uint8_t>(i * 5 + uVariant * 31));
+            data.push_back(static_cast<uint8_t>(255 - i + uVariant * 7));
+        }
+    }
+
+    // Rows in the order an interlaced image stores them
+    void InterlaceRows(unsigned int cy, std::vector<unsigned int>& rows)
+    {
+        static const unsigned int PASS_START[4] = { 0, 4, 2, 1 };
+        static const unsigned int PASS_STEP[4] = { 8, 8, 4, 2 };
+
+        rows.clear();
+        for (int pass = 0; pass < 4; pass++)
+        {
+            for (unsigned int y = PASS_START[pass]; y < cy; y += PASS_STEP[pass])
+            {
+                rows.push_back(y);
+            }
+        }
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  SynthesizeGif                                                  *
+*                                                                 *
+******************************************************************/
+
+std::vector<uint8_t> SynthesizeGif(const GifSynthSpec& spec)
+{
+    if (spec.cx == 0 || spec.cy == 0 || spec.cx > 0xFFFF || spec.cy > 0xFFFF)
+    {
+        throw std::invalid_argument("The canvas must be 1 to 65535 pixels on each side");
+    }
+    if (spec.cFrames == 0 || spec.cTiles == 0)
+    {
+        throw std::invalid_argument("A gif needs at least one frame and one tile per frame");
+    }
+    if (spec.uDisposal > GIF_SYNTH_MIXED_DISPOSAL)
+    {
+        throw std::invalid_argument("Invalid disposal method");
+    }
+    if (spec.uCoverage == 0 || spec.uCoverage > 100)
+    {
+        throw std::invalid_argument("Coverage must be 1 to 100 percent");
+    }
+
+    SynthRandom random(spec.seed);
+    GifLzwEncoder encoder;
+    std::vector<uint8_t> data;
+    std::vector<uint8_t> indices;
+    std::vector<uint8_t> rowOrdered;
+    std::vector<unsigned int> rows;
+
+    // Header, logical screen with a 256 color global table, and an
+    // infinite loop
+    const uint8_t HEADER[] = { 'G', 'I', 'F', '8', '9', 'a' };
+    data.insert(data.end(), HEADER, HEADER + sizeof(HEADER));
+    AppendUInt16(data, spec.cx);
+    AppendUInt16(data, spec.cy);
+    data.push_back(0xF7);
+    data.push_back(0);      // Background color index
+    data.push_back(0);      // Square pixels
+    AppendPalette(data, 0);
+
+    const uint8_t LOOP_EXTENSION[] = { 0x21, 0xFF, 0x0B, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0', 0x03, 0x01 };
+    data.insert(data.end(), LOOP_EXTENSION, LOOP_EXTENSION + sizeof(LOOP_EXTENSION));
+    AppendUInt16(data, 0);
+    data.push_back(0);
+
+    // Each displayed frame covers a sprite of uCoverage percent of the
+    // canvas, moving across it from frame to frame
+    double scale = std::sqrt(spec.uCoverage / 100.);
+    unsigned int cxSprite = (std::max)(1u, static_cast<unsigned int>(spec.cx * scale + 0.5));
+    unsigned int cySprite = (std::max)(1u, static_cast<unsigned int>(spec.cy * scale + 0.5));
+    unsigned int cxTiles = static_cast<unsigned int>(std::ceil(std::sqrt(static_cast<double>(spec.cTiles))));
+    unsigned int cyTiles = (spec.cTiles + cxTiles - 1) / cxTiles;
+
+    for (unsigned int uFrame = 0; uFrame < spec.cFrames; uFrame++)
+    {
+        unsigned int uDisposal = spec.uDisposal == GIF_SYNTH_MIXED_DISPOSAL ? uFrame % 4 : spec.uDisposal;
+
+        SynthRect sprite;
+        sprite.cx = cxSprite;
+        sprite.cy = cySprite;
+        sprite.left = (uFrame * 7) % (spec.cx - cxSprite + 1);
+        sprite.top = (uFrame * 5) % (spec.cy - cySprite + 1);
+
+        // The square the animation is about, moving faster than the sprite
+        unsigned int uSquareSize = (std::max)(2u, (std::min)(spec.cx, spec.cy) / 6);
+        unsigned int xSquare = (uFrame * 11) % spec.cx;
+        unsigned int ySquare = (uFrame * 13) % spec.cy;
+
+        for (unsigned int uTile = 0; uTile < spec.cTiles; uTile++)
+        {
+            // Tiles split the sprite into a grid; the last tile ends the run
+            unsigned int xTile = uTile % cxTiles;
+            unsigned int yTile = uTile / cxTiles;
+            SynthRect rect;
+            rect.left = sprite.left + sprite.cx * xTile / cxTiles;
+            rect.top = sprite.top + sprite.cy * yTile / cyTiles;
+            rect.cx = sprite.left + sprite.cx * (xTile + 1) / cxTiles - rect.left;
+            rect.cy = sprite.top + sprite.cy * (yTile + 1) / cyTiles - rect.top;
+            if (rect.cx == 0 || rect.cy == 0)
+            {
+                rect.cx = 1;
+                rect.cy = 1;
+            }
+            bool fDisplayed = (uTile + 1 == spec.cTiles);
+
+            // Graphic control extension
+            data.push_back(0x21);
+            data.push_back(0xF9);
+            data.push_back(4);
+            data.push_back(static_cast<uint8_t>((uDisposal << 2) | (spec.fTransparent ? 1 : 0)));
+            AppendUInt16(data, fDisplayed ? spec.uDelay : 0);
+            data.push_back(TRANSPARENT_INDEX);
+            data.push_back(0);
+
+            // Image descriptor
+            data.push_back(0x2C);
+            AppendUInt16(data, rect.left);
+            AppendUInt16(data, rect.top);
+            AppendUInt16(data, rect.cx);
+            AppendUInt16(data, rect.cy);
+            data.push_back(static_cast<uint8_t>((spec.fLocalPalettes ? 0x87 : 0) | (spec.fInterlaced ? 0x40 : 0)));
+            if (spec.fLocalPalettes)
+            {
+                AppendPalette(data, uFrame + 1);
+            }
+
+            // Moving diagonal bands, the square, a little noise and, if
+            // asked for, transparent blocks
+            indices.resize(static_cast<size_t>(rect.cx) * rect.cy);
+            for (unsigned int y = 0; y < rect.cy; y++)
+            {
+                unsigned int yCanvas = rect.top + y;
+                for (unsigned int x = 0; x < rect.cx; x++)
+                {
+                    unsigned int xCanvas = rect.left + x;
+                    uint8_t index;
+
+                    if (xCanvas - xSquare < uSquareSize && yCanvas - ySquare < uSquareSize)
+                    {
+                        index = static_cast<uint8_t>(200 + ((xCanvas ^ yCanvas) & 31));
+                    }
+                    else
+                    {
+                        index = static_cast<uint8_t>((((xCanvas + 2 * uFrame) >> 3) + ((yCanvas + uFrame) >> 3)) % 200);
+                    }
+
+                    if ((random.Next() & 63) == 0)
+                    {
+                        index = static_cast<uint8_t>(random.Next() % 250);
+                    }
+                    if (spec.fTransparent && (((xCanvas >> 2) + (yCanvas >> 2) + uFrame) & 3) == 0)
+                    {
+                        index = TRANSPARENT_INDEX;
+                    }
+
+                    indices[static_cast<size_t>(y) * rect.cx + x] = index;
+                }
+            }
+
+            if (spec.fInterlaced)
+            {
+                InterlaceRows(rect.cy, rows);
+                rowOrdered.resize(indices.size());
+                for (size_t i = 0; i < rows.size(); i++)
+                {
+                    std::copy_n(
+                        indices.begin() + static_cast<size_t>(rows[i]) * rect.cx,
+                        rect.cx,
+                        rowOrdered.begin() + i * rect.cx);
+                }
+                indices.swap(rowOrdered);
+            }
+
+            encoder.Encode(indices.data(), indices.size(), 8, data);
+        }
+    }
+
+    data.push_back(0x3B);
+    return data;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "GifLzwEncoder.h"
+
+// GifSynthSpec::uDisposal value that cycles the displayed frames through
+// disposal methods 0 to 3
+const unsigned int GIF_SYNTH_MIXED_DISPOSAL = 4;
+
+// What a synthetic gif looks like
+struct GifSynthSpec
+{
+    std::string     name;
+    unsigned int    cx;
+    unsigned int    cy;
+    unsigned int    cFrames;            // Displayed frames
+    unsigned int    uDisposal;          // 0-3, or GIF_SYNTH_MIXED_DISPOSAL
+    unsigned int    uCoverage;          // Percentage of the canvas area each displayed frame covers
+    unsigned int    cTiles;             // > 1 splits every displayed frame into a run of zero delay tiles
+    bool            fLocalPalettes;     // Every frame has a local color table instead of using the global one
+    bool            fInterlaced;
+    bool            fTransparent;       // Frames use a transparent index for part of their pixels
+    unsigned int    uDelay;             // Delay of the displayed frames, in 10 ms units
+    uint32_t        seed;
+};
+
+// Writes a GIF89a as described by spec.  The content is a moving gradient
+// with a sprite and some noise, so it compresses about as well as typical
+// animations.  The same spec always gives the same bytes.
+std::vector<uint8_t> SynthesizeGif(const GifSynthSpec& spec);
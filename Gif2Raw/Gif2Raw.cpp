@@ -0,0 +1,1184 @@
+// gif2raw: decodes and composes a gif without a window and writes the
+// composed frames as raw BGRA, PNG or Y4M, or encodes them as a new gif,
+// reporting how long decoding, composing and writing took.  Builds with
+// CMake on any platform.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "GifCompositor.h"
+#include "GifDecoder.h"
+#include "GifEncoder.h"
+#include "GifFrameWriter.h"
+#include "GifParallelDecoder.h"
+#include "GifTrace.h"
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    double ElapsedMs(Clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    /******************************************************************
+    *                                                                 *
+    *  TimedFrameSource                                               *
+    *                                                                 *
+    *  Forwards to the decoder and adds up the time spent in it, so   *
+    *  decoding can be told apart from composing.                     *
+    *                                                                 *
+    ******************************************************************/
+
+    class TimedFrameSource : public IGifFrameSource
+    {
+    public:
+
+        explicit TimedFrameSource(std::shared_ptr<IGifFrameSource> source) :
+            m_source(std::move(source)),
+            m_msDecode(0.),
+            m_cRawFrames(0),
+            m_cRawPixels(0)
+        {
+        }
+
+        void GetGlobalInfo(GifGlobalInfo& globalInfo) override
+        {
+            auto start = Clock::now();
+            m_source->GetGlobalInfo(globalInfo);
+            m_msDecode += ElapsedMs(start);
+        }
+
+        void GetFrameInfo(unsigned int uFrameIndex, GifFrameInfo& frameInfo) override
+        {
+            auto start = Clock::now();
+            m_source->GetFrameInfo(uFrameIndex, frameInfo);
+            m_msDecode += ElapsedMs(start);
+        }
+
+        void DiscoverFrames(unsigned int cFramesNeeded, GifGlobalInfo& globalInfo) override
+        {
+            auto start = Clock::now();
+            m_source->DiscoverFrames(cFramesNeeded, globalInfo);
+            m_msDecode += ElapsedMs(start);
+        }
+
+        void GetRawFrame(unsigned int uFrameIndex, GifRawFrame& rawFrame) override
+        {
+            auto start = Clock::now();
+            m_source->GetRawFrame(uFrameIndex, rawFrame);
+            m_msDecode += ElapsedMs(start);
+            CountRawFrame(uFrameIndex);
+        }
+
+        bool DrawRawFrame(unsigned int uFrameIndex, const GifSurface& surface) override
+        {
+            auto start = Clock::now();
+            bool fDrawn = m_source->DrawRawFrame(uFrameIndex, surface);
+            m_msDecode += ElapsedMs(start);
+            if (fDrawn)
+            {
+                CountRawFrame(uFrameIndex);
+            }
+            return fDrawn;
+        }
+
+        bool IsFrameOpaque(unsigned int uFrameIndex) override
+        {
+            auto start = Clock::now();
+            bool fOpaque = m_source->IsFrameOpaque(uFrameIndex);
+            m_msDecode += ElapsedMs(start);
+            return fOpaque;
+        }
+
+        double GetDecodeMs() const
+        {
+            return m_msDecode;
+        }
+
+        uint64_t GetRawFrameCount() const
+        {
+            return m_cRawFrames;
+        }
+
+        uint64_t GetRawPixelCount() const
+        {
+            return m_cRawPixels;
+        }
+
+    private:
+
+        void CountRawFrame(unsigned int uFrameIndex)
+        {
+            GifFrameInfo frameInfo;
+            m_source->GetFrameInfo(uFrameIndex, frameInfo);
+            m_cRawFrames++;
+            m_cRawPixels += static_cast<uint64_t>(frameInfo.rect.Width()) * frameInfo.rect.Height();
+        }
+
+    private:
+
+        std::shared_ptr<IGifFrameSource>    m_source;
+        double                              m_msDecode;
+        uint64_t                            m_cRawFrames;
+        uint64_t                            m_cRawPixels;
+    };
+
+    // Chunk size for reading stdin when -s is not given
+    const unsigned int DEFAULT_STREAM_CHUNK = 64 * 1024;
+
+    /******************************************************************
+    *                                                                 *
+    *  StreamInput                                                    *
+    *                                                                 *
+    *  Feeds a file or stdin to a streaming decoder a chunk at a      *
+    *  time, the way bytes would arrive over a socket.                *
+    *                                                                 *
+    ******************************************************************/
+
+    class StreamInput
+    {
+    public:
+
+        StreamInput(const std::string& path, size_t cbChunk, std::shared_ptr<GifDecoder> decoder) :
+            m_decoder(std::move(decoder)),
+            m_chunk(cbChunk),
+            m_pFile(nullptr),
+            m_fOwnsFile(false),
+            m_cbRead(0),
+            m_fEnded(false)
+        {
+            if (path == "-")
+            {
+#ifdef _WIN32
+                _setmode(_fileno(stdin), _O_BINARY);
+#endif
+                m_pFile = stdin;
+            }
+            else
+            {
+                m_pFile = std::fopen(path.c_str(), "rb");
+                if (m_pFile == nullptr)
+                {
+                    throw std::runtime_error("Cannot open " + path);
+                }
+                m_fOwnsFile = true;
+            }
+
+            m_decoder->OpenStream();
+        }
+
+        ~StreamInput()
+        {
+            if (m_fOwnsFile)
+            {
+                std::fclose(m_pFile);
+            }
+        }
+
+        StreamInput(const StreamInput&) = delete;
+        StreamInput& operator=(const StreamInput&) = delete;
+
+        // Appends the next chunk to the decoder, or ends the stream at the
+        // end of the input.  Returns false once the stream has ended.
+        bool Feed()
+        {
+            if (m_fEnded)
+            {
+                return false;
+            }
+
+            size_t cbRead = std::fread(m_chunk.data(), 1, m_chunk.size(), m_pFile);
+            if (cbRead > 0)
+            {
+                m_decoder->AppendBytes(m_chunk.data(), cbRead);
+                m_cbRead += cbRead;
+                return true;
+            }
+
+            if (std::ferror(m_pFile))
+            {
+                throw std::runtime_error("Reading the input failed");
+            }
+            m_decoder->EndStream();
+            m_fEnded = true;
+            return false;
+        }
+
+        uint64_t GetBytesRead() const
+        {
+            return m_cbRead;
+        }
+
+    private:
+
+        std::shared_ptr<GifDecoder> m_decoder;
+        std::vector<uint8_t>        m_chunk;
+        std::FILE*                  m_pFile;
+        bool                        m_fOwnsFile;
+        uint64_t                    m_cbRead;
+        bool                        m_fEnded;
+    };
+
+    struct Options
+    {
+        std::string         inputPath;          // "-" for stdin
+        std::string         outputPath;         // Empty to discard, "-" for stdout
+        std::string         tracePath;          // Empty for no trace
+        std::string         encodePath;         // Empty to not encode a gif
+        unsigned int        uEncodeStep;        // Encode every uEncodeStep-th frame
+        bool                fQuantize;
+        GIF_OUTPUT_FORMAT   format;
+        bool                fFormatGiven;
+        unsigned int        cLoops;
+        unsigned int        cMaxFrames;         // 0 for no limit
+        unsigned int        uFrameRate;
+        unsigned int        cbStreamChunk;      // 0 to map the input instead of streaming it
+        unsigned int        cxMax;              // Target size, 0 by 0 for the gif's own size
+        unsigned int        cyMax;
+        FRAME_CACHE_MODE    cacheMode;
+        unsigned int        uCacheCodec;        // GIF_FRAME_CODEC flags
+        GIF_OPEN_MODE       openMode;
+        bool                fParallelDecode;
+        unsigned int        cDecodeThreads;     // 0 for one per hardware thread
+        bool                fJson;
+        bool                fQuiet;
+    };
+
+    void PrintUsage()
+    {
+        std::fprintf(stderr,
+            "usage: gif2raw [options] input.gif|-\n"
+            "\n"
+            "  -o PATH     Write composed frames to PATH, or to stdout for -.  A PATH\n"
+            "              with a %%d (e.g. frame%%04d.png) gets one file per frame.\n"
+            "              Without -o frames are composed but not written.\n"
+            "  -f FORMAT   bgra, png or y4m.  Defaults to the extension of PATH,\n"
+            "              or bgra.\n"
+            "  -l LOOPS    Animation loops to compose (default 1)\n"
+            "  -n FRAMES   Stop after FRAMES composed frames\n"
+            "  -r FPS      Frame rate written to the y4m header (default 10)\n"
+            "  -c MODE     Composed frame cache: off, keyframe or full (default full)\n"
+            "  -k CODEC    Pack the cached frames with delta, palette or lz, joined\n"
+            "              with + (e.g. delta+lz), all or none (default none)\n"
+            "  -i MODE     Frame indexing: full counts the frames when the file is\n"
+            "              opened, lazy finds them as they are composed (default full)\n"
+            "  -s BYTES    Read the input as a stream, BYTES at a time, and compose\n"
+            "              each frame as soon as it has arrived.  An input of -\n"
+            "              is read from stdin this way, 64 KB at a time.\n"
+            "  -z WxH      Decode and compose at the largest size that fits in W by H,\n"
+            "              keeping the aspect ratio.  Never scales up.\n"
+            "  -d THREADS  Decode frames ahead of composing on THREADS threads, or\n"
+            "              one per hardware thread for 0.  Not with -s, -z or -i lazy.\n"
+            "  -t PATH     Write a Chrome trace of the decode and compose stages to\n"
+            "              PATH.  Needs a build with GIF_ENABLE_TRACING.\n"
+            "  -e PATH     Encode the composed frames as a gif to PATH, after -z\n"
+            "  -p STEP     Encode every STEP-th frame, shown for the frames dropped\n"
+            "              after it too (default 1)\n"
+            "  -m          Encode frames with more than 256 colors with a fixed\n"
+            "              palette rather than splitting them\n"
+            "  -j          Print the statistics as one JSON object\n"
+            "  -q          Do not print statistics\n");
+    }
+
+    // none, all, or codec names joined with +
+    unsigned int ParseCodec(const char* pszValue)
+    {
+        std::string value = pszValue;
+        if (value == "none")
+        {
+            return GFC_NONE;
+        }
+        if (value == "all")
+        {
+            return GFC_ALL;
+        }
+
+        unsigned int uCodec = GFC_NONE;
+        size_t iStart = 0;
+        while (iStart <= value.size())
+        {
+            size_t iEnd = value.find('+', iStart);
+            if (iEnd == std::string::npos)
+            {
+                iEnd = value.size();
+            }
+            auto name = value.substr(iStart, iEnd - iStart);
+            if (name == "delta")
+            {
+                uCodec |= GFC_DELTA;
+            }
+            else if (name == "palette")
+            {
+                uCodec |= GFC_PALETTE;
+            }
+            else if (name == "lz")
+            {
+                uCodec |= GFC_LZ;
+            }
+            else
+            {
+                throw std::invalid_argument("Unknown cache codec: " + value);
+            }
+            iStart = iEnd + 1;
+        }
+        return uCodec;
+    }
+
+    unsigned int ParseCount(const char* pszValue, const char* pszOption)
+    {
+        char* pszEnd = nullptr;
+        unsigned long value = std::strtoul(pszValue, &pszEnd, 10);
+        if (*pszValue == '\0' || *pszEnd != '\0' || value > 0xFFFFFFFFul)
+        {
+            throw std::invalid_argument(std::string("Invalid value for ") + pszOption + ": " + pszValue);
+        }
+        return static_cast<unsigned int>(value);
+    }
+
+    // WIDTHxHEIGHT, both at least 1
+    void ParseSize(const char* pszValue, const char* pszOption, unsigned int& cx, unsigned int& cy)
+    {
+        const char* pszX = std::strchr(pszValue, 'x');
+        try
+        {
+            if (pszX == nullptr)
+            {
+                throw std::invalid_argument("No x");
+            }
+            cx = ParseCount(std::string(pszValue, pszX).c_str(), pszOption);
+            cy = ParseCount(pszX + 1, pszOption);
+        }
+        catch (const std::invalid_argument&)
+        {
+            throw std::invalid_argument(std::string("Invalid value for ") + pszOption + ": " + pszValue);
+        }
+        if (cx == 0 || cy == 0)
+        {
+            throw std::invalid_argument(std::string(pszOption) + " must be at least 1x1");
+        }
+    }
+
+    GIF_OUTPUT_FORMAT ParseFormat(const std::string& name)
+    {
+        if (name == "bgra" || name == "raw")
+        {
+            return GOF_BGRA;
+        }
+        if (name == "png")
+        {
+            return GOF_PNG;
+        }
+        if (name == "y4m")
+        {
+            return GOF_Y4M;
+        }
+        throw std::invalid_argument("Unknown output format: " + name);
+    }
+
+    bool EndsWith(const std::string& s, const char* pszSuffix)
+    {
+        size_t cchSuffix = std::strlen(pszSuffix);
+        return s.size() >= cchSuffix && s.compare(s.size() - cchSuffix, cchSuffix, pszSuffix) == 0;
+    }
+
+    // Whether the path is a per frame pattern: a single %d, optionally
+    // with a zero padded width, and %% for a literal %
+    bool IsFramePattern(const std::string& path)
+    {
+        int cConversions = 0;
+        for (size_t i = 0; i < path.size(); i++)
+        {
+            if (path[i] != '%')
+            {
+                continue;
+            }
+            if (i + 1 < path.size() && path[i + 1] == '%')
+            {
+                i++;
+                continue;
+            }
+
+            i++;
+            while (i < path.size() && path[i] >= '0' && path[i] <= '9')
+            {
+                i++;
+            }
+            if (i >= path.size() || path[i] != 'd')
+            {
+                throw std::invalid_argument("Only %d is allowed in the output path: " + path);
+            }
+            cConversions++;
+        }
+
+        if (cConversions > 1)
+        {
+            throw std::invalid_argument("The output path has more than one %d: " + path);
+        }
+        return cConversions == 1;
+    }
+
+    Options ParseOptions(int argc, char** argv)
+    {
+        Options options;
+        options.format = GOF_BGRA;
+        options.fFormatGiven = false;
+        options.cLoops = 1;
+        options.cMaxFrames = 0;
+        options.uFrameRate = 10;
+        options.cbStreamChunk = 0;
+        options.cxMax = 0;
+        options.cyMax = 0;
+        options.cacheMode = FCM_FULL;
+        options.uCacheCodec = GFC_NONE;
+        options.openMode = GOM_FULL;
+        options.fParallelDecode = false;
+        options.cDecodeThreads = 0;
+        options.uEncodeStep = 1;
+        options.fQuantize = false;
+        options.fJson = false;
+        options.fQuiet = false;
+
+        for (int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+
+            if (arg == "-j")
+            {
+                options.fJson = true;
+            }
+            else if (arg == "-q")
+            {
+                options.fQuiet = true;
+            }
+            else if (arg == "-m")
+            {
+                options.fQuantize = true;
+            }
+            else if (arg.size() == 2 && arg[0] == '-' && std::strchr("oflnrckidstzep", arg[1]) != nullptr)
+            {
+                if (i + 1 >= argc)
+                {
+                    throw std::invalid_argument("Missing value for " + arg);
+                }
+                const char* pszValue = argv[++i];
+
+                switch (arg[1])
+                {
+                case 'o':
+                    options.outputPath = pszValue;
+                    break;
+                case 'f':
+                    options.format = ParseFormat(pszValue);
+                    options.fFormatGiven = true;
+                    break;
+                case 'l':
+                    options.cLoops = ParseCount(pszValue, "-l");
+                    break;
+                case 'n':
+                    options.cMaxFrames = ParseCount(pszValue, "-n");
+                    break;
+                case 'r':
+                    options.uFrameRate = ParseCount(pszValue, "-r");
+                    break;
+                case 'c':
+                    if (std::strcmp(pszValue, "off") == 0)
+                    {
+                        options.cacheMode = FCM_OFF;
+                    }
+                    else if (std::strcmp(pszValue, "keyframe") == 0)
+                    {
+                        options.cacheMode = FCM_KEYFRAME;
+                    }
+                    else if (std::strcmp(pszValue, "full") == 0)
+                    {
+                        options.cacheMode = FCM_FULL;
+                    }
+                    else
+                    {
+                        throw std::invalid_argument(std::string("Unknown cache mode: ") + pszValue);
+                    }
+                    break;
+                case 'k':
+                    options.uCacheCodec = ParseCodec(pszValue);
+                    break;
+                case 'i':
+                    if (std::strcmp(pszValue, "full") == 0)
+                    {
+                        options.openMode = GOM_FULL;
+                    }
+                    else if (std::strcmp(pszValue, "lazy") == 0)
+                    {
+                        options.openMode = GOM_LAZY;
+                    }
+                    else
+                    {
+                        throw std::invalid_argument(std::string("Unknown indexing mode: ") + pszValue);
+                    }
+                    break;
+                case 'd':
+                    options.fParallelDecode = true;
+                    options.cDecodeThreads = ParseCount(pszValue, "-d");
+                    break;
+                case 's':
+                    options.cbStreamChunk = ParseCount(pszValue, "-s");
+                    if (options.cbStreamChunk == 0)
+                    {
+                        throw std::invalid_argument("-s must be at least 1");
+                    }
+                    break;
+                case 't':
+                    options.tracePath = pszValue;
+                    break;
+                case 'z':
+                    ParseSize(pszValue, "-z", options.cxMax, options.cyMax);
+                    break;
+                case 'e':
+                    options.encodePath = pszValue;
+                    break;
+                case 'p':
+                    options.uEncodeStep = ParseCount(pszValue, "-p");
+                    if (options.uEncodeStep == 0)
+                    {
+                        throw std::invalid_argument("-p must be at least 1");
+                    }
+                    break;
+                }
+            }
+            else if (arg.size() > 1 && arg[0] == '-')
+            {
+                throw std::invalid_argument("Unknown option: " + arg);
+            }
+            else if (options.inputPath.empty())
+            {
+                options.inputPath = arg;
+            }
+            else
+            {
+                throw std::invalid_argument("More than one input file");
+            }
+        }
+
+        if (options.inputPath.empty())
+        {
+            throw std::invalid_argument("No input file");
+        }
+        if (options.cLoops == 0)
+        {
+            throw std::invalid_argument("-l must be at least 1");
+        }
+        if (options.inputPath == "-" && options.cbStreamChunk == 0)
+        {
+            options.cbStreamChunk = DEFAULT_STREAM_CHUNK;
+        }
+        if (options.fParallelDecode && (options.cbStreamChunk != 0 || options.cxMax != 0 || options.openMode == GOM_LAZY))
+        {
+            throw std::invalid_argument("-d cannot be used with -s, -z, -i lazy or an input of -");
+        }
+        if (!options.tracePath.empty() && !IsGifTracingEnabled())
+        {
+            throw std::invalid_argument("-t needs gif2raw built with GIF_ENABLE_TRACING");
+        }
+
+        if (!options.fFormatGiven)
+        {
+            if (EndsWith(options.outputPath, ".png"))
+            {
+                options.format = GOF_PNG;
+            }
+            else if (EndsWith(options.outputPath, ".y4m"))
+            {
+                options.format = GOF_Y4M;
+            }
+        }
+        return options;
+    }
+
+    // Peak resident memory of the process so far, in bytes
+    uint64_t GetPeakMemoryBytes()
+    {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters = {};
+        if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        {
+            return 0;
+        }
+        return counters.PeakWorkingSetSize;
+#else
+        struct rusage usage = {};
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+        {
+            return 0;
+        }
+#ifdef __APPLE__
+        return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+        return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+    }
+
+    /******************************************************************
+    *                                                                 *
+    *  FrameOutput                                                    *
+    *                                                                 *
+    *  Where the composed frames go: nowhere, stdout, one file, or a  *
+    *  new file for every frame.                                      *
+    *                                                                 *
+    ******************************************************************/
+
+    class FrameOutput
+    {
+    public:
+
+        FrameOutput(const Options& options, unsigned int cx, unsigned int cy) :
+            m_path(options.outputPath),
+            m_fPattern(!options.outputPath.empty() && IsFramePattern(options.outputPath)),
+            m_pFile(nullptr),
+            m_fOwnsFile(false),
+            m_cx(cx),
+            m_cy(cy)
+        {
+            if (m_path.empty())
+            {
+                return;
+            }
+            m_writer = CreateGifFrameWriter(options.format, options.uFrameRate);
+
+            if (m_path == "-")
+            {
+#ifdef _WIN32
+                _setmode(_fileno(stdout), _O_BINARY);
+#endif
+                m_pFile = stdout;
+                m_writer->BeginStream(m_pFile, m_cx, m_cy);
+            }
+            else if (!m_fPattern)
+            {
+                Open(m_path);
+            }
+        }
+
+        ~FrameOutput()
+        {
+            if (m_fOwnsFile)
+            {
+                std::fclose(m_pFile);
+            }
+        }
+
+        FrameOutput(const FrameOutput&) = delete;
+        FrameOutput& operator=(const FrameOutput&) = delete;
+
+        void WriteFrame(unsigned int uFrameNumber, const GifSurface& frame)
+        {
+            if (!m_writer)
+            {
+                return;
+            }
+
+            if (m_fPattern)
+            {
+                std::vector<char> path(m_path.size() + 32);
+                std::snprintf(path.data(), path.size(), m_path.c_str(), uFrameNumber);
+                Open(path.data());
+            }
+
+            m_writer->WriteFrame(m_pFile, frame);
+
+            if (m_fPattern)
+            {
+                Close();
+            }
+        }
+
+        void Close()
+        {
+            if (m_pFile == nullptr)
+            {
+                return;
+            }
+
+            bool fFailed = std::fflush(m_pFile) != 0;
+            if (m_fOwnsFile)
+            {
+                fFailed = std::fclose(m_pFile) != 0 || fFailed;
+            }
+            m_pFile = nullptr;
+            m_fOwnsFile = false;
+
+            if (fFailed)
+            {
+                throw std::runtime_error("Writing the output failed");
+            }
+        }
+
+    private:
+
+        void Open(const std::string& path)
+        {
+            m_pFile = std::fopen(path.c_str(), "wb");
+            if (m_pFile == nullptr)
+            {
+                throw std::runtime_error("Cannot create " + path);
+            }
+            m_fOwnsFile = true;
+            m_writer->BeginStream(m_pFile, m_cx, m_cy);
+        }
+
+    private:
+
+        std::string                         m_path;
+        bool                                m_fPattern;
+        std::unique_ptr<IGifFrameWriter>    m_writer;
+        std::FILE*                          m_pFile;
+        bool                                m_fOwnsFile;
+        unsigned int                        m_cx;
+        unsigned int                        m_cy;
+    };
+
+    /******************************************************************
+    *                                                                 *
+    *  EncodedOutput                                                  *
+    *                                                                 *
+    *  Encodes the composed frames as a new gif.  With a step above   *
+    *  1 each frame kept is held until the frames dropped after it    *
+    *  have been composed, so that it is shown for their delays too.  *
+    *                                                                 *
+    ******************************************************************/
+
+    class EncodedOutput
+    {
+    public:
+
+        EncodedOutput(const Options& options, unsigned int cx, unsigned int cy) :
+            m_path(options.encodePath),
+            m_uStep(options.uEncodeStep),
+            m_uPendingDelay(0),
+            m_fPending(false),
+            m_msEncode(0.)
+        {
+            if (m_path.empty())
+            {
+                return;
+            }
+            m_encoder = std::make_unique<GifEncoder>(cx, cy);
+            m_encoder->SetQuantize(options.fQuantize);
+            m_pending.Resize(cx, cy);
+        }
+
+        EncodedOutput(const EncodedOutput&) = delete;
+        EncodedOutput& operator=(const EncodedOutput&) = delete;
+
+        bool IsEnabled() const
+        {
+            return m_encoder != nullptr;
+        }
+
+        void AddFrame(unsigned int uFrameNumber, const GifSurface& frame, unsigned int uDelay)
+        {
+            if (!m_encoder)
+            {
+                return;
+            }
+
+            auto start = Clock::now();
+            if (uFrameNumber % m_uStep == 0)
+            {
+                AddPendingFrame();
+
+                GifSurface pending = m_pending.Surface();
+                for (unsigned int y = 0; y < frame.cy; y++)
+                {
+                    std::memcpy(pending.Row(y), frame.Row(y), frame.cx * sizeof(uint32_t));
+                }
+                m_fPending = true;
+            }
+            m_uPendingDelay += uDelay;
+            m_msEncode += ElapsedMs(start);
+        }
+
+        // Loops as the gif composed does
+        void Close(const GifGlobalInfo& globalInfo)
+        {
+            if (!m_encoder)
+            {
+                return;
+            }
+
+            auto start = Clock::now();
+            AddPendingFrame();
+            m_encoder->SetLoopCount(globalInfo.fHasLoop, globalInfo.uTotalLoopCount);
+            auto data = m_encoder->Finish();
+            m_msEncode += ElapsedMs(start);
+
+            std::FILE* pFile = std::fopen(m_path.c_str(), "wb");
+            if (pFile == nullptr)
+            {
+                throw std::runtime_error("Cannot create " + m_path);
+            }
+            bool fFailed = std::fwrite(data.data(), 1, data.size(), pFile) != data.size();
+            fFailed = std::fclose(pFile) != 0 || fFailed;
+            if (fFailed)
+            {
+                throw std::runtime_error("Writing " + m_path + " failed");
+            }
+        }
+
+        double GetEncodeMs() const
+        {
+            return m_msEncode;
+        }
+
+        GifEncoderStats GetStats() const
+        {
+            return m_encoder ? m_encoder->GetStats() : GifEncoderStats();
+        }
+
+    private:
+
+        void AddPendingFrame()
+        {
+            if (m_fPending)
+            {
+                m_encoder->AddFrame(m_pending.Surface(), m_uPendingDelay);
+                m_fPending = false;
+            }
+            m_uPendingDelay = 0;
+        }
+
+    private:
+
+        std::string                 m_path;
+        unsigned int                m_uStep;
+        std::unique_ptr<GifEncoder> m_encoder;
+        GifBitmap                   m_pending;
+        unsigned int                m_uPendingDelay;
+        bool                        m_fPending;
+        double                      m_msEncode;
+    };
+
+    std::string JsonEscape(const std::string& s)
+    {
+        std::string escaped;
+        for (char c : s)
+        {
+            if (c == '"' || c == '\\')
+            {
+                escaped += '\\';
+                escaped += c;
+            }
+            else if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char szEscape[8];
+                std::snprintf(szEscape, sizeof(szEscape), "\\u%04x", c);
+                escaped += szEscape;
+            }
+            else
+            {
+                escaped += c;
+            }
+        }
+        return escaped;
+    }
+
+    double PerSecond(double count, double ms)
+    {
+        return ms > 0. ? count * 1000. / ms : 0.;
+    }
+
+    // The stages that ran, as a JSON member to append to the statistics
+    std::string FormatStageStatsJson()
+    {
+        if (!IsGifTracingEnabled())
+        {
+            return std::string();
+        }
+
+        std::string json = ", \"stages\": {";
+        bool fFirst = true;
+        for (int stage = 0; stage < GTS_COUNT; stage++)
+        {
+            auto stats = GetGifTraceStageStats(static_cast<GIF_TRACE_STAGE>(stage));
+            if (stats.cCalls == 0)
+            {
+                continue;
+            }
+
+            char szStage[128];
+            std::snprintf(szStage, sizeof(szStage), "%s\"%s\": {\"calls\": %llu, \"ms\": %.3f}",
+                fFirst ? "" : ", ", GetGifTraceStageName(static_cast<GIF_TRACE_STAGE>(stage)),
+                static_cast<unsigned long long>(stats.cCalls), stats.totalNs / 1e6);
+            json += szStage;
+            fFirst = false;
+        }
+        return json + "}";
+    }
+
+    void PrintStageStats()
+    {
+        for (int stage = 0; stage < GTS_COUNT; stage++)
+        {
+            auto stats = GetGifTraceStageStats(static_cast<GIF_TRACE_STAGE>(stage));
+            if (stats.cCalls == 0)
+            {
+                continue;
+            }
+
+            std::fprintf(stderr, "  %-8s %10.3f ms  %10llu calls  %8.2f us/call\n",
+                GetGifTraceStageName(static_cast<GIF_TRACE_STAGE>(stage)), stats.totalNs / 1e6,
+                static_cast<unsigned long long>(stats.cCalls), stats.totalNs / 1e3 / stats.cCalls);
+        }
+    }
+
+    void WriteTrace(const std::string& path)
+    {
+        std::FILE* pFile = std::fopen(path.c_str(), "w");
+        if (pFile == nullptr)
+        {
+            throw std::runtime_error("Cannot create " + path);
+        }
+
+        bool fFailed = !WriteGifChromeTrace(pFile);
+        fFailed = std::fclose(pFile) != 0 || fFailed;
+        if (fFailed)
+        {
+            throw std::runtime_error("Writing the trace failed");
+        }
+    }
+
+    int Run(const Options& options)
+    {
+        auto totalStart = Clock::now();
+
+        std::shared_ptr<IGifFrameSource> frameSource;
+        std::shared_ptr<GifParallelDecoder> parallelDecoder;
+        std::unique_ptr<StreamInput> stream;
+        if (options.fParallelDecode)
+        {
+            parallelDecoder = std::make_shared<GifParallelDecoder>(GifByteSource::MapFile(options.inputPath), options.cDecodeThreads);
+            frameSource = parallelDecoder;
+        }
+        else
+        {
+            auto decoder = std::make_shared<GifDecoder>();
+            decoder->SetOpenMode(options.openMode);
+            decoder->SetTargetSize(options.cxMax, options.cyMax);
+
+            if (options.cbStreamChunk != 0)
+            {
+                stream = std::make_unique<StreamInput>(options.inputPath, options.cbStreamChunk, decoder);
+                while (!decoder->IsHeaderReady() && stream->Feed())
+                {
+                }
+            }
+            else
+            {
+                decoder->Open(GifByteSource::MapFile(options.inputPath));
+            }
+            frameSource = decoder;
+        }
+        auto source = std::make_shared<TimedFrameSource>(frameSource);
+
+        GifCompositor compositor(source, std::make_unique<CpuPixelBackend>());
+        compositor.SetFrameCacheMode(options.cacheMode);
+        compositor.SetFrameCacheCodec(options.uCacheCodec);
+        const auto& globalInfo = compositor.GetGlobalInfo();
+
+        FrameOutput output(options, globalInfo.cxGifImage, globalInfo.cyGifImage);
+        EncodedOutput encodedOutput(options, globalInfo.cxGifImage, globalInfo.cyGifImage);
+
+        double msFirstFrame = 0.;
+        uint64_t cbFirstFrame = 0;
+        double msCompose = 0.;
+        double msWrite = 0.;
+        unsigned int cFrames = 0;
+        unsigned int cLoops = 0;
+
+        // Reads the stream until the frames for the next ComposeNextFrame are
+        // there.  Only then is it known whether the frame composed last was
+        // the last frame.
+        auto waitForNextFrame = [&]()
+        {
+            while (stream && !compositor.IsNextFrameReady() && stream->Feed())
+            {
+            }
+        };
+        waitForNextFrame();
+
+        while (cLoops < options.cLoops && (options.cMaxFrames == 0 || cFrames < options.cMaxFrames))
+        {
+            auto composeStart = Clock::now();
+            compositor.ComposeNextFrame();
+            msCompose += ElapsedMs(composeStart);
+            if (cFrames == 0)
+            {
+                msFirstFrame = ElapsedMs(totalStart);
+                cbFirstFrame = stream ? stream->GetBytesRead() : 0;
+            }
+
+            auto writeStart = Clock::now();
+            output.WriteFrame(cFrames, compositor.GetComposedFrame());
+            msWrite += ElapsedMs(writeStart);
+            encodedOutput.AddFrame(cFrames, compositor.GetComposedFrame(), compositor.GetFrameDelay());
+            cFrames++;
+
+            waitForNextFrame();
+
+            if (compositor.IsLastFrame())
+            {
+                cLoops++;
+                if (compositor.EndOfAnimation())
+                {
+                    break;
+                }
+            }
+        }
+
+        auto writeStart = Clock::now();
+        output.Close();
+        msWrite += ElapsedMs(writeStart);
+        encodedOutput.Close(globalInfo);
+
+        double msTotal = ElapsedMs(totalStart);
+        double msDecode = source->GetDecodeMs();
+        msCompose -= msDecode;  // The compositor calls the decoder
+        if (msCompose < 0.)
+        {
+            msCompose = 0.;
+        }
+
+        double cComposedPixels = static_cast<double>(cFrames) * globalInfo.cxGifImage * globalInfo.cyGifImage;
+        double cRawPixels = static_cast<double>(source->GetRawPixelCount());
+        double cRawFrames = static_cast<double>(source->GetRawFrameCount());
+        auto cbPeak = GetPeakMemoryBytes();
+        auto cacheStats = compositor.GetFrameCacheStats();
+        double msEncode = encodedOutput.GetEncodeMs();
+        auto encodeStats = encodedOutput.GetStats();
+        double cEncodedPixels = static_cast<double>(encodeStats.cFramesAdded) * globalInfo.cxGifImage * globalInfo.cyGifImage;
+
+        if (options.fJson)
+        {
+            // On stdout unless the frames are written there
+            std::fprintf(options.outputPath == "-" ? stderr : stdout,
+                "{\"file\": \"%s\", \"width\": %u, \"height\": %u, \"frames\": %u, \"loops\": %u, "
+                "\"raw_frames\": %.0f, "
+                "\"decode_ms\": %.3f, \"decode_fps\": %.1f, \"decode_mpix_s\": %.2f, "
+                "\"compose_ms\": %.3f, \"compose_fps\": %.1f, \"compose_mpix_s\": %.2f, "
+                "\"write_ms\": %.3f, "
+                "\"first_frame_ms\": %.3f, "
+                "\"stream_bytes\": %llu, \"stream_first_frame_bytes\": %llu, "
+                "\"total_ms\": %.3f, \"total_fps\": %.1f, \"total_mpix_s\": %.2f, "
+                "\"cache_frames\": %zu, \"cache_bytes\": %zu, \"cache_hits\": %llu, "
+                "\"encode_ms\": %.3f, \"encode_mpix_s\": %.2f, \"encode_frames\": %u, \"encode_images\": %u, \"encode_bytes\": %zu, "
+                "\"decode_threads\": %u, \"decoded_ahead\": %u, \"decode_misses\": %u, "
+                "\"peak_memory_bytes\": %llu%s}\n",
+                JsonEscape(options.inputPath).c_str(), globalInfo.cxGifImage, globalInfo.cyGifImage, cFrames, cLoops,
+                cRawFrames,
+                msDecode, PerSecond(cRawFrames, msDecode), PerSecond(cRawPixels, msDecode) / 1e6,
+                msCompose, PerSecond(cFrames, msCompose), PerSecond(cComposedPixels, msCompose) / 1e6,
+                msWrite,
+                msFirstFrame,
+                static_cast<unsigned long long>(stream ? stream->GetBytesRead() : 0),
+                static_cast<unsigned long long>(cbFirstFrame),
+                msTotal, PerSecond(cFrames, msTotal), PerSecond(cComposedPixels, msTotal) / 1e6,
+                cacheStats.cEntries, cacheStats.cbUsed, static_cast<unsigned long long>(cacheStats.cHits),
+                msEncode, PerSecond(cEncodedPixels, msEncode) / 1e6,
+                encodeStats.cFramesAdded, encodeStats.cImages, encodeStats.cbOutput,
+                parallelDecoder ? parallelDecoder->GetThreadCount() : 0,
+                parallelDecoder ? parallelDecoder->GetDecodedAheadCount() : 0,
+                parallelDecoder ? parallelDecoder->GetMissCount() : 0,
+                static_cast<unsigned long long>(cbPeak),
+                FormatStageStatsJson().c_str());
+        }
+        else if (!options.fQuiet)
+        {
+            // Statistics go to stderr, stdout may carry the frames
+            std::fprintf(stderr, "%s: %ux%u, %u frames composed from %.0f raw frames, %u loops\n",
+                options.inputPath.c_str(), globalInfo.cxGifImage, globalInfo.cyGifImage, cFrames, cRawFrames, cLoops);
+            std::fprintf(stderr, "  decode   %10.3f ms  %10.1f frames/s  %8.2f MPix/s\n",
+                msDecode, PerSecond(cRawFrames, msDecode), PerSecond(cRawPixels, msDecode) / 1e6);
+            if (parallelDecoder)
+            {
+                std::fprintf(stderr, "  ahead    %u frames decoded ahead on %u threads, %u out of order\n",
+                    parallelDecoder->GetDecodedAheadCount(), parallelDecoder->GetThreadCount(), parallelDecoder->GetMissCount());
+            }
+            std::fprintf(stderr, "  compose  %10.3f ms  %10.1f frames/s  %8.2f MPix/s\n",
+                msCompose, PerSecond(cFrames, msCompose), PerSecond(cComposedPixels, msCompose) / 1e6);
+            std::fprintf(stderr, "  write    %10.3f ms\n", msWrite);
+            std::fprintf(stderr, "  first    %10.3f ms  from opening the file\n", msFirstFrame);
+            if (stream)
+            {
+                std::fprintf(stderr, "  stream   first frame after %llu of %llu bytes\n",
+                    static_cast<unsigned long long>(cbFirstFrame),
+                    static_cast<unsigned long long>(stream->GetBytesRead()));
+            }
+            std::fprintf(stderr, "  total    %10.3f ms  %10.1f frames/s  %8.2f MPix/s\n",
+                msTotal, PerSecond(cFrames, msTotal), PerSecond(cComposedPixels, msTotal) / 1e6);
+            std::fprintf(stderr, "  cache    %zu frames in %.1f MB, %llu hits\n",
+                cacheStats.cEntries, cacheStats.cbUsed / (1024. * 1024.), static_cast<unsigned long long>(cacheStats.cHits));
+            if (encodedOutput.IsEnabled())
+            {
+                std::fprintf(stderr, "  encode   %10.3f ms  %10.1f frames/s  %8.2f MPix/s\n",
+                    msEncode, PerSecond(encodeStats.cFramesAdded, msEncode), PerSecond(cEncodedPixels, msEncode) / 1e6);
+                std::fprintf(stderr, "  encoded  %u frames (%u merged) as %u images, %u local palettes, %zu bytes\n",
+                    encodeStats.cFramesAdded, encodeStats.cFramesMerged, encodeStats.cImages,
+                    encodeStats.cLocalPalettes, encodeStats.cbOutput);
+            }
+            std::fprintf(stderr, "  peak memory %.1f MB\n", cbPeak / (1024. * 1024.));
+            if (IsGifTracingEnabled())
+            {
+                std::fprintf(stderr, "stages (inclusive):\n");
+                PrintStageStats();
+            }
+        }
+
+        if (!options.tracePath.empty())
+        {
+            WriteTrace(options.tracePath);
+        }
+        return 0;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    try
+    {
+        options = ParseOptions(argc, argv);
+    }
+    catch (const std::exception& e)
+    {
+        std::fprintf(stderr, "gif2raw: %s\n\n", e.what());
+        PrintUsage();
+        return 2;
+    }
+
+    try
+    {
+        return Run(options);
+    }
+    catch (const std::exception& e)
+    {
+        std::fprintf(stderr, "gif2raw: %s: %s\n", options.inputPath.c_str(), e.what());
+        return 1;
+    }
+}
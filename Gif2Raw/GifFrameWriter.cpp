@@ -0,0 +1,360 @@
+#include "GifFrameWriter.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+    void WriteBytes(std::FILE* pFile, const void* pData, size_t cbData)
+    {
+        if (cbData > 0 && std::fwrite(pData, 1, cbData, pFile) != cbData)
+        {
+            throw std::runtime_error("Writing the output failed");
+        }
+    }
+
+    void PutBigEndian32(uint8_t* p, uint32_t value)
+    {
+        p[0] = static_cast<uint8_t>(value >> 24);
+        p[1] = static_cast<uint8_t>(value >> 16);
+        p[2] = static_cast<uint8_t>(value >> 8);
+        p[3] = static_cast<uint8_t>(value);
+    }
+
+    uint32_t UpdateCrc32(uint32_t crc, const uint8_t* pData, size_t cbData)
+    {
+        static const struct CrcTable
+        {
+            uint32_t entries[256];
+
+            CrcTable()
+            {
+                for (uint32_t i = 0; i < 256; i++)
+                {
+                    uint32_t c = i;
+                    for (int k = 0; k < 8; k++)
+                    {
+                        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                    }
+                    entries[i] = c;
+                }
+            }
+        } table;
+
+        for (size_t i = 0; i < cbData; i++)
+        {
+            crc = table.entries[(crc ^ pData[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+    uint32_t Adler32(const uint8_t* pData, size_t cbData)
+    {
+        const uint32_t ADLER_MOD = 65521;
+        uint32_t a = 1;
+        uint32_t b = 0;
+
+        // 5552 bytes is the most that can be summed before b overflows
+        while (cbData > 0)
+        {
+            size_t cbBlock = cbData < 5552 ? cbData : 5552;
+            for (size_t i = 0; i < cbBlock; i++)
+            {
+                a += pData[i];
+                b += a;
+            }
+            a %= ADLER_MOD;
+            b %= ADLER_MOD;
+            pData += cbBlock;
+            cbData -= cbBlock;
+        }
+        return (b << 16) | a;
+    }
+
+    uint8_t ClampByte(int value)
+    {
+        return static_cast<uint8_t>(value < 0 ? 0 : (value > 255 ? 255 : value));
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  CreateGifFrameWriter                                           *
+*                                                                 *
+******************************************************************/
+
+std::unique_ptr<IGifFrameWriter> CreateGifFrameWriter(GIF_OUTPUT_FORMAT format, unsigned int uFrameRate)
+{
+    switch (format)
+    {
+    case GOF_BGRA:
+        return std::make_unique<BgraFrameWriter>();
+    case GOF_PNG:
+        return std::make_unique<PngFrameWriter>();
+    case GOF_Y4M:
+        return std::make_unique<Y4mFrameWriter>(uFrameRate);
+    default:
+        throw std::invalid_argument("Unknown output format");
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  BgraFrameWriter::BeginStream                                   *
+*                                                                 *
+******************************************************************/
+
+void BgraFrameWriter::BeginStream(std::FILE* pFile, unsigned int cx, unsigned int cy)
+{
+    (void)pFile;
+    (void)cx;
+    (void)cy;
+}
+
+/******************************************************************
+*                                                                 *
+*  BgraFrameWriter::WriteFrame                                    *
+*                                                                 *
+******************************************************************/
+
+void BgraFrameWriter::WriteFrame(std::FILE* pFile, const GifSurface& frame)
+{
+    if (frame.stride == frame.cx)
+    {
+        WriteBytes(pFile, frame.pPixels, static_cast<size_t>(frame.cx) * frame.cy * sizeof(uint32_t));
+        return;
+    }
+
+    for (unsigned int y = 0; y < frame.cy; y++)
+    {
+        WriteBytes(pFile, frame.Row(y), frame.cx * sizeof(uint32_t));
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  PngFrameWriter::BeginStream                                    *
+*                                                                 *
+*  Every PNG is complete on its own, so a stream of several is    *
+*  simply concatenated.                                           *
+*                                                                 *
+******************************************************************/
+
+void PngFrameWriter::BeginStream(std::FILE* pFile, unsigned int cx, unsigned int cy)
+{
+    (void)pFile;
+    (void)cx;
+    (void)cy;
+}
+
+/******************************************************************
+*                                                                 *
+*  PngFrameWriter::WriteFrame                                     *
+*                                                                 *
+******************************************************************/
+
+void PngFrameWriter::WriteFrame(std::FILE* pFile, const GifSurface& frame)
+{
+    static const uint8_t PNG_SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    const size_t CB_STORED_BLOCK = 65535;
+
+    size_t cbRow = 1 + static_cast<size_t>(frame.cx) * 4;
+    size_t cbRows = cbRow * frame.cy;
+    size_t cBlocks = cbRows > 0 ? (cbRows + CB_STORED_BLOCK - 1) / CB_STORED_BLOCK : 1;
+    size_t cbZlib = 2 + cBlocks * 5 + cbRows + 4;
+    if (cbZlib > 0x7FFFFFFF)
+    {
+        throw std::runtime_error("The frame is too large for a single PNG chunk");
+    }
+
+    // Unpremultiply into RGBA rows, each with filter type 0
+    m_rows.resize(cbRows);
+    for (unsigned int y = 0; y < frame.cy; y++)
+    {
+        auto pSource = frame.Row(y);
+        auto pDest = m_rows.data() + y * cbRow;
+        *pDest++ = 0;
+
+        for (unsigned int x = 0; x < frame.cx; x++)
+        {
+            uint32_t pixel = pSource[x];
+            uint32_t a = pixel >> 24;
+            uint32_t r = (pixel >> 16) & 0xFF;
+            uint32_t g = (pixel >> 8) & 0xFF;
+            uint32_t b = pixel & 0xFF;
+            if (a == 0)
+            {
+                r = g = b = 0;
+            }
+            else if (a < 255)
+            {
+                r = (r * 255 + a / 2) / a;
+                g = (g * 255 + a / 2) / a;
+                b = (b * 255 + a / 2) / a;
+            }
+            pDest[0] = ClampByte(static_cast<int>(r));
+            pDest[1] = ClampByte(static_cast<int>(g));
+            pDest[2] = ClampByte(static_cast<int>(b));
+            pDest[3] = static_cast<uint8_t>(a);
+            pDest += 4;
+        }
+    }
+
+    // zlib header (deflate, 32K window, no dictionary), stored blocks and
+    // the Adler-32 of the uncompressed data
+    m_zlib.resize(cbZlib);
+    auto pZlib = m_zlib.data();
+    *pZlib++ = 0x78;
+    *pZlib++ = 0x01;
+    size_t off = 0;
+    do
+    {
+        size_t cbBlock = cbRows - off < CB_STORED_BLOCK ? cbRows - off : CB_STORED_BLOCK;
+        auto len = static_cast<uint16_t>(cbBlock);
+        auto nlen = static_cast<uint16_t>(~len);
+        *pZlib++ = (off + cbBlock == cbRows) ? 1 : 0;   // BFINAL on the last block
+        *pZlib++ = static_cast<uint8_t>(len);
+        *pZlib++ = static_cast<uint8_t>(len >> 8);
+        *pZlib++ = static_cast<uint8_t>(nlen);
+        *pZlib++ = static_cast<uint8_t>(nlen >> 8);
+        memcpy(pZlib, m_rows.data() + off, cbBlock);
+        pZlib += cbBlock;
+        off += cbBlock;
+    } while (off < cbRows);
+    PutBigEndian32(pZlib, Adler32(m_rows.data(), cbRows));
+
+    uint8_t header[13];
+    PutBigEndian32(header, frame.cx);
+    PutBigEndian32(header + 4, frame.cy);
+    header[8] = 8;      // Bit depth
+    header[9] = 6;      // Color type RGBA
+    header[10] = 0;     // Deflate
+    header[11] = 0;     // Adaptive filtering
+    header[12] = 0;     // Not interlaced
+
+    WriteBytes(pFile, PNG_SIGNATURE, sizeof(PNG_SIGNATURE));
+    WriteChunk(pFile, "IHDR", header, sizeof(header));
+    WriteChunk(pFile, "IDAT", m_zlib.data(), m_zlib.size());
+    WriteChunk(pFile, "IEND", nullptr, 0);
+}
+
+/******************************************************************
+*                                                                 *
+*  PngFrameWriter::WriteChunk                                     *
+*                                                                 *
+******************************************************************/
+
+void PngFrameWriter::WriteChunk(std::FILE* pFile, const char* pszType, const uint8_t* pData, size_t cbData)
+{
+    uint8_t length[4];
+    uint8_t crc[4];
+
+    PutBigEndian32(length, static_cast<uint32_t>(cbData));
+    uint32_t crc32 = UpdateCrc32(0xFFFFFFFFu, reinterpret_cast<const uint8_t*>(pszType), 4);
+    crc32 = UpdateCrc32(crc32, pData, cbData);
+    PutBigEndian32(crc, crc32 ^ 0xFFFFFFFFu);
+
+    WriteBytes(pFile, length, sizeof(length));
+    WriteBytes(pFile, pszType, 4);
+    WriteBytes(pFile, pData, cbData);
+    WriteBytes(pFile, crc, sizeof(crc));
+}
+
+/******************************************************************
+*                                                                 *
+*  Y4mFrameWriter::Y4mFrameWriter constructor                     *
+*                                                                 *
+******************************************************************/
+
+Y4mFrameWriter::Y4mFrameWriter(unsigned int uFrameRate) :
+    m_uFrameRate(uFrameRate)
+{
+    if (uFrameRate == 0)
+    {
+        throw std::invalid_argument("The frame rate must be at least 1");
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  Y4mFrameWriter::BeginStream                                    *
+*                                                                 *
+******************************************************************/
+
+void Y4mFrameWriter::BeginStream(std::FILE* pFile, unsigned int cx, unsigned int cy)
+{
+    auto header = "YUV4MPEG2 W" + std::to_string(cx) + " H" + std::to_string(cy) +
+        " F" + std::to_string(m_uFrameRate) + ":1 Ip A1:1 C420jpeg\n";
+    WriteBytes(pFile, header.data(), header.size());
+}
+
+/******************************************************************
+*                                                                 *
+*  Y4mFrameWriter::WriteFrame                                     *
+*                                                                 *
+*  Full range BT.601 in 8 bit fixed point.  Chroma is taken from  *
+*  the average color of each 2x2 block.                           *
+*                                                                 *
+******************************************************************/
+
+void Y4mFrameWriter::WriteFrame(std::FILE* pFile, const GifSurface& frame)
+{
+    static const char FRAME_HEADER[] = "FRAME\n";
+
+    unsigned int cxChroma = (frame.cx + 1) / 2;
+    unsigned int cyChroma = (frame.cy + 1) / 2;
+    size_t cbLuma = static_cast<size_t>(frame.cx) * frame.cy;
+    size_t cbChroma = static_cast<size_t>(cxChroma) * cyChroma;
+
+    m_planes.resize(cbLuma + 2 * cbChroma);
+    auto pLuma = m_planes.data();
+    auto pCb = pLuma + cbLuma;
+    auto pCr = pCb + cbChroma;
+
+    for (unsigned int y = 0; y < frame.cy; y++)
+    {
+        auto pRow = frame.Row(y);
+        for (unsigned int x = 0; x < frame.cx; x++)
+        {
+            int r = (pRow[x] >> 16) & 0xFF;
+            int g = (pRow[x] >> 8) & 0xFF;
+            int b = pRow[x] & 0xFF;
+            *pLuma++ = ClampByte((77 * r + 150 * g + 29 * b + 128) >> 8);
+        }
+    }
+
+    for (unsigned int yChroma = 0; yChroma < cyChroma; yChroma++)
+    {
+        for (unsigned int xChroma = 0; xChroma < cxChroma; xChroma++)
+        {
+            int rSum = 0;
+            int gSum = 0;
+            int bSum = 0;
+            int cPixels = 0;
+
+            for (unsigned int y = yChroma * 2; y < frame.cy && y < yChroma * 2 + 2; y++)
+            {
+                auto pRow = frame.Row(y);
+                for (unsigned int x = xChroma * 2; x < frame.cx && x < xChroma * 2 + 2; x++)
+                {
+                    rSum += (pRow[x] >> 16) & 0xFF;
+                    gSum += (pRow[x] >> 8) & 0xFF;
+                    bSum += pRow[x] & 0xFF;
+                    cPixels++;
+                }
+            }
+
+            int r = (rSum + cPixels / 2) / cPixels;
+            int g = (gSum + cPixels / 2) / cPixels;
+            int b = (bSum + cPixels / 2) / cPixels;
+
+            // Offset by 128 << 8 before shifting so that the sum stays positive
+            *pCb++ = ClampByte((-43 * r - 85 * g + 128 * b + 32768 + 128) >> 8);
+            *pCr++ = ClampByte((128 * r - 107 * g - 21 * b + 32768 + 128) >> 8);
+        }
+    }
+
+    WriteBytes(pFile, FRAME_HEADER, sizeof(FRAME_HEADER) - 1);
+    WriteBytes(pFile, m_planes.data(), m_planes.size());
+}
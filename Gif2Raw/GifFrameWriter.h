@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include "GifTypes.h"
+
+enum GIF_OUTPUT_FORMAT
+{
+    GOF_BGRA = 0,   // Raw premultiplied BGRA, frames back to back
+    GOF_PNG = 1,    // One PNG per frame, straight alpha, stored without compression
+    GOF_Y4M = 2     // YUV4MPEG2 4:2:0, composed over black
+};
+
+/******************************************************************
+*                                                                 *
+*  IGifFrameWriter                                                *
+*                                                                 *
+*  Writes composed frames to a stdio stream.  A stream holds one  *
+*  or more frames: BeginStream writes whatever header the format  *
+*  needs once, WriteFrame writes one frame.  Write errors throw   *
+*  std::runtime_error.  Buffers are kept between frames.          *
+*                                                                 *
+******************************************************************/
+
+class IGifFrameWriter
+{
+public:
+
+    virtual ~IGifFrameWriter() = default;
+
+    virtual void BeginStream(std::FILE* pFile, unsigned int cx, unsigned int cy) = 0;
+    virtual void WriteFrame(std::FILE* pFile, const GifSurface& frame) = 0;
+};
+
+// uFrameRate is only used by GOF_Y4M, whose header has a fixed frame rate
+std::unique_ptr<IGifFrameWriter> CreateGifFrameWriter(GIF_OUTPUT_FORMAT format, unsigned int uFrameRate);
+
+/******************************************************************
+*                                                                 *
+*  BgraFrameWriter                                                *
+*                                                                 *
+******************************************************************/
+
+class BgraFrameWriter : public IGifFrameWriter
+{
+public:
+
+    void BeginStream(std::FILE* pFile, unsigned int cx, unsigned int cy) override;
+    void WriteFrame(std::FILE* pFile, const GifSurface& frame) override;
+};
+
+/******************************************************************
+*                                                                 *
+*  PngFrameWriter                                                 *
+*                                                                 *
+*  Writes 8 bit RGBA PNGs.  The image data is zlib wrapped but    *
+*  uses stored deflate blocks: this tool measures decoding and    *
+*  composing, and compressing would dominate the write time.      *
+*                                                                 *
+******************************************************************/
+
+class PngFrameWriter : public IGifFrameWriter
+{
+public:
+
+    void BeginStream(std::FILE* pFile, unsigned int cx, unsigned int cy) override;
+    void WriteFrame(std::FILE* pFile, const GifSurface& frame) override;
+
+private:
+
+    void WriteChunk(std::FILE* pFile, const char* pszType, const uint8_t* pData, size_t cbData);
+
+private:
+
+    std::vector<uint8_t>    m_rows;     // Filter byte and RGBA pixels of every row
+    std::vector<uint8_t>    m_zlib;     // m_rows as a zlib stream
+};
+
+/******************************************************************
+*                                                                 *
+*  Y4mFrameWriter                                                 *
+*                                                                 *
+*  Writes C420jpeg (full range BT.601) frames.  Chroma planes are *
+*  rounded up for odd sizes.  Premultiplied pixels are already    *
+*  composed over black, so alpha is dropped.                      *
+*                                                                 *
+******************************************************************/
+
+class Y4mFrameWriter : public IGifFrameWriter
+{
+public:
+
+    explicit Y4mFrameWriter(unsigned int uFrameRate);
+
+    void BeginStream(std::FILE* pFile, unsigned int cx, unsigned int cy) override;
+    void WriteFrame(std::FILE* pFile, const GifSurface& frame) override;
+
+private:
+
+    unsigned int            m_uFrameRate;
+    std::vector<uint8_t>    m_planes;   // Y, Cb and Cr planes of one frame
+};
@@ -0,0 +1,104 @@
+// Steady-state playback allocating nothing.  Built into gifalloctests,
+// which counts allocations whether or not GifCore was configured with
+// GIF_COUNT_ALLOCATIONS.
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "GifAllocCounter.h"
+#include "GifCompositor.h"
+#include "GifDecoder.h"
+#include "GifTest.h"
+#include "GifTestGifs.h"
+
+namespace
+{
+    struct CacheConfig
+    {
+        const char*         pszName;
+        FRAME_CACHE_MODE    mode;
+        unsigned int        cFramesBudget;  // Composed frames the cache holds, 0 for the default budget
+    };
+
+    const CacheConfig CACHE_CONFIGS[] =
+    {
+        { "off", FCM_OFF, 0 },
+        { "keyframe", FCM_KEYFRAME, 0 },
+        { "full", FCM_FULL, 0 },
+        { "full, evicting", FCM_FULL, 3 },
+    };
+
+    // Loops a gif may take to stop allocating
+    const unsigned int MAX_WARM_UP_LOOPS = 16;
+
+    void ComposeLoop(GifCompositor& compositor)
+    {
+        do
+        {
+            compositor.ComposeNextFrame();
+        } while (!compositor.IsLastFrame());
+    }
+
+    // Plays loops to warm up the caches and scratch buffers until one
+    // allocates nothing, then checks that the next allocates nothing either.
+    // A cache smaller than the animation hands its spares to different frames
+    // from loop to loop, and a disposal 3 frame can get one that never held a
+    // saved frame, so that takes a few loops to settle.
+    void CheckSteadyStatePlayback(const GifTestSpec& spec, const CacheConfig& config, unsigned int uGif)
+    {
+        auto data = WriteTestGif(spec);
+        auto decoder = std::make_shared<GifDecoder>();
+        decoder->Open(data);
+
+        GifCompositor compositor(decoder, std::make_unique<CpuPixelBackend>());
+        size_t cbBudget = DEFAULT_FRAME_CACHE_BUDGET;
+        if (config.cFramesBudget != 0)
+        {
+            cbBudget = static_cast<size_t>(spec.cx) * spec.cy * sizeof(uint32_t) * config.cFramesBudget;
+        }
+        compositor.SetFrameCacheMode(config.mode, cbBudget);
+        compositor.Reset();
+
+        unsigned int cWarmUpLoops = 0;
+        uint64_t cAllocations;
+        do
+        {
+            GifAllocScope scope;
+            ComposeLoop(compositor);
+            cAllocations = scope.GetStats().cAllocations;
+            cWarmUpLoops++;
+        } while (cAllocations != 0 && cWarmUpLoops < MAX_WARM_UP_LOOPS);
+
+        GifAllocScope scope;
+        ComposeLoop(compositor);
+        auto stats = scope.GetStats();
+
+        GIF_CHECK_MESSAGE(stats.cAllocations == 0,
+            "gif " << uGif << ", cache " << config.pszName << ": " << stats.cAllocations << " allocations ("
+            << stats.cbAllocated << " bytes) in a loop after "
+            << cWarmUpLoops << " warm-up loops");
+    }
+}
+
+GIF_TEST(allocations, CountingIsEnabled)
+{
+    GIF_CHECK(IsGifAllocCountingEnabled());
+
+    GifAllocScope scope;
+    auto pValue = std::make_unique<int>(0);
+    GIF_CHECK_EQUAL(uint64_t(1), scope.GetStats().cAllocations);
+}
+
+GIF_TEST(allocations, ComposeAllocatesNothingAfterWarmUp)
+{
+    std::mt19937 random(14);
+    for (unsigned int uGif = 0; uGif < 100; uGif++)
+    {
+        auto spec = MakeRandomTestGif(random, uGif % 2 != 0);
+        for (const auto& config : CACHE_CONFIGS)
+        {
+            CheckSteadyStatePlayback(spec, config, uGif);
+        }
+    }
+}
@@ -0,0 +1,167 @@
+// GifAssetCache sharing gifs and their frames between players, and the
+// frames it serves matching the reference compositor
+
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "GifAssetCache.h"
+#include "GifTest.h"
+#include "GifTestGifs.h"
+
+namespace
+{
+    // Plays one loop through the asset and checks each displayed frame
+    void CheckAssetPlayback(GifAsset& asset, const GifTestSpec& spec, FRAME_CACHE_MODE mode = FCM_FULL, unsigned int uCodec = GFC_NONE)
+    {
+        auto reference = ComposeTestGifReference(spec);
+
+        GifCompositor compositor(asset.CreateFrameSource(), std::make_unique<CpuPixelBackend>());
+        compositor.SetFrameCacheMode(FCM_OFF);
+        compositor.SetSharedFrameStore(asset.GetComposedFrameStore(0, 0, mode, uCodec));
+        compositor.Reset();
+        do
+        {
+            compositor.ComposeNextFrame();
+            unsigned int uNext = compositor.GetNextFrameIndex();
+            unsigned int uFrameIndex = (uNext == 0 ? compositor.GetGlobalInfo().cFrames : uNext) - 1;
+
+            GifSurface surface = compositor.GetComposedFrame();
+            for (unsigned int y = 0; y < surface.cy; y++)
+            {
+                GIF_CHECK_MESSAGE(memcmp(surface.Row(y), reference[uFrameIndex].data() + static_cast<size_t>(y) * spec.cx, surface.cx * sizeof(uint32_t)) == 0,
+                    "frame " << uFrameIndex << " row " << y << " differs from the reference");
+            }
+        } while (!compositor.IsLastFrame());
+    }
+}
+
+GIF_TEST(assetcache, SameBytesShareAnAsset)
+{
+    std::mt19937 random(7);
+    auto data = WriteTestGif(MakeRandomTestGif(random, false));
+
+    GifAssetCache cache;
+    auto asset = cache.Acquire(GifByteSource::FromVector(data));
+    auto again = cache.Acquire(GifByteSource::FromVector(data));
+    GIF_CHECK(asset == again);
+    GIF_CHECK_EQUAL(uint64_t(1), cache.GetStats().cAcquireHits);
+}
+
+GIF_TEST(assetcache, DifferentBytesGetTheirOwnAsset)
+{
+    std::mt19937 random(8);
+    auto data = WriteTestGif(MakeRandomTestGif(random, false));
+    auto other = data;
+    other[6] ^= 1;      // Logical screen width
+
+    GifAssetCache cache;
+    auto asset = cache.Acquire(GifByteSource::FromVector(data));
+    auto otherAsset = cache.Acquire(GifByteSource::FromVector(other));
+    GIF_CHECK(asset != otherAsset);
+    GIF_CHECK_EQUAL(uint64_t(0), cache.GetStats().cAcquireHits);
+}
+
+GIF_TEST(assetcache, SharedFramesMatchReference)
+{
+    std::mt19937 random(9);
+    GifAssetCache cache;
+    for (int i = 0; i < 50; i++)
+    {
+        auto spec = MakeRandomTestGif(random, true);
+        auto data = WriteTestGif(spec);
+
+        // The second player composes from frames the first left in the cache
+        for (int player = 0; player < 2; player++)
+        {
+            auto asset = cache.Acquire(GifByteSource::FromVector(data));
+            CheckAssetPlayback(*asset, spec);
+        }
+    }
+    GIF_CHECK(cache.GetStats().cComposedFrameHits > 0);
+}
+
+GIF_TEST(assetcache, StoreFollowsCacheMode)
+{
+    std::mt19937 random(35);
+    auto spec = MakeRandomTestGif(random, false);
+    GifAssetCache cache;
+    auto asset = cache.Acquire(GifByteSource::FromVector(WriteTestGif(spec)));
+
+    auto full = asset->GetComposedFrameStore(0, 0, FCM_FULL);
+    auto keyframes = asset->GetComposedFrameStore(0, 0, FCM_KEYFRAME);
+    auto off = asset->GetComposedFrameStore(0, 0, FCM_OFF);
+    for (unsigned int uFrame = 0; uFrame < 3 * DEFAULT_KEYFRAME_INTERVAL; uFrame++)
+    {
+        GIF_CHECK(full->ShouldInsert(uFrame));
+        GIF_CHECK_EQUAL(uFrame % DEFAULT_KEYFRAME_INTERVAL == 0, keyframes->ShouldInsert(uFrame));
+        GIF_CHECK(!off->ShouldInsert(uFrame));
+    }
+
+    // A player with caching off neither adds frames nor finds them
+    CheckAssetPlayback(*asset, spec, FCM_OFF);
+    GIF_CHECK(full->Lookup(0) == nullptr);
+    CheckAssetPlayback(*asset, spec, FCM_FULL);
+    GIF_CHECK(full->Lookup(0) != nullptr);
+    GIF_CHECK(off->Lookup(0) == nullptr);
+}
+
+GIF_TEST(assetcache, PlayersWithOtherCodecsShareFrames)
+{
+    const unsigned int CODECS[] = { GFC_NONE, GFC_DELTA, GFC_PALETTE | GFC_LZ, GFC_ALL };
+    const FRAME_CACHE_MODE MODES[] = { FCM_FULL, FCM_KEYFRAME };
+
+    std::mt19937 random(36);
+    GifAssetCache cache;
+    for (int i = 0; i < 50; i++)
+    {
+        auto spec = MakeRandomTestGif(random, true);
+        auto data = WriteTestGif(spec);
+
+        // Each player packs what it adds with its own codec and restores
+        // what the players before it packed with theirs
+        for (int player = 0; player < 3; player++)
+        {
+            auto uCodec = CODECS[random() % 4];
+            auto asset = cache.Acquire(GifByteSource::FromVector(data));
+            CheckAssetPlayback(*asset, spec, MODES[random() % 2], uCodec);
+
+            // The first player added the first frame
+            auto frame = asset->GetComposedFrameStore(0, 0, FCM_FULL, uCodec)->Lookup(0);
+            GIF_CHECK(frame != nullptr);
+            if (player == 0)
+            {
+                GIF_CHECK_EQUAL(uCodec != GFC_NONE, frame->fPacked);
+            }
+        }
+    }
+    GIF_CHECK(cache.GetStats().cComposedFrameHits > 0);
+}
+
+GIF_TEST(assetcache, AssetIndexesAsPlayersGo)
+{
+    std::mt19937 random(37);
+    GifTestSpec spec;
+    do
+    {
+        spec = MakeRandomTestGif(random, false);
+    } while (spec.frames.size() < 3);
+
+    GifAssetCache cache;
+    auto asset = cache.Acquire(GifByteSource::FromVector(WriteTestGif(spec)));
+
+    // Acquiring the gif only finds its first frame, as a lazy open does
+    GifGlobalInfo globalInfo;
+    asset->CreateFrameSource()->GetGlobalInfo(globalInfo);
+    GIF_CHECK(globalInfo.fFrameCountPartial);
+    GIF_CHECK(globalInfo.cFrames < spec.frames.size());
+
+    // Once a player has played through it, the next opens with every frame
+    CheckAssetPlayback(*asset, spec);
+    asset->CreateFrameSource()->GetGlobalInfo(globalInfo);
+    GIF_CHECK(!globalInfo.fFrameCountPartial);
+    GIF_CHECK_EQUAL(spec.frames.size(), static_cast<size_t>(globalInfo.cFrames));
+    GIF_CHECK_EQUAL(spec.frames.size(), static_cast<size_t>(asset->GetFrameIndex().Size()));
+    CheckAssetPlayback(*asset, spec);
+}
@@ -0,0 +1,216 @@
+// GifAtlasCompositor keeping every playback in a slot of its own as
+// animations come and go, and composing into each slot what a compositor
+// of its own composes
+
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "GifAtlasCompositor.h"
+#include "GifTest.h"
+#include "GifTestGifs.h"
+
+namespace
+{
+    using Clock = GifAtlasCompositor::Clock;
+
+    // Small pages, so that a few dozen animations fill shelves, leave gaps
+    // and spill onto further pages
+    const unsigned int TEST_PAGE_SIZE = 64;
+    const unsigned int TEST_MAX_PAGES = 4;
+
+    struct TestAnimation
+    {
+        std::string             key;
+        std::vector<uint8_t>    data;
+        unsigned int            cxMax;
+        unsigned int            cyMax;
+        unsigned int            cFramesComposed;
+    };
+
+    // A random gif, scaled down by half now and then
+    TestAnimation MakeTestAnimation(std::mt19937& random, unsigned int uKey)
+    {
+        auto spec = MakeRandomTestGif(random, false);
+        TestAnimation animation = { "gif" + std::to_string(uKey), WriteTestGif(spec), 0, 0, 0 };
+        if (random() % 4 == 0 && spec.cx > 1 && spec.cy > 1)
+        {
+            animation.cxMax = spec.cx / 2;
+            animation.cyMax = spec.cy / 2;
+        }
+        return animation;
+    }
+
+    // Adds the animation, returning false if the atlas is full
+    bool AddTestAnimation(GifAtlasCompositor& atlas, const TestAnimation& animation, GifAnimationId& id)
+    {
+        try
+        {
+            id = atlas.Add(animation.key, GifByteSource::FromVector(animation.data), animation.cxMax, animation.cyMax);
+            return true;
+        }
+        catch (const std::runtime_error&)
+        {
+            return false;
+        }
+    }
+
+    bool SlotsOverlap(const GifAtlasSlot& a, const GifAtlasSlot& b)
+    {
+        return a.uPage == b.uPage && !IntersectGifRect(a.rect, b.rect).IsEmpty();
+    }
+
+    // Every slot lies within its page and no two animations with different
+    // keys share any of a page
+    void CheckSlots(GifAtlasCompositor& atlas, const std::map<GifAnimationId, TestAnimation>& animations)
+    {
+        for (auto a = animations.begin(); a != animations.end(); ++a)
+        {
+            const auto& slot = atlas.GetPlacement(a->first);
+            GIF_CHECK(slot.uPage < atlas.GetStats().cPages);
+            auto page = atlas.GetPage(slot.uPage);
+            GIF_CHECK_MESSAGE(slot.rect.right <= page.cx && slot.rect.bottom <= page.cy && !slot.rect.IsEmpty(),
+                a->second.key << " is placed at " << slot.rect.left << "," << slot.rect.top << "-" << slot.rect.right
+                << "," << slot.rect.bottom << " on a " << page.cx << " x " << page.cy << " page");
+
+            for (auto b = std::next(a); b != animations.end(); ++b)
+            {
+                if (a->second.key != b->second.key)
+                {
+                    GIF_CHECK_MESSAGE(!SlotsOverlap(slot, atlas.GetPlacement(b->first)),
+                        a->second.key << " and " << b->second.key << " overlap on page " << slot.uPage);
+                }
+            }
+        }
+    }
+
+    // Composes the frames the atlas has composed of the animation with a
+    // compositor of its own and compares them with its slot
+    void CheckSlotPixels(GifAtlasCompositor& atlas, GifAnimationId id, const TestAnimation& animation)
+    {
+        auto decoder = std::make_shared<GifDecoder>();
+        decoder->SetTargetSize(animation.cxMax, animation.cyMax);
+        decoder->Open(animation.data);
+        GifCompositor compositor(decoder, std::make_unique<CpuPixelBackend>());
+        for (unsigned int i = 0; i < animation.cFramesComposed; i++)
+        {
+            compositor.ComposeNextFrame();
+        }
+
+        const auto& slot = atlas.GetPlacement(id);
+        auto page = atlas.GetPage(slot.uPage);
+        auto expected = compositor.GetComposedFrame();
+        GIF_CHECK_EQUAL(expected.cx, slot.rect.Width());
+        GIF_CHECK_EQUAL(expected.cy, slot.rect.Height());
+        for (unsigned int y = 0; y < expected.cy; y++)
+        {
+            GIF_CHECK_MESSAGE(memcmp(page.Row(slot.rect.top + y) + slot.rect.left, expected.Row(y), expected.cx * sizeof(uint32_t)) == 0,
+                animation.key << " after " << animation.cFramesComposed << " frames: row " << y << " differs from its own compositor's");
+        }
+    }
+
+    // A Tick far enough on that every playback is due and composes one frame
+    void TickAll(GifAtlasCompositor& atlas, Clock::time_point& now, std::map<GifAnimationId, TestAnimation>& animations)
+    {
+        now += std::chrono::hours(1);
+        std::vector<GifAtlasUpdate> updates;
+        atlas.Tick(now, updates);
+
+        // Animations sharing a key share one playback, which composes once
+        std::map<std::string, bool> composed;
+        for (auto& entry : animations)
+        {
+            GIF_CHECK(!atlas.IsFinished(entry.first));
+            if (!composed[entry.second.key])
+            {
+                composed[entry.second.key] = true;
+                for (auto& other : animations)
+                {
+                    if (other.second.key == entry.second.key)
+                    {
+                        other.second.cFramesComposed++;
+                    }
+                }
+            }
+        }
+    }
+}
+
+GIF_TEST(atlas, SlotsNeverOverlap)
+{
+    std::mt19937 random(27);
+    GifAtlasCompositor atlas(TEST_PAGE_SIZE, TEST_PAGE_SIZE, TEST_MAX_PAGES, 2);
+    std::map<GifAnimationId, TestAnimation> animations;
+    unsigned int uNextKey = 0;
+
+    for (int iStep = 0; iStep < 2000; iStep++)
+    {
+        if (!animations.empty() && random() % 3 == 0)
+        {
+            auto it = std::next(animations.begin(), random() % animations.size());
+            atlas.Remove(it->first);
+            animations.erase(it);
+        }
+        else
+        {
+            // Now and then a second animation of a gif already playing,
+            // which shares its slot
+            auto animation = (!animations.empty() && random() % 8 == 0)
+                ? std::next(animations.begin(), random() % animations.size())->second
+                : MakeTestAnimation(random, uNextKey++);
+            GifAnimationId id;
+            if (AddTestAnimation(atlas, animation, id))
+            {
+                animations[id] = animation;
+            }
+        }
+        CheckSlots(atlas, animations);
+    }
+    GIF_CHECK(atlas.GetStats().cPages <= TEST_MAX_PAGES);
+}
+
+GIF_TEST(atlas, SlotsMatchOwnCompositor)
+{
+    std::mt19937 random(28);
+    GifAtlasCompositor atlas(TEST_PAGE_SIZE, TEST_PAGE_SIZE, TEST_MAX_PAGES, 4);
+    std::map<GifAnimationId, TestAnimation> animations;
+    unsigned int uNextKey = 0;
+    auto now = Clock::now();
+
+    // Animations come and go between Ticks, so later ones take the slots
+    // of earlier ones and start from the first frame as others play on
+    for (int iRound = 0; iRound < 50; iRound++)
+    {
+        for (int i = random() % 4; i > 0 && !animations.empty(); i--)
+        {
+            auto it = std::next(animations.begin(), random() % animations.size());
+            atlas.Remove(it->first);
+            animations.erase(it);
+        }
+        for (int i = random() % 6; i > 0; i--)
+        {
+            auto animation = MakeTestAnimation(random, uNextKey++);
+            GifAnimationId id;
+            if (AddTestAnimation(atlas, animation, id))
+            {
+                animations[id] = animation;
+            }
+        }
+
+        for (int iTick = 1 + random() % 8; iTick > 0; iTick--)
+        {
+            TickAll(atlas, now, animations);
+        }
+        CheckSlots(atlas, animations);
+        for (const auto& entry : animations)
+        {
+            CheckSlotPixels(atlas, entry.first, entry.second);
+        }
+    }
+    GIF_CHECK_EQUAL(uint64_t(0), atlas.GetStats().cFailed);
+}
@@ -0,0 +1,200 @@
+// GifBatchProcessor composing a batch of random gifs on one thread and on
+// several, checked against composing each gif in turn with a compositor of
+// its own.  A gif that cannot be read gets an error result of its own and
+// leaves the workers fit to compose the gifs after it.
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "GifBatchProcessor.h"
+#include "GifCompositor.h"
+#include "GifDecoder.h"
+#include "GifTest.h"
+#include "GifTestGifs.h"
+
+namespace
+{
+    struct ExpectedTestResult
+    {
+        bool                        fSucceeded;
+        unsigned int                cDisplayedFrames;
+        std::vector<GifBatchFrame>  frames;
+    };
+
+    // What the batch should return for the input, composing its first loop
+    // in turn
+    ExpectedTestResult ComposeSequentially(const GifBatchInput& input)
+    {
+        ExpectedTestResult expected = { true, 0, {} };
+
+        auto decoder = std::make_shared<GifDecoder>();
+        decoder->SetTargetSize(input.cxMax, input.cyMax);
+        decoder->Open(input.data);
+        GifCompositor compositor(decoder, std::make_unique<CpuPixelBackend>());
+        if (compositor.GetGlobalInfo().cFrames == 0)
+        {
+            return expected;
+        }
+
+        auto requested = input.composedFrames;
+        std::sort(requested.begin(), requested.end());
+        requested.erase(std::unique(requested.begin(), requested.end()), requested.end());
+
+        unsigned int uFrameNumber = 0;
+        for (auto itRequested = requested.begin(); itRequested != requested.end(); uFrameNumber++)
+        {
+            compositor.ComposeNextFrame();
+            if (*itRequested == uFrameNumber)
+            {
+                GifBatchFrame frame;
+                frame.uFrameNumber = uFrameNumber;
+                frame.uFrameDelay = compositor.GetFrameDelay();
+                auto surface = compositor.GetComposedFrame();
+                frame.composedFrame.Resize(surface.cx, surface.cy);
+                for (unsigned int y = 0; y < surface.cy; y++)
+                {
+                    memcpy(frame.composedFrame.Surface().Row(y), surface.Row(y), surface.cx * sizeof(uint32_t));
+                }
+                expected.frames.push_back(std::move(frame));
+                ++itRequested;
+            }
+            if (compositor.IsLastFrame())
+            {
+                uFrameNumber++;
+                break;
+            }
+        }
+        expected.cDisplayedFrames = uFrameNumber;
+        return expected;
+    }
+
+    // Random gifs, some scaled down, asking for a few displayed frames each,
+    // now and then past the end of the first loop
+    std::vector<GifBatchInput> MakeTestInputs(std::mt19937& random, unsigned int cInputs)
+    {
+        std::vector<GifBatchInput> inputs;
+        for (unsigned int i = 0; i < cInputs; i++)
+        {
+            auto spec = MakeRandomTestGif(random, i % 3 == 0);
+
+            GifBatchInput input;
+            input.data = WriteTestGif(spec);
+            if (random() % 4 == 0 && spec.cx > 1 && spec.cy > 1)
+            {
+                input.cxMax = spec.cx / 2;
+                input.cyMax = spec.cy / 2;
+            }
+            for (unsigned int iFrame = random() % 4; iFrame > 0; iFrame--)
+            {
+                input.composedFrames.push_back(random() % (spec.frames.size() + 3));
+            }
+            input.uTag = i;
+            inputs.push_back(std::move(input));
+        }
+        return inputs;
+    }
+
+    std::map<uint64_t, GifBatchResult> ProcessBatch(const std::vector<GifBatchInput>& inputs, unsigned int cThreads)
+    {
+        std::map<uint64_t, GifBatchResult> results;
+        GifBatchProcessor processor([&](GifBatchResult&& result)
+        {
+            auto uTag = result.uTag;
+            results[uTag] = std::move(result);
+        }, cThreads);
+        GIF_CHECK_EQUAL(cThreads, processor.GetThreadCount());
+
+        for (const auto& input : inputs)
+        {
+            processor.Submit(input);
+        }
+        processor.Wait();
+        GIF_CHECK_EQUAL(inputs.size(), results.size());
+        return results;
+    }
+
+    void CheckBatchResult(const ExpectedTestResult& expected, const GifBatchResult& result, unsigned int cThreads)
+    {
+        GIF_CHECK_MESSAGE(result.fSucceeded == expected.fSucceeded,
+            "gif " << result.uTag << " on " << cThreads << " threads: " << (result.fSucceeded ? "succeeded" : result.error));
+        if (!expected.fSucceeded)
+        {
+            GIF_CHECK(!result.error.empty());
+            GIF_CHECK(result.frames.empty());
+            return;
+        }
+
+        GIF_CHECK_EQUAL(expected.cDisplayedFrames, result.cDisplayedFrames);
+        GIF_CHECK_EQUAL(expected.frames.size(), result.frames.size());
+        for (size_t i = 0; i < expected.frames.size(); i++)
+        {
+            const auto& expectedFrame = expected.frames[i];
+            const auto& frame = result.frames[i];
+            GIF_CHECK_EQUAL(expectedFrame.uFrameNumber, frame.uFrameNumber);
+            GIF_CHECK_EQUAL(expectedFrame.uFrameDelay, frame.uFrameDelay);
+            GIF_CHECK_EQUAL(expectedFrame.composedFrame.Width(), frame.composedFrame.Width());
+            GIF_CHECK_EQUAL(expectedFrame.composedFrame.Height(), frame.composedFrame.Height());
+            GIF_CHECK_MESSAGE(memcmp(expectedFrame.composedFrame.Pixels(), frame.composedFrame.Pixels(), frame.composedFrame.SizeInBytes()) == 0,
+                "gif " << result.uTag << " on " << cThreads << " threads: frame " << frame.uFrameNumber << " differs from a sequential compose");
+        }
+    }
+
+    void CheckBatch(const std::vector<GifBatchInput>& inputs, const std::vector<ExpectedTestResult>& expected)
+    {
+        for (unsigned int cThreads : { 1u, 4u })
+        {
+            auto results = ProcessBatch(inputs, cThreads);
+            for (const auto& input : inputs)
+            {
+                CheckBatchResult(expected[input.uTag], results[input.uTag], cThreads);
+            }
+        }
+    }
+}
+
+GIF_TEST(batch, ThreadsMatchSequentialCompose)
+{
+    std::mt19937 random(29);
+    auto inputs = MakeTestInputs(random, 200);
+
+    std::vector<ExpectedTestResult> expected;
+    for (const auto& input : inputs)
+    {
+        expected.push_back(ComposeSequentially(input));
+    }
+    CheckBatch(inputs, expected);
+}
+
+GIF_TEST(batch, BadGifFailsAlone)
+{
+    std::mt19937 random(30);
+    auto inputs = MakeTestInputs(random, 60);
+
+    std::vector<ExpectedTestResult> expected;
+    for (const auto& input : inputs)
+    {
+        expected.push_back(ComposeSequentially(input));
+    }
+
+    // Data that is not a gif and a file that does not exist, between gifs
+    // that must still compose as if they were alone
+    for (size_t i = 10; i < inputs.size(); i += 10)
+    {
+        if (i % 20 == 0)
+        {
+            inputs[i].data.assign({ 'N', 'O', 'T', 'G', 'I', 'F', 0, 0, 0, 0, 0, 0, 0 });
+        }
+        else
+        {
+            inputs[i].data.clear();
+            inputs[i].path = "no such file " + std::to_string(i) + ".gif";
+        }
+        expected[i] = { false, 0, {} };
+    }
+    CheckBatch(inputs, expected);
+}
@@ -0,0 +1,569 @@
+// Composed frames checked against hand-worked pixels on tiny canvases and
+// against ComposeTestGifReference, which draws every frame in turn, on
+// random gifs.  The compositor folds zero delay frames into runs, caches,
+// seeks and decodes straight onto the canvas, so every one of those paths
+// has to match drawing each frame in order.
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "GifCompositor.h"
+#include "GifDecoder.h"
+#include "GifParallelDecoder.h"
+#include "GifTest.h"
+#include "GifTestGifs.h"
+
+namespace
+{
+    const uint32_t RED = 0xFFFF0000;
+    const uint32_t GREEN = 0xFF00FF00;
+    const uint32_t BLUE = 0xFF0000FF;
+    const uint32_t WHITE = 0xFFFFFFFF;
+
+    // Palette indices of the colors above; white is the background
+    const uint8_t R = 0;
+    const uint8_t G = 1;
+    const uint8_t B = 2;
+
+    GifTestSpec MakeGoldenSpec(unsigned int cx, unsigned int cy)
+    {
+        GifTestSpec spec = {};
+        spec.cx = cx;
+        spec.cy = cy;
+        spec.globalPalette = { 0xFF0000, 0x00FF00, 0x0000FF, 0xFFFFFF };
+        spec.backgroundIndex = 3;
+        spec.fTrailer = true;
+        return spec;
+    }
+
+    // Hides DrawRawFrame, so the compositor goes through GetRawFrame and
+    // the pixel backend
+    class RawFrameOnlySource : public IGifFrameSource
+    {
+    public:
+
+        explicit RawFrameOnlySource(std::shared_ptr<IGifFrameSource> source) : m_source(std::move(source))
+        {
+        }
+
+        void GetGlobalInfo(GifGlobalInfo& globalInfo) override
+        {
+            m_source->GetGlobalInfo(globalInfo);
+        }
+
+        void GetFrameInfo(unsigned int uFrameIndex, GifFrameInfo& frameInfo) override
+        {
+            m_source->GetFrameInfo(uFrameIndex, frameInfo);
+        }
+
+        void DiscoverFrames(unsigned int cFramesNeeded, GifGlobalInfo& globalInfo) override
+        {
+            m_source->DiscoverFrames(cFramesNeeded, globalInfo);
+        }
+
+        void GetRawFrame(unsigned int uFrameIndex, GifRawFrame& rawFrame) override
+        {
+            m_source->GetRawFrame(uFrameIndex, rawFrame);
+        }
+
+        bool IsFrameOpaque(unsigned int uFrameIndex) override
+        {
+            return m_source->IsFrameOpaque(uFrameIndex);
+        }
+
+    private:
+
+        std::shared_ptr<IGifFrameSource> m_source;
+    };
+
+    enum TEST_SOURCE
+    {
+        TS_DECODER,
+        TS_LAZY,
+        TS_RAW_FRAMES,
+        TS_PARALLEL
+    };
+
+    std::shared_ptr<IGifFrameSource> OpenTestSource(const std::vector<uint8_t>& data, TEST_SOURCE source)
+    {
+        if (source == TS_PARALLEL)
+        {
+            return std::make_shared<GifParallelDecoder>(GifByteSource::FromVector(data), 2);
+        }
+
+        auto decoder = std::make_shared<GifDecoder>();
+        decoder->SetOpenMode(source == TS_LAZY ? GOM_LAZY : GOM_FULL);
+        decoder->Open(data);
+        if (source == TS_RAW_FRAMES)
+        {
+            return std::make_shared<RawFrameOnlySource>(decoder);
+        }
+        return decoder;
+    }
+
+    std::vector<uint32_t> CopyComposedFrame(GifCompositor& compositor)
+    {
+        GifSurface surface = compositor.GetComposedFrame();
+        std::vector<uint32_t> pixels;
+        for (unsigned int y = 0; y < surface.cy; y++)
+        {
+            pixels.insert(pixels.end(), surface.Row(y), surface.Row(y) + surface.cx);
+        }
+        return pixels;
+    }
+
+    // Index of the frame ComposeNextFrame has just displayed
+    unsigned int GetDisplayedFrameIndex(GifCompositor& compositor)
+    {
+        unsigned int uNext = compositor.GetNextFrameIndex();
+        return (uNext == 0 ? compositor.GetGlobalInfo().cFrames : uNext) - 1;
+    }
+
+    // The composed frames of one loop, each repeated for the zero delay
+    // frames folded into it, so the result lines up with the reference
+    std::vector<std::vector<uint32_t>> ComposeTestGif(const GifTestSpec& spec)
+    {
+        GifCompositor compositor(OpenTestSource(WriteTestGif(spec), TS_DECODER), std::make_unique<CpuPixelBackend>());
+        compositor.Reset();
+
+        std::vector<std::vector<uint32_t>> composed;
+        do
+        {
+            compositor.ComposeNextFrame();
+            auto pixels = CopyComposedFrame(compositor);
+            while (composed.size() <= GetDisplayedFrameIndex(compositor))
+            {
+                composed.push_back(pixels);
+            }
+        } while (!compositor.IsLastFrame());
+        return composed;
+    }
+
+    void CheckComposedFrame(const std::vector<uint32_t>& expected, const std::vector<uint32_t>& actual, const char* pszPath, unsigned int uFrameIndex)
+    {
+        GIF_CHECK_EQUAL(expected.size(), actual.size());
+        for (size_t i = 0; i < expected.size(); i++)
+        {
+            GIF_CHECK_MESSAGE(expected[i] == actual[i],
+                pszPath << ": frame " << uFrameIndex << " pixel " << i << " is " << std::hex << actual[i] << ", expected " << expected[i]);
+        }
+    }
+
+    // Plays two loops of the gif, checking every displayed frame against
+    // the reference, then seeks to every frame and composes the frame after
+    // it, which the frame cache restores when it holds it.  Returns the
+    // frames restored from the cache.
+    uint64_t CheckAgainstReference(const GifTestSpec& spec, TEST_SOURCE source, FRAME_CACHE_MODE cacheMode, unsigned int uCodec, const char* pszPath)
+    {
+        auto data = WriteTestGif(spec);
+        auto reference = ComposeTestGifReference(spec);
+
+        GifCompositor compositor(OpenTestSource(data, source), std::make_unique<CpuPixelBackend>());
+        compositor.SetFrameCacheMode(cacheMode);
+        compositor.SetFrameCacheCodec(uCodec);
+        compositor.Reset();
+
+        // A lazy source only knows every frame once the first loop is over
+        if (compositor.GetGlobalInfo().fFrameCountPartial)
+        {
+            GIF_CHECK(compositor.GetGlobalInfo().cFrames <= reference.size());
+        }
+        else
+        {
+            GIF_CHECK_EQUAL(reference.size(), static_cast<size_t>(compositor.GetGlobalInfo().cFrames));
+        }
+
+        for (int loop = 0; loop < 2; loop++)
+        {
+            do
+            {
+                compositor.ComposeNextFrame();
+                unsigned int uFrameIndex = GetDisplayedFrameIndex(compositor);
+                CheckComposedFrame(reference[uFrameIndex], CopyComposedFrame(compositor), pszPath, uFrameIndex);
+            } while (!compositor.IsLastFrame());
+        }
+        GIF_CHECK(!compositor.GetGlobalInfo().fFrameCountPartial);
+        GIF_CHECK_EQUAL(reference.size(), static_cast<size_t>(compositor.GetGlobalInfo().cFrames));
+
+        compositor.SetSeekInterval(2);
+        for (unsigned int uFrameIndex = static_cast<unsigned int>(reference.size()); uFrameIndex-- > 0;)
+        {
+            compositor.SeekToFrame(uFrameIndex);
+            CheckComposedFrame(reference[uFrameIndex], CopyComposedFrame(compositor), pszPath, uFrameIndex);
+
+            compositor.ComposeNextFrame();
+            unsigned int uNextFrameIndex = GetDisplayedFrameIndex(compositor);
+            CheckComposedFrame(reference[uNextFrameIndex], CopyComposedFrame(compositor), pszPath, uNextFrameIndex);
+        }
+        return compositor.GetFrameCacheStats().cHits;
+    }
+}
+
+GIF_TEST(compositor, DisposalNoneKeepsFrame)
+{
+    for (unsigned int uDisposal : { GIF_DM_UNDEFINED, GIF_DM_NONE })
+    {
+        auto spec = MakeGoldenSpec(4, 1);
+        spec.frames.push_back(MakeSolidTestFrame({ 0, 0, 4, 1 }, R, 1, uDisposal));
+        spec.frames.push_back(MakeSolidTestFrame({ 1, 0, 3, 1 }, B, 1, uDisposal));
+        spec.frames.push_back(MakeSolidTestFrame({ 3, 0, 4, 1 }, G, 1, uDisposal));
+
+        auto composed = ComposeTestGif(spec);
+        GIF_CHECK_EQUAL(size_t(3), composed.size());
+        GIF_CHECK(composed[0] == std::vector<uint32_t>({ RED, RED, RED, RED }));
+        GIF_CHECK(composed[1] == std::vector<uint32_t>({ RED, BLUE, BLUE, RED }));
+        GIF_CHECK(composed[2] == std::vector<uint32_t>({ RED, BLUE, BLUE, GREEN }));
+    }
+}
+
+GIF_TEST(compositor, DisposalBackgroundClearsRect)
+{
+    auto spec = MakeGoldenSpec(4, 1);
+    spec.frames.push_back(MakeSolidTestFrame({ 0, 0, 4, 1 }, R, 1, GIF_DM_NONE));
+    spec.frames.push_back(MakeSolidTestFrame({ 1, 0, 3, 1 }, B, 1, GIF_DM_BACKGROUND));
+    spec.frames.push_back(MakeSolidTestFrame({ 0, 0, 1, 1 }, G, 1, GIF_DM_NONE));
+
+    auto composed = ComposeTestGif(spec);
+    GIF_CHECK(composed[1] == std::vector<uint32_t>({ RED, BLUE, BLUE, RED }));
+    GIF_CHECK(composed[2] == std::vector<uint32_t>({ GREEN, WHITE, WHITE, RED }));
+}
+
+GIF_TEST(compositor, DisposalPreviousRestoresCanvas)
+{
+    auto spec = MakeGoldenSpec(4, 1);
+    spec.frames.push_back(MakeSolidTestFrame({ 0, 0, 4, 1 }, R, 1, GIF_DM_NONE));
+    spec.frames.push_back(MakeSolidTestFrame({ 0, 0, 2, 1 }, G, 1, GIF_DM_NONE));
+    spec.frames.push_back(MakeSolidTestFrame({ 1, 0, 3, 1 }, B, 1, GIF_DM_PREVIOUS));
+    spec.frames.push_back(MakeSolidTestFrame({ 3, 0, 4, 1 }, G, 1, GIF_DM_NONE));
+
+    auto composed = ComposeTestGif(spec);
+    GIF_CHECK(composed[2] == std::vector<uint32_t>({ GREEN, BLUE, BLUE, RED }));
+    GIF_CHECK(composed[3] == std::vector<uint32_t>({ GREEN, GREEN, RED, GREEN }));
+}
+
+GIF_TEST(compositor, DisposalPreviousOnFirstFrameRestoresBackground)
+{
+    auto spec = MakeGoldenSpec(2, 1);
+    spec.frames.push_back(MakeSolidTestFrame({ 0, 0, 2, 1 }, R, 1, GIF_DM_PREVIOUS));
+    spec.frames.push_back(MakeSolidTestFrame({ 1, 0, 2, 1 }, B, 1, GIF_DM_NONE));
+
+    auto composed = ComposeTestGif(spec);
+    GIF_CHECK(composed[0] == std::vector<uint32_t>({ RED, RED }));
+    GIF_CHECK(composed[1] == std::vector<uint32_t>({ WHITE, BLUE }));
+}
+
+GIF_TEST(compositor, ZeroDelayFramesAreFolded)
+{
+    // Frame 1 is never displayed on its own, but its disposal still applies
+    auto spec = MakeGoldenSpec(3, 1);
+    spec.frames.push_back(MakeSolidTestFrame({ 0, 0, 3, 1 }, R, 1, GIF_DM_NONE));
+    spec.frames.push_back(MakeSolidTestFrame({ 0, 0, 2, 1 }, B, 0, GIF_DM_BACKGROUND));
+    spec.frames.push_back(MakeSolidTestFrame({ 1, 0, 2, 1 }, G, 1, GIF_DM_NONE));
+
+    auto composed = ComposeTestGif(spec);
+    GIF_CHECK(composed[2] == std::vector<uint32_t>({ WHITE, GREEN, RED }));
+}
+
+GIF_TEST(compositor, TransparentIndexShowsCanvas)
+{
+    auto spec = MakeGoldenSpec(4, 1);
+    spec.frames.push_back(MakeSolidTestFrame({ 0, 0, 4, 1 }, R, 1, GIF_DM_NONE));
+    auto frame = MakeSolidTestFrame({ 0, 0, 4, 1 }, G, 1, GIF_DM_NONE);
+    frame.indices = { G, B, B, G };
+    frame.fTransparent = true;
+    frame.transparentIndex = B;
+    spec.frames.push_back(frame);
+
+    auto composed = ComposeTestGif(spec);
+    GIF_CHECK(composed[1] == std::vector<uint32_t>({ GREEN, RED, RED, GREEN }));
+}
+
+GIF_TEST(compositor, TransparentFirstFrameShowsBackground)
+{
+    auto spec = MakeGoldenSpec(2, 1);
+    auto frame = MakeSolidTestFrame({ 0, 0, 2, 1 }, G, 1, GIF_DM_NONE);
+    frame.indices = { R, B };
+    frame.fTransparent = true;
+    frame.transparentIndex = B;
+    spec.frames.push_back(frame);
+
+    auto composed = ComposeTestGif(spec);
+    GIF_CHECK(composed[0] == std::vector<uint32_t>({ RED, WHITE }));
+}
+
+GIF_TEST(compositor, OverhangingRectIsClipped)
+{
+    auto spec = MakeGoldenSpec(3, 2);
+    spec.frames.push_back(MakeSolidTestFrame({ 0, 0, 3, 2 }, R, 1, GIF_DM_NONE));
+    spec.frames.push_back(MakeSolidTestFrame({ 2, 1, 6, 4 }, B, 1, GIF_DM_BACKGROUND));
+    spec.frames.push_back(MakeSolidTestFrame({ 5, 5, 7, 7 }, G, 1, GIF_DM_NONE));
+
+    auto composed = ComposeTestGif(spec);
+    GIF_CHECK_EQUAL(size_t(3), composed.size());
+    GIF_CHECK(composed[1] == std::vector<uint32_t>({ RED, RED, RED, RED, RED, BLUE }));
+    GIF_CHECK(composed[2] == std::vector<uint32_t>({ RED, RED, RED, RED, RED, WHITE }));
+}
+
+GIF_TEST(compositor, MissingTrailerKeepsFrames)
+{
+    auto spec = MakeGoldenSpec(2, 1);
+    spec.fTrailer = false;
+    spec.frames.push_back(MakeSolidTestFrame({ 0, 0, 2, 1 }, R, 1, GIF_DM_NONE));
+    spec.frames.push_back(MakeSolidTestFrame({ 0, 0, 1, 1 }, B, 1, GIF_DM_NONE));
+
+    auto composed = ComposeTestGif(spec);
+    GIF_CHECK_EQUAL(size_t(2), composed.size());
+    GIF_CHECK(composed[0] == std::vector<uint32_t>({ RED, RED }));
+    GIF_CHECK(composed[1] == std::vector<uint32_t>({ BLUE, RED }));
+}
+
+GIF_TEST(compositor, InterlacedRowsAreReordered)
+{
+    auto spec = MakeGoldenSpec(1, 5);
+    auto frame = MakeSolidTestFrame({ 0, 0, 1, 5 }, R, 1, GIF_DM_NONE);
+    frame.indices = { R, G, B, G, R };
+    frame.fInterlaced = true;
+    spec.frames.push_back(frame);
+
+    auto composed = ComposeTestGif(spec);
+    GIF_CHECK(composed[0] == std::vector<uint32_t>({ RED, GREEN, BLUE, GREEN, RED }));
+}
+
+GIF_TEST(compositor, DirtyRectsRebuildEveryFrame)
+{
+    // Presenting only the dirty rect of each composed frame over the frames
+    // presented before must give the composed frame, through the frame
+    // cache and its codecs, loop restarts and seeks
+    const struct
+    {
+        FRAME_CACHE_MODE    cacheMode;
+        unsigned int        uCodec;
+    } MODES[] =
+    {
+        { FCM_OFF, GFC_NONE },
+        { FCM_FULL, GFC_NONE },
+        { FCM_FULL, GFC_ALL },
+        { FCM_KEYFRAME, GFC_DELTA },
+    };
+
+    std::mt19937 random(3);
+    for (int i = 0; i < 200; i++)
+    {
+        auto spec = MakeRandomTestGif(random, true);
+        auto data = WriteTestGif(spec);
+        for (const auto& mode : MODES)
+        {
+            GifCompositor compositor(OpenTestSource(data, TS_DECODER), std::make_unique<CpuPixelBackend>());
+            compositor.SetFrameCacheMode(mode.cacheMode);
+            compositor.SetFrameCacheCodec(mode.uCodec);
+            compositor.Reset();
+
+            std::vector<uint32_t> presented(static_cast<size_t>(spec.cx) * spec.cy, 0xDEADBEEF);
+            auto present = [&]()
+            {
+                GifSurface surface = compositor.GetComposedFrame();
+                const GifRect& dirtyRect = compositor.GetDirtyRect();
+                for (unsigned int y = dirtyRect.top; y < dirtyRect.bottom; y++)
+                {
+                    for (unsigned int x = dirtyRect.left; x < dirtyRect.right; x++)
+                    {
+                        presented[static_cast<size_t>(y) * spec.cx + x] = surface.Row(y)[x];
+                    }
+                }
+                CheckComposedFrame(CopyComposedFrame(compositor), presented, "dirty rects", GetDisplayedFrameIndex(compositor));
+            };
+
+            for (int cFrames = 0; cFrames < 3 * static_cast<int>(spec.frames.size()); cFrames++)
+            {
+                compositor.ComposeNextFrame();
+                present();
+
+                // Now and then jump elsewhere, which dirties the whole canvas
+                if (random() % 8 == 0)
+                {
+                    compositor.SeekToFrame(static_cast<unsigned int>(random() % spec.frames.size()));
+                    present();
+                }
+            }
+        }
+    }
+}
+
+GIF_TEST(compositor, TruncatedFrameDoesNotHideEarlierFrames)
+{
+    // Frame 3 has no transparent index but its data stops after one pixel,
+    // so frame 1 still shows through in the run of frames 1 to 3
+    auto spec = MakeGoldenSpec(3, 1);
+    spec.frames.push_back(MakeSolidTestFrame({ 0, 0, 3, 1 }, R, 1, GIF_DM_NONE));
+    spec.frames.push_back(MakeSolidTestFrame({ 0, 0, 3, 1 }, B, 0, GIF_DM_NONE));
+    spec.frames.push_back(MakeSolidTestFrame({ 0, 0, 2, 1 }, R, 0, GIF_DM_PREVIOUS));
+    spec.frames.push_back(MakeSolidTestFrame({ 0, 0, 3, 1 }, G, 1, GIF_DM_NONE));
+    spec.frames.back().cPixelsEncoded = 1;
+    spec.frames.push_back(MakeSolidTestFrame({ 2, 0, 3, 1 }, R, 1, GIF_DM_NONE));
+
+    auto composed = ComposeTestGif(spec);
+    GIF_CHECK(composed[3] == std::vector<uint32_t>({ GREEN, BLUE, BLUE }));
+    GIF_CHECK(composed[4] == std::vector<uint32_t>({ GREEN, BLUE, RED }));
+
+    // Nor is it a restart point for seeking
+    CheckAgainstReference(spec, TS_DECODER, FCM_OFF, GFC_NONE, "decoder");
+    CheckAgainstReference(spec, TS_RAW_FRAMES, FCM_FULL, GFC_NONE, "raw frames cached");
+    CheckAgainstReference(spec, TS_PARALLEL, FCM_OFF, GFC_NONE, "parallel");
+}
+
+GIF_TEST(compositor, RandomGifsMatchReference)
+{
+    const struct
+    {
+        TEST_SOURCE         source;
+        FRAME_CACHE_MODE    cacheMode;
+        unsigned int        uCodec;
+        const char*         pszPath;
+    } PATHS[] =
+    {
+        { TS_DECODER, FCM_OFF, GFC_NONE, "decoder" },
+        { TS_DECODER, FCM_FULL, GFC_NONE, "decoder cached" },
+        { TS_DECODER, FCM_FULL, GFC_DELTA, "decoder cached, delta" },
+        { TS_DECODER, FCM_FULL, GFC_PALETTE, "decoder cached, palette" },
+        { TS_DECODER, FCM_FULL, GFC_LZ, "decoder cached, lz" },
+        { TS_DECODER, FCM_FULL, GFC_ALL, "decoder cached, all codecs" },
+        { TS_DECODER, FCM_KEYFRAME, GFC_NONE, "decoder keyframes" },
+        { TS_DECODER, FCM_KEYFRAME, GFC_DELTA, "decoder keyframes, delta" },
+        { TS_DECODER, FCM_KEYFRAME, GFC_PALETTE, "decoder keyframes, palette" },
+        { TS_DECODER, FCM_KEYFRAME, GFC_LZ, "decoder keyframes, lz" },
+        { TS_DECODER, FCM_KEYFRAME, GFC_ALL, "decoder keyframes, all codecs" },
+        { TS_LAZY, FCM_OFF, GFC_NONE, "lazy" },
+        { TS_LAZY, FCM_FULL, GFC_NONE, "lazy cached" },
+        { TS_RAW_FRAMES, FCM_OFF, GFC_NONE, "raw frames" },
+        { TS_PARALLEL, FCM_OFF, GFC_NONE, "parallel" },
+    };
+
+    const size_t PATH_COUNT = sizeof(PATHS) / sizeof(PATHS[0]);
+    uint64_t cHits[PATH_COUNT] = {};
+
+    std::mt19937 random(2);
+    for (int i = 0; i < 300; i++)
+    {
+        auto spec = MakeRandomTestGif(random, true);
+        for (size_t iPath = 0; iPath < PATH_COUNT; iPath++)
+        {
+            const auto& path = PATHS[iPath];
+            cHits[iPath] += CheckAgainstReference(spec, path.source, path.cacheMode, path.uCodec, path.pszPath);
+        }
+    }
+
+    // The cached paths must have restored frames, or they tested nothing
+    // the uncached ones do not
+    for (size_t iPath = 0; iPath < PATH_COUNT; iPath++)
+    {
+        GIF_CHECK_MESSAGE(PATHS[iPath].cacheMode == FCM_OFF || cHits[iPath] > 0,
+            PATHS[iPath].pszPath << ": no frame was restored from the cache");
+    }
+}
+
+GIF_TEST(compositor, LazyOpenSeeksPastUnparsedFrames)
+{
+    // A lazily opened gif is only walked as far as its first frame.  Frames
+    // past that are found when asked for, whether by a seek that jumps
+    // over them or by DiscoverFrames.
+    std::mt19937 random(18);
+    for (int i = 0; i < 300; i++)
+    {
+        auto spec = MakeRandomTestGif(random, true);
+        auto data = WriteTestGif(spec);
+        auto reference = ComposeTestGifReference(spec);
+        auto cFrames = static_cast<unsigned int>(reference.size());
+
+        auto decoder = std::make_shared<GifDecoder>();
+        decoder->SetOpenMode(GOM_LAZY);
+        decoder->Open(data);
+
+        GifGlobalInfo globalInfo;
+        decoder->GetGlobalInfo(globalInfo);
+        GIF_CHECK(globalInfo.cFrames >= 1 && globalInfo.cFrames <= cFrames);
+        GIF_CHECK(globalInfo.fFrameCountPartial || globalInfo.cFrames == cFrames);
+
+        // Looking for a frame in the middle finds the frames up to it and
+        // no more than there are
+        unsigned int cFramesNeeded = 1 + static_cast<unsigned int>(random() % (cFrames + 2));
+        decoder->DiscoverFrames(cFramesNeeded, globalInfo);
+        GIF_CHECK(globalInfo.cFrames >= std::min(cFramesNeeded, cFrames) && globalInfo.cFrames <= cFrames);
+        GIF_CHECK(globalInfo.fFrameCountPartial || globalInfo.cFrames == cFrames);
+
+        // A fresh lazy decoder seeked straight to its last frame, then to
+        // the others in a random order
+        decoder = std::make_shared<GifDecoder>();
+        decoder->SetOpenMode(GOM_LAZY);
+        decoder->Open(data);
+        GifCompositor compositor(decoder, std::make_unique<CpuPixelBackend>());
+        compositor.Reset();
+
+        compositor.SeekToFrame(cFrames - 1);
+        CheckComposedFrame(reference[cFrames - 1], CopyComposedFrame(compositor), "lazy seek", cFrames - 1);
+        for (unsigned int uSeek = 0; uSeek < cFrames; uSeek++)
+        {
+            unsigned int uFrameIndex = static_cast<unsigned int>(random() % cFrames);
+            compositor.SeekToFrame(uFrameIndex);
+            CheckComposedFrame(reference[uFrameIndex], CopyComposedFrame(compositor), "lazy seek", uFrameIndex);
+        }
+
+        decoder->GetGlobalInfo(globalInfo);
+        GIF_CHECK_EQUAL(cFrames, globalInfo.cFrames);
+    }
+}
+
+GIF_TEST(compositor, LazyOpenMatchesFullOpenOnCutFiles)
+{
+    // Files cut short anywhere, as when a download stops: opening lazily
+    // must find the same frames, delays and pixels as walking the whole
+    // file first, or fail the same way
+    std::mt19937 random(19);
+    for (int i = 0; i < 300; i++)
+    {
+        auto spec = MakeRandomTestGif(random, true);
+        auto data = WriteTestGif(spec);
+        data.resize(random() % (data.size() + 1));
+
+        std::vector<std::unique_ptr<GifCompositor>> compositors;
+        bool fOpened[2] = {};
+        for (GIF_OPEN_MODE mode : { GOM_FULL, GOM_LAZY })
+        {
+            auto decoder = std::make_shared<GifDecoder>();
+            decoder->SetOpenMode(mode);
+            try
+            {
+                decoder->Open(data);
+                compositors.push_back(std::make_unique<GifCompositor>(decoder, std::make_unique<CpuPixelBackend>()));
+                compositors.back()->Reset();
+                fOpened[mode == GOM_LAZY] = true;
+            }
+            catch (const std::runtime_error&)
+            {
+            }
+        }
+        GIF_CHECK_MESSAGE(fOpened[0] == fOpened[1], "cut at " << data.size() << ": only one open mode failed");
+        if (!fOpened[0])
+        {
+            continue;
+        }
+
+        auto& full = *compositors[0];
+        auto& lazy = *compositors[1];
+        do
+        {
+            full.ComposeNextFrame();
+            lazy.ComposeNextFrame();
+            unsigned int uFrameIndex = GetDisplayedFrameIndex(full);
+            GIF_CHECK_EQUAL(uFrameIndex, GetDisplayedFrameIndex(lazy));
+            GIF_CHECK_EQUAL(full.GetFrameDelay(), lazy.GetFrameDelay());
+            CheckComposedFrame(CopyComposedFrame(full), CopyComposedFrame(lazy), "lazy cut file", uFrameIndex);
+        } while (!full.IsLastFrame());
+
+        GIF_CHECK(lazy.IsLastFrame());
+        GIF_CHECK(!lazy.GetGlobalInfo().fFrameCountPartial);
+        GIF_CHECK_EQUAL(full.GetGlobalInfo().cFrames, lazy.GetGlobalInfo().cFrames);
+    }
+}
@@ -0,0 +1,602 @@
+// The decoder fed a gif over time through OpenStream and AppendBytes,
+// checked against opening the whole file at once.  A streamed gif must
+// compose the same frames however its bytes are split, and the compositor
+// must only call a frame the last one once the stream says so.  A gif
+// opened with a saved frame index must compose like one opened afresh, and
+// an index that is cut short, damaged or saved for other data is rejected.
+// Frames decoded scaled down compose to the full size frames box filtered.
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "GifByteSource.h"
+#include "GifCompositor.h"
+#include "GifDecoder.h"
+#include "GifTest.h"
+#include "GifTestGifs.h"
+
+namespace
+{
+    struct ComposedTestFrame
+    {
+        unsigned int            uFrameIndex;    // Raw frame displayed
+        unsigned int            uDelay;
+        std::vector<uint32_t>   pixels;
+    };
+
+    std::vector<uint32_t> CopyComposedFrame(GifCompositor& compositor)
+    {
+        GifSurface surface = compositor.GetComposedFrame();
+        std::vector<uint32_t> pixels;
+        for (unsigned int y = 0; y < surface.cy; y++)
+        {
+            pixels.insert(pixels.end(), surface.Row(y), surface.Row(y) + surface.cx);
+        }
+        return pixels;
+    }
+
+    ComposedTestFrame GetComposedTestFrame(GifCompositor& compositor)
+    {
+        unsigned int uNext = compositor.GetNextFrameIndex();
+        unsigned int uFrameIndex = (uNext == 0 ? compositor.GetGlobalInfo().cFrames : uNext) - 1;
+        return { uFrameIndex, compositor.GetFrameDelay(), CopyComposedFrame(compositor) };
+    }
+
+    // One loop of a gif the decoder has opened
+    std::vector<ComposedTestFrame> ComposeOpenedGif(std::shared_ptr<GifDecoder> decoder, unsigned int& cFrames)
+    {
+        GifCompositor compositor(std::move(decoder), std::make_unique<CpuPixelBackend>());
+
+        std::vector<ComposedTestFrame> frames;
+        if (compositor.IsNextFrameReady())
+        {
+            do
+            {
+                compositor.ComposeNextFrame();
+                frames.push_back(GetComposedTestFrame(compositor));
+            } while (!compositor.IsLastFrame());
+        }
+        cFrames = compositor.GetGlobalInfo().cFrames;
+        return frames;
+    }
+
+    // One loop of the gif opened whole.  Throws like Open for data that is
+    // not a gif.
+    std::vector<ComposedTestFrame> ComposeWholeFile(const std::vector<uint8_t>& data, unsigned int& cFrames)
+    {
+        auto decoder = std::make_shared<GifDecoder>();
+        decoder->Open(data);
+        return ComposeOpenedGif(decoder, cFrames);
+    }
+
+    std::vector<uint8_t> SerializeFrameIndex(const std::vector<uint8_t>& data)
+    {
+        GifDecoder decoder;
+        decoder.Open(data);
+        std::vector<uint8_t> serialized;
+        decoder.GetFrameIndex().Serialize(serialized);
+        return serialized;
+    }
+
+    // Opening data with the serialized index must throw
+    void CheckIndexRejected(const std::vector<uint8_t>& data, const std::vector<uint8_t>& serialized, const char* pszHow)
+    {
+        bool fRejected = false;
+        try
+        {
+            GifFrameIndex frameIndex;
+            frameIndex.Deserialize(serialized.data(), serialized.size());
+            GifDecoder decoder;
+            decoder.Open(GifByteSource::FromVector(data), frameIndex);
+        }
+        catch (const std::runtime_error&)
+        {
+            fRejected = true;
+        }
+        GIF_CHECK_MESSAGE(fRejected, pszHow << ": the index was accepted");
+    }
+
+    // A gif of solid blocks at random, often odd, offsets, some with a
+    // transparent hole, on a canvas of cxUnit x cyUnit multiples of 6, so
+    // that it scales down by 2 and 3 exactly.  Disposals are random.
+    GifTestSpec MakeBlockTestGif(std::mt19937& random)
+    {
+        auto uniform = [&random](unsigned int uMin, unsigned int uMax)
+        {
+            return std::uniform_int_distribution<unsigned int>(uMin, uMax)(random);
+        };
+
+        GifTestSpec spec = {};
+        spec.cx = 6 * uniform(1, 6);
+        spec.cy = 6 * uniform(1, 6);
+        spec.globalPalette.resize(16);
+        for (auto& color : spec.globalPalette)
+        {
+            color = random() & 0xFFFFFF;
+        }
+        spec.backgroundIndex = static_cast<uint8_t>(uniform(0, 15));
+        spec.fTrailer = true;
+
+        for (unsigned int i = uniform(1, 8); i > 0; i--)
+        {
+            GifRect rect;
+            rect.left = uniform(0, spec.cx - 1);
+            rect.top = uniform(0, spec.cy - 1);
+            rect.right = uniform(rect.left + 1, spec.cx);
+            rect.bottom = uniform(rect.top + 1, spec.cy);
+            auto frame = MakeSolidTestFrame(rect, static_cast<uint8_t>(uniform(1, 15)), uniform(1, 5), uniform(0, 3));
+
+            if (uniform(0, 1) != 0)
+            {
+                frame.fTransparent = true;
+                frame.transparentIndex = 0;
+                auto xHole = uniform(0, rect.Width() - 1);
+                auto yHole = uniform(0, rect.Height() - 1);
+                auto cxHole = uniform(1, rect.Width() - xHole);
+                auto cyHole = uniform(1, rect.Height() - yHole);
+                for (unsigned int y = yHole; y < yHole + cyHole; y++)
+                {
+                    std::fill_n(frame.indices.begin() + static_cast<size_t>(y) * rect.Width() + xHole, cxHole, uint8_t(0));
+                }
+            }
+            spec.frames.push_back(std::move(frame));
+        }
+        return spec;
+    }
+
+    unsigned int GetChannel(uint32_t pixel, unsigned int iChannel)
+    {
+        return (pixel >> (8 * iChannel)) & 0xFF;
+    }
+
+    // Box filters a full size canvas to cxScaled x cyScaled, each scaled
+    // pixel the average of the source pixels it covers weighted by how much
+    // of each it covers, one channel at a time
+    std::vector<double> BoxDownscale(const std::vector<uint32_t>& pixels, unsigned int cx, unsigned int cy, unsigned int cxScaled, unsigned int cyScaled, unsigned int iChannel)
+    {
+        // Source pixel u covers [u, u + 1) and scaled pixel x covers
+        // [x * cx / cxScaled, (x + 1) * cx / cxScaled)
+        auto overlap = [](unsigned int u, unsigned int x, unsigned int c, unsigned int cScaled)
+        {
+            double start = std::max<double>(u, static_cast<double>(x) * c / cScaled);
+            double end = std::min<double>(u + 1, static_cast<double>(x + 1) * c / cScaled);
+            return std::max(end - start, 0.);
+        };
+
+        std::vector<double> scaled(static_cast<size_t>(cxScaled) * cyScaled);
+        for (unsigned int y = 0; y < cyScaled; y++)
+        {
+            for (unsigned int x = 0; x < cxScaled; x++)
+            {
+                double sum = 0.;
+                for (unsigned int v = 0; v < cy; v++)
+                {
+                    for (unsigned int u = 0; u < cx; u++)
+                    {
+                        double weight = overlap(u, x, cx, cxScaled) * overlap(v, y, cy, cyScaled);
+                        if (weight != 0.)
+                        {
+                            sum += weight * GetChannel(pixels[static_cast<size_t>(v) * cx + u], iChannel);
+                        }
+                    }
+                }
+                scaled[static_cast<size_t>(y) * cxScaled + x] = sum * cxScaled * cyScaled / (static_cast<double>(cx) * cy);
+            }
+        }
+        return scaled;
+    }
+
+    // Feeds data to a streaming decoder in chunks of nextChunk() bytes and
+    // ends the stream after the last one
+    class TestStream
+    {
+    public:
+
+        TestStream(const std::vector<uint8_t>& data, std::function<size_t()> nextChunk) :
+            m_data(data),
+            m_nextChunk(std::move(nextChunk)),
+            m_offset(0),
+            m_fEnded(false),
+            m_decoder(std::make_shared<GifDecoder>())
+        {
+            m_decoder->OpenStream();
+        }
+
+        // Returns false once the stream has ended
+        bool Feed()
+        {
+            if (m_offset == m_data.size())
+            {
+                if (m_fEnded)
+                {
+                    return false;
+                }
+                m_decoder->EndStream();
+                m_fEnded = true;
+                return true;
+            }
+
+            size_t cb = std::min(std::max<size_t>(m_nextChunk(), 1), m_data.size() - m_offset);
+            m_decoder->AppendBytes(m_data.data() + m_offset, cb);
+            m_offset += cb;
+            return true;
+        }
+
+        bool HasEnded() const
+        {
+            return m_fEnded;
+        }
+
+        const std::shared_ptr<GifDecoder>& GetDecoder() const
+        {
+            return m_decoder;
+        }
+
+    private:
+
+        const std::vector<uint8_t>&     m_data;
+        std::function<size_t()>         m_nextChunk;
+        size_t                          m_offset;
+        bool                            m_fEnded;
+        std::shared_ptr<GifDecoder>     m_decoder;
+    };
+
+    // One loop of the gif streamed in chunks, composing each frame as soon
+    // as it is ready, the way gif2raw does.  While the stream is open, a
+    // frame that is not ready must leave the compositor where it is and not
+    // be taken for the end of the loop.  Throws like Open for data that is
+    // not a gif.
+    std::vector<ComposedTestFrame> ComposeStreamed(const std::vector<uint8_t>& data, std::function<size_t()> nextChunk, unsigned int& cFrames)
+    {
+        TestStream stream(data, std::move(nextChunk));
+        while (!stream.GetDecoder()->IsHeaderReady() && stream.Feed())
+        {
+        }
+        GifCompositor compositor(stream.GetDecoder(), std::make_unique<CpuPixelBackend>());
+
+        std::vector<ComposedTestFrame> frames;
+        auto waitForNextFrame = [&]()
+        {
+            while (!compositor.IsNextFrameReady())
+            {
+                if (!stream.HasEnded())
+                {
+                    GIF_CHECK(frames.empty() || !compositor.IsLastFrame());
+
+                    unsigned int uNext = compositor.GetNextFrameIndex();
+                    auto pixels = CopyComposedFrame(compositor);
+                    compositor.ComposeNextFrame();
+                    GIF_CHECK_EQUAL(uNext, compositor.GetNextFrameIndex());
+                    GIF_CHECK(pixels == CopyComposedFrame(compositor));
+                }
+                if (!stream.Feed())
+                {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        if (waitForNextFrame())
+        {
+            do
+            {
+                compositor.ComposeNextFrame();
+                frames.push_back(GetComposedTestFrame(compositor));
+            } while (waitForNextFrame() && !compositor.IsLastFrame());
+        }
+
+        GIF_CHECK(!compositor.GetGlobalInfo().fFrameCountPartial);
+        cFrames = compositor.GetGlobalInfo().cFrames;
+        return frames;
+    }
+
+    void CheckComposedFrames(const std::vector<ComposedTestFrame>& expected, const std::vector<ComposedTestFrame>& actual, const char* pszHow)
+    {
+        GIF_CHECK_MESSAGE(expected.size() == actual.size(),
+            pszHow << ": " << actual.size() << " frames composed, expected " << expected.size());
+        for (size_t i = 0; i < expected.size(); i++)
+        {
+            GIF_CHECK_MESSAGE(expected[i].uFrameIndex == actual[i].uFrameIndex && expected[i].uDelay == actual[i].uDelay,
+                pszHow << ": displayed frame " << i << " is raw frame " << actual[i].uFrameIndex << " for " << actual[i].uDelay
+                << " ms, expected " << expected[i].uFrameIndex << " for " << expected[i].uDelay << " ms");
+            GIF_CHECK_MESSAGE(expected[i].pixels == actual[i].pixels,
+                pszHow << ": displayed frame " << i << " differs from the whole file's");
+        }
+    }
+
+    // Streams data in each way and checks the frames against the whole
+    // file, including data that the whole file open rejects
+    void CheckStreamedLikeWholeFile(const std::vector<uint8_t>& data, std::mt19937& random)
+    {
+        std::vector<ComposedTestFrame> expected;
+        unsigned int cFramesExpected = 0;
+        bool fValid = true;
+        try
+        {
+            expected = ComposeWholeFile(data, cFramesExpected);
+        }
+        catch (const std::runtime_error&)
+        {
+            fValid = false;
+        }
+
+        const struct
+        {
+            const char*             pszHow;
+            std::function<size_t()> nextChunk;
+        } CHUNKINGS[] =
+        {
+            { "1 byte chunks", []() { return size_t(1); } },
+            { "random chunks", [&random]() { return static_cast<size_t>(1 + random() % 64); } },
+            { "one chunk", []() { return SIZE_MAX; } },
+        };
+
+        for (const auto& chunking : CHUNKINGS)
+        {
+            unsigned int cFrames = 0;
+            try
+            {
+                auto frames = ComposeStreamed(data, chunking.nextChunk, cFrames);
+                GIF_CHECK_MESSAGE(fValid, chunking.pszHow << ": a stream of " << data.size() << " bytes opened where the whole file did not");
+                CheckComposedFrames(expected, frames, chunking.pszHow);
+                GIF_CHECK_EQUAL(cFramesExpected, cFrames);
+            }
+            catch (const std::runtime_error&)
+            {
+                GIF_CHECK_MESSAGE(!fValid, chunking.pszHow << ": a stream of " << data.size() << " bytes failed where the whole file did not");
+            }
+        }
+    }
+}
+
+GIF_TEST(decoder, StreamedGifsMatchWholeFile)
+{
+    std::mt19937 random(19);
+    for (int i = 0; i < 200; i++)
+    {
+        auto spec = MakeRandomTestGif(random, i % 2 != 0);
+        CheckStreamedLikeWholeFile(WriteTestGif(spec), random);
+    }
+}
+
+GIF_TEST(decoder, StreamsCutShortMatchWholeFile)
+{
+    // The stream ends early, anywhere in the file, as a download that
+    // stops does
+    std::mt19937 random(20);
+    for (int i = 0; i < 200; i++)
+    {
+        auto spec = MakeRandomTestGif(random, true);
+        auto data = WriteTestGif(spec);
+        data.resize(random() % (data.size() + 1));
+        CheckStreamedLikeWholeFile(data, random);
+    }
+}
+
+GIF_TEST(decoder, EndStreamRevealsTheLastFrame)
+{
+    // Without a trailer, the last frame is only known to be last once the
+    // stream ends: until then the next frame is not ready and the loop has
+    // not ended.  EndStream makes IsNextFrameReady wrap to the first frame.
+    // With a trailer it is known as soon as the trailer arrives.  The last
+    // frame has a delay, as a run of zero delay frames at the end could
+    // otherwise still go on and is not ready either.
+    std::mt19937 random(21);
+    for (int i = 0; i < 200; i++)
+    {
+        auto spec = MakeRandomTestGif(random, false);
+        spec.fTrailer = (i % 2 != 0);
+        spec.frames.back().uDelay = std::max(spec.frames.back().uDelay, 1u);
+        auto data = WriteTestGif(spec);
+
+        unsigned int cFrames = 0;
+        auto expected = ComposeWholeFile(data, cFrames);
+
+        auto decoder = std::make_shared<GifDecoder>();
+        decoder->OpenStream();
+        decoder->AppendBytes(data.data(), data.size());
+        GifCompositor compositor(decoder, std::make_unique<CpuPixelBackend>());
+
+        for (size_t iFrame = 0; iFrame < expected.size(); iFrame++)
+        {
+            GIF_CHECK(compositor.IsNextFrameReady());
+            compositor.ComposeNextFrame();
+            GIF_CHECK_EQUAL(expected[iFrame].uFrameIndex, GetComposedTestFrame(compositor).uFrameIndex);
+        }
+
+        GIF_CHECK_EQUAL(spec.fTrailer, compositor.IsNextFrameReady());
+        GIF_CHECK_EQUAL(spec.fTrailer, compositor.IsLastFrame());
+        GIF_CHECK_EQUAL(spec.fTrailer, !compositor.GetGlobalInfo().fFrameCountPartial);
+
+        decoder->EndStream();
+        GIF_CHECK(compositor.IsNextFrameReady());
+        GIF_CHECK(compositor.IsLastFrame());
+        GIF_CHECK_EQUAL(0u, compositor.GetNextFrameIndex());
+        GIF_CHECK_EQUAL(cFrames, compositor.GetGlobalInfo().cFrames);
+
+        // The next loop starts from the first frame
+        compositor.ComposeNextFrame();
+        GIF_CHECK(expected[0].pixels == CopyComposedFrame(compositor));
+        GIF_CHECK_EQUAL(2u, compositor.GetLoopNumber());
+    }
+}
+
+GIF_TEST(decoder, SavedIndexComposesLikeAFreshOpen)
+{
+    std::mt19937 random(22);
+    for (int i = 0; i < 200; i++)
+    {
+        auto spec = MakeRandomTestGif(random, i % 2 != 0);
+        auto data = WriteTestGif(spec);
+
+        unsigned int cFramesExpected = 0;
+        auto expected = ComposeWholeFile(data, cFramesExpected);
+
+        auto serialized = SerializeFrameIndex(data);
+        GifFrameIndex frameIndex;
+        frameIndex.Deserialize(serialized.data(), serialized.size());
+
+        // The loaded index serializes back to the same bytes
+        std::vector<uint8_t> reserialized;
+        frameIndex.Serialize(reserialized);
+        GIF_CHECK(serialized == reserialized);
+
+        auto decoder = std::make_shared<GifDecoder>();
+        decoder->Open(GifByteSource::FromVector(data), frameIndex);
+        unsigned int cFrames = 0;
+        auto frames = ComposeOpenedGif(decoder, cFrames);
+        CheckComposedFrames(expected, frames, "saved index");
+        GIF_CHECK_EQUAL(cFramesExpected, cFrames);
+    }
+}
+
+GIF_TEST(decoder, DamagedIndexIsRejected)
+{
+    std::mt19937 random(23);
+    for (int i = 0; i < 20; i++)
+    {
+        auto data = WriteTestGif(MakeRandomTestGif(random, false));
+        auto serialized = SerializeFrameIndex(data);
+
+        for (size_t cb = 0; cb < serialized.size(); cb++)
+        {
+            CheckIndexRejected(data, std::vector<uint8_t>(serialized.begin(), serialized.begin() + cb), "truncated");
+        }
+
+        for (size_t off = 0; off < serialized.size(); off++)
+        {
+            auto corrupted = serialized;
+            corrupted[off] ^= static_cast<uint8_t>(1 + random() % 255);
+            CheckIndexRejected(data, corrupted, "corrupted");
+        }
+    }
+}
+
+GIF_TEST(decoder, IndexForOtherDataIsRejected)
+{
+    std::mt19937 random(24);
+    for (int i = 0; i < 200; i++)
+    {
+        auto spec = MakeRandomTestGif(random, false);
+        auto data = WriteTestGif(spec);
+        auto serialized = SerializeFrameIndex(data);
+
+        // The file with bytes added or taken off the end
+        auto longer = data;
+        longer.push_back(0x3B);
+        CheckIndexRejected(longer, serialized, "longer file");
+        CheckIndexRejected(std::vector<uint8_t>(data.begin(), data.end() - 1), serialized, "shorter file");
+
+        // Another file of the same size, with a frame moved within the canvas
+        auto& frame = spec.frames[random() % spec.frames.size()];
+        if (frame.rect.left > 0)
+        {
+            frame.rect.left--;
+            frame.rect.right--;
+        }
+        else
+        {
+            frame.rect.left++;
+            frame.rect.right++;
+        }
+        auto moved = WriteTestGif(spec);
+        GIF_CHECK_EQUAL(data.size(), moved.size());
+        CheckIndexRejected(moved, serialized, "frame moved");
+    }
+}
+
+GIF_TEST(decoder, ScaledFramesMatchBoxFilteredReference)
+{
+    // Frame rects are rounded to the nearest scaled pixel, which moves
+    // edges at odd offsets by up to half a scaled pixel, and a frame's
+    // pixels are stretched to fill its rounded rect, which moves what is
+    // inside it by up to a scaled pixel more.  The partly transparent edges
+    // of a frame also let through what earlier frames left under them.  So
+    // a scaled pixel matches the box filtered reference where the frames of
+    // the loop so far are all the same colour around it, and elsewhere is a
+    // mix of the colours they had around it.
+    const unsigned int cMargin = 1;     // Scaled pixels around each one that it may take colour from
+
+    std::mt19937 random(26);
+    for (int i = 0; i < 200; i++)
+    {
+        auto spec = MakeBlockTestGif(random);
+        auto data = WriteTestGif(spec);
+        auto reference = ComposeTestGifReference(spec);
+
+        const struct
+        {
+            unsigned int uNumerator;
+            unsigned int uDenominator;
+        } SCALES[] = { { 1, 2 }, { 1, 3 }, { 2, 3 } };
+
+        for (const auto& scale : SCALES)
+        {
+            auto cxScaled = spec.cx * scale.uNumerator / scale.uDenominator;
+            auto cyScaled = spec.cy * scale.uNumerator / scale.uDenominator;
+            auto decoder = std::make_shared<GifDecoder>();
+            decoder->SetTargetSize(cxScaled, cyScaled);
+            decoder->Open(data);
+            GifCompositor compositor(decoder, std::make_unique<CpuPixelBackend>());
+            GIF_CHECK_EQUAL(cxScaled, compositor.GetGlobalInfo().cxGifImage);
+            GIF_CHECK_EQUAL(cyScaled, compositor.GetGlobalInfo().cyGifImage);
+
+            // The full size pixels within cMargin scaled pixels of x
+            auto getSourceRange = [&](unsigned int x, unsigned int c, unsigned int cScaled, unsigned int& uFirst, unsigned int& uEnd)
+            {
+                uFirst = x > cMargin ? (x - cMargin) * c / cScaled : 0;
+                uEnd = std::min(((x + cMargin + 1) * c + cScaled - 1) / cScaled, c);
+            };
+
+            do
+            {
+                compositor.ComposeNextFrame();
+                auto frame = GetComposedTestFrame(compositor);
+                const auto& full = reference[frame.uFrameIndex];
+
+                for (unsigned int iChannel = 0; iChannel < 4; iChannel++)
+                {
+                    auto expected = BoxDownscale(full, spec.cx, spec.cy, cxScaled, cyScaled, iChannel);
+                    for (unsigned int y = 0; y < cyScaled; y++)
+                    {
+                        unsigned int vFirst, vEnd;
+                        getSourceRange(y, spec.cy, cyScaled, vFirst, vEnd);
+                        for (unsigned int x = 0; x < cxScaled; x++)
+                        {
+                            unsigned int uFirst, uEnd;
+                            getSourceRange(x, spec.cx, cxScaled, uFirst, uEnd);
+                            unsigned int uMin = 255, uMax = 0;
+                            for (unsigned int uFrameIndex = 0; uFrameIndex <= frame.uFrameIndex; uFrameIndex++)
+                            {
+                                for (unsigned int v = vFirst; v < vEnd; v++)
+                                {
+                                    for (unsigned int u = uFirst; u < uEnd; u++)
+                                    {
+                                        auto value = GetChannel(reference[uFrameIndex][static_cast<size_t>(v) * spec.cx + u], iChannel);
+                                        uMin = std::min(uMin, value);
+                                        uMax = std::max(uMax, value);
+                                    }
+                                }
+                            }
+
+                            // A rounding step either way, and the whole range
+                            // around an edge
+                            auto actual = static_cast<double>(GetChannel(frame.pixels[static_cast<size_t>(y) * cxScaled + x], iChannel));
+                            auto tolerance = 1. + (uMax - uMin);
+                            GIF_CHECK_MESSAGE(std::abs(actual - expected[static_cast<size_t>(y) * cxScaled + x]) <= tolerance &&
+                                actual + 1. >= uMin && actual <= uMax + 1.,
+                                "gif " << i << " scaled by " << scale.uNumerator << "/" << scale.uDenominator << ": frame "
+                                << frame.uFrameIndex << " pixel " << x << "," << y << " channel " << iChannel << " is " << actual
+                                << ", expected " << expected[static_cast<size_t>(y) * cxScaled + x] << " within " << uMin << "-" << uMax);
+                        }
+                    }
+                }
+            } while (!compositor.IsLastFrame());
+        }
+    }
+}
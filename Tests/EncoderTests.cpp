@@ -0,0 +1,192 @@
+// GifEncoder round trips: the composed frames of random gifs are encoded
+// and the output decoded through GifCompositor, which must give back every
+// frame as it went in.  Frames identical to the one before are merged by
+// the encoder, so they come back as one frame shown for their delays added
+// up.  Gifs whose frames draw local palettes of 256 colors over each other
+// compose to more than 256 colors per frame, which the encoder splits.
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "GifCompositor.h"
+#include "GifDecoder.h"
+#include "GifEncoder.h"
+#include "GifTest.h"
+#include "GifTestGifs.h"
+
+namespace
+{
+    struct EncodedTestFrame
+    {
+        std::vector<uint32_t>   pixels;
+        unsigned int            uDelay;     // ms
+    };
+
+    // One loop of the gif as displayed
+    std::vector<EncodedTestFrame> ComposeLoop(const std::vector<uint8_t>& data, GifGlobalInfo& globalInfo)
+    {
+        auto decoder = std::make_shared<GifDecoder>();
+        decoder->Open(data);
+        GifCompositor compositor(decoder, std::make_unique<CpuPixelBackend>());
+        globalInfo = compositor.GetGlobalInfo();
+
+        std::vector<EncodedTestFrame> frames;
+        do
+        {
+            compositor.ComposeNextFrame();
+            GifSurface surface = compositor.GetComposedFrame();
+            EncodedTestFrame frame = { {}, compositor.GetFrameDelay() };
+            for (unsigned int y = 0; y < surface.cy; y++)
+            {
+                frame.pixels.insert(frame.pixels.end(), surface.Row(y), surface.Row(y) + surface.cx);
+            }
+            frames.push_back(std::move(frame));
+        } while (!compositor.IsLastFrame());
+        return frames;
+    }
+
+    // Frames of up to 256 random colors each, mostly local ones, with
+    // transparent pixels and every disposal, so that the composed frames
+    // mix the colors of several of them.  Without a global color table the
+    // background is transparent.  Now and then a frame that is all
+    // transparent and leaves the canvas as it was.
+    GifTestSpec MakeManyColorTestGif(std::mt19937& random)
+    {
+        auto uniform = [&random](unsigned int uMin, unsigned int uMax)
+        {
+            return std::uniform_int_distribution<unsigned int>(uMin, uMax)(random);
+        };
+        auto makePalette = [&]()
+        {
+            std::vector<uint32_t> palette(256);
+            for (auto& color : palette)
+            {
+                color = random() & 0xFFFFFF;
+            }
+            return palette;
+        };
+
+        GifTestSpec spec = {};
+        spec.cx = uniform(16, 40);
+        spec.cy = uniform(16, 40);
+        if (uniform(0, 1) != 0)
+        {
+            spec.globalPalette = makePalette();
+        }
+        spec.fTrailer = true;
+
+        for (unsigned int i = uniform(2, 8); i > 0; i--)
+        {
+            GifTestFrame frame = {};
+            frame.rect.left = uniform(0, spec.cx / 2);
+            frame.rect.top = uniform(0, spec.cy / 2);
+            frame.rect.right = uniform(frame.rect.left + 1, spec.cx);
+            frame.rect.bottom = uniform(frame.rect.top + 1, spec.cy);
+            if (spec.globalPalette.empty() || uniform(0, 3) != 0)
+            {
+                frame.localPalette = makePalette();
+            }
+            frame.fTransparent = uniform(0, 1) != 0;
+            frame.transparentIndex = static_cast<uint8_t>(uniform(0, 255));
+
+            bool fEmpty = frame.fTransparent && uniform(0, 4) == 0;
+            frame.indices.resize(static_cast<size_t>(frame.rect.Width()) * frame.rect.Height());
+            for (auto& index : frame.indices)
+            {
+                index = fEmpty ? frame.transparentIndex : static_cast<uint8_t>(uniform(0, 255));
+            }
+
+            frame.uDelay = uniform(1, 5);
+            frame.uDisposal = fEmpty ? 0 : uniform(0, 3);
+            frame.fInterlaced = uniform(0, 3) == 0;
+            frame.cPixelsEncoded = frame.indices.size();
+            spec.frames.push_back(std::move(frame));
+        }
+        return spec;
+    }
+
+    // Encodes the composed frames of the gif, decodes the output and checks
+    // it against them with identical frames merged.  Returns the encoder's
+    // statistics, and counts the frames with transparent pixels.
+    GifEncoderStats CheckRoundTrip(const GifTestSpec& spec, unsigned int cThreads, unsigned int iGif, unsigned int& cTransparentFrames)
+    {
+        GifGlobalInfo globalInfo = {};
+        auto frames = ComposeLoop(WriteTestGif(spec), globalInfo);
+
+        GifEncoder encoder(globalInfo.cxGifImage, globalInfo.cyGifImage, cThreads);
+        std::vector<EncodedTestFrame> expected;
+        for (auto& frame : frames)
+        {
+            if (std::find(frame.pixels.begin(), frame.pixels.end(), 0u) != frame.pixels.end())
+            {
+                cTransparentFrames++;
+            }
+            encoder.AddFrame({ frame.pixels.data(), globalInfo.cxGifImage, globalInfo.cxGifImage, globalInfo.cyGifImage }, frame.uDelay);
+            if (!expected.empty() && expected.back().pixels == frame.pixels)
+            {
+                expected.back().uDelay += frame.uDelay;
+            }
+            else
+            {
+                expected.push_back(frame);
+            }
+        }
+        auto data = encoder.Finish();
+        const auto& stats = encoder.GetStats();
+        GIF_CHECK_EQUAL(static_cast<unsigned int>(frames.size()), stats.cFramesAdded);
+        GIF_CHECK_EQUAL(static_cast<unsigned int>(frames.size() - expected.size()), stats.cFramesMerged);
+        GIF_CHECK_EQUAL(data.size(), stats.cbOutput);
+
+        GifGlobalInfo decodedInfo = {};
+        auto decoded = ComposeLoop(data, decodedInfo);
+        GIF_CHECK_EQUAL(globalInfo.cxGifImage, decodedInfo.cxGifImage);
+        GIF_CHECK_EQUAL(globalInfo.cyGifImage, decodedInfo.cyGifImage);
+        GIF_CHECK_EQUAL(expected.size(), decoded.size());
+        for (size_t i = 0; i < expected.size(); i++)
+        {
+            GIF_CHECK_MESSAGE(expected[i].uDelay == decoded[i].uDelay,
+                "gif " << iGif << " frame " << i << " is shown for " << decoded[i].uDelay << " ms, expected " << expected[i].uDelay);
+            for (size_t iPixel = 0; iPixel < expected[i].pixels.size(); iPixel++)
+            {
+                GIF_CHECK_MESSAGE(expected[i].pixels[iPixel] == decoded[i].pixels[iPixel],
+                    "gif " << iGif << " frame " << i << " pixel " << iPixel << " is " << std::hex << decoded[i].pixels[iPixel]
+                    << ", expected " << expected[i].pixels[iPixel]);
+            }
+        }
+        return stats;
+    }
+}
+
+GIF_TEST(encoder, RandomGifsRoundTrip)
+{
+    std::mt19937 random(33);
+    unsigned int cMerged = 0;
+    unsigned int cTransparentFrames = 0;
+    for (unsigned int iGif = 0; iGif < 300; iGif++)
+    {
+        cMerged += CheckRoundTrip(MakeRandomTestGif(random, iGif % 2 != 0), 1 + iGif % 4, iGif, cTransparentFrames).cFramesMerged;
+    }
+
+    // Random gifs repeat frames often enough that the merging is tested
+    GIF_CHECK(cMerged > 0);
+    GIF_CHECK(cTransparentFrames > 0);
+}
+
+GIF_TEST(encoder, ManyColorGifsRoundTrip)
+{
+    std::mt19937 random(34);
+    unsigned int cSplit = 0;
+    unsigned int cMerged = 0;
+    unsigned int cTransparentFrames = 0;
+    for (unsigned int iGif = 0; iGif < 60; iGif++)
+    {
+        auto stats = CheckRoundTrip(MakeManyColorTestGif(random), 1 + iGif % 4, iGif, cTransparentFrames);
+        cSplit += stats.cFramesSplit;
+        cMerged += stats.cFramesMerged;
+    }
+    GIF_CHECK(cSplit > 0);
+    GIF_CHECK(cMerged > 0);
+    GIF_CHECK(cTransparentFrames > 0);
+}
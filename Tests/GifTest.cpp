@@ -0,0 +1,112 @@
+// gifcoretests: runs the GifCore tests registered with GIF_TEST.  With
+// arguments, only the tests whose names start with one of them.
+
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "GifTest.h"
+
+namespace
+{
+    struct GifTestCase
+    {
+        const char*     pszName;
+        GifTestFunction pfnTest;
+    };
+
+    // A function local static, so registrars in any translation unit can
+    // add to it during static initialization
+    std::vector<GifTestCase>& GetTestCases()
+    {
+        static std::vector<GifTestCase> testCases;
+        return testCases;
+    }
+
+    class GifTestFailure : public std::runtime_error
+    {
+    public:
+
+        explicit GifTestFailure(const std::string& message) :
+            std::runtime_error(message)
+        {
+        }
+    };
+
+    bool IsSelected(const char* pszName, int argc, char** argv)
+    {
+        if (argc < 2)
+        {
+            return true;
+        }
+        for (int i = 1; i < argc; i++)
+        {
+            if (std::strncmp(pszName, argv[i], std::strlen(argv[i])) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifTestRegistrar constructor                                   *
+*                                                                 *
+******************************************************************/
+
+GifTestRegistrar::GifTestRegistrar(const char* pszName, GifTestFunction pfnTest)
+{
+    GetTestCases().push_back({ pszName, pfnTest });
+}
+
+/******************************************************************
+*                                                                 *
+*  FailGifTest                                                    *
+*                                                                 *
+******************************************************************/
+
+void FailGifTest(const char* pszFile, int line, const std::string& message)
+{
+    throw GifTestFailure(std::string(pszFile) + ":" + std::to_string(line) + ": " + message);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int cRun = 0;
+    unsigned int cFailed = 0;
+
+    for (const auto& testCase : GetTestCases())
+    {
+        if (!IsSelected(testCase.pszName, argc, argv))
+        {
+            continue;
+        }
+
+        cRun++;
+        try
+        {
+            testCase.pfnTest();
+            std::printf("[ passed ] %s\n", testCase.pszName);
+        }
+        catch (const GifTestFailure& e)
+        {
+            cFailed++;
+            std::printf("[ FAILED ] %s\n  %s\n", testCase.pszName, e.what());
+        }
+        catch (const std::exception& e)
+        {
+            cFailed++;
+            std::printf("[ FAILED ] %s\n  threw %s\n", testCase.pszName, e.what());
+        }
+    }
+
+    std::printf("%u tests, %u failed\n", cRun, cFailed);
+
+    // Selecting nothing is a mistake in the ctest setup, not a pass
+    return (cFailed == 0 && cRun > 0) ? 0 : 1;
+}
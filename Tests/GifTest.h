@@ -0,0 +1,67 @@
+#pragma once
+
+#include <sstream>
+#include <string>
+
+/******************************************************************
+*                                                                 *
+*  GifTest                                                        *
+*                                                                 *
+*  A small test harness, so the tests build wherever GifCore does *
+*  without a test framework.  GIF_TEST registers a test named     *
+*  group/name; gifcoretests runs the tests whose names start with *
+*  its arguments, and ctest runs it once per group.  A failed     *
+*  check throws, ending the test, and the run carries on with the *
+*  next one.                                                      *
+*                                                                 *
+******************************************************************/
+
+using GifTestFunction = void (*)();
+
+struct GifTestRegistrar
+{
+    GifTestRegistrar(const char* pszName, GifTestFunction pfnTest);
+};
+
+// Throws the failure that ends the running test
+[[noreturn]] void FailGifTest(const char* pszFile, int line, const std::string& message);
+
+#define GIF_TEST(group, name) \
+    static void GifTest_##group##_##name(); \
+    static GifTestRegistrar s_gifTestRegistrar_##group##_##name(#group "/" #name, GifTest_##group##_##name); \
+    static void GifTest_##group##_##name()
+
+#define GIF_CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            FailGifTest(__FILE__, __LINE__, "GIF_CHECK(" #condition ") failed"); \
+        } \
+    } while (0)
+
+#define GIF_CHECK_EQUAL(expected, actual) \
+    do \
+    { \
+        const auto& gifTestExpected = (expected); \
+        const auto& gifTestActual = (actual); \
+        if (!(gifTestExpected == gifTestActual)) \
+        { \
+            std::ostringstream gifTestMessage; \
+            gifTestMessage << #actual " is " << gifTestActual << ", expected " << gifTestExpected; \
+            FailGifTest(__FILE__, __LINE__, gifTestMessage.str()); \
+        } \
+    } while (0)
+
+// Fails with message unless condition holds, for checks in loops that need
+// to say which frame or pixel was wrong
+#define GIF_CHECK_MESSAGE(condition, message) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            std::ostringstream gifTestMessage; \
+            gifTestMessage << message; \
+            FailGifTest(__FILE__, __LINE__, gifTestMessage.str()); \
+        } \
+    } while (0)
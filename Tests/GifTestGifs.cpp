@@ -0,0 +1,328 @@
+#include "GifTestGifs.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "GifLzwEncoder.h"
+
+namespace
+{
+    void AppendUInt16(std::vector<uint8_t>& data, unsigned int value)
+    {
+        data.push_back(static_cast<uint8_t>(value));
+        data.push_back(static_cast<uint8_t>(value >> 8));
+    }
+
+    // Bits per index for cColors colors, as the color table size field and
+    // the LZW minimum code size need it: at least 1
+    unsigned int GetIndexBits(size_t cColors)
+    {
+        unsigned int cBits = 1;
+        while ((1u << cBits) < cColors)
+        {
+            cBits++;
+        }
+        return cBits;
+    }
+
+    // Writes the palette padded to 1 << cBits colors
+    void AppendPalette(std::vector<uint8_t>& data, const std::vector<uint32_t>& palette, unsigned int cBits)
+    {
+        for (unsigned int i = 0; i < (1u << cBits); i++)
+        {
+            uint32_t color = i < palette.size() ? palette[i] : 0;
+            data.push_back(static_cast<uint8_t>(color >> 16));
+            data.push_back(static_cast<uint8_t>(color >> 8));
+            data.push_back(static_cast<uint8_t>(color));
+        }
+    }
+
+    // Image rows in the order the file stores them
+    std::vector<unsigned int> GetStoredRows(unsigned int cy, bool fInterlaced)
+    {
+        std::vector<unsigned int> rows;
+        if (!fInterlaced)
+        {
+            for (unsigned int y = 0; y < cy; y++)
+            {
+                rows.push_back(y);
+            }
+            return rows;
+        }
+
+        const unsigned int PASS_START[4] = { 0, 4, 2, 1 };
+        const unsigned int PASS_STEP[4] = { 8, 8, 4, 2 };
+        for (int pass = 0; pass < 4; pass++)
+        {
+            for (unsigned int y = PASS_START[pass]; y < cy; y += PASS_STEP[pass])
+            {
+                rows.push_back(y);
+            }
+        }
+        return rows;
+    }
+
+    uint32_t GetBackgroundColor(const GifTestSpec& spec)
+    {
+        if (spec.backgroundIndex < spec.globalPalette.size())
+        {
+            return 0xFF000000 | spec.globalPalette[spec.backgroundIndex];
+        }
+        if (!spec.globalPalette.empty() && spec.backgroundIndex < (1u << GetIndexBits(spec.globalPalette.size())))
+        {
+            // Padding of the global table
+            return 0xFF000000;
+        }
+        return 0;
+    }
+
+    void FillRect(std::vector<uint32_t>& canvas, const GifTestSpec& spec, const GifRect& rect, uint32_t color)
+    {
+        for (unsigned int y = rect.top; y < rect.bottom && y < spec.cy; y++)
+        {
+            for (unsigned int x = rect.left; x < rect.right && x < spec.cx; x++)
+            {
+                canvas[static_cast<size_t>(y) * spec.cx + x] = color;
+            }
+        }
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  MakeSolidTestFrame                                             *
+*                                                                 *
+******************************************************************/
+
+GifTestFrame MakeSolidTestFrame(const GifRect& rect, uint8_t index, unsigned int uDelay, unsigned int uDisposal)
+{
+    GifTestFrame frame = {};
+    frame.rect = rect;
+    frame.indices.assign(static_cast<size_t>(rect.Width()) * rect.Height(), index);
+    frame.uDelay = uDelay;
+    frame.uDisposal = uDisposal;
+    frame.cPixelsEncoded = frame.indices.size();
+    return frame;
+}
+
+/******************************************************************
+*                                                                 *
+*  WriteTestGif                                                   *
+*                                                                 *
+******************************************************************/
+
+std::vector<uint8_t> WriteTestGif(const GifTestSpec& spec)
+{
+    std::vector<uint8_t> data;
+    const uint8_t HEADER[] = { 'G', 'I', 'F', '8', '9', 'a' };
+    data.insert(data.end(), HEADER, HEADER + sizeof(HEADER));
+    AppendUInt16(data, spec.cx);
+    AppendUInt16(data, spec.cy);
+
+    unsigned int cGlobalBits = GetIndexBits(spec.globalPalette.size());
+    data.push_back(static_cast<uint8_t>(spec.globalPalette.empty() ? 0 : 0x80 | (cGlobalBits - 1)));
+    data.push_back(spec.backgroundIndex);
+    data.push_back(0);
+    if (!spec.globalPalette.empty())
+    {
+        AppendPalette(data, spec.globalPalette, cGlobalBits);
+    }
+
+    const uint8_t LOOP_EXTENSION[] = { 0x21, 0xFF, 0x0B, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0', 0x03, 0x01, 0x00, 0x00, 0x00 };
+    data.insert(data.end(), LOOP_EXTENSION, LOOP_EXTENSION + sizeof(LOOP_EXTENSION));
+
+    GifLzwEncoder encoder;
+    std::vector<uint8_t> stored;
+    for (const auto& frame : spec.frames)
+    {
+        const unsigned int cx = frame.rect.Width();
+        const unsigned int cy = frame.rect.Height();
+        if (frame.indices.size() != static_cast<size_t>(cx) * cy || frame.cPixelsEncoded > frame.indices.size())
+        {
+            throw std::invalid_argument("The indices do not match the frame rect");
+        }
+
+        data.push_back(0x21);
+        data.push_back(0xF9);
+        data.push_back(4);
+        data.push_back(static_cast<uint8_t>((frame.uDisposal << 2) | (frame.fTransparent ? 1 : 0)));
+        AppendUInt16(data, frame.uDelay);
+        data.push_back(frame.transparentIndex);
+        data.push_back(0);
+
+        data.push_back(0x2C);
+        AppendUInt16(data, frame.rect.left);
+        AppendUInt16(data, frame.rect.top);
+        AppendUInt16(data, cx);
+        AppendUInt16(data, cy);
+
+        // Enough bits for the palette and for every index used
+        size_t cColors = frame.localPalette.empty() ? spec.globalPalette.size() : frame.localPalette.size();
+        uint8_t maxIndex = frame.indices.empty() ? 0 : *std::max_element(frame.indices.begin(), frame.indices.end());
+        cColors = std::max<size_t>(cColors, static_cast<size_t>(maxIndex) + 1);
+        unsigned int cBits = GetIndexBits(cColors);
+
+        uint8_t flags = frame.fInterlaced ? 0x40 : 0;
+        if (!frame.localPalette.empty())
+        {
+            flags |= static_cast<uint8_t>(0x80 | (cBits - 1));
+        }
+        data.push_back(flags);
+        if (!frame.localPalette.empty())
+        {
+            AppendPalette(data, frame.localPalette, cBits);
+        }
+
+        stored.clear();
+        for (auto y : GetStoredRows(cy, frame.fInterlaced))
+        {
+            stored.insert(stored.end(), frame.indices.begin() + static_cast<size_t>(y) * cx, frame.indices.begin() + static_cast<size_t>(y + 1) * cx);
+        }
+        encoder.Encode(stored.data(), frame.cPixelsEncoded, std::max(2u, cBits), data);
+    }
+
+    if (spec.fTrailer)
+    {
+        data.push_back(0x3B);
+    }
+    return data;
+}
+
+/******************************************************************
+*                                                                 *
+*  ComposeTestGifReference                                        *
+*                                                                 *
+******************************************************************/
+
+std::vector<std::vector<uint32_t>> ComposeTestGifReference(const GifTestSpec& spec)
+{
+    const uint32_t background = GetBackgroundColor(spec);
+    std::vector<uint32_t> canvas(static_cast<size_t>(spec.cx) * spec.cy, background);
+    std::vector<uint32_t> saved;
+    std::vector<std::vector<uint32_t>> composed;
+
+    const GifTestFrame* pPrevious = nullptr;
+    for (const auto& frame : spec.frames)
+    {
+        if (pPrevious != nullptr && pPrevious->uDisposal == GIF_DM_BACKGROUND)
+        {
+            FillRect(canvas, spec, pPrevious->rect, background);
+        }
+        else if (pPrevious != nullptr && pPrevious->uDisposal == GIF_DM_PREVIOUS)
+        {
+            canvas = saved;
+        }
+
+        if (frame.uDisposal == GIF_DM_PREVIOUS)
+        {
+            saved = canvas;
+        }
+
+        const auto& palette = frame.localPalette.empty() ? spec.globalPalette : frame.localPalette;
+        const unsigned int cx = frame.rect.Width();
+        auto rows = GetStoredRows(frame.rect.Height(), frame.fInterlaced);
+        for (size_t i = 0; i < frame.cPixelsEncoded; i++)
+        {
+            unsigned int xImage = static_cast<unsigned int>(i % cx);
+            unsigned int yImage = rows[i / cx];
+            unsigned int x = frame.rect.left + xImage;
+            unsigned int y = frame.rect.top + yImage;
+            uint8_t index = frame.indices[static_cast<size_t>(yImage) * cx + xImage];
+            if (x >= spec.cx || y >= spec.cy || (frame.fTransparent && index == frame.transparentIndex))
+            {
+                continue;
+            }
+            canvas[static_cast<size_t>(y) * spec.cx + x] = 0xFF000000 | (index < palette.size() ? palette[index] : 0);
+        }
+
+        composed.push_back(canvas);
+        pPrevious = &frame;
+    }
+    return composed;
+}
+
+/******************************************************************
+*                                                                 *
+*  MakeRandomTestGif                                              *
+*                                                                 *
+******************************************************************/
+
+GifTestSpec MakeRandomTestGif(std::mt19937& random, bool fTruncate)
+{
+    auto uniform = [&random](unsigned int uMin, unsigned int uMax)
+    {
+        return std::uniform_int_distribution<unsigned int>(uMin, uMax)(random);
+    };
+    auto makePalette = [&](unsigned int cColors)
+    {
+        std::vector<uint32_t> palette(cColors);
+        for (auto& color : palette)
+        {
+            color = random() & 0xFFFFFF;
+        }
+        return palette;
+    };
+
+    GifTestSpec spec = {};
+    spec.cx = uniform(1, 16);
+    spec.cy = uniform(1, 16);
+    if (uniform(0, 7) != 0)
+    {
+        spec.globalPalette = makePalette(uniform(2, 16));
+    }
+    spec.backgroundIndex = static_cast<uint8_t>(uniform(0, 17));
+    spec.fTrailer = uniform(0, 3) != 0;
+
+    unsigned int cFrames = uniform(1, 10);
+    for (unsigned int i = 0; i < cFrames; i++)
+    {
+        GifTestFrame frame = {};
+
+        // Mostly within the screen, sometimes the whole screen, sometimes
+        // hanging over its right or bottom edge
+        switch (uniform(0, 3))
+        {
+        case 0:
+            frame.rect = { 0, 0, spec.cx, spec.cy };
+            break;
+        case 1:
+            frame.rect.left = uniform(0, spec.cx + 2);
+            frame.rect.top = uniform(0, spec.cy + 2);
+            frame.rect.right = frame.rect.left + uniform(1, 8);
+            frame.rect.bottom = frame.rect.top + uniform(1, 8);
+            break;
+        default:
+            frame.rect.left = uniform(0, spec.cx - 1);
+            frame.rect.top = uniform(0, spec.cy - 1);
+            frame.rect.right = uniform(frame.rect.left + 1, spec.cx);
+            frame.rect.bottom = uniform(frame.rect.top + 1, spec.cy);
+            break;
+        }
+
+        if (spec.globalPalette.empty() || uniform(0, 3) == 0)
+        {
+            frame.localPalette = makePalette(uniform(2, 16));
+        }
+        unsigned int cColors = static_cast<unsigned int>(frame.localPalette.empty() ? spec.globalPalette.size() : frame.localPalette.size());
+
+        frame.indices.resize(static_cast<size_t>(frame.rect.Width()) * frame.rect.Height());
+        for (auto& index : frame.indices)
+        {
+            // Now and then an index past the end of the palette
+            index = static_cast<uint8_t>(uniform(0, 15) == 0 ? uniform(0, 15) : uniform(0, cColors - 1));
+        }
+
+        frame.uDelay = uniform(0, 2) == 0 ? 0 : uniform(1, 5);
+        frame.uDisposal = uniform(0, 3);
+        frame.fTransparent = uniform(0, 1) != 0;
+        frame.transparentIndex = static_cast<uint8_t>(uniform(0, cColors - 1));
+        frame.fInterlaced = uniform(0, 3) == 0;
+        frame.cPixelsEncoded = frame.indices.size();
+        if (fTruncate && uniform(0, 3) == 0)
+        {
+            frame.cPixelsEncoded = uniform(0, static_cast<unsigned int>(frame.indices.size()));
+        }
+        spec.frames.push_back(std::move(frame));
+    }
+    return spec;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "GifTypes.h"
+
+// A frame of a test gif, as written to the file
+struct GifTestFrame
+{
+    GifRect                 rect;               // As in the image descriptor, so it may overhang the logical screen
+    std::vector<uint8_t>    indices;            // rect.Width() * rect.Height(), top row first
+    std::vector<uint32_t>   localPalette;       // 0xRRGGBB, empty to use the global palette
+    unsigned int            uDelay;             // In 10 ms units
+    unsigned int            uDisposal;
+    bool                    fTransparent;
+    uint8_t                 transparentIndex;
+    bool                    fInterlaced;
+    size_t                  cPixelsEncoded;     // Pixels of the image data, in the order they are stored; fewer than indices.size() for data that ends early
+};
+
+struct GifTestSpec
+{
+    unsigned int                cx;
+    unsigned int                cy;
+    std::vector<uint32_t>       globalPalette;  // 0xRRGGBB, empty for no global color table
+    uint8_t                     backgroundIndex;
+    bool                        fTrailer;
+    std::vector<GifTestFrame>   frames;
+};
+
+// A frame covering rect with every pixel set to index, shown for uDelay
+GifTestFrame MakeSolidTestFrame(const GifRect& rect, uint8_t index, unsigned int uDelay, unsigned int uDisposal);
+
+// Writes spec as a GIF89a that loops forever.  Palettes are padded to a
+// power of two with black.
+std::vector<uint8_t> WriteTestGif(const GifTestSpec& spec);
+
+// Composes spec one frame at a time the simplest way there is, pixel by
+// pixel from the indices the spec holds, and returns the canvas after each
+// frame, as PBGRA.  Shares no code with the decoder or compositor.
+std::vector<std::vector<uint32_t>> ComposeTestGifReference(const GifTestSpec& spec);
+
+// A small gif with random frame rects (some overhanging the screen),
+// disposals, delays (some 0), palettes, transparency and interlacing.
+// With fTruncate, some frames' image data ends early.
+GifTestSpec MakeRandomTestGif(std::mt19937& random, bool fTruncate);
@@ -0,0 +1,170 @@
+// Every vectorized kernel set this CPU supports against the scalar
+// reference, on random PBGRA palettes and widths and alignments that leave
+// both a vector body and a scalar tail
+
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "GifKernels.h"
+#include "GifTest.h"
+#include "GifTypes.h"
+
+namespace
+{
+    const char* const ISA_NAMES[] = { "scalar", "sse2", "avx2", "neon" };
+
+    // Widths that hit the vector tails of every kernel, plus a few long rows
+    const unsigned int WIDTHS[] = { 0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 100, 257, 1023 };
+
+    // Starting element offsets into the buffers, so the pointers are not
+    // always vector aligned
+    const unsigned int MAX_OFFSET = 9;
+
+    std::vector<const GifKernels*> GetVectorKernels()
+    {
+        std::vector<const GifKernels*> kernels;
+        for (auto isa : { GKI_SSE2, GKI_AVX2, GKI_NEON })
+        {
+            if (auto pKernels = GetGifKernelsForIsa(isa))
+            {
+                printf("  testing %s\n", ISA_NAMES[isa]);
+                kernels.push_back(pKernels);
+            }
+        }
+        return kernels;
+    }
+
+    void FillRandomPalette(std::mt19937& random, uint32_t* pPalette)
+    {
+        for (unsigned int i = 0; i < 256; i++)
+        {
+            pPalette[i] = PremultiplyArgb(random());
+        }
+    }
+
+    void FillRandomPixels(std::mt19937& random, std::vector<uint32_t>& pixels)
+    {
+        for (auto& pixel : pixels)
+        {
+            pixel = PremultiplyArgb(random());
+        }
+    }
+
+    // Indices mostly from a few colors, so the transparent index shows up
+    // in runs as well as alone
+    void FillRandomIndices(std::mt19937& random, std::vector<uint8_t>& indices)
+    {
+        unsigned int cColors = 1u << (random() % 9);
+        for (auto& index : indices)
+        {
+            index = static_cast<uint8_t>(random() % cColors);
+        }
+    }
+}
+
+GIF_TEST(kernels, ScalarIsSelectable)
+{
+    auto pScalar = GetGifKernelsForIsa(GKI_SCALAR);
+    GIF_CHECK(pScalar != nullptr);
+    GIF_CHECK_EQUAL(GKI_SCALAR, pScalar->isa);
+    GIF_CHECK(GetGifKernelsForIsa(GetGifKernels().isa) == &GetGifKernels());
+}
+
+GIF_TEST(kernels, VectorKernelsAreCompiledIn)
+{
+    // So that a build that lost its vector kernels does not pass by
+    // comparing nothing
+#if defined(__aarch64__) || defined(_M_ARM64)
+    GIF_CHECK(GetGifKernelsForIsa(GKI_NEON) != nullptr);
+#elif defined(__x86_64__) || defined(_M_X64)
+    GIF_CHECK(GetGifKernelsForIsa(GKI_SSE2) != nullptr);
+#endif
+}
+
+GIF_TEST(kernels, ExpandIndicesMatchesScalar)
+{
+    const auto& scalar = *GetGifKernelsForIsa(GKI_SCALAR);
+    std::mt19937 random(4);
+    uint32_t palette[256];
+
+    for (auto pKernels : GetVectorKernels())
+    {
+        for (auto cPixels : WIDTHS)
+        {
+            for (unsigned int offDest = 0; offDest < MAX_OFFSET; offDest++)
+            {
+                unsigned int offIndices = random() % MAX_OFFSET;
+                FillRandomPalette(random, palette);
+                std::vector<uint8_t> indices(cPixels + MAX_OFFSET);
+                FillRandomIndices(random, indices);
+
+                // Guard pixels around the row must survive
+                std::vector<uint32_t> expected(cPixels + 2 * MAX_OFFSET);
+                FillRandomPixels(random, expected);
+                auto actual = expected;
+
+                scalar.ExpandIndices(expected.data() + offDest, indices.data() + offIndices, cPixels, palette);
+                pKernels->ExpandIndices(actual.data() + offDest, indices.data() + offIndices, cPixels, palette);
+                GIF_CHECK_MESSAGE(actual == expected,
+                    ISA_NAMES[pKernels->isa] << " ExpandIndices differs at width " << cPixels << ", offsets " << offDest << "/" << offIndices);
+            }
+        }
+    }
+}
+
+GIF_TEST(kernels, ExpandIndicesMaskedMatchesScalar)
+{
+    const auto& scalar = *GetGifKernelsForIsa(GKI_SCALAR);
+    std::mt19937 random(5);
+    uint32_t palette[256];
+
+    for (auto pKernels : GetVectorKernels())
+    {
+        for (auto cPixels : WIDTHS)
+        {
+            for (unsigned int offDest = 0; offDest < MAX_OFFSET; offDest++)
+            {
+                unsigned int offIndices = random() % MAX_OFFSET;
+                FillRandomPalette(random, palette);
+                std::vector<uint8_t> indices(cPixels + MAX_OFFSET);
+                FillRandomIndices(random, indices);
+                auto transparentIndex = indices.empty() ? 0 : indices[random() % indices.size()];
+
+                std::vector<uint32_t> expected(cPixels + 2 * MAX_OFFSET);
+                FillRandomPixels(random, expected);
+                auto actual = expected;
+
+                scalar.ExpandIndicesMasked(expected.data() + offDest, indices.data() + offIndices, cPixels, palette, transparentIndex);
+                pKernels->ExpandIndicesMasked(actual.data() + offDest, indices.data() + offIndices, cPixels, palette, transparentIndex);
+                GIF_CHECK_MESSAGE(actual == expected,
+                    ISA_NAMES[pKernels->isa] << " ExpandIndicesMasked differs at width " << cPixels << ", offsets " << offDest << "/" << offIndices);
+            }
+        }
+    }
+}
+
+GIF_TEST(kernels, FillPixelsMatchesScalar)
+{
+    const auto& scalar = *GetGifKernelsForIsa(GKI_SCALAR);
+    std::mt19937 random(6);
+
+    for (auto pKernels : GetVectorKernels())
+    {
+        for (auto cPixels : WIDTHS)
+        {
+            for (unsigned int offDest = 0; offDest < MAX_OFFSET; offDest++)
+            {
+                uint32_t color = PremultiplyArgb(random());
+                std::vector<uint32_t> expected(cPixels + 2 * MAX_OFFSET);
+                FillRandomPixels(random, expected);
+                auto actual = expected;
+
+                scalar.FillPixels(expected.data() + offDest, cPixels, color);
+                pKernels->FillPixels(actual.data() + offDest, cPixels, color);
+                GIF_CHECK_MESSAGE(actual == expected,
+                    ISA_NAMES[pKernels->isa] << " FillPixels differs at width " << cPixels << ", offset " << offDest);
+            }
+        }
+    }
+}
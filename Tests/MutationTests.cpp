@@ -0,0 +1,242 @@
+// Damaged gifs: random gifs with bytes flipped, inserted, deleted, copied
+// and cut off, opened and played every way a player can.  A damaged gif
+// may fail to open or to decode with std::runtime_error, but must not
+// crash, read outside its data or throw anything else.  The mutations are
+// seeded, so a failure repeats; built with sanitizers this finds what a
+// fuzzer would on the same inputs.
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "GifByteSource.h"
+#include "GifCompositor.h"
+#include "GifDecoder.h"
+#include "GifParallelDecoder.h"
+#include "GifTest.h"
+#include "GifTestGifs.h"
+
+namespace
+{
+    // A damaged header can ask for a canvas of up to GIF_MAX_CANVAS_PIXELS,
+    // which is valid but too slow to compose thousands of times
+    const uint64_t MAX_TEST_CANVAS_PIXELS = 1u << 16;
+
+    // Frames composed per way of playing, enough for two loops of any
+    // random gif
+    const unsigned int MAX_COMPOSED_FRAMES = 24;
+
+    enum MUTATION
+    {
+        M_FLIP_BITS,
+        M_SET_BYTES,
+        M_INSERT,
+        M_DELETE,
+        M_COPY_RANGE,
+        M_TRUNCATE,
+
+        M_COUNT
+    };
+
+    std::vector<uint8_t> Mutate(std::vector<uint8_t> data, std::mt19937& random)
+    {
+        auto randomOffset = [&](size_t cbExtra)
+        {
+            return static_cast<size_t>(random() % (data.size() + cbExtra));
+        };
+
+        switch (random() % M_COUNT)
+        {
+        case M_FLIP_BITS:
+            for (unsigned int i = 1 + random() % 4; i > 0; i--)
+            {
+                data[randomOffset(0)] ^= static_cast<uint8_t>(1u << (random() % 8));
+            }
+            break;
+
+        case M_SET_BYTES:
+        {
+            // Bytes that end blocks, fill them or stand for the largest size
+            const uint8_t INTERESTING[] = { 0x00, 0x01, 0x21, 0x2C, 0x3B, 0x7F, 0x80, 0xFF };
+            for (unsigned int i = 1 + random() % 4; i > 0; i--)
+            {
+                data[randomOffset(0)] = INTERESTING[random() % sizeof(INTERESTING)];
+            }
+            break;
+        }
+
+        case M_INSERT:
+        {
+            auto off = randomOffset(1);
+            std::vector<uint8_t> inserted(1 + random() % 16);
+            for (auto& b : inserted)
+            {
+                b = static_cast<uint8_t>(random());
+            }
+            data.insert(data.begin() + off, inserted.begin(), inserted.end());
+            break;
+        }
+
+        case M_DELETE:
+        {
+            auto off = randomOffset(0);
+            auto cb = std::min<size_t>(1 + random() % 16, data.size() - off);
+            data.erase(data.begin() + off, data.begin() + off + cb);
+            break;
+        }
+
+        case M_COPY_RANGE:
+        {
+            // Repeats a run of blocks, or part of one, elsewhere in the file
+            auto offFrom = randomOffset(0);
+            auto cb = std::min<size_t>(1 + random() % 64, data.size() - offFrom);
+            std::vector<uint8_t> copied(data.begin() + offFrom, data.begin() + offFrom + cb);
+            auto offTo = randomOffset(1);
+            data.insert(data.begin() + offTo, copied.begin(), copied.end());
+            break;
+        }
+
+        case M_TRUNCATE:
+            data.resize(randomOffset(0));
+            break;
+        }
+        return data;
+    }
+
+    bool IsCanvasTestable(IGifFrameSource& source)
+    {
+        GifGlobalInfo globalInfo = {};
+        source.GetGlobalInfo(globalInfo);
+        return static_cast<uint64_t>(globalInfo.cxGifImage) * globalInfo.cyGifImage <= MAX_TEST_CANVAS_PIXELS;
+    }
+
+    // Composes while frames are ready, then seeks to a random frame and
+    // composes on from there
+    void Play(std::shared_ptr<IGifFrameSource> source, std::mt19937& random)
+    {
+        GifCompositor compositor(std::move(source), std::make_unique<CpuPixelBackend>());
+        compositor.Reset();
+        for (unsigned int i = 0; i < MAX_COMPOSED_FRAMES && compositor.IsNextFrameReady(); i++)
+        {
+            compositor.ComposeNextFrame();
+        }
+
+        auto cFrames = compositor.GetGlobalInfo().cFrames;
+        if (cFrames != 0)
+        {
+            compositor.SeekToFrame(random() % cFrames);
+            if (compositor.IsNextFrameReady())
+            {
+                compositor.ComposeNextFrame();
+            }
+        }
+    }
+
+    void PlayDecoded(const std::vector<uint8_t>& data, GIF_OPEN_MODE openMode, bool fScaled, std::mt19937& random)
+    {
+        auto decoder = std::make_shared<GifDecoder>();
+        decoder->SetOpenMode(openMode);
+        if (fScaled)
+        {
+            decoder->SetTargetSize(1 + random() % 8, 1 + random() % 8);
+        }
+        decoder->Open(data);
+        if (IsCanvasTestable(*decoder))
+        {
+            Play(decoder, random);
+        }
+    }
+
+    void PlayParallel(const std::vector<uint8_t>& data, std::mt19937& random)
+    {
+        auto decoder = std::make_shared<GifParallelDecoder>(GifByteSource::FromVector(data), 2);
+        if (IsCanvasTestable(*decoder))
+        {
+            Play(decoder, random);
+        }
+    }
+
+    // Streams the data in random chunks, composing each frame once it is
+    // ready, and plays the ended stream on
+    void PlayStreamed(const std::vector<uint8_t>& data, std::mt19937& random)
+    {
+        auto decoder = std::make_shared<GifDecoder>();
+        decoder->OpenStream();
+
+        size_t off = 0;
+        std::unique_ptr<GifCompositor> compositor;
+        while (off < data.size())
+        {
+            auto cb = std::min<size_t>(1 + random() % 32, data.size() - off);
+            decoder->AppendBytes(data.data() + off, cb);
+            off += cb;
+
+            if (!compositor && decoder->IsHeaderReady())
+            {
+                if (!IsCanvasTestable(*decoder))
+                {
+                    return;
+                }
+                compositor = std::make_unique<GifCompositor>(decoder, std::make_unique<CpuPixelBackend>());
+            }
+            if (compositor && compositor->IsNextFrameReady())
+            {
+                compositor->ComposeNextFrame();
+            }
+        }
+
+        decoder->EndStream();
+        if (compositor)
+        {
+            for (unsigned int i = 0; i < MAX_COMPOSED_FRAMES && compositor->IsNextFrameReady(); i++)
+            {
+                compositor->ComposeNextFrame();
+            }
+        }
+        else
+        {
+            // Throws as the header never arrived
+            GifGlobalInfo globalInfo = {};
+            decoder->GetGlobalInfo(globalInfo);
+        }
+    }
+
+    // Runs one way of playing a damaged gif, which may reject it
+    template <typename TPlay>
+    void PlayDamaged(TPlay play)
+    {
+        try
+        {
+            play();
+        }
+        catch (const std::runtime_error&)
+        {
+        }
+    }
+}
+
+GIF_TEST(mutation, DamagedGifsFailCleanly)
+{
+    std::mt19937 random(25);
+    for (int iGif = 0; iGif < 100; iGif++)
+    {
+        auto data = WriteTestGif(MakeRandomTestGif(random, iGif % 2 != 0));
+        for (int iMutant = 0; iMutant < 30; iMutant++)
+        {
+            // Later mutants pile damage on earlier ones
+            auto mutant = Mutate(data, random);
+            if (iMutant % 3 != 0 && !mutant.empty())
+            {
+                mutant = Mutate(mutant, random);
+            }
+
+            PlayDamaged([&]() { PlayDecoded(mutant, GOM_FULL, false, random); });
+            PlayDamaged([&]() { PlayDecoded(mutant, GOM_LAZY, false, random); });
+            PlayDamaged([&]() { PlayDecoded(mutant, GOM_FULL, true, random); });
+            PlayDamaged([&]() { PlayParallel(mutant, random); });
+            PlayDamaged([&]() { PlayStreamed(mutant, random); });
+        }
+    }
+}
@@ -0,0 +1,159 @@
+// GifFramePipeline composing random gifs ahead on its worker while the
+// presenter restarts it and changes the frame cache mode between frames.
+// Every frame must come in the order a compositor of its own shows them,
+// hold the frame ComposeTestGifReference draws, and only differ from the
+// frame before it within its dirty rect.  Destroying a pipeline must stop
+// its worker cleanly however many frames it has queued.
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "GifCompositor.h"
+#include "GifDecoder.h"
+#include "GifFramePipeline.h"
+#include "GifTest.h"
+#include "GifTestGifs.h"
+
+namespace
+{
+    const FRAME_CACHE_MODE TEST_CACHE_MODES[] = { FCM_OFF, FCM_KEYFRAME, FCM_FULL };
+
+    // Budgets that cache every frame of a random gif and only a few of them
+    const size_t TEST_CACHE_BUDGETS[] = { DEFAULT_FRAME_CACHE_BUDGET, 4096 };
+
+    std::unique_ptr<GifCompositor> MakeTestCompositor(const std::vector<uint8_t>& data)
+    {
+        auto decoder = std::make_shared<GifDecoder>();
+        decoder->Open(data);
+        return std::make_unique<GifCompositor>(decoder, std::make_unique<CpuPixelBackend>());
+    }
+
+    // The raw frames a compositor of its own displays in one loop, with the
+    // zero delay frames folded into the frames after them
+    std::vector<unsigned int> GetDisplayedFrames(const std::vector<uint8_t>& data)
+    {
+        auto compositor = MakeTestCompositor(data);
+        std::vector<unsigned int> displayed;
+        do
+        {
+            compositor->ComposeNextFrame();
+            unsigned int uNext = compositor->GetNextFrameIndex();
+            displayed.push_back((uNext == 0 ? compositor->GetGlobalInfo().cFrames : uNext) - 1);
+        } while (!compositor->IsLastFrame());
+        return displayed;
+    }
+
+    void CheckPipelineFrame(const GifPipelineFrame& frame, unsigned int uFrameIndex, const std::vector<uint32_t>& expected,
+        const std::vector<uint32_t>* pPrevious, unsigned int iFrame)
+    {
+        const auto& composedFrame = frame.composedFrame;
+        GIF_CHECK_EQUAL(expected.size(), static_cast<size_t>(composedFrame.Width()) * composedFrame.Height());
+        auto pPixels = composedFrame.Pixels();
+        for (unsigned int y = 0; y < composedFrame.Height(); y++)
+        {
+            for (unsigned int x = 0; x < composedFrame.Width(); x++)
+            {
+                size_t i = static_cast<size_t>(y) * composedFrame.Width() + x;
+                GIF_CHECK_MESSAGE(pPixels[i] == expected[i],
+                    "frame " << iFrame << " (raw frame " << uFrameIndex << ") pixel " << x << "," << y
+                    << " is " << std::hex << pPixels[i] << ", expected " << expected[i]);
+
+                bool fDirty = x >= frame.dirtyRect.left && x < frame.dirtyRect.right && y >= frame.dirtyRect.top && y < frame.dirtyRect.bottom;
+                GIF_CHECK_MESSAGE(!pPrevious || fDirty || pPixels[i] == (*pPrevious)[i],
+                    "frame " << iFrame << " (raw frame " << uFrameIndex << ") pixel " << x << "," << y << " changed outside the dirty rect");
+            }
+        }
+    }
+}
+
+GIF_TEST(pipeline, RestartAndCacheModeKeepFrameOrder)
+{
+    std::mt19937 random(31);
+    for (int iGif = 0; iGif < 100; iGif++)
+    {
+        auto spec = MakeRandomTestGif(random, iGif % 2 != 0);
+        auto data = WriteTestGif(spec);
+        auto reference = ComposeTestGifReference(spec);
+        auto displayed = GetDisplayedFrames(data);
+        bool fStill = reference.size() == 1;
+
+        auto compositor = MakeTestCompositor(data);
+        compositor->SetFrameCacheMode(TEST_CACHE_MODES[random() % 3]);
+        GifFramePipeline pipeline(std::move(compositor), 1 + random() % 4);
+
+        // Up to four loops, with the frames before a restart or mode change
+        // already composed ahead under the old state
+        size_t iDisplayed = 0;
+        std::vector<uint32_t> previous;
+        bool fHasPrevious = false;
+        unsigned int cFrames = static_cast<unsigned int>(displayed.size() * (1 + random() % 4));
+        for (unsigned int iFrame = 0; iFrame < cFrames; iFrame++)
+        {
+            switch (random() % 8)
+            {
+            case 0:
+                pipeline.Restart();
+                iDisplayed = 0;
+                fHasPrevious = false;
+                break;
+
+            case 1:
+                pipeline.SetFrameCacheMode(TEST_CACHE_MODES[random() % 3], TEST_CACHE_BUDGETS[random() % 2]);
+                break;
+            }
+
+            // A still image gives its only frame once per start
+            auto pFrame = pipeline.AcquireFrame();
+            if (fStill && fHasPrevious)
+            {
+                GIF_CHECK(pFrame == nullptr);
+                continue;
+            }
+            GIF_CHECK_MESSAGE(pFrame != nullptr, "gif " << iGif << " ran out of frames at frame " << iFrame);
+
+            unsigned int uFrameIndex = displayed[iDisplayed];
+            unsigned int uNext = pFrame->uNextFrameIndex;
+            GIF_CHECK_EQUAL(uFrameIndex, (uNext == 0 ? static_cast<unsigned int>(reference.size()) : uNext) - 1);
+            GIF_CHECK_EQUAL(iDisplayed + 1 == displayed.size(), uNext == 0);
+            GIF_CHECK_EQUAL(spec.frames[uFrameIndex].uDelay * 10, pFrame->uFrameDelay);
+            CheckPipelineFrame(*pFrame, uFrameIndex, reference[uFrameIndex], fHasPrevious ? &previous : nullptr, iFrame);
+
+            previous.assign(pFrame->composedFrame.Pixels(), pFrame->composedFrame.Pixels() + reference[uFrameIndex].size());
+            fHasPrevious = true;
+            pipeline.ReleaseFrame();
+            iDisplayed = (iDisplayed + 1) % displayed.size();
+        }
+    }
+}
+
+GIF_TEST(pipeline, DestroyWithFramesQueued)
+{
+    std::mt19937 random(32);
+    for (int iGif = 0; iGif < 200; iGif++)
+    {
+        auto spec = MakeRandomTestGif(random, iGif % 2 != 0);
+        auto data = WriteTestGif(spec);
+        GifFramePipeline pipeline(MakeTestCompositor(data), 1 + random() % 4);
+        unsigned int cFrames = spec.frames.size() == 1 ? 1 : ~0u;
+
+        // Destroyed straight away, after some frames with the rest of the
+        // ring filling, or while holding a frame, the worker maybe blocked
+        // on a full ring or in the middle of a frame
+        for (unsigned int i = std::min<unsigned int>(random() % 6, cFrames); i > 0; i--)
+        {
+            GIF_CHECK(pipeline.AcquireFrame() != nullptr);
+            pipeline.ReleaseFrame();
+            cFrames--;
+        }
+        if (random() % 2 == 0 && cFrames > 0)
+        {
+            GIF_CHECK(pipeline.AcquireFrame() != nullptr);
+        }
+        if (random() % 4 == 0)
+        {
+            pipeline.Restart();
+        }
+    }
+}
@@ -0,0 +1,169 @@
+// GifPlaybackScheduler keeping a long animation on its timeline, run on a
+// fake clock so that the times it is checked against are exact
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "GifPlaybackScheduler.h"
+#include "GifTest.h"
+
+namespace
+{
+    using Clock = IGifPlaybackClock::Clock;
+    using std::chrono::milliseconds;
+
+    const unsigned int TEST_FRAME_COUNT = 1000;
+    const unsigned int TEST_FRAME_DELAY = 10;
+
+    // A clock whose time only moves when the test advances it.  A wait
+    // returns as soon as it is made, with the time moved to its deadline,
+    // as if the thread had slept exactly until then.
+    class FakePlaybackClock : public IGifPlaybackClock
+    {
+    public:
+
+        Clock::time_point Now() override
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            return m_now;
+        }
+
+        bool WaitUntil(
+            std::condition_variable& wake,
+            std::unique_lock<std::mutex>& lock,
+            Clock::time_point due,
+            const WakePredicate& fWake) override
+        {
+            // The scheduler's state only changes while its lock is held by
+            // another thread, so there is nothing to wait for once checked
+            (void)wake;
+            (void)lock;
+            if (fWake())
+            {
+                return true;
+            }
+            {
+                std::lock_guard<std::mutex> clockLock(m_lock);
+                m_now = std::max(m_now, due);
+            }
+            return fWake();
+        }
+
+        void Advance(Clock::duration duration)
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_now += duration;
+        }
+
+    private:
+
+        std::mutex          m_lock;
+        Clock::time_point   m_now;
+    };
+
+    struct PlaybackResult
+    {
+        Clock::duration     elapsed;
+        GifPlaybackStats    stats;
+    };
+
+    // Plays TEST_FRAME_COUNT frames of TEST_FRAME_DELAY ms the way a player
+    // does: each due callback composes frames until one is accepted and
+    // presents it.  Composing frame i takes composeTime(i) on the fake
+    // clock.  Returns how long the frames took to play, up to the end of
+    // the last one.
+    PlaybackResult PlayTestFrames(const std::function<Clock::duration(unsigned int)>& composeTime)
+    {
+        auto clock = std::make_shared<FakePlaybackClock>();
+        std::mutex lock;
+        std::condition_variable done;
+        bool fDone = false;
+        unsigned int uNextFrame = 0;
+        Clock::time_point end;
+
+        // Set once the scheduler exists; its callback only runs after the
+        // first frame has been composed below
+        GifPlaybackScheduler* pScheduler = nullptr;
+        auto composeUntilPresented = [&]
+        {
+            while (uNextFrame < TEST_FRAME_COUNT)
+            {
+                clock->Advance(composeTime(uNextFrame++));
+                if (pScheduler->FrameComposed(TEST_FRAME_DELAY))
+                {
+                    pScheduler->FramePresented();
+                    return;
+                }
+            }
+
+            std::lock_guard<std::mutex> doneLock(lock);
+            end = clock->Now();
+            fDone = true;
+            done.notify_one();
+        };
+
+        GifPlaybackScheduler scheduler([&](unsigned int) { composeUntilPresented(); }, DEFAULT_MAX_CONSECUTIVE_DROPS, clock);
+        pScheduler = &scheduler;
+
+        auto start = clock->Now();
+        scheduler.Start();
+        composeUntilPresented();
+        {
+            std::unique_lock<std::mutex> doneLock(lock);
+            done.wait(doneLock, [&] { return fDone; });
+        }
+        scheduler.Stop();
+
+        return { end - start, scheduler.GetStats() };
+    }
+}
+
+GIF_TEST(scheduler, SteadyPlaybackKeepsTheTimeline)
+{
+    auto result = PlayTestFrames([](unsigned int) { return milliseconds(3); });
+
+    GIF_CHECK(result.elapsed == milliseconds(TEST_FRAME_COUNT * TEST_FRAME_DELAY));
+    GIF_CHECK_EQUAL(uint64_t(TEST_FRAME_COUNT), result.stats.cFramesPresented);
+    GIF_CHECK_EQUAL(uint64_t(0), result.stats.cFramesDropped);
+    GIF_CHECK_EQUAL(uint64_t(0), result.stats.cResyncs);
+    GIF_CHECK_EQUAL(int64_t(3000), result.stats.maxLatenessUs);
+    GIF_CHECK_EQUAL(int64_t(0), result.stats.maxWakeupLatenessUs);
+}
+
+GIF_TEST(scheduler, StallsDropFramesWithoutDrift)
+{
+    // A 50 ms stall every 50 frames leaves the next frames 1 ms apart to
+    // catch up: the stalled frame and the four after it end before they
+    // can be shown, and the fifth is shown 5 ms late.
+    auto result = PlayTestFrames([](unsigned int uFrame)
+        {
+            return uFrame % 50 == 10 ? milliseconds(50) : milliseconds(1);
+        });
+
+    GIF_CHECK(result.elapsed == milliseconds(TEST_FRAME_COUNT * TEST_FRAME_DELAY));
+    GIF_CHECK_EQUAL(uint64_t(100), result.stats.cFramesDropped);
+    GIF_CHECK_EQUAL(uint64_t(TEST_FRAME_COUNT - 100), result.stats.cFramesPresented);
+    GIF_CHECK_EQUAL(uint64_t(0), result.stats.cResyncs);
+    GIF_CHECK_EQUAL(int64_t(5000), result.stats.maxLatenessUs);
+}
+
+GIF_TEST(scheduler, LongStallResyncsTheTimeline)
+{
+    // A 200 ms stall at frame 500 drops the eight frames allowed in a row,
+    // 1 ms apart, then shows the ninth 118 ms after its end and restarts the
+    // timeline from there: it ends 10 ms later, 128 ms behind the original
+    // timeline, which the remaining frames keep to.
+    auto result = PlayTestFrames([](unsigned int uFrame)
+        {
+            return uFrame == 500 ? milliseconds(200) : milliseconds(1);
+        });
+
+    GIF_CHECK(result.elapsed == milliseconds(TEST_FRAME_COUNT * TEST_FRAME_DELAY + 128));
+    GIF_CHECK_EQUAL(uint64_t(DEFAULT_MAX_CONSECUTIVE_DROPS), result.stats.cFramesDropped);
+    GIF_CHECK_EQUAL(uint64_t(TEST_FRAME_COUNT - DEFAULT_MAX_CONSECUTIVE_DROPS), result.stats.cFramesPresented);
+    GIF_CHECK_EQUAL(uint64_t(1), result.stats.cResyncs);
+}
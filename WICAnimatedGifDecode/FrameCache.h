@@ -0,0 +1,265 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Cache of composed frames keyed by the index of the first raw frame that
+// was used to produce them.  Every animation loop starts from a cleared
+// canvas, so the composed frame for a given index is identical in every loop;
+// once loop 1 has populated the cache, later loops can skip decoding and
+// composing entirely.
+//
+// Eviction uses the GreedyDual-Size policy: each entry gets a priority of
+// L + cost / size, where cost is the number of raw frames that had to be
+// composed to produce it.  The entry with the lowest priority is evicted and
+// L is raised to its priority, which ages the remaining entries.  With uniform
+// costs and sizes this degenerates to plain LRU; with zero delay frames in
+// the mix it prefers to keep the composed frames that were expensive to make.
+//
+// Once the cache is full, insertions evict entries.  Evicted entries are
+// kept as spares and their map nodes and frames are reused for the next
+// insertions (see TakeSpareFrame), so a cache cycling through its budget does
+// not allocate.  One insertion can evict several smaller entries that later
+// insertions reuse one at a time, so there can be several spares.  New
+// frames are only made when there is no spare, so the spares and entries
+// together never outnumber the most entries the cache has held at once.
+
+enum FRAME_CACHE_MODE
+{
+    FCM_OFF = 0,        // Never cache, compose every frame in every loop
+    FCM_KEYFRAME = 1,   // Only cache every n-th displayed frame
+    FCM_FULL = 2        // Cache every displayed frame that fits the budget
+};
+
+const size_t DEFAULT_FRAME_CACHE_BUDGET = 64 * 1024 * 1024;
+const unsigned int DEFAULT_KEYFRAME_INTERVAL = 8;
+
+struct FrameCacheStats
+{
+    uint64_t cHits;
+    uint64_t cMisses;
+    uint64_t cInsertions;
+    uint64_t cEvictions;
+    uint64_t cRejections;   // Frames that were not cached because they exceed the budget
+    size_t   cbUsed;
+    size_t   cEntries;
+};
+
+/******************************************************************
+*                                                                 *
+*  FrameCache                                                     *
+*                                                                 *
+******************************************************************/
+
+template <typename TFrame>
+class FrameCache
+{
+public:
+
+    FrameCache()
+    {
+        Configure(FCM_OFF, 0);
+    }
+
+    void Configure(
+        FRAME_CACHE_MODE mode,
+        size_t cbBudget,
+        unsigned int uKeyframeInterval = DEFAULT_KEYFRAME_INTERVAL)
+    {
+        Clear();
+        m_mode = mode;
+        m_cbBudget = cbBudget;
+        m_uKeyframeInterval = (uKeyframeInterval > 0) ? uKeyframeInterval : 1;
+        ResetStats();
+    }
+
+    FRAME_CACHE_MODE GetMode() const
+    {
+        return m_mode;
+    }
+
+    size_t GetBudget() const
+    {
+        return m_cbBudget;
+    }
+
+    // Drops all the cached frames but keeps the configuration and counters
+    void Clear()
+    {
+        m_entries.clear();
+        m_spares.clear();
+        m_cbUsed = 0;
+        m_inflation = 0.;
+    }
+
+    void ResetStats()
+    {
+        m_stats = {};
+    }
+
+    // Whether a composed frame that starts at uFrameIndex is worth caching
+    bool ShouldCache(unsigned int uFrameIndex) const
+    {
+        switch (m_mode)
+        {
+        case FCM_FULL:
+            return m_cbBudget > 0;
+        case FCM_KEYFRAME:
+            return m_cbBudget > 0 && (uFrameIndex % m_uKeyframeInterval) == 0;
+        default:
+            return false;
+        }
+    }
+
+    // Returns the cached frame or nullptr, and updates the hit/miss counters.
+    // The returned pointer stays valid until the next call to Insert or Clear.
+    const TFrame* Lookup(unsigned int uFrameIndex)
+    {
+        if (m_mode == FCM_OFF)
+        {
+            return nullptr;
+        }
+
+        auto it = m_entries.find(uFrameIndex);
+        if (it == m_entries.end())
+        {
+            m_stats.cMisses++;
+            return nullptr;
+        }
+
+        m_stats.cHits++;
+        it->second.priority = m_inflation + it->second.weight;
+        return &it->second.frame;
+    }
+
+    // Returns the frame of the last evicted or replaced entry, or a default
+    // constructed frame if there is none.  Filling it in and passing it to
+    // Insert reuses whatever memory it still holds.
+    TFrame TakeSpareFrame()
+    {
+        if (m_spares.empty())
+        {
+            return TFrame();
+        }
+        return std::move(m_spares.back().mapped().frame);
+    }
+
+    // Adds a frame to the cache, evicting lower priority frames to make room.
+    // cbSize is the memory the frame holds on to and cComposeCost is the number
+    // of raw frames it took to produce it.  Returns false if the frame was not
+    // cached.
+    bool Insert(unsigned int uFrameIndex, TFrame&& frame, size_t cbSize, unsigned int cComposeCost)
+    {
+        if (!ShouldCache(uFrameIndex))
+        {
+            return false;
+        }
+
+        if (cbSize > m_cbBudget)
+        {
+            m_stats.cRejections++;
+            return false;
+        }
+
+        // The node of the last spare entry is reused for this frame, and the
+        // entries evicted below become spares
+        typename Map::node_type node;
+        if (!m_spares.empty())
+        {
+            node = std::move(m_spares.back());
+            m_spares.pop_back();
+        }
+
+        Erase(uFrameIndex);
+
+        while (m_cbUsed + cbSize > m_cbBudget)
+        {
+            EvictOne();
+        }
+
+        Entry entry{ std::move(frame), cbSize, 0., 0. };
+        entry.weight = static_cast<double>(cComposeCost > 0 ? cComposeCost : 1)
+            / static_cast<double>(cbSize > 0 ? cbSize : 1);
+        entry.priority = m_inflation + entry.weight;
+
+        if (node.empty())
+        {
+            // A new frame: make room for it among the spares as well
+            m_entries.emplace(uFrameIndex, std::move(entry));
+            m_spares.reserve(m_entries.size() + m_spares.size());
+        }
+        else
+        {
+            node.key() = uFrameIndex;
+            node.mapped() = std::move(entry);
+            m_entries.insert(std::move(node));
+        }
+        m_cbUsed += cbSize;
+        m_stats.cInsertions++;
+        return true;
+    }
+
+    FrameCacheStats GetStats() const
+    {
+        auto stats = m_stats;
+        stats.cbUsed = m_cbUsed;
+        stats.cEntries = m_entries.size();
+        return stats;
+    }
+
+private:
+
+    struct Entry
+    {
+        TFrame  frame;
+        size_t  cbSize;
+        double  weight;     // cost / size
+        double  priority;   // GreedyDual-Size H value
+    };
+
+    using Map = std::unordered_map<unsigned int, Entry>;
+
+    void Erase(unsigned int uFrameIndex)
+    {
+        auto it = m_entries.find(uFrameIndex);
+        if (it != m_entries.end())
+        {
+            m_cbUsed -= it->second.cbSize;
+            m_spares.push_back(m_entries.extract(it));
+        }
+    }
+
+    void EvictOne()
+    {
+        // The number of cached frames is bounded by the frame count of a
+        // single animation, so a linear scan is cheap compared to composing
+        auto victim = m_entries.begin();
+        for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+        {
+            if (it->second.priority < victim->second.priority)
+            {
+                victim = it;
+            }
+        }
+
+        m_inflation = victim->second.priority;
+        m_cbUsed -= victim->second.cbSize;
+        m_spares.push_back(m_entries.extract(victim));
+        m_stats.cEvictions++;
+    }
+
+private:
+
+    FRAME_CACHE_MODE    m_mode;
+    size_t              m_cbBudget;
+    unsigned int        m_uKeyframeInterval;
+    size_t              m_cbUsed;
+    double              m_inflation;    // GreedyDual-Size L value
+    FrameCacheStats     m_stats;
+
+    Map                 m_entries;
+    std::vector<typename Map::node_type>    m_spares;   // Entries removed, the last one removed at the back
+};
@@ -0,0 +1,79 @@
+#include "GifAllocCounter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+    std::atomic<uint64_t> g_cAllocations(0);
+    std::atomic<uint64_t> g_cbAllocated(0);
+}
+
+/******************************************************************
+*                                                                 *
+*  IsGifAllocCountingEnabled                                      *
+*                                                                 *
+******************************************************************/
+
+bool IsGifAllocCountingEnabled()
+{
+#ifdef GIF_COUNT_ALLOCATIONS
+    return true;
+#else
+    return false;
+#endif
+}
+
+/******************************************************************
+*                                                                 *
+*  GetGifAllocStats                                               *
+*                                                                 *
+******************************************************************/
+
+GifAllocStats GetGifAllocStats()
+{
+    GifAllocStats stats;
+    stats.cAllocations = g_cAllocations.load(std::memory_order_relaxed);
+    stats.cbAllocated = g_cbAllocated.load(std::memory_order_relaxed);
+    return stats;
+}
+
+#ifdef GIF_COUNT_ALLOCATIONS
+
+// The replaceable global allocation functions.  The array and nothrow forms
+// call these by default, so they are counted as well.
+
+void* operator new(std::size_t cb)
+{
+    g_cAllocations.fetch_add(1, std::memory_order_relaxed);
+    g_cbAllocated.fetch_add(cb, std::memory_order_relaxed);
+
+    for (;;)
+    {
+        void* p = std::malloc(cb != 0 ? cb : 1);
+        if (p != nullptr)
+        {
+            return p;
+        }
+
+        auto handler = std::get_new_handler();
+        if (handler == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+#endif
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+
+// Heap allocations made through the global operator new
+struct GifAllocStats
+{
+    uint64_t    cAllocations;
+    uint64_t    cbAllocated;
+};
+
+// Whether GifCore was built with GIF_COUNT_ALLOCATIONS.  Only then does it
+// replace the global operator new to count allocations; otherwise all
+// counts stay zero.
+bool IsGifAllocCountingEnabled();
+
+// Allocations made by all threads since the process started
+GifAllocStats GetGifAllocStats();
+
+/******************************************************************
+*                                                                 *
+*  GifAllocScope                                                  *
+*                                                                 *
+*  Counts the allocations made by all threads while it is alive.  *
+*  Used to check that steady-state playback, after the first      *
+*  loop has warmed up the pools and caches, does not allocate:    *
+*                                                                 *
+*      GifAllocScope scope;                                       *
+*      ... play another loop ...                                  *
+*      if (scope.GetStats().cAllocations != 0) ...fail...         *
+*                                                                 *
+******************************************************************/
+
+class GifAllocScope
+{
+public:
+
+    GifAllocScope() :
+        m_start(GetGifAllocStats())
+    {
+    }
+
+    GifAllocStats GetStats() const
+    {
+        auto stats = GetGifAllocStats();
+        stats.cAllocations -= m_start.cAllocations;
+        stats.cbAllocated -= m_start.cbAllocated;
+        return stats;
+    }
+
+private:
+
+    GifAllocStats   m_start;
+};
@@ -0,0 +1,933 @@
+#include "GifAssetCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "GifDecoder.h"
+
+namespace
+{
+    const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ull;
+    const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4Full;
+    const uint64_t PRIME64_3 = 0x165667B19E3779F9ull;
+    const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ull;
+    const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ull;
+
+    // The first field of every cache key, so raw and composed frame keys
+    // never collide
+    const uint64_t RAW_FRAME_KEY = 1;
+    const uint64_t COMPOSED_FRAME_KEY = 2;
+
+    // Logical screen descriptor flags
+    const size_t HEADER_SIZE = 13;
+    const uint8_t GLOBAL_PALETTE_FLAG = 0x80;
+
+    uint64_t RotateLeft(uint64_t value, int cBits)
+    {
+        return (value << cBits) | (value >> (64 - cBits));
+    }
+
+    uint64_t Read64(const uint8_t* p)
+    {
+        uint64_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    uint32_t Read32(const uint8_t* p)
+    {
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    uint64_t HashRound(uint64_t acc, uint64_t input)
+    {
+        acc += input * PRIME64_2;
+        acc = RotateLeft(acc, 31);
+        return acc * PRIME64_1;
+    }
+
+    uint64_t MergeRound(uint64_t acc, uint64_t value)
+    {
+        acc ^= HashRound(0, value);
+        return acc * PRIME64_1 + PRIME64_4;
+    }
+
+    template <size_t cFields>
+    uint64_t HashKey(const std::array<uint64_t, cFields>& fields)
+    {
+        return HashGifBytes(reinterpret_cast<const uint8_t*>(fields.data()), sizeof(fields));
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  HashGifBytes                                                   *
+*                                                                 *
+*  XXH64: four lanes of 8 bytes per round, then the tail.  Runs   *
+*  at memory speed, far faster than the data can be decoded.      *
+*                                                                 *
+******************************************************************/
+
+uint64_t HashGifBytes(const uint8_t* pData, size_t cbData, uint64_t seed)
+{
+    const uint8_t* p = pData;
+    const uint8_t* pEnd = pData + cbData;
+    uint64_t hash;
+
+    if (cbData >= 32)
+    {
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+        do
+        {
+            v1 = HashRound(v1, Read64(p));
+            v2 = HashRound(v2, Read64(p + 8));
+            v3 = HashRound(v3, Read64(p + 16));
+            v4 = HashRound(v4, Read64(p + 24));
+            p += 32;
+        } while (pEnd - p >= 32);
+
+        hash = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) + RotateLeft(v4, 18);
+        hash = MergeRound(hash, v1);
+        hash = MergeRound(hash, v2);
+        hash = MergeRound(hash, v3);
+        hash = MergeRound(hash, v4);
+    }
+    else
+    {
+        hash = seed + PRIME64_5;
+    }
+    hash += cbData;
+
+    for (; pEnd - p >= 8; p += 8)
+    {
+        hash ^= HashRound(0, Read64(p));
+        hash = RotateLeft(hash, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (pEnd - p >= 4)
+    {
+        hash ^= Read32(p) * PRIME64_1;
+        hash = RotateLeft(hash, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for (; p < pEnd; p++)
+    {
+        hash ^= *p * PRIME64_5;
+        hash = RotateLeft(hash, 11) * PRIME64_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAssetFrameSource                                            *
+*                                                                 *
+*  The frame source of one player of an asset: a decoder of its   *
+*  own, opened with the asset's frame index once it is complete   *
+*  and lazily before, that looks raw frames up in the cache       *
+*  before decoding them.                                          *
+*                                                                 *
+******************************************************************/
+
+class GifAssetFrameSource : public IGifFrameSource
+{
+public:
+
+    GifAssetFrameSource(std::shared_ptr<GifAsset> asset, unsigned int cxMax, unsigned int cyMax) :
+        m_asset(std::move(asset))
+    {
+        m_decoder.SetTargetSize(cxMax, cyMax);
+        if (auto pFrameIndex = m_asset->GetCompleteFrameIndex())
+        {
+            m_decoder.Open(m_asset->m_byteSource, *pFrameIndex);
+        }
+        else
+        {
+            m_decoder.SetOpenMode(GOM_LAZY);
+            m_decoder.Open(m_asset->m_byteSource);
+        }
+        m_decoder.GetGlobalInfo(m_globalInfo);
+        m_asset->m_cFrameSources++;
+    }
+
+    ~GifAssetFrameSource() override
+    {
+        m_asset->m_cFrameSources--;
+    }
+
+    void GetGlobalInfo(GifGlobalInfo& globalInfo) override
+    {
+        m_decoder.GetGlobalInfo(globalInfo);
+    }
+
+    void GetFrameInfo(unsigned int uFrameIndex, GifFrameInfo& frameInfo) override
+    {
+        m_decoder.GetFrameInfo(uFrameIndex, frameInfo);
+    }
+
+    void DiscoverFrames(unsigned int cFramesNeeded, GifGlobalInfo& globalInfo) override
+    {
+        m_decoder.DiscoverFrames(cFramesNeeded, globalInfo);
+    }
+
+    bool IsFrameOpaque(unsigned int uFrameIndex) override
+    {
+        return m_decoder.IsFrameOpaque(uFrameIndex);
+    }
+
+    void GetRawFrame(unsigned int uFrameIndex, GifRawFrame& rawFrame) override
+    {
+        // Also checks uFrameIndex before it is used for the frame hash
+        m_decoder.GetFrameInfo(uFrameIndex, rawFrame.info);
+
+        // The pixels depend on the frame's bytes, the logical screen it is
+        // clipped to and the canvas it is scaled to
+        const GifAssetCache::KeyFields key = {
+            RAW_FRAME_KEY,
+            m_asset->GetFrameHash(uFrameIndex),
+            m_asset->m_cxScreen,
+            m_asset->m_cyScreen,
+            m_globalInfo.cxGifImage,
+            m_globalInfo.cyGifImage };
+
+        auto& cache = m_asset->m_cache;
+        m_heldFrame = cache.LookupRawFrame(key, *m_asset, uFrameIndex);
+        if (m_heldFrame)
+        {
+            rawFrame.pixels = {
+                const_cast<uint32_t*>(m_heldFrame->Pixels()),
+                m_heldFrame->Width(),
+                m_heldFrame->Width(),
+                m_heldFrame->Height() };
+            return;
+        }
+
+        m_decoder.GetRawFrame(uFrameIndex, rawFrame);
+
+        auto copy = std::make_shared<GifBitmap>(rawFrame.pixels.cx, rawFrame.pixels.cy);
+        auto dest = copy->Surface();
+        for (unsigned int y = 0; y < dest.cy; y++)
+        {
+            memcpy(dest.Row(y), rawFrame.pixels.Row(y), dest.cx * sizeof(uint32_t));
+        }
+        cache.InsertRawFrame(key, m_asset, uFrameIndex, std::move(copy));
+    }
+
+private:
+
+    std::shared_ptr<GifAsset>           m_asset;
+    GifDecoder                          m_decoder;
+    GifGlobalInfo                       m_globalInfo;
+    std::shared_ptr<const GifBitmap>    m_heldFrame;    // Behind the pixels GetRawFrame returned last
+};
+
+/******************************************************************
+*                                                                 *
+*  GifAssetFrameStore                                             *
+*                                                                 *
+*  The composed frames of one asset at one target size, kept in   *
+*  the cache, for players with one frame cache mode and codec.    *
+*  Frames packed with any codec restore the same, so players with *
+*  different codecs share them.                                   *
+*                                                                 *
+******************************************************************/
+
+class GifAssetFrameStore : public IGifSharedFrameStore
+{
+public:
+
+    GifAssetFrameStore(std::shared_ptr<GifAsset> asset, unsigned int cxMax, unsigned int cyMax, FRAME_CACHE_MODE mode, unsigned int uCodec) :
+        m_asset(std::move(asset)),
+        m_cxMax(cxMax),
+        m_cyMax(cyMax),
+        m_mode(mode),
+        m_uCodec(uCodec)
+    {
+    }
+
+    std::shared_ptr<const GifCachedFrame> Lookup(unsigned int uFirstFrameIndex) override
+    {
+        if (m_mode == FCM_OFF)
+        {
+            return nullptr;
+        }
+        return m_asset->m_cache.LookupComposedFrame(GetKey(uFirstFrameIndex), *m_asset);
+    }
+
+    // Follows FrameCache::ShouldCache, without its budget, which is the
+    // cache's
+    bool ShouldInsert(unsigned int uFirstFrameIndex) override
+    {
+        switch (m_mode)
+        {
+        case FCM_FULL:
+            break;
+        case FCM_KEYFRAME:
+            if (uFirstFrameIndex % DEFAULT_KEYFRAME_INTERVAL != 0)
+            {
+                return false;
+            }
+            break;
+        default:
+            return false;
+        }
+        return !m_asset->m_cache.ContainsComposedFrame(GetKey(uFirstFrameIndex), *m_asset);
+    }
+
+    unsigned int GetCodec() override
+    {
+        return m_uCodec;
+    }
+
+    void Insert(unsigned int uFirstFrameIndex, std::shared_ptr<const GifCachedFrame> frame, unsigned int cComposeCost) override
+    {
+        (void)cComposeCost;
+        m_asset->m_cache.InsertComposedFrame(GetKey(uFirstFrameIndex), m_asset, std::move(frame));
+    }
+
+private:
+
+    GifAssetCache::KeyFields GetKey(unsigned int uFirstFrameIndex) const
+    {
+        return { COMPOSED_FRAME_KEY, m_asset->GetHash(), m_cxMax, m_cyMax, uFirstFrameIndex, 0 };
+    }
+
+private:
+
+    std::shared_ptr<GifAsset>   m_asset;
+    const unsigned int          m_cxMax;
+    const unsigned int          m_cyMax;
+    const FRAME_CACHE_MODE      m_mode;
+    const unsigned int          m_uCodec;
+};
+
+/******************************************************************
+*                                                                 *
+*  GifAsset::GifAsset constructor                                 *
+*                                                                 *
+*  Only finds the first frame, as a lazily opened decoder does.   *
+*                                                                 *
+******************************************************************/
+
+GifAsset::GifAsset(GifAssetCache& cache, uint64_t hash, std::shared_ptr<GifByteSource> byteSource) :
+    m_cache(cache),
+    m_hash(hash),
+    m_byteSource(std::move(byteSource)),
+    m_offGlobalPalette(0),
+    m_cbGlobalPalette(0),
+    m_cFrameSources(0)
+{
+    m_indexer.SetOpenMode(GOM_LAZY);
+    m_indexer.Open(m_byteSource);
+
+    GifGlobalInfo globalInfo;
+    m_indexer.GetGlobalInfo(globalInfo);
+    m_cxScreen = globalInfo.cxGifImage;
+    m_cyScreen = globalInfo.cyGifImage;
+
+    const uint8_t* pData = m_byteSource->Data();
+    if (m_byteSource->Size() >= HEADER_SIZE && (pData[10] & GLOBAL_PALETTE_FLAG))
+    {
+        m_offGlobalPalette = HEADER_SIZE;
+        m_cbGlobalPalette = static_cast<size_t>(3) << ((pData[10] & 0x07) + 1);
+    }
+
+    std::lock_guard<std::mutex> lock(m_indexLock);
+    HashFrames();
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAsset::GetFrameIndex                                        *
+*                                                                 *
+*  Once complete the index no longer changes, so the reference    *
+*  stays valid without the lock.                                  *
+*                                                                 *
+******************************************************************/
+
+const GifFrameIndex& GifAsset::GetFrameIndex()
+{
+    std::lock_guard<std::mutex> lock(m_indexLock);
+    m_indexer.GetFrameIndex();
+    HashFrames();
+    return m_indexer.GetIndexedFrames();
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAsset::GetCompleteFrameIndex                                *
+*                                                                 *
+*  The frame index if players have found every frame, or nullptr. *
+*                                                                 *
+******************************************************************/
+
+const GifFrameIndex* GifAsset::GetCompleteFrameIndex() const
+{
+    std::lock_guard<std::mutex> lock(m_indexLock);
+    const auto& frameIndex = m_indexer.GetIndexedFrames();
+    return frameIndex.IsComplete() ? &frameIndex : nullptr;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAsset::GetFrameHash                                         *
+*                                                                 *
+******************************************************************/
+
+uint64_t GifAsset::GetFrameHash(unsigned int uFrameIndex)
+{
+    std::lock_guard<std::mutex> lock(m_indexLock);
+    if (uFrameIndex >= m_frameHashes.size())
+    {
+        IndexFrames(uFrameIndex + 1);
+        if (uFrameIndex >= m_frameHashes.size())
+        {
+            throw std::out_of_range("Frame index out of range");
+        }
+    }
+    return m_frameHashes[uFrameIndex];
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAsset::IndexFrames                                          *
+*                                                                 *
+*  Finds and hashes frames up to cFramesNeeded, and one more, so  *
+*  that the index is complete once a player reaches the last      *
+*  frame and later players open with it.  Called with the index   *
+*  lock held.                                                     *
+*                                                                 *
+******************************************************************/
+
+void GifAsset::IndexFrames(unsigned int cFramesNeeded)
+{
+    GifGlobalInfo globalInfo;
+    m_indexer.DiscoverFrames(cFramesNeeded + 1, globalInfo);
+    HashFrames();
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAsset::HasSameData                                          *
+*                                                                 *
+******************************************************************/
+
+bool GifAsset::HasSameData(const GifByteSource& byteSource) const
+{
+    return m_byteSource.get() == &byteSource ||
+        (m_byteSource->Size() == byteSource.Size() &&
+         memcmp(m_byteSource->Data(), byteSource.Data(), byteSource.Size()) == 0);
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAsset::GetFrameBytes                                        *
+*                                                                 *
+*  The frame's image descriptor fields and transparency, its      *
+*  palette (its own or the global one) and its image data, up to  *
+*  the block terminator or the end of a truncated file.  Called   *
+*  with the index lock held.                                      *
+*                                                                 *
+******************************************************************/
+
+GifAsset::FrameBytes GifAsset::GetFrameBytes(unsigned int uFrameIndex) const
+{
+    const uint8_t* pData = m_byteSource->Data();
+    size_t cbData = m_byteSource->Size();
+    const auto& frameIndex = m_indexer.GetIndexedFrames();
+
+    GifFrameInfo frameInfo;
+    frameIndex.GetFrameInfo(uFrameIndex, frameInfo);
+    const GifRect& imageRect = frameIndex.GetImageRect(uFrameIndex);
+
+    FrameBytes bytes;
+    bytes.fields[0] = imageRect.left;
+    bytes.fields[1] = imageRect.top;
+    bytes.fields[2] = imageRect.right;
+    bytes.fields[3] = imageRect.bottom;
+    bytes.fields[4] = frameInfo.fTransparent ? 0x100u | frameInfo.transparentIndex : 0u;
+    bytes.fields[5] = frameInfo.fInterlaced ? 1u : 0u;
+
+    size_t offPalette = frameIndex.GetLocalPaletteOffset(uFrameIndex);
+    size_t cbPalette = 3 * static_cast<size_t>(frameIndex.GetLocalColorCount(uFrameIndex));
+    if (offPalette == 0)
+    {
+        offPalette = m_offGlobalPalette;
+        cbPalette = m_cbGlobalPalette;
+    }
+    offPalette = std::min(offPalette, cbData);
+    bytes.pPalette = pData + offPalette;
+    bytes.cbPalette = std::min(cbPalette, cbData - offPalette);
+
+    size_t offImageData = std::min(frameIndex.GetImageDataOffset(uFrameIndex), cbData);
+    size_t off = offImageData + 1;
+    while (off < cbData && pData[off] != 0)
+    {
+        off += pData[off] + 1;
+    }
+    off = std::min(off + 1, cbData);
+    bytes.pImageData = pData + offImageData;
+    bytes.cbImageData = off - offImageData;
+    return bytes;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAsset::IsSameFrame                                          *
+*                                                                 *
+******************************************************************/
+
+bool GifAsset::IsSameFrame(unsigned int uFrameIndex, const GifAsset& other, unsigned int uOtherFrameIndex) const
+{
+    if (&other == this && uOtherFrameIndex == uFrameIndex)
+    {
+        return true;
+    }
+
+    // One lock at a time, so two threads comparing the same assets the
+    // other way round cannot deadlock.  The bytes themselves never change.
+    FrameBytes bytes;
+    {
+        std::lock_guard<std::mutex> lock(m_indexLock);
+        bytes = GetFrameBytes(uFrameIndex);
+    }
+    FrameBytes otherBytes;
+    {
+        std::lock_guard<std::mutex> lock(other.m_indexLock);
+        otherBytes = other.GetFrameBytes(uOtherFrameIndex);
+    }
+    return memcmp(bytes.fields, otherBytes.fields, sizeof(bytes.fields)) == 0 &&
+        bytes.cbPalette == otherBytes.cbPalette &&
+        memcmp(bytes.pPalette, otherBytes.pPalette, bytes.cbPalette) == 0 &&
+        bytes.cbImageData == otherBytes.cbImageData &&
+        memcmp(bytes.pImageData, otherBytes.pImageData, bytes.cbImageData) == 0;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAsset::HashFrames                                           *
+*                                                                 *
+*  Hashes the frames found since it was last called.  Called with *
+*  the index lock held.                                           *
+*                                                                 *
+******************************************************************/
+
+void GifAsset::HashFrames()
+{
+    auto cFrames = m_indexer.GetIndexedFrames().Size();
+    for (auto uFrame = static_cast<unsigned int>(m_frameHashes.size()); uFrame < cFrames; uFrame++)
+    {
+        auto bytes = GetFrameBytes(uFrame);
+        uint64_t hash = HashGifBytes(reinterpret_cast<const uint8_t*>(bytes.fields), sizeof(bytes.fields));
+        hash = HashGifBytes(bytes.pPalette, bytes.cbPalette, hash);
+        hash = HashGifBytes(bytes.pImageData, bytes.cbImageData, hash);
+        m_frameHashes.push_back(hash);
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAsset::CreateFrameSource                                    *
+*                                                                 *
+******************************************************************/
+
+std::shared_ptr<IGifFrameSource> GifAsset::CreateFrameSource(unsigned int cxMax, unsigned int cyMax)
+{
+    return std::make_shared<GifAssetFrameSource>(shared_from_this(), cxMax, cyMax);
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAsset::GetComposedFrameStore                                *
+*                                                                 *
+******************************************************************/
+
+std::shared_ptr<IGifSharedFrameStore> GifAsset::GetComposedFrameStore(unsigned int cxMax, unsigned int cyMax,
+    FRAME_CACHE_MODE mode, unsigned int uCodec)
+{
+    return std::make_shared<GifAssetFrameStore>(shared_from_this(), cxMax, cyMax, mode, uCodec);
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAssetCache::GifAssetCache constructor                       *
+*                                                                 *
+******************************************************************/
+
+GifAssetCache::GifAssetCache(size_t cbBudget) :
+    m_cbBudget(cbBudget),
+    m_cbUsed(0),
+    m_stats()
+{
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAssetCache::Shared                                          *
+*                                                                 *
+******************************************************************/
+
+GifAssetCache& GifAssetCache::Shared()
+{
+    static GifAssetCache cache;
+    return cache;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAssetCache::Acquire                                         *
+*                                                                 *
+*  Hashes and compares the data without the lock.  A new asset is *
+*  loaded without the lock too, so if two threads load the same   *
+*  gif at once the one that finishes second uses the first one's  *
+*  asset.  Gifs whose hashes collide get assets of their own.     *
+*                                                                 *
+******************************************************************/
+
+std::shared_ptr<GifAsset> GifAssetCache::Acquire(std::shared_ptr<GifByteSource> byteSource)
+{
+    uint64_t hash = HashGifBytes(byteSource->Data(), byteSource->Size(), byteSource->Size());
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stats.cAcquires++;
+    }
+
+    if (auto loaded = FindLoadedAsset(hash, *byteSource))
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stats.cAcquireHits++;
+        return loaded;
+    }
+
+    std::shared_ptr<GifAsset> asset(new GifAsset(*this, hash, std::move(byteSource)));
+
+    // Another thread may have loaded the same gif meanwhile.  Comparing
+    // under the lock is rare: it takes a race or a hash collision.
+    std::lock_guard<std::mutex> lock(m_lock);
+    auto range = m_assets.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        auto existing = it->second.lock();
+        if (existing && existing->HasSameData(*asset->m_byteSource))
+        {
+            m_stats.cAcquireHits++;
+            return existing;
+        }
+    }
+    m_assets.emplace(hash, asset);
+
+    // Forget the assets nothing holds any more
+    for (auto it = m_assets.begin(); it != m_assets.end();)
+    {
+        it = it->second.expired() ? m_assets.erase(it) : std::next(it);
+    }
+    return asset;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAssetCache::FindLoadedAsset                                 *
+*                                                                 *
+*  Returns the loaded asset whose data equals byteSource's, or    *
+*  nullptr.  The assets with the hash are collected under the     *
+*  lock and compared after it is released.                        *
+*                                                                 *
+******************************************************************/
+
+std::shared_ptr<GifAsset> GifAssetCache::FindLoadedAsset(uint64_t hash, const GifByteSource& byteSource)
+{
+    std::vector<std::shared_ptr<GifAsset>> candidates;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        auto range = m_assets.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (auto asset = it->second.lock())
+            {
+                candidates.push_back(std::move(asset));
+            }
+        }
+    }
+
+    for (auto& asset : candidates)
+    {
+        if (asset->HasSameData(byteSource))
+        {
+            return asset;
+        }
+    }
+    return nullptr;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAssetCache::SetBudget                                       *
+*                                                                 *
+******************************************************************/
+
+void GifAssetCache::SetBudget(size_t cbBudget)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_cbBudget = cbBudget;
+    EvictToBudget(0);
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAssetCache::Clear                                           *
+*                                                                 *
+******************************************************************/
+
+void GifAssetCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_entries.clear();
+    m_lru.clear();
+    m_cbUsed = 0;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAssetCache::GetStats                                        *
+*                                                                 *
+*  Without the cache, each player would hold the gif data and the *
+*  composed frames it caches itself, so every player past the     *
+*  first of a gif adds to cbSaved.                                *
+*                                                                 *
+******************************************************************/
+
+GifAssetCacheStats GifAssetCache::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    auto stats = m_stats;
+    stats.cAssets = 0;
+    stats.cFrameSources = 0;
+    stats.cbUsed = m_cbUsed;
+    stats.cbBudget = m_cbBudget;
+    stats.cbSaved = 0;
+
+    std::unordered_map<const GifAsset*, unsigned int> extraPlayers;
+    for (const auto& loaded : m_assets)
+    {
+        auto asset = loaded.second.lock();
+        if (!asset)
+        {
+            continue;
+        }
+
+        unsigned int cFrameSources = asset->m_cFrameSources;
+        stats.cAssets++;
+        stats.cFrameSources += cFrameSources;
+        if (cFrameSources > 1)
+        {
+            extraPlayers[asset.get()] = cFrameSources - 1;
+            stats.cbSaved += (cFrameSources - 1) * asset->m_byteSource->Size();
+        }
+    }
+
+    for (const auto& entry : m_entries)
+    {
+        if (entry.second.composedFrame)
+        {
+            auto it = extraPlayers.find(entry.second.asset.get());
+            if (it != extraPlayers.end())
+            {
+                stats.cbSaved += it->second * entry.second.cbSize;
+            }
+        }
+    }
+    return stats;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAssetCache::LookupRawFrame                                  *
+*                                                                 *
+******************************************************************/
+
+std::shared_ptr<const GifBitmap> GifAssetCache::LookupRawFrame(const KeyFields& key, const GifAsset& asset, unsigned int uFrameIndex)
+{
+    std::shared_ptr<const GifBitmap> rawFrame;
+    std::shared_ptr<const GifAsset> entryAsset;
+    unsigned int uEntryFrameIndex = 0;
+    size_t cbSize = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        auto pEntry = Find(key);
+        if (pEntry != nullptr)
+        {
+            rawFrame = pEntry->rawFrame;
+            entryAsset = pEntry->asset;
+            uEntryFrameIndex = pEntry->uFrameIndex;
+            cbSize = pEntry->cbSize;
+        }
+    }
+
+    // Frames from other gifs, or repeated within this one, are compared
+    // without the lock
+    bool fHit = rawFrame && asset.IsSameFrame(uFrameIndex, *entryAsset, uEntryFrameIndex);
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (!fHit)
+    {
+        m_stats.cRawFrameMisses++;
+        return nullptr;
+    }
+    m_stats.cRawFrameHits++;
+    m_stats.cbReused += cbSize;
+    return rawFrame;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAssetCache::InsertRawFrame                                  *
+*                                                                 *
+******************************************************************/
+
+void GifAssetCache::InsertRawFrame(const KeyFields& key, std::shared_ptr<const GifAsset> asset, unsigned int uFrameIndex, std::shared_ptr<const GifBitmap> rawFrame)
+{
+    Entry entry = {};
+    entry.cbSize = rawFrame->SizeInBytes();
+    entry.rawFrame = std::move(rawFrame);
+    entry.keyFields = key;
+    entry.asset = std::move(asset);
+    entry.uFrameIndex = uFrameIndex;
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    Insert(key, std::move(entry));
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAssetCache::LookupComposedFrame                             *
+*                                                                 *
+******************************************************************/
+
+std::shared_ptr<const GifCachedFrame> GifAssetCache::LookupComposedFrame(const KeyFields& key, const GifAsset& asset)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    auto pEntry = Find(key);
+    if (pEntry == nullptr || pEntry->asset.get() != &asset || !pEntry->composedFrame)
+    {
+        m_stats.cComposedFrameMisses++;
+        return nullptr;
+    }
+    m_stats.cComposedFrameHits++;
+    m_stats.cbReused += pEntry->cbSize;
+    return pEntry->composedFrame;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAssetCache::ContainsComposedFrame                           *
+*                                                                 *
+******************************************************************/
+
+bool GifAssetCache::ContainsComposedFrame(const KeyFields& key, const GifAsset& asset) const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    auto it = m_entries.find(HashKey(key));
+    return it != m_entries.end() && it->second.keyFields == key && it->second.asset.get() == &asset;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAssetCache::InsertComposedFrame                             *
+*                                                                 *
+******************************************************************/
+
+void GifAssetCache::InsertComposedFrame(const KeyFields& key, std::shared_ptr<const GifAsset> asset, std::shared_ptr<const GifCachedFrame> composedFrame)
+{
+    Entry entry = {};
+    entry.cbSize = composedFrame->SizeInBytes();
+    entry.composedFrame = std::move(composedFrame);
+    entry.keyFields = key;
+    entry.asset = std::move(asset);
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    Insert(key, std::move(entry));
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAssetCache::Find                                            *
+*                                                                 *
+*  Returns the entry and marks it as the most recently used.  An  *
+*  entry whose key fields hash the same but differ is not found.  *
+*  Called with the lock held.                                     *
+*                                                                 *
+******************************************************************/
+
+GifAssetCache::Entry* GifAssetCache::Find(const KeyFields& key)
+{
+    auto it = m_entries.find(HashKey(key));
+    if (it == m_entries.end() || it->second.keyFields != key)
+    {
+        return nullptr;
+    }
+    m_lru.splice(m_lru.begin(), m_lru, it->second.itLru);
+    return &it->second;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAssetCache::Insert                                          *
+*                                                                 *
+*  Adds an entry unless another player added it first, a key      *
+*  whose hash collides holds the slot, or it does not fit the     *
+*  budget on its own.  Called with the lock held.                 *
+*                                                                 *
+******************************************************************/
+
+void GifAssetCache::Insert(const KeyFields& key, Entry entry)
+{
+    uint64_t hash = HashKey(key);
+    if (entry.cbSize > m_cbBudget || m_entries.count(hash) != 0)
+    {
+        return;
+    }
+
+    EvictToBudget(entry.cbSize);
+
+    m_lru.push_front(hash);
+    entry.itLru = m_lru.begin();
+    m_cbUsed += entry.cbSize;
+    m_entries.emplace(hash, std::move(entry));
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAssetCache::EvictToBudget                                   *
+*                                                                 *
+*  Evicts least recently used entries until cbIncoming more bytes *
+*  fit.  Players still using an evicted frame keep it until they  *
+*  are done.  Called with the lock held.                          *
+*                                                                 *
+******************************************************************/
+
+void GifAssetCache::EvictToBudget(size_t cbIncoming)
+{
+    while (!m_lru.empty() && m_cbUsed + cbIncoming > m_cbBudget)
+    {
+        auto it = m_entries.find(m_lru.back());
+        m_cbUsed -= it->second.cbSize;
+        m_entries.erase(it);
+        m_lru.pop_back();
+        m_stats.cEvictions++;
+    }
+}
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "GifByteSource.h"
+#include "GifCompositor.h"
+#include "GifDecoder.h"
+#include "GifFrameIndex.h"
+
+const size_t DEFAULT_ASSET_CACHE_BUDGET = 256 * 1024 * 1024;
+
+// 64 bit xxHash of cbData bytes.  Finds gif data and single frames within
+// it in GifAssetCache.  It is not collision resistant, so a match is only
+// taken once the bytes themselves compare equal.
+uint64_t HashGifBytes(const uint8_t* pData, size_t cbData, uint64_t seed = 0);
+
+struct GifAssetCacheStats
+{
+    uint64_t        cAcquires;
+    uint64_t        cAcquireHits;       // Acquires that found the gif already loaded
+    unsigned int    cAssets;            // Distinct gifs loaded now
+    unsigned int    cFrameSources;      // Players of those gifs now
+    uint64_t        cRawFrameHits;
+    uint64_t        cRawFrameMisses;
+    uint64_t        cComposedFrameHits;
+    uint64_t        cComposedFrameMisses;
+    uint64_t        cEvictions;
+    size_t          cbUsed;             // Raw and composed frames held
+    size_t          cbBudget;
+    size_t          cbSaved;            // Gif data and composed frames the players of each gif would otherwise hold each
+    uint64_t        cbReused;           // Raw and composed frames served from the cache rather than decoded and composed again
+};
+
+class GifAssetCache;
+
+/******************************************************************
+*                                                                 *
+*  GifAsset                                                       *
+*                                                                 *
+*  One gif as loaded by GifAssetCache: its data, its frame index  *
+*  and the hash of each frame.  Every player of the same gif gets *
+*  the same asset.  The index and hashes are built as players     *
+*  reach each frame, so the first player of a gif shows its first *
+*  frame without waiting for the rest to be found, and players    *
+*  that come once the index is complete open with it.  The        *
+*  decoded raw frames and composed frames it hands out live in    *
+*  the cache, under the cache's budget.                           *
+*                                                                 *
+******************************************************************/
+
+class GifAsset : public std::enable_shared_from_this<GifAsset>
+{
+public:
+
+    GifAsset(const GifAsset&) = delete;
+    GifAsset& operator=(const GifAsset&) = delete;
+
+    uint64_t GetHash() const
+    {
+        return m_hash;
+    }
+
+    const std::shared_ptr<GifByteSource>& GetByteSource() const
+    {
+        return m_byteSource;
+    }
+
+    // The complete frame index, finding any frames no player has reached
+    // yet first
+    const GifFrameIndex& GetFrameIndex();
+
+    // Hash of everything that decides a frame's raw pixels: its image
+    // descriptor, transparency, palette and image data.  Equal frames in
+    // different gifs, or repeated within one, have equal hashes.  Finds
+    // the frame first if no player has reached it yet, and throws
+    // std::out_of_range if there is no such frame.
+    uint64_t GetFrameHash(unsigned int uFrameIndex);
+
+    // Whether the frame's hashed bytes equal those of a frame of other
+    bool IsSameFrame(unsigned int uFrameIndex, const GifAsset& other, unsigned int uOtherFrameIndex) const;
+
+    // A frame source for one player, scaled down to fit cxMax by cyMax
+    // unless both are 0 (see GifDecoder::SetTargetSize).  It opens with
+    // the asset's frame index, and shares raw frames with every other
+    // source of the same frames at the same size.
+    std::shared_ptr<IGifFrameSource> CreateFrameSource(unsigned int cxMax = 0, unsigned int cyMax = 0);
+
+    // The composed frames shared by the compositors playing this asset
+    // from sources made with the same cxMax and cyMax.  The store adds the
+    // frames mode would have a player's own frame cache keep, packed with
+    // the GIF_FRAME_CODEC flags in uCodec, and finds those any player added.
+    std::shared_ptr<IGifSharedFrameStore> GetComposedFrameStore(unsigned int cxMax = 0, unsigned int cyMax = 0,
+        FRAME_CACHE_MODE mode = FCM_FULL, unsigned int uCodec = GFC_NONE);
+
+private:
+
+    friend class GifAssetCache;
+    friend class GifAssetFrameSource;
+    friend class GifAssetFrameStore;
+
+    // The bytes that decide a frame's raw pixels, as GetFrameHash hashes them
+    struct FrameBytes
+    {
+        uint64_t        fields[6];
+        const uint8_t*  pPalette;
+        size_t          cbPalette;
+        const uint8_t*  pImageData;
+        size_t          cbImageData;
+    };
+
+    GifAsset(GifAssetCache& cache, uint64_t hash, std::shared_ptr<GifByteSource> byteSource);
+
+    bool HasSameData(const GifByteSource& byteSource) const;
+    const GifFrameIndex* GetCompleteFrameIndex() const;
+    FrameBytes GetFrameBytes(unsigned int uFrameIndex) const;
+    void IndexFrames(unsigned int cFramesNeeded);
+    void HashFrames();
+
+private:
+
+    GifAssetCache&                  m_cache;
+    const uint64_t                  m_hash;
+    std::shared_ptr<GifByteSource>  m_byteSource;
+    unsigned int                    m_cxScreen;
+    unsigned int                    m_cyScreen;
+    size_t                          m_offGlobalPalette;
+    size_t                          m_cbGlobalPalette;
+    std::atomic<unsigned int>       m_cFrameSources;
+
+    // The index and hashes grow as players reach later frames
+    mutable std::mutex              m_indexLock;
+    GifDecoder                      m_indexer;          // Opened lazily, only used to find frames
+    std::vector<uint64_t>           m_frameHashes;      // Of the frames m_indexer has found
+};
+
+/******************************************************************
+*                                                                 *
+*  GifAssetCache                                                  *
+*                                                                 *
+*  Content addressed store of gifs and of what is decoded from    *
+*  them, for a process that plays the same gifs many times over.  *
+*  Gifs are found by the hash of their bytes and then compared    *
+*  byte for byte, so every player of the same file shares one     *
+*  asset however the bytes reached it, and a gif crafted to hash  *
+*  like another never gets its asset.  Raw frames (keyed by frame *
+*  hash and size) and composed frames (by gif hash, size and      *
+*  frame) are kept under one memory budget, evicting the least    *
+*  recently used.  Each holds the asset it was made from: a       *
+*  composed frame is only served to that asset, and a raw frame   *
+*  to frames whose bytes compare equal to the one it was decoded  *
+*  from.  Assets live as long as a player or a cached frame holds *
+*  them, so a gif opened again finds its frames.  Safe to use     *
+*  from any thread.                                               *
+*                                                                 *
+******************************************************************/
+
+class GifAssetCache
+{
+public:
+
+    explicit GifAssetCache(size_t cbBudget = DEFAULT_ASSET_CACHE_BUDGET);
+
+    GifAssetCache(const GifAssetCache&) = delete;
+    GifAssetCache& operator=(const GifAssetCache&) = delete;
+
+    // The cache shared by the whole process
+    static GifAssetCache& Shared();
+
+    // Returns the asset for the gif in byteSource, loading it unless it is
+    // loaded already.  A source with the same bytes as a loaded asset is
+    // not kept.
+    // Throws std::runtime_error if the gif cannot be opened.  The cache
+    // must outlive the assets it returns.
+    std::shared_ptr<GifAsset> Acquire(std::shared_ptr<GifByteSource> byteSource);
+
+    // Evicts frames down to the new budget
+    void SetBudget(size_t cbBudget);
+
+    // Drops every cached frame.  Assets stay as long as they are held.
+    void Clear();
+
+    GifAssetCacheStats GetStats() const;
+
+private:
+
+    friend class GifAsset;
+    friend class GifAssetFrameSource;
+    friend class GifAssetFrameStore;
+
+    // What a cache key is hashed from.  Entries keep it, so that keys
+    // whose hashes collide are told apart.
+    using KeyFields = std::array<uint64_t, 6>;
+
+    struct Entry
+    {
+        KeyFields                               keyFields;
+        std::shared_ptr<const GifBitmap>        rawFrame;      // Pixels of the frame's (scaled) rect
+        std::shared_ptr<const GifCachedFrame>   composedFrame;
+        std::shared_ptr<const GifAsset>         asset;          // The frame was made from
+        unsigned int                            uFrameIndex;    // Of the raw frame in asset
+        size_t                                  cbSize;
+        std::list<uint64_t>::iterator           itLru;
+    };
+
+    std::shared_ptr<GifAsset> FindLoadedAsset(uint64_t hash, const GifByteSource& byteSource);
+    std::shared_ptr<const GifBitmap> LookupRawFrame(const KeyFields& key, const GifAsset& asset, unsigned int uFrameIndex);
+    void InsertRawFrame(const KeyFields& key, std::shared_ptr<const GifAsset> asset, unsigned int uFrameIndex, std::shared_ptr<const GifBitmap> rawFrame);
+    std::shared_ptr<const GifCachedFrame> LookupComposedFrame(const KeyFields& key, const GifAsset& asset);
+    bool ContainsComposedFrame(const KeyFields& key, const GifAsset& asset) const;
+    void InsertComposedFrame(const KeyFields& key, std::shared_ptr<const GifAsset> asset, std::shared_ptr<const GifCachedFrame> composedFrame);
+
+    Entry* Find(const KeyFields& key);
+    void Insert(const KeyFields& key, Entry entry);
+    void EvictToBudget(size_t cbIncoming);
+
+private:
+
+    mutable std::mutex  m_lock;
+    size_t              m_cbBudget;
+    size_t              m_cbUsed;
+    std::unordered_multimap<uint64_t, std::weak_ptr<GifAsset>>  m_assets;  // By the hash of their data
+    std::unordered_map<uint64_t, Entry>                     m_entries;  // By the hash of their key fields
+    std::list<uint64_t>                                     m_lru;      // Keys of m_entries, most recently used first
+    GifAssetCacheStats  m_stats;
+};
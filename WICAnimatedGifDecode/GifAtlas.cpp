@@ -0,0 +1,230 @@
+#include "GifAtlas.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+    // Shelf heights are rounded up to this, so that slots of nearly the
+    // same height share shelves
+    const unsigned int SHELF_HEIGHT_STEP = 8;
+
+    unsigned int RoundUp(unsigned int value, unsigned int step)
+    {
+        return (value + step - 1) / step * step;
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAtlas::GifAtlas constructor                                 *
+*                                                                 *
+******************************************************************/
+
+GifAtlas::GifAtlas(unsigned int cxPage, unsigned int cyPage, unsigned int cMaxPages) :
+    m_cxPage(RoundUp(cxPage, GIF_ATLAS_ALIGNMENT)),
+    m_cyPage(cyPage),
+    m_cMaxPages(cMaxPages)
+{
+    if (cxPage == 0 || cyPage == 0 || cMaxPages == 0)
+    {
+        throw std::invalid_argument("An atlas needs at least one page of at least one pixel");
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAtlas::Allocate                                             *
+*                                                                 *
+*  Prefers the lowest shelf that wastes at most half the slot's   *
+*  height, then a new shelf, and only then any shelf tall enough, *
+*  so that small slots fill up the gaps of a full atlas last.     *
+*                                                                 *
+******************************************************************/
+
+bool GifAtlas::Allocate(unsigned int cx, unsigned int cy, GifAtlasSlot& slot)
+{
+    cx = std::max(cx, 1u);
+    cy = std::max(cy, 1u);
+    const unsigned int cxAligned = RoundUp(cx, GIF_ATLAS_ALIGNMENT);
+    if (cxAligned > m_cxPage || cy > m_cyPage)
+    {
+        return false;
+    }
+
+    auto place = [&](Shelf& shelf, unsigned int x)
+    {
+        slot.uPage = shelf.uPage;
+        slot.rect = { x, shelf.y, x + cx, shelf.y + cy };
+        return true;
+    };
+
+    // Shelves tall enough, shortest first
+    std::vector<Shelf*> candidates;
+    for (auto& shelf : m_shelves)
+    {
+        if (shelf.cy >= cy)
+        {
+            candidates.push_back(&shelf);
+        }
+    }
+    std::stable_sort(candidates.begin(), candidates.end(),
+        [](const Shelf* pA, const Shelf* pB) { return pA->cy < pB->cy; });
+
+    unsigned int x;
+    for (auto pShelf : candidates)
+    {
+        if (pShelf->cy - cy <= cy / 2 && AllocateOnShelf(*pShelf, cxAligned, x))
+        {
+            return place(*pShelf, x);
+        }
+    }
+
+    // A new shelf, on the first page with room or on a new page
+    const unsigned int cyShelf = std::min(RoundUp(cy, SHELF_HEIGHT_STEP), m_cyPage);
+    unsigned int uPage = 0;
+    while (uPage < m_pages.size() && m_pageShelvesEnd[uPage] + cyShelf > m_cyPage)
+    {
+        uPage++;
+    }
+    if (uPage == m_pages.size() && uPage < m_cMaxPages)
+    {
+        m_pages.emplace_back(m_cxPage, m_cyPage);
+        m_pageShelvesEnd.push_back(0);
+    }
+    if (uPage < m_pages.size())
+    {
+        m_shelves.push_back({ uPage, m_pageShelvesEnd[uPage], cyShelf, 0, {} });
+        m_pageShelvesEnd[uPage] += cyShelf;
+        AllocateOnShelf(m_shelves.back(), cxAligned, x);
+        return place(m_shelves.back(), x);
+    }
+
+    for (auto pShelf : candidates)
+    {
+        if (AllocateOnShelf(*pShelf, cxAligned, x))
+        {
+            return place(*pShelf, x);
+        }
+    }
+    return false;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAtlas::AllocateOnShelf                                      *
+*                                                                 *
+*  Takes the first gap wide enough, or room at the end.           *
+*                                                                 *
+******************************************************************/
+
+bool GifAtlas::AllocateOnShelf(Shelf& shelf, unsigned int cxAligned, unsigned int& x)
+{
+    for (auto it = shelf.gaps.begin(); it != shelf.gaps.end(); ++it)
+    {
+        if (it->second >= cxAligned)
+        {
+            x = it->first;
+            it->first += cxAligned;
+            it->second -= cxAligned;
+            if (it->second == 0)
+            {
+                shelf.gaps.erase(it);
+            }
+            return true;
+        }
+    }
+
+    if (m_cxPage - shelf.xEnd >= cxAligned)
+    {
+        x = shelf.xEnd;
+        shelf.xEnd += cxAligned;
+        return true;
+    }
+    return false;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAtlas::Free                                                 *
+*                                                                 *
+*  Turns the slot into a gap, merged with the gaps next to it.    *
+*  Gaps at the end of a shelf shorten it, and empty shelves at    *
+*  the bottom of a page give their rows back to the page.         *
+*                                                                 *
+******************************************************************/
+
+void GifAtlas::Free(const GifAtlasSlot& slot)
+{
+    auto itShelf = std::find_if(m_shelves.begin(), m_shelves.end(), [&](const Shelf& shelf)
+    {
+        return shelf.uPage == slot.uPage && shelf.y == slot.rect.top;
+    });
+    if (itShelf == m_shelves.end())
+    {
+        throw std::invalid_argument("The slot is not in the atlas");
+    }
+
+    auto& gaps = itShelf->gaps;
+    std::pair<unsigned int, unsigned int> gap(slot.rect.left, RoundUp(std::max(slot.rect.Width(), 1u), GIF_ATLAS_ALIGNMENT));
+    auto it = gaps.insert(std::lower_bound(gaps.begin(), gaps.end(), gap), gap);
+    if (it + 1 != gaps.end() && it->first + it->second == (it + 1)->first)
+    {
+        it->second += (it + 1)->second;
+        gaps.erase(it + 1);
+    }
+    if (it != gaps.begin() && (it - 1)->first + (it - 1)->second == it->first)
+    {
+        (it - 1)->second += it->second;
+        it = gaps.erase(it) - 1;
+    }
+    if (it->first + it->second == itShelf->xEnd)
+    {
+        itShelf->xEnd = it->first;
+        gaps.erase(it);
+    }
+
+    // Empty shelves at the bottom of the page
+    const unsigned int uPage = slot.uPage;
+    for (;;)
+    {
+        auto itLast = std::find_if(m_shelves.begin(), m_shelves.end(), [&](const Shelf& shelf)
+        {
+            return shelf.uPage == uPage && shelf.y + shelf.cy == m_pageShelvesEnd[uPage];
+        });
+        if (itLast == m_shelves.end() || itLast->xEnd != 0)
+        {
+            break;
+        }
+        m_pageShelvesEnd[uPage] = itLast->y;
+        m_shelves.erase(itLast);
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAtlas::GetSlotSurface                                       *
+*                                                                 *
+******************************************************************/
+
+GifSurface GifAtlas::GetSlotSurface(const GifAtlasSlot& slot)
+{
+    auto page = GetPage(slot.uPage);
+    return { page.Row(slot.rect.top) + slot.rect.left, page.stride, slot.rect.Width(), slot.rect.Height() };
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAtlas::GetSizeInBytes                                       *
+*                                                                 *
+******************************************************************/
+
+size_t GifAtlas::GetSizeInBytes() const
+{
+    size_t cbPages = 0;
+    for (const auto& page : m_pages)
+    {
+        cbPages += page.SizeInBytes();
+    }
+    return cbPages;
+}
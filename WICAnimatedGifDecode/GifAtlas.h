@@ -0,0 +1,82 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include "GifTypes.h"
+
+// Slots start and end on multiples of this many pixels, a 64 byte cache
+// line, to keep slots composed on different threads off each other's lines
+const unsigned int GIF_ATLAS_ALIGNMENT = 16;
+
+// Where an atlas allocation lives
+struct GifAtlasSlot
+{
+    unsigned int    uPage;
+    GifRect         rect;       // In page pixels, at the size asked for
+};
+
+/******************************************************************
+*                                                                 *
+*  GifAtlas                                                       *
+*                                                                 *
+*  Fixed size pages of PBGRA pixels shared by many small bitmaps. *
+*  Pages are split into shelves, rows of slots of about the same  *
+*  height.  A slot goes into a gap left by a freed slot or at the *
+*  end of the best fitting shelf, or starts a new shelf.  Pages   *
+*  are allocated as needed, up to a maximum, and kept after that. *
+*                                                                 *
+******************************************************************/
+
+class GifAtlas
+{
+public:
+
+    // cMaxPages bounds the memory to cMaxPages * cxPage * cyPage pixels
+    GifAtlas(unsigned int cxPage, unsigned int cyPage, unsigned int cMaxPages);
+
+    // Finds room for cx by cy pixels.  Returns false if it does not fit in
+    // a page, or if every page is full and no more may be added.  The
+    // slot's pixels are undefined.
+    bool Allocate(unsigned int cx, unsigned int cy, GifAtlasSlot& slot);
+
+    // Gives back a slot returned by Allocate
+    void Free(const GifAtlasSlot& slot);
+
+    unsigned int GetPageCount() const
+    {
+        return static_cast<unsigned int>(m_pages.size());
+    }
+
+    GifSurface GetPage(unsigned int uPage)
+    {
+        return m_pages[uPage].Surface();
+    }
+
+    // The pixels of a slot, with the page's stride
+    GifSurface GetSlotSurface(const GifAtlasSlot& slot);
+
+    size_t GetSizeInBytes() const;
+
+private:
+
+    struct Shelf
+    {
+        unsigned int    uPage;
+        unsigned int    y;
+        unsigned int    cy;
+        unsigned int    xEnd;       // Where the next slot goes if no gap fits
+        std::vector<std::pair<unsigned int, unsigned int>> gaps;    // Freed x ranges below xEnd, as (x, cx) in x order
+    };
+
+    bool AllocateOnShelf(Shelf& shelf, unsigned int cxAligned, unsigned int& x);
+
+private:
+
+    const unsigned int      m_cxPage;
+    const unsigned int      m_cyPage;
+    const unsigned int      m_cMaxPages;
+    std::vector<GifBitmap>  m_pages;
+    std::vector<unsigned int>   m_pageShelvesEnd;   // Per page, where the next shelf starts
+    std::vector<Shelf>      m_shelves;
+};
@@ -0,0 +1,328 @@
+#include "GifAtlasCompositor.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+    // Playbacks composed by one pool task, so that a Tick with many small
+    // animations does not pay for a task each
+    const size_t PLAYBACKS_PER_TASK = 8;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAtlasCompositor::GifAtlasCompositor constructor             *
+*                                                                 *
+******************************************************************/
+
+GifAtlasCompositor::GifAtlasCompositor(
+    unsigned int cxPage,
+    unsigned int cyPage,
+    unsigned int cMaxPages,
+    unsigned int cThreads) :
+    m_atlas(cxPage, cyPage, cMaxPages),
+    m_frameCacheMode(FCM_OFF),
+    m_cbFrameCacheBudget(0),
+    m_fClampShortDelays(false),
+    m_nextId(1),
+    m_cFramesComposed(0),
+    m_cResyncs(0),
+    m_cFailed(0),
+    m_threadPool(cThreads)
+{
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAtlasCompositor::SetFrameCacheMode                          *
+*                                                                 *
+******************************************************************/
+
+void GifAtlasCompositor::SetFrameCacheMode(FRAME_CACHE_MODE mode, size_t cbBudget)
+{
+    m_frameCacheMode = mode;
+    m_cbFrameCacheBudget = cbBudget;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAtlasCompositor::Add                                        *
+*                                                                 *
+*  Opens the gif lazily, so that only its first frame is walked   *
+*  before it starts, and composes it straight into its slot.      *
+*                                                                 *
+******************************************************************/
+
+GifAnimationId GifAtlasCompositor::Add(
+    const std::string& key,
+    std::shared_ptr<GifByteSource> source,
+    unsigned int cxMax,
+    unsigned int cyMax)
+{
+    PlaybackKey playbackKey(key, cxMax, cyMax);
+    auto it = m_playbacks.find(playbackKey);
+    if (it == m_playbacks.end())
+    {
+        auto playback = std::make_unique<Playback>();
+        playback->key = playbackKey;
+        playback->decoder = std::make_shared<GifDecoder>();
+        playback->decoder->SetOpenMode(GOM_LAZY);
+        playback->decoder->SetTargetSize(cxMax, cyMax);
+        playback->decoder->Open(std::move(source));
+
+        GifGlobalInfo globalInfo;
+        playback->decoder->GetGlobalInfo(globalInfo);
+        if (!m_atlas.Allocate(globalInfo.cxGifImage, globalInfo.cyGifImage, playback->slot))
+        {
+            throw std::runtime_error("The atlas has no room for the animation");
+        }
+
+        try
+        {
+            playback->compositor = std::make_unique<GifCompositor>(
+                playback->decoder,
+                std::make_unique<CpuPixelBackend>(m_atlas.GetSlotSurface(playback->slot)));
+        }
+        catch (...)
+        {
+            m_atlas.Free(playback->slot);
+            throw;
+        }
+        playback->compositor->SetFrameCacheMode(m_frameCacheMode, m_cbFrameCacheBudget);
+
+        playback->due = Clock::time_point::min();
+        playback->cRefs = 0;
+        playback->fFinished = (globalInfo.cFrames == 0 && !globalInfo.fFrameCountPartial);
+        playback->fFailed = false;
+        it = m_playbacks.emplace(playbackKey, std::move(playback)).first;
+    }
+
+    it->second->cRefs++;
+    GifAnimationId id = m_nextId++;
+    m_animations[id] = it->second.get();
+    return id;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAtlasCompositor::Remove                                     *
+*                                                                 *
+******************************************************************/
+
+void GifAtlasCompositor::Remove(GifAnimationId id)
+{
+    auto it = m_animations.find(id);
+    if (it == m_animations.end())
+    {
+        throw std::invalid_argument("Unknown animation");
+    }
+
+    Playback* pPlayback = it->second;
+    m_animations.erase(it);
+    if (--pPlayback->cRefs == 0)
+    {
+        m_atlas.Free(pPlayback->slot);
+        PlaybackKey key = pPlayback->key;     // Not a reference into the node being erased
+        m_playbacks.erase(key);
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAtlasCompositor::Tick                                       *
+*                                                                 *
+*  Composes the due playbacks on the thread pool, a few per task, *
+*  then moves each one's due time on by its frame delay.  A       *
+*  playback that is more than a frame behind is moved to now      *
+*  rather than composing every frame it missed.                   *
+*                                                                 *
+******************************************************************/
+
+void GifAtlasCompositor::Tick(Clock::time_point now, std::vector<GifAtlasUpdate>& updates)
+{
+    m_due.clear();
+    for (auto& entry : m_playbacks)
+    {
+        if (!entry.second->fFinished && entry.second->due <= now)
+        {
+            m_due.push_back(entry.second.get());
+        }
+    }
+    if (m_due.empty())
+    {
+        return;
+    }
+
+    for (size_t iFirst = 0; iFirst < m_due.size(); iFirst += PLAYBACKS_PER_TASK)
+    {
+        size_t iEnd = std::min(iFirst + PLAYBACKS_PER_TASK, m_due.size());
+        m_threadPool.Submit([this, iFirst, iEnd](unsigned int)
+        {
+            for (size_t i = iFirst; i < iEnd; i++)
+            {
+                Playback& playback = *m_due[i];
+                try
+                {
+                    if (playback.compositor->IsNextFrameReady())
+                    {
+                        playback.compositor->ComposeNextFrame();
+                    }
+                    else
+                    {
+                        playback.fFailed = true;
+                    }
+                }
+                catch (...)
+                {
+                    // Tasks must not throw; the error is kept for GetError
+                    playback.fFailed = true;
+                    playback.error = std::current_exception();
+                }
+            }
+        });
+    }
+    m_threadPool.Wait();
+
+    size_t iFirstUpdate = updates.size();
+    for (auto pPlayback : m_due)
+    {
+        auto& compositor = *pPlayback->compositor;
+        if (pPlayback->fFailed)
+        {
+            pPlayback->fFinished = true;
+            m_cFailed++;
+            continue;
+        }
+        m_cFramesComposed++;
+
+        const GifRect& dirtyRect = compositor.GetDirtyRect();
+        const GifRect& slotRect = pPlayback->slot.rect;
+        GifRect pageRect = {
+            slotRect.left + dirtyRect.left,
+            slotRect.top + dirtyRect.top,
+            slotRect.left + dirtyRect.right,
+            slotRect.top + dirtyRect.bottom };
+        pageRect = IntersectGifRect(pageRect, slotRect);
+        if (!pageRect.IsEmpty())
+        {
+            updates.push_back({ pPlayback->slot.uPage, pageRect });
+        }
+
+        if (compositor.EndOfAnimation())
+        {
+            pPlayback->fFinished = true;
+            continue;
+        }
+
+        unsigned int uDelay = compositor.GetFrameDelay();
+        if (m_fClampShortDelays && uDelay <= GIF_ATLAS_SHORT_DELAY)
+        {
+            uDelay = GIF_ATLAS_SHORT_DELAY_FIX;
+        }
+        auto delay = std::chrono::milliseconds(uDelay);
+        if (pPlayback->due == Clock::time_point::min() || uDelay == 0)
+        {
+            pPlayback->due = now + delay;
+        }
+        else
+        {
+            pPlayback->due += delay;
+            if (pPlayback->due <= now)
+            {
+                pPlayback->due = now + delay;
+                m_cResyncs++;
+            }
+        }
+    }
+
+    std::stable_sort(updates.begin() + iFirstUpdate, updates.end(),
+        [](const GifAtlasUpdate& a, const GifAtlasUpdate& b) { return a.uPage < b.uPage; });
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAtlasCompositor::GetNextDueTime                             *
+*                                                                 *
+******************************************************************/
+
+GifAtlasCompositor::Clock::time_point GifAtlasCompositor::GetNextDueTime() const
+{
+    auto nextDue = Clock::time_point::max();
+    for (const auto& entry : m_playbacks)
+    {
+        if (!entry.second->fFinished)
+        {
+            nextDue = std::min(nextDue, entry.second->due);
+        }
+    }
+    return nextDue;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAtlasCompositor::GetPlacement                               *
+*                                                                 *
+******************************************************************/
+
+const GifAtlasSlot& GifAtlasCompositor::GetPlacement(GifAnimationId id) const
+{
+    return FindPlayback(id).slot;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAtlasCompositor::IsFinished                                 *
+*                                                                 *
+******************************************************************/
+
+bool GifAtlasCompositor::IsFinished(GifAnimationId id) const
+{
+    return FindPlayback(id).fFinished;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAtlasCompositor::GetError                                   *
+*                                                                 *
+******************************************************************/
+
+std::exception_ptr GifAtlasCompositor::GetError(GifAnimationId id) const
+{
+    return FindPlayback(id).error;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAtlasCompositor::GetStats                                   *
+*                                                                 *
+******************************************************************/
+
+GifAtlasStats GifAtlasCompositor::GetStats() const
+{
+    GifAtlasStats stats;
+    stats.cAnimations = static_cast<unsigned int>(m_animations.size());
+    stats.cPlaying = static_cast<unsigned int>(m_playbacks.size());
+    stats.cPages = m_atlas.GetPageCount();
+    stats.cbPages = m_atlas.GetSizeInBytes();
+    stats.cFramesComposed = m_cFramesComposed;
+    stats.cResyncs = m_cResyncs;
+    stats.cFailed = m_cFailed;
+    return stats;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifAtlasCompositor::FindPlayback                               *
+*                                                                 *
+******************************************************************/
+
+GifAtlasCompositor::Playback& GifAtlasCompositor::FindPlayback(GifAnimationId id) const
+{
+    auto it = m_animations.find(id);
+    if (it == m_animations.end())
+    {
+        throw std::invalid_argument("Unknown animation");
+    }
+    return *it->second;
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "GifAtlas.h"
+#include "GifByteSource.h"
+#include "GifCompositor.h"
+#include "GifDecoder.h"
+#include "GifThreadPool.h"
+
+const unsigned int DEFAULT_ATLAS_PAGE_SIZE = 2048;
+const unsigned int DEFAULT_ATLAS_MAX_PAGES = 4;
+
+// With SetClampShortDelays, delays of at most this many ms are shown for
+// GIF_ATLAS_SHORT_DELAY_FIX ms instead, as browsers do
+const unsigned int GIF_ATLAS_SHORT_DELAY = 10;
+const unsigned int GIF_ATLAS_SHORT_DELAY_FIX = 100;
+
+using GifAnimationId = uint64_t;
+
+// A part of an atlas page that changed during a Tick
+struct GifAtlasUpdate
+{
+    unsigned int    uPage;
+    GifRect         dirtyRect;      // In page pixels
+};
+
+struct GifAtlasStats
+{
+    unsigned int    cAnimations;        // Added and not removed
+    unsigned int    cPlaying;           // Distinct playbacks, each with its own decoder and slot
+    unsigned int    cPages;
+    size_t          cbPages;
+    uint64_t        cFramesComposed;
+    uint64_t        cResyncs;           // Times a playback fell behind and was moved to the present
+    uint64_t        cFailed;            // Playbacks stopped by a decode error
+};
+
+/******************************************************************
+*                                                                 *
+*  GifAtlasCompositor                                             *
+*                                                                 *
+*  Plays many small animations at once, composing each into its   *
+*  own slot of a few shared atlas pages (GifAtlas) instead of a   *
+*  bitmap per animation, so a renderer can draw them all from a   *
+*  handful of textures.  A single Tick composes every animation   *
+*  that is due, in parallel on a thread pool, and returns the     *
+*  dirty rects of the pages for one upload per page.              *
+*                                                                 *
+*  Animations added with the same key and size share one decoder, *
+*  compositor and slot, so they are one playback shown in several *
+*  places: an animation added while another with its key plays    *
+*  joins it at its current frame rather than starting from the    *
+*  first.  Animations that must play independently need keys of   *
+*  their own.                                                     *
+*                                                                 *
+*  Frame delays are kept as they are, like the native player      *
+*  does with EXTRA_GIF_DELAY off: a frame with no delay is due    *
+*  again at once and so shown for one Tick.                       *
+*                                                                 *
+******************************************************************/
+
+class GifAtlasCompositor
+{
+public:
+
+    using Clock = std::chrono::steady_clock;
+
+    // The atlas holds at most cMaxPages pages of cxPage by cyPage pixels.
+    // cThreads == 0 uses one thread per hardware thread.
+    GifAtlasCompositor(
+        unsigned int cxPage = DEFAULT_ATLAS_PAGE_SIZE,
+        unsigned int cyPage = DEFAULT_ATLAS_PAGE_SIZE,
+        unsigned int cMaxPages = DEFAULT_ATLAS_MAX_PAGES,
+        unsigned int cThreads = 0);
+
+    GifAtlasCompositor(const GifAtlasCompositor&) = delete;
+    GifAtlasCompositor& operator=(const GifAtlasCompositor&) = delete;
+
+    // Applies to the playbacks started by following Adds.  Defaults to
+    // FCM_OFF, since a cache per animation defeats the shared pages.
+    void SetFrameCacheMode(FRAME_CACHE_MODE mode, size_t cbBudget = DEFAULT_FRAME_CACHE_BUDGET);
+
+    // Shows frames of GIF_ATLAS_SHORT_DELAY ms or less for
+    // GIF_ATLAS_SHORT_DELAY_FIX ms, so that gifs relying on browsers doing
+    // so are not played flat out.  Off by default; applies from the next
+    // Tick.
+    void SetClampShortDelays(bool fClamp)
+    {
+        m_fClampShortDelays = fClamp;
+    }
+
+    // Starts playing a gif, scaled down to fit cxMax by cyMax unless both
+    // are 0 (see GifDecoder::SetTargetSize).  If an animation with the same
+    // key and size is playing, the new one shares its playback, in
+    // lockstep, and source is not read.  The first frame is composed by the
+    // next Tick.  Throws std::runtime_error if the gif cannot be opened or
+    // the atlas is full.
+    GifAnimationId Add(
+        const std::string& key,
+        std::shared_ptr<GifByteSource> source,
+        unsigned int cxMax = 0,
+        unsigned int cyMax = 0);
+
+    // Stops an animation.  Its slot is freed once no animation shares it.
+    void Remove(GifAnimationId id);
+
+    // Composes the next frame of every animation due at now, and appends the
+    // parts of the pages that changed to updates, ordered by page
+    void Tick(Clock::time_point now, std::vector<GifAtlasUpdate>& updates);
+
+    // When the next Tick has something to do, or Clock::time_point::max()
+    // if every animation has ended
+    Clock::time_point GetNextDueTime() const;
+
+    // Where the animation's composed frame is.  The pixels are valid from
+    // the first Tick after Add.
+    const GifAtlasSlot& GetPlacement(GifAnimationId id) const;
+
+    // Whether the animation has shown its last frame, or stopped on a
+    // decode error (and keeps showing the last frame composed)
+    bool IsFinished(GifAnimationId id) const;
+
+    // The exception that stopped the animation, or null if it did not fail
+    // or only ran out of data
+    std::exception_ptr GetError(GifAnimationId id) const;
+
+    GifSurface GetPage(unsigned int uPage)
+    {
+        return m_atlas.GetPage(uPage);
+    }
+
+    GifAtlasStats GetStats() const;
+
+private:
+
+    using PlaybackKey = std::tuple<std::string, unsigned int, unsigned int>;
+
+    struct Playback
+    {
+        PlaybackKey                     key;
+        std::shared_ptr<GifDecoder>     decoder;
+        std::unique_ptr<GifCompositor>  compositor;
+        GifAtlasSlot                    slot;
+        Clock::time_point               due;
+        unsigned int                    cRefs;
+        bool                            fFinished;
+        bool                            fFailed;    // Set by the worker composing it
+        std::exception_ptr              error;      // Set with fFailed when composing threw
+    };
+
+    Playback& FindPlayback(GifAnimationId id) const;
+
+private:
+
+    GifAtlas                                        m_atlas;
+    FRAME_CACHE_MODE                                m_frameCacheMode;
+    size_t                                          m_cbFrameCacheBudget;
+    bool                                            m_fClampShortDelays;
+    std::map<PlaybackKey, std::unique_ptr<Playback>>    m_playbacks;
+    std::map<GifAnimationId, Playback*>             m_animations;
+    GifAnimationId                                  m_nextId;
+    std::vector<Playback*>                          m_due;      // Kept between Ticks for its capacity
+    uint64_t                                        m_cFramesComposed;
+    uint64_t                                        m_cResyncs;
+    uint64_t                                        m_cFailed;
+
+    // Last, so the workers are joined before the state they use goes away
+    GifThreadPool                                   m_threadPool;
+};
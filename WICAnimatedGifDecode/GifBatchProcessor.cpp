@@ -0,0 +1,182 @@
+#include "GifBatchProcessor.h"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+
+namespace
+{
+    void CopySurface(const GifSurface& source, GifBitmap& dest)
+    {
+        dest.Resize(source.cx, source.cy);
+        auto destSurface = dest.Surface();
+        for (unsigned int y = 0; y < source.cy; y++)
+        {
+            memcpy(destSurface.Row(y), source.Row(y), source.cx * sizeof(uint32_t));
+        }
+    }
+
+    // The message of an exception of any type, for GifBatchResult::error
+    std::string DescribeException(std::exception_ptr error)
+    {
+        try
+        {
+            std::rethrow_exception(error);
+        }
+        catch (const std::exception& e)
+        {
+            return e.what();
+        }
+        catch (...)
+        {
+            return "Unknown error";
+        }
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifBatchProcessor::GifBatchProcessor constructor               *
+*                                                                 *
+******************************************************************/
+
+GifBatchProcessor::GifBatchProcessor(ResultCallback callback, unsigned int cThreads) :
+    m_callback(std::move(callback)),
+    m_threadPool(cThreads)
+{
+    // Nothing has been submitted yet, so no worker can be using the contexts
+    m_contexts.resize(m_threadPool.GetThreadCount());
+}
+
+/******************************************************************
+*                                                                 *
+*  GifBatchProcessor::~GifBatchProcessor destructor               *
+*                                                                 *
+******************************************************************/
+
+GifBatchProcessor::~GifBatchProcessor()
+{
+    Wait();
+}
+
+/******************************************************************
+*                                                                 *
+*  GifBatchProcessor::Submit                                      *
+*                                                                 *
+******************************************************************/
+
+void GifBatchProcessor::Submit(GifBatchInput input)
+{
+    auto pInput = std::make_shared<GifBatchInput>(std::move(input));
+
+    m_threadPool.Submit([this, pInput](unsigned int uWorker)
+    {
+        GifBatchResult result = {};
+        result.uTag = pInput->uTag;
+
+        try
+        {
+            Process(m_contexts[uWorker], *pInput, result);
+            result.fSucceeded = true;
+        }
+        catch (...)
+        {
+            // Tasks must not throw, whatever the exception
+            result.fSucceeded = false;
+            result.error = DescribeException(std::current_exception());
+            result.frames.clear();
+        }
+
+        std::lock_guard<std::mutex> lock(m_callbackLock);
+        m_callback(std::move(result));
+    });
+}
+
+/******************************************************************
+*                                                                 *
+*  GifBatchProcessor::Wait                                        *
+*                                                                 *
+******************************************************************/
+
+void GifBatchProcessor::Wait()
+{
+    m_threadPool.Wait();
+}
+
+/******************************************************************
+*                                                                 *
+*  GifBatchProcessor::Process                                     *
+*                                                                 *
+*  Opens one gif on the worker's decoder and composes frames up   *
+*  to the last requested one.                                     *
+*                                                                 *
+******************************************************************/
+
+void GifBatchProcessor::Process(WorkerContext& context, GifBatchInput& input, GifBatchResult& result)
+{
+    if (!context.decoder)
+    {
+        context.decoder = std::make_shared<GifDecoder>();
+    }
+
+    context.decoder->SetTargetSize(input.cxMax, input.cyMax);
+    if (input.data.empty())
+    {
+        context.decoder->Open(GifByteSource::MapFile(input.path));
+    }
+    else
+    {
+        context.decoder->Open(std::move(input.data));
+    }
+
+    // Each gif is composed once front to back, so there is nothing to cache
+    if (!context.compositor)
+    {
+        context.compositor = std::make_unique<GifCompositor>(context.decoder, std::make_unique<CpuPixelBackend>());
+        context.compositor->SetFrameCacheMode(FCM_OFF);
+    }
+    else
+    {
+        context.compositor->Reset();
+    }
+
+    auto& compositor = *context.compositor;
+    result.globalInfo = compositor.GetGlobalInfo();
+
+    auto& requested = input.composedFrames;
+    std::sort(requested.begin(), requested.end());
+    requested.erase(std::unique(requested.begin(), requested.end()), requested.end());
+
+    if (result.globalInfo.cFrames == 0)
+    {
+        return;
+    }
+
+    // Displayed frames are only known by composing, so stop after the last
+    // requested one or at the end of the first loop
+    auto itRequested = requested.begin();
+    unsigned int uFrameNumber = 0;
+    while (itRequested != requested.end())
+    {
+        compositor.ComposeNextFrame();
+
+        if (*itRequested == uFrameNumber)
+        {
+            GifBatchFrame frame;
+            frame.uFrameNumber = uFrameNumber;
+            frame.uFrameDelay = compositor.GetFrameDelay();
+            CopySurface(compositor.GetComposedFrame(), frame.composedFrame);
+            result.frames.push_back(std::move(frame));
+            ++itRequested;
+        }
+
+        uFrameNumber++;
+        if (compositor.IsLastFrame())
+        {
+            break;
+        }
+    }
+
+    result.cDisplayedFrames = uFrameNumber;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "GifCompositor.h"
+#include "GifDecoder.h"
+#include "GifThreadPool.h"
+
+// One gif to process.  Either path or data is set.
+struct GifBatchInput
+{
+    std::string                 path;           // File to read, if data is empty
+    std::vector<uint8_t>        data;           // In memory gif
+    std::vector<unsigned int>   composedFrames; // Displayed frame numbers to return, in the first loop
+    unsigned int                cxMax = 0;      // Compose at the largest size that fits, or at the gif's own size for 0 by 0
+    unsigned int                cyMax = 0;
+    uint64_t                    uTag;           // Caller cookie, passed back in the result
+};
+
+struct GifBatchFrame
+{
+    unsigned int    uFrameNumber;   // Displayed frame number (zero delay frames are folded in)
+    unsigned int    uFrameDelay;    // ms
+    GifBitmap       composedFrame;
+};
+
+struct GifBatchResult
+{
+    uint64_t                    uTag;
+    bool                        fSucceeded;
+    std::string                 error;          // Set when fSucceeded is false
+    GifGlobalInfo               globalInfo;
+    unsigned int                cDisplayedFrames;   // Frames composed, which stops after the last requested one
+    std::vector<GifBatchFrame>  frames;         // Requested frames in increasing order
+};
+
+/******************************************************************
+*                                                                 *
+*  GifBatchProcessor                                              *
+*                                                                 *
+*  Decodes and composes many gifs in parallel.  Inputs are queued *
+*  on a work-stealing thread pool, and each worker keeps its own  *
+*  decoder and compositor so their buffers are reused from one    *
+*  gif to the next.  Results are delivered as each gif finishes,  *
+*  in completion order.                                           *
+*                                                                 *
+******************************************************************/
+
+class GifBatchProcessor
+{
+public:
+
+    // Called once per input.  Calls are serialized but come from the
+    // worker threads.
+    using ResultCallback = std::function<void(GifBatchResult&& result)>;
+
+    // cThreads == 0 uses one thread per hardware thread
+    GifBatchProcessor(ResultCallback callback, unsigned int cThreads = 0);
+    ~GifBatchProcessor();
+
+    // Queues a gif.  Safe to call from any thread, including the callback.
+    void Submit(GifBatchInput input);
+
+    // Blocks until every submitted gif has been delivered
+    void Wait();
+
+    unsigned int GetThreadCount() const
+    {
+        return m_threadPool.GetThreadCount();
+    }
+
+private:
+
+    struct WorkerContext
+    {
+        std::shared_ptr<GifDecoder>     decoder;
+        std::unique_ptr<GifCompositor>  compositor;
+    };
+
+    void Process(WorkerContext& context, GifBatchInput& input, GifBatchResult& result);
+
+private:
+
+    ResultCallback              m_callback;
+    std::mutex                  m_callbackLock;
+    std::vector<WorkerContext>  m_contexts;     // Indexed by worker
+
+    // Last, so the workers are joined before the state they use goes away
+    GifThreadPool               m_threadPool;
+};
@@ -0,0 +1,196 @@
+#include "GifByteSource.h"
+
+#include <fstream>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/******************************************************************
+*                                                                 *
+*  GifByteSource::GifByteSource constructor                       *
+*                                                                 *
+******************************************************************/
+
+GifByteSource::GifByteSource() :
+    m_pData(nullptr),
+    m_cbData(0),
+    m_pMapping(nullptr)
+{
+}
+
+/******************************************************************
+*                                                                 *
+*  GifByteSource::~GifByteSource destructor                       *
+*                                                                 *
+******************************************************************/
+
+GifByteSource::~GifByteSource()
+{
+    if (m_pMapping != nullptr)
+    {
+#if defined(_WIN32)
+        UnmapViewOfFile(m_pMapping);
+#else
+        munmap(m_pMapping, m_cbData);
+#endif
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifByteSource::MapFile                                         *
+*                                                                 *
+*  Maps the whole file.  Empty files cannot be mapped and give an *
+*  empty source, which the decoder rejects like any non-gif.      *
+*                                                                 *
+******************************************************************/
+
+std::shared_ptr<GifByteSource> GifByteSource::MapFile(const std::filesystem::path& path)
+{
+    std::shared_ptr<GifByteSource> source(new GifByteSource());
+
+#if defined(_WIN32)
+    HANDLE hFile = CreateFileW(
+        path.c_str(),
+        GENERIC_READ,
+        FILE_SHARE_READ,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        throw std::runtime_error("Cannot open " + path.string());
+    }
+
+    LARGE_INTEGER cbFile;
+    if (!GetFileSizeEx(hFile, &cbFile) || static_cast<uint64_t>(cbFile.QuadPart) > SIZE_MAX)
+    {
+        CloseHandle(hFile);
+        throw std::runtime_error("Cannot get the size of " + path.string());
+    }
+
+    if (cbFile.QuadPart > 0)
+    {
+        // The view keeps the file mapping alive, so both handles can be closed
+        HANDLE hMapping = CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(hFile);
+        if (hMapping == nullptr)
+        {
+            throw std::runtime_error("Cannot map " + path.string());
+        }
+
+        auto pView = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(hMapping);
+        if (pView == nullptr)
+        {
+            throw std::runtime_error("Cannot map " + path.string());
+        }
+
+        source->m_pMapping = pView;
+        source->m_pData = static_cast<const uint8_t*>(pView);
+        source->m_cbData = static_cast<size_t>(cbFile.QuadPart);
+    }
+    else
+    {
+        CloseHandle(hFile);
+    }
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Cannot open " + path.string());
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0)
+    {
+        close(fd);
+        throw std::runtime_error("Cannot get the size of " + path.string());
+    }
+
+    if (fileStat.st_size > 0)
+    {
+        auto cbFile = static_cast<size_t>(fileStat.st_size);
+        auto pView = mmap(nullptr, cbFile, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (pView == MAP_FAILED)
+        {
+            throw std::runtime_error("Cannot map " + path.string());
+        }
+
+        source->m_pMapping = pView;
+        source->m_pData = static_cast<const uint8_t*>(pView);
+        source->m_cbData = cbFile;
+    }
+    else
+    {
+        close(fd);
+    }
+#endif
+
+    return source;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifByteSource::ReadFile                                        *
+*                                                                 *
+******************************************************************/
+
+std::shared_ptr<GifByteSource> GifByteSource::ReadFile(const std::filesystem::path& path)
+{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+    {
+        throw std::runtime_error("Cannot open " + path.string());
+    }
+
+    std::vector<uint8_t> data(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    if (!file.read(reinterpret_cast<char*>(data.data()), data.size()))
+    {
+        throw std::runtime_error("Cannot read " + path.string());
+    }
+
+    return FromVector(std::move(data));
+}
+
+/******************************************************************
+*                                                                 *
+*  GifByteSource::FromVector                                      *
+*                                                                 *
+******************************************************************/
+
+std::shared_ptr<GifByteSource> GifByteSource::FromVector(std::vector<uint8_t> data)
+{
+    std::shared_ptr<GifByteSource> source(new GifByteSource());
+    source->m_ownedData = std::move(data);
+    source->m_pData = source->m_ownedData.data();
+    source->m_cbData = source->m_ownedData.size();
+    return source;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifByteSource::FromSpan                                        *
+*                                                                 *
+******************************************************************/
+
+std::shared_ptr<GifByteSource> GifByteSource::FromSpan(const uint8_t* pData, size_t cbData)
+{
+    std::shared_ptr<GifByteSource> source(new GifByteSource());
+    source->m_pData = pData;
+    source->m_cbData = cbData;
+    return source;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+/******************************************************************
+*                                                                 *
+*  GifByteSource                                                  *
+*                                                                 *
+*  Read-only bytes of a gif file.  The decoder walks them in      *
+*  place, so a mapped file is never copied and only the pages     *
+*  holding the blocks that are actually parsed or decoded are     *
+*  read from disk.                                                *
+*                                                                 *
+******************************************************************/
+
+class GifByteSource
+{
+public:
+
+    // Maps the file read-only.  Throws std::runtime_error on failure.
+    static std::shared_ptr<GifByteSource> MapFile(const std::filesystem::path& path);
+
+    // Reads the whole file into memory with buffered I/O
+    static std::shared_ptr<GifByteSource> ReadFile(const std::filesystem::path& path);
+
+    // Takes ownership of data already in memory
+    static std::shared_ptr<GifByteSource> FromVector(std::vector<uint8_t> data);
+
+    // Wraps bytes owned by the caller, which must outlive every user of the source
+    static std::shared_ptr<GifByteSource> FromSpan(const uint8_t* pData, size_t cbData);
+
+    ~GifByteSource();
+
+    GifByteSource(const GifByteSource&) = delete;
+    GifByteSource& operator=(const GifByteSource&) = delete;
+
+    const uint8_t* Data() const
+    {
+        return m_pData;
+    }
+
+    size_t Size() const
+    {
+        return m_cbData;
+    }
+
+private:
+
+    GifByteSource();
+
+private:
+
+    const uint8_t*          m_pData;
+    size_t                  m_cbData;
+    std::vector<uint8_t>    m_ownedData;
+    void*                   m_pMapping;     // Mapped view to unmap, if any
+};
@@ -0,0 +1,693 @@
+#include "GifCompositor.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "GifTrace.h"
+
+namespace
+{
+    bool CoversCanvas(const GifRect& rect, const GifGlobalInfo& globalInfo)
+    {
+        return rect.left == 0 && rect.top == 0 &&
+            rect.right >= globalInfo.cxGifImage && rect.bottom >= globalInfo.cyGifImage;
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifCompositor::GifCompositor constructor                       *
+*                                                                 *
+******************************************************************/
+
+GifCompositor::GifCompositor(
+    std::shared_ptr<IGifFrameSource> source,
+    std::unique_ptr<IPixelBackend> backend) :
+    m_source(std::move(source)),
+    m_backend(std::move(backend)),
+    m_uFrameCacheCodec(GFC_NONE),
+    m_cSeekInterval(DEFAULT_SEEK_INTERVAL)
+{
+    m_frameCache.Configure(FCM_FULL, DEFAULT_FRAME_CACHE_BUDGET);
+    Reset();
+}
+
+/******************************************************************
+*                                                                 *
+*  GifCompositor::Reset                                           *
+*                                                                 *
+*  Reads the global metadata, recreates the composed frame and    *
+*  rewinds to the start of the animation.                         *
+*                                                                 *
+******************************************************************/
+
+void GifCompositor::Reset()
+{
+    m_source->GetGlobalInfo(m_globalInfo);
+    m_backend->Initialize(m_globalInfo.cxGifImage, m_globalInfo.cyGifImage);
+    m_frameCache.Clear();
+
+    m_rawFrame = {};
+    m_uNextFrameIndex = 0;
+    m_uFrameDisposal = GIF_DM_NONE;  // No previous frame, use disposal none
+    m_uFrameDelay = 0;
+    m_uLoopNumber = 0;
+    m_framePosition = {};
+    m_dirtyRect = { 0, 0, m_globalInfo.cxGifImage, m_globalInfo.cyGifImage };
+
+    ClearSeekIndex();
+
+    m_cSavedPixelsMax = 0;
+    if (!m_globalInfo.fFrameCountPartial)
+    {
+        for (unsigned int uFrameIndex = 0; uFrameIndex < m_globalInfo.cFrames; uFrameIndex++)
+        {
+            GifFrameInfo frameInfo;
+            m_source->GetFrameInfo(uFrameIndex, frameInfo);
+            UpdateSavedPixelsMax(frameInfo);
+        }
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifCompositor::SetFrameCacheMode                               *
+*                                                                 *
+******************************************************************/
+
+void GifCompositor::SetFrameCacheMode(FRAME_CACHE_MODE mode, size_t cbBudget)
+{
+    m_frameCache.Configure(mode, cbBudget);
+}
+
+/******************************************************************
+*                                                                 *
+*  GifCompositor::SetFrameCacheCodec                              *
+*                                                                 *
+******************************************************************/
+
+void GifCompositor::SetFrameCacheCodec(unsigned int uCodec)
+{
+    m_uFrameCacheCodec = uCodec;
+    m_frameCache.Clear();
+}
+
+/******************************************************************
+*                                                                 *
+*  GifCompositor::SetSeekInterval                                 *
+*                                                                 *
+******************************************************************/
+
+void GifCompositor::SetSeekInterval(unsigned int cInterval)
+{
+    m_cSeekInterval = cInterval;
+    ClearSeekIndex();
+}
+
+/******************************************************************
+*                                                                 *
+*  GifCompositor::SeekToFrame                                     *
+*                                                                 *
+*  Starts from the closest known seek point at or before the      *
+*  frame and replays the raw frames from there, recording new     *
+*  seek points for any frames replayed for the first time.        *
+*                                                                 *
+******************************************************************/
+
+void GifCompositor::SeekToFrame(unsigned int uFrameIndex)
+{
+    if (!HasFrame(uFrameIndex))
+    {
+        throw std::out_of_range("Frame index out of range");
+    }
+
+    // Seeking stays within the current loop
+    auto uLoopNumber = std::max(m_uLoopNumber, 1u);
+
+    // Frame 0 is always a restart point
+    auto it = m_seekPoints.upper_bound(std::min(uFrameIndex, m_uSeekIndexEnd));
+    --it;
+
+    if (it->second.fRestart)
+    {
+        m_backend->Clear({ 0, 0, m_globalInfo.cxGifImage, m_globalInfo.cyGifImage }, m_globalInfo.backgroundColor);
+        m_uFrameDisposal = GIF_DM_NONE;
+        m_framePosition = {};
+        m_uNextFrameIndex = it->first;
+    }
+    else
+    {
+        LoadState(it->second.state);
+    }
+
+    for (auto uIndex = it->first; uIndex <= uFrameIndex; uIndex++)
+    {
+        UpdateSeekIndex();
+        DisposeCurrentFrame();
+        OverlayNextFrame();
+    }
+
+    m_uLoopNumber = uLoopNumber;
+
+    // The previously composed frame could have been any frame
+    m_dirtyRect = { 0, 0, m_globalInfo.cxGifImage, m_globalInfo.cyGifImage };
+}
+
+/******************************************************************
+*                                                                 *
+*  GifCompositor::ComposeNextFrame                                *
+*                                                                 *
+*  Composes the next frame by first disposing the current frame   *
+*  and then overlaying the next frame, or restores it from the    *
+*  frame cache if an earlier loop already composed it.  Zero      *
+*  delay frames before it are planned as one run, so that only    *
+*  their net effect on the displayed frame is composed.  The      *
+*  composed frame stays as it is while the frames have not        *
+*  arrived.                                                       *
+*                                                                 *
+******************************************************************/
+
+void GifCompositor::ComposeNextFrame()
+{
+    GIF_TRACE_SCOPE(GTS_COMPOSE, m_uNextFrameIndex);
+
+    if (!IsNextFrameReady() || RestoreCachedFrame())
+    {
+        return;
+    }
+
+    auto uFirstFrameIndex = m_uNextFrameIndex;
+
+    m_dirtyRect = {};
+
+    DisposeCurrentFrame();
+
+    // Plan the run of frames up to the first frame with a delay greater
+    // than 0 (0 delay frames are the invisible intermediate frames), or up
+    // to the very last frame
+    m_frameRun.Plan(m_uNextFrameIndex, m_globalInfo.cFrames,
+        [this](unsigned int uFrameIndex, GifFrameInfo& frameInfo) { m_source->GetFrameInfo(uFrameIndex, frameInfo); },
+        [this](unsigned int uFrameIndex) { return m_source->IsFrameOpaque(uFrameIndex); });
+
+    const auto& steps = m_frameRun.GetSteps();
+    for (size_t i = 0; i + 1 < steps.size(); i++)
+    {
+        ApplyRunStep(steps[i]);
+    }
+    OverlayNextFrame();
+
+    CacheComposedFrame(uFirstFrameIndex, static_cast<unsigned int>(steps.size()));
+}
+
+/******************************************************************
+*                                                                 *
+*  GifCompositor::DisposeCurrentFrame                             *
+*                                                                 *
+*  Disposes the current frame based on its disposal method.       *
+*                                                                 *
+******************************************************************/
+
+void GifCompositor::DisposeCurrentFrame()
+{
+    GIF_TRACE_SCOPE(GTS_DISPOSE, m_uNextFrameIndex);
+
+    switch (m_uFrameDisposal)
+    {
+    case GIF_DM_UNDEFINED:
+    case GIF_DM_NONE:
+        // We simply draw on the previous frames. Do nothing here.
+        break;
+    case GIF_DM_BACKGROUND:
+        // Clear the area covered by the current raw frame with background color
+        m_backend->Clear(m_framePosition, m_globalInfo.backgroundColor);
+        m_dirtyRect = UnionGifRect(m_dirtyRect, m_framePosition);
+        break;
+    case GIF_DM_PREVIOUS:
+        // We restore the previous composed frame first.  Only the current
+        // frame was drawn since it was saved, so only its area changes.
+        {
+            GIF_TRACE_SCOPE(GTS_RESTORE, m_uNextFrameIndex);
+            m_backend->RestoreFrame();
+        }
+        m_dirtyRect = UnionGifRect(m_dirtyRect, m_framePosition);
+        break;
+    default:
+        throw std::runtime_error("Invalid disposal method");
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifCompositor::OverlayNextFrame                                *
+*                                                                 *
+*  Loads and draws the next raw frame onto the composed frame.    *
+*                                                                 *
+******************************************************************/
+
+void GifCompositor::OverlayNextFrame()
+{
+    GifFrameInfo frameInfo;
+    m_source->GetFrameInfo(m_uNextFrameIndex, frameInfo);
+    m_framePosition = frameInfo.rect;
+    m_uFrameDelay = frameInfo.uDelay;
+    m_uFrameDisposal = frameInfo.uDisposal;
+    UpdateSavedPixelsMax(frameInfo);
+
+    // If starting a new animation loop.  This happens before the frame is
+    // saved, so that disposing a disposal 3 first frame restores the
+    // background rather than the last frame of the previous loop.
+    if (m_uNextFrameIndex == 0)
+    {
+        StartLoop();
+    }
+
+    // For disposal 3 method, save a copy of the area the frame covers
+    if (m_uFrameDisposal == GIF_DM_PREVIOUS)
+    {
+        GIF_TRACE_SCOPE(GTS_SAVE, m_uNextFrameIndex);
+        m_backend->SaveFrame(m_framePosition);
+    }
+
+    DrawRawFrame(m_uNextFrameIndex);
+    m_dirtyRect = UnionGifRect(m_dirtyRect, m_framePosition);
+
+    m_uNextFrameIndex = IsPastLastFrame(m_uNextFrameIndex + 1) ? 0 : m_uNextFrameIndex + 1;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifCompositor::ApplyRunStep                                    *
+*                                                                 *
+*  Applies the net effect of a zero delay intermediate frame:     *
+*  drawing it and disposing it right away, as planned by          *
+*  GifFrameRun.  The displayed frame is overlaid as usual.        *
+*                                                                 *
+******************************************************************/
+
+void GifCompositor::ApplyRunStep(const GifFrameRunStep& step)
+{
+    if (step.uFrameIndex == 0)
+    {
+        StartLoop();
+    }
+
+    switch (step.action)
+    {
+    case GIF_RUN_SKIP:
+        break;
+    case GIF_RUN_DRAW:
+        DrawRawFrame(step.uFrameIndex);
+        m_dirtyRect = UnionGifRect(m_dirtyRect, step.info.rect);
+        break;
+    case GIF_RUN_CLEAR:
+        m_backend->Clear(step.info.rect, m_globalInfo.backgroundColor);
+        m_dirtyRect = UnionGifRect(m_dirtyRect, step.info.rect);
+        break;
+    default:
+        throw std::logic_error("The displayed frame is overlaid, not applied");
+    }
+
+    // Intermediate frames are never the last frame, so this does not wrap
+    m_uNextFrameIndex = step.uFrameIndex + 1;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifCompositor::StartLoop                                       *
+*                                                                 *
+*  Draws the background and increases the loop count.             *
+*                                                                 *
+******************************************************************/
+
+void GifCompositor::StartLoop()
+{
+    GifRect canvasRect = { 0, 0, m_globalInfo.cxGifImage, m_globalInfo.cyGifImage };
+    m_backend->Clear(canvasRect, m_globalInfo.backgroundColor);
+    m_dirtyRect = canvasRect;
+    m_uLoopNumber++;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifCompositor::DrawRawFrame                                    *
+*                                                                 *
+*  Lets the source decode straight into the composed frame if it  *
+*  can, otherwise goes through a raw frame.                       *
+*                                                                 *
+******************************************************************/
+
+void GifCompositor::DrawRawFrame(unsigned int uFrameIndex)
+{
+    auto surface = m_backend->GetSurface();
+    bool fDrawn;
+    {
+        GIF_TRACE_SCOPE(GTS_DECODE, uFrameIndex);
+        fDrawn = !surface.IsEmpty() && m_source->DrawRawFrame(uFrameIndex, surface);
+        if (!fDrawn)
+        {
+            m_source->GetRawFrame(uFrameIndex, m_rawFrame);
+        }
+    }
+
+    if (!fDrawn)
+    {
+        GIF_TRACE_SCOPE(GTS_OVERLAY, uFrameIndex);
+        m_backend->DrawFrame(m_rawFrame);
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifCompositor::IsNextFrameReady                                *
+*                                                                 *
+******************************************************************/
+
+bool GifCompositor::IsNextFrameReady()
+{
+    if (IsPastLastFrame(m_uNextFrameIndex))
+    {
+        m_uNextFrameIndex = 0;
+    }
+
+    if (m_globalInfo.fFrameCountPartial)
+    {
+        return DiscoverRun(m_uNextFrameIndex);
+    }
+    return m_uNextFrameIndex < m_globalInfo.cFrames;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifCompositor::HasFrame                                        *
+*                                                                 *
+*  Asks the source for more frames first if the frame count is    *
+*  not final yet.                                                 *
+*                                                                 *
+******************************************************************/
+
+bool GifCompositor::HasFrame(unsigned int uFrameIndex)
+{
+    if (uFrameIndex >= m_globalInfo.cFrames && m_globalInfo.fFrameCountPartial)
+    {
+        m_source->DiscoverFrames(uFrameIndex + 1, m_globalInfo);
+    }
+    return uFrameIndex < m_globalInfo.cFrames;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifCompositor::IsPastLastFrame                                 *
+*                                                                 *
+*  False for a frame that has not arrived yet but may still.      *
+*                                                                 *
+******************************************************************/
+
+bool GifCompositor::IsPastLastFrame(unsigned int uFrameIndex)
+{
+    return !HasFrame(uFrameIndex) && !m_globalInfo.fFrameCountPartial;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifCompositor::DiscoverRun                                     *
+*                                                                 *
+*  Makes sure the frames of the run starting at uFirstFrameIndex  *
+*  are known, so that planning it sees where it ends.  Returns    *
+*  false if the run goes on past the frames found so far.         *
+*                                                                 *
+******************************************************************/
+
+bool GifCompositor::DiscoverRun(unsigned int uFirstFrameIndex)
+{
+    auto uFrameIndex = uFirstFrameIndex;
+    for (; HasFrame(uFrameIndex); uFrameIndex++)
+    {
+        GifFrameInfo frameInfo;
+        m_source->GetFrameInfo(uFrameIndex, frameInfo);
+        if (frameInfo.uDelay != 0)
+        {
+            return true;
+        }
+    }
+
+    // The run ends with the last frame
+    return uFrameIndex > uFirstFrameIndex && !m_globalInfo.fFrameCountPartial;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifCompositor::RestoreCachedFrame                              *
+*                                                                 *
+*  On a frame cache hit, loads the cached composed frame into     *
+*  the backend and advances the state as if it had been composed. *
+*  The shared frame store is only asked on a frame cache miss.    *
+*                                                                 *
+******************************************************************/
+
+bool GifCompositor::RestoreCachedFrame()
+{
+    GIF_TRACE_SCOPE(GTS_CACHE, m_uNextFrameIndex);
+
+    auto cachedFrame = m_frameCache.Lookup(m_uNextFrameIndex);
+    std::shared_ptr<const GifCachedFrame> sharedFrame;  // Keeps the frame alive if the store drops it meanwhile
+    if (cachedFrame == nullptr && m_sharedFrames)
+    {
+        sharedFrame = m_sharedFrames->Lookup(m_uNextFrameIndex);
+        cachedFrame = sharedFrame.get();
+    }
+    if (cachedFrame == nullptr)
+    {
+        return false;
+    }
+
+    if (m_uNextFrameIndex == 0)
+    {
+        m_uLoopNumber++;
+    }
+
+    LoadState(*cachedFrame);
+
+    return true;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifCompositor::CacheComposedFrame                              *
+*                                                                 *
+******************************************************************/
+
+void GifCompositor::CacheComposedFrame(unsigned int uFirstFrameIndex, unsigned int cFramesComposed)
+{
+    if (m_sharedFrames && m_sharedFrames->ShouldInsert(uFirstFrameIndex))
+    {
+        GIF_TRACE_SCOPE(GTS_CACHE, uFirstFrameIndex);
+
+        auto sharedFrame = std::make_shared<GifCachedFrame>();
+        auto uCodec = m_sharedFrames->GetCodec();
+        if (uCodec != GFC_NONE)
+        {
+            SavePackedState(*sharedFrame, uCodec);
+        }
+        else
+        {
+            SaveState(*sharedFrame);
+        }
+        m_sharedFrames->Insert(uFirstFrameIndex, std::move(sharedFrame), cFramesComposed);
+    }
+
+    if (!m_frameCache.ShouldCache(uFirstFrameIndex))
+    {
+        return;
+    }
+
+    GIF_TRACE_SCOPE(GTS_CACHE, uFirstFrameIndex);
+
+    // Reuse the buffers of the frame the cache evicted last.  The spares
+    // are handed to different frames from loop to loop, so each keeps room
+    // for the largest saved frame whether or not this one has one.
+    auto cachedFrame = m_frameCache.TakeSpareFrame();
+    cachedFrame.snapshot.savedFrame.Reserve(m_cSavedPixelsMax);
+    if (m_uFrameCacheCodec != GFC_NONE)
+    {
+        SavePackedState(cachedFrame, m_uFrameCacheCodec);
+    }
+    else
+    {
+        SaveState(cachedFrame);
+    }
+
+    auto cbSize = cachedFrame.SizeInBytes();
+    m_frameCache.Insert(uFirstFrameIndex, std::move(cachedFrame), cbSize, cFramesComposed);
+}
+
+/******************************************************************
+*                                                                 *
+*  GifCompositor::UpdateSavedPixelsMax                            *
+*                                                                 *
+******************************************************************/
+
+void GifCompositor::UpdateSavedPixelsMax(const GifFrameInfo& frameInfo)
+{
+    if (frameInfo.uDisposal == GIF_DM_PREVIOUS)
+    {
+        auto savedRect = IntersectGifRect(frameInfo.rect, { 0, 0, m_globalInfo.cxGifImage, m_globalInfo.cyGifImage });
+        m_cSavedPixelsMax = std::max(m_cSavedPixelsMax, static_cast<size_t>(savedRect.Width()) * savedRect.Height());
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifCompositor::SaveState                                       *
+*                                                                 *
+*  Captures the composed frame and everything needed to continue  *
+*  composing from it.                                             *
+*                                                                 *
+******************************************************************/
+
+void GifCompositor::SaveState(GifCachedFrame& state)
+{
+    m_backend->SaveSnapshot(state.snapshot, m_uFrameDisposal == GIF_DM_PREVIOUS);
+    state.fPacked = false;
+    state.framePosition = m_framePosition;
+    state.dirtyRect = m_dirtyRect;
+    state.uFrameDisposal = m_uFrameDisposal;
+    state.uFrameDelay = m_uFrameDelay;
+    state.uNextFrameIndex = m_uNextFrameIndex;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifCompositor::SavePackedState                                 *
+*                                                                 *
+*  SaveState for the frame cache or the shared frame store with a *
+*  codec.  With GFC_DELTA only the dirty rect is kept: frames are *
+*  restored in the order they were composed, on top of the frame  *
+*  displayed before, and the dirty rect is what the compositor    *
+*  changed of that frame, which is the same for every compositor  *
+*  playing the gif at the same size.  Seeking does not use the    *
+*  frame cache, and the first frame of a loop and frames after a  *
+*  seek are dirty all over.                                       *
+*                                                                 *
+******************************************************************/
+
+void GifCompositor::SavePackedState(GifCachedFrame& state, unsigned int uCodec)
+{
+    auto& unpacked = m_unpackedState;
+    m_backend->SaveSnapshot(unpacked, m_uFrameDisposal == GIF_DM_PREVIOUS);
+
+    GifRect frameRect = { 0, 0, unpacked.composedFrame.Width(), unpacked.composedFrame.Height() };
+    state.packedRect = (uCodec & GFC_DELTA) ? IntersectGifRect(m_dirtyRect, frameRect) : frameRect;
+    auto surface = unpacked.composedFrame.Surface();
+    surface.pPixels = surface.Row(state.packedRect.top) + state.packedRect.left;
+    surface.cx = state.packedRect.Width();
+    surface.cy = state.packedRect.Height();
+    PackGifPixels(surface, uCodec, state.packedPixels, m_packScratch);
+    state.fPacked = true;
+
+    state.snapshot.composedFrame.Resize(0, 0);
+    state.snapshot.composedRect = {};
+    state.snapshot.fHasSavedFrame = unpacked.fHasSavedFrame;
+    if (unpacked.fHasSavedFrame)
+    {
+        state.snapshot.savedFrame = unpacked.savedFrame;
+        state.snapshot.savedRect = unpacked.savedRect;
+    }
+
+    state.framePosition = m_framePosition;
+    state.dirtyRect = m_dirtyRect;
+    state.uFrameDisposal = m_uFrameDisposal;
+    state.uFrameDelay = m_uFrameDelay;
+    state.uNextFrameIndex = m_uNextFrameIndex;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifCompositor::LoadState                                       *
+*                                                                 *
+******************************************************************/
+
+void GifCompositor::LoadState(const GifCachedFrame& state)
+{
+    if (state.fPacked)
+    {
+        auto& unpacked = m_unpackedState;
+        unpacked.composedFrame.Resize(state.packedRect.Width(), state.packedRect.Height());
+        UnpackGifPixels(state.packedPixels, unpacked.composedFrame.Surface(), m_packScratch);
+        unpacked.composedRect = state.packedRect;
+        unpacked.fHasSavedFrame = state.snapshot.fHasSavedFrame;
+        if (unpacked.fHasSavedFrame)
+        {
+            unpacked.savedFrame = state.snapshot.savedFrame;
+            unpacked.savedRect = state.snapshot.savedRect;
+        }
+        m_backend->LoadSnapshot(unpacked);
+    }
+    else
+    {
+        m_backend->LoadSnapshot(state.snapshot);
+    }
+    m_framePosition = state.framePosition;
+    m_dirtyRect = state.dirtyRect;
+    m_uFrameDisposal = state.uFrameDisposal;
+    m_uFrameDelay = state.uFrameDelay;
+    m_uNextFrameIndex = state.uNextFrameIndex;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifCompositor::ClearSeekIndex                                  *
+*                                                                 *
+******************************************************************/
+
+void GifCompositor::ClearSeekIndex()
+{
+    m_seekPoints.clear();
+    m_seekPoints[0].fRestart = true;
+    m_uSeekIndexEnd = 0;
+    m_uLastSeekPoint = 0;
+    m_cbSeekPoints = 0;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifCompositor::UpdateSeekIndex                                 *
+*                                                                 *
+*  Called before the next frame is composed during a seek.  The   *
+*  first time a frame is reached, decides whether it is a restart *
+*  point, or whether it is far enough from the last seek point to *
+*  need a snapshot.                                               *
+*                                                                 *
+******************************************************************/
+
+void GifCompositor::UpdateSeekIndex()
+{
+    auto uFrameIndex = m_uNextFrameIndex;
+    if (uFrameIndex != m_uSeekIndexEnd + 1)
+    {
+        return;
+    }
+    m_uSeekIndexEnd = uFrameIndex;
+
+    GifFrameInfo frameInfo;
+    m_source->GetFrameInfo(uFrameIndex, frameInfo);
+
+    // A frame saving the canvas for disposal 3 depends on what came before,
+    // even if it covers the canvas, and so does one whose data ends early
+    bool fCanvasCleared = m_uFrameDisposal == GIF_DM_BACKGROUND && CoversCanvas(m_framePosition, m_globalInfo);
+    bool fCanvasReplaced = !frameInfo.fTransparent && frameInfo.uDisposal != GIF_DM_PREVIOUS &&
+        CoversCanvas(frameInfo.rect, m_globalInfo) && m_source->IsFrameOpaque(uFrameIndex);
+
+    if (fCanvasCleared || fCanvasReplaced)
+    {
+        m_seekPoints[uFrameIndex].fRestart = true;
+        m_uLastSeekPoint = uFrameIndex;
+    }
+    else if (m_cSeekInterval != 0 && uFrameIndex - m_uLastSeekPoint >= m_cSeekInterval)
+    {
+        auto& seekPoint = m_seekPoints[uFrameIndex];
+        seekPoint.fRestart = false;
+        SaveState(seekPoint.state);
+        m_cbSeekPoints += seekPoint.state.SizeInBytes();
+        m_uLastSeekPoint = uFrameIndex;
+    }
+}
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "FrameCache.h"
+#include "GifFrameCodec.h"
+#include "GifFrameRun.h"
+#include "GifFrameSource.h"
+#include "GifPixelBackend.h"
+
+// A composed frame and the compositor state needed to continue from it
+struct GifCachedFrame
+{
+    GifSnapshot     snapshot;       // Without the composed pixels when they are packed
+    GifPackedPixels packedPixels;   // The composed pixels under packedRect, if fPacked
+    GifRect         packedRect;     // With GFC_DELTA, the pixels outside it are those of the frame before
+    bool            fPacked;
+    GifRect         framePosition;
+    GifRect         dirtyRect;
+    unsigned int    uFrameDisposal;
+    unsigned int    uFrameDelay;
+    unsigned int    uNextFrameIndex;
+
+    size_t SizeInBytes() const
+    {
+        return snapshot.SizeInBytes() + (fPacked ? packedPixels.SizeInBytes() : 0);
+    }
+};
+
+/******************************************************************
+*                                                                 *
+*  IGifSharedFrameStore                                           *
+*                                                                 *
+*  Composed frames shared by every compositor playing the same    *
+*  gif at the same size, on top of each compositor's own frame    *
+*  cache.  Called from the threads of all those compositors.      *
+*                                                                 *
+******************************************************************/
+
+class IGifSharedFrameStore
+{
+public:
+
+    virtual ~IGifSharedFrameStore() = default;
+
+    // The composed frame that starts at uFirstFrameIndex, or nullptr
+    virtual std::shared_ptr<const GifCachedFrame> Lookup(unsigned int uFirstFrameIndex) = 0;
+
+    // Whether a frame composed from uFirstFrameIndex should be saved and
+    // passed to Insert, which it should not if the store's cache mode
+    // leaves the frame out or another compositor has already done so
+    virtual bool ShouldInsert(unsigned int uFirstFrameIndex) = 0;
+
+    // GIF_FRAME_CODEC flags to pack the frames passed to Insert with
+    virtual unsigned int GetCodec() = 0;
+
+    // cComposeCost is the number of raw frames it took to compose
+    virtual void Insert(unsigned int uFirstFrameIndex, std::shared_ptr<const GifCachedFrame> frame, unsigned int cComposeCost) = 0;
+};
+
+// A point SeekToFrame can start composing from.  Restart points are frames
+// whose result does not depend on earlier frames: the frame before them
+// disposes the whole canvas to the background, or they cover the whole
+// canvas without transparency.  Other seek points keep a snapshot.
+struct GifSeekPoint
+{
+    bool            fRestart;
+    GifCachedFrame  state;      // State before the frame, unused for restart points
+};
+
+// Most raw frames SeekToFrame replays when no restart point is closer
+const unsigned int DEFAULT_SEEK_INTERVAL = 16;
+
+/******************************************************************
+*                                                                 *
+*  GifCompositor                                                  *
+*                                                                 *
+*  The gif disposal state machine from DemoApp, without a window  *
+*  or a timer.  Raw frames come from an IGifFrameSource and all   *
+*  pixel work is done by an IPixelBackend.                        *
+*                                                                 *
+******************************************************************/
+
+class GifCompositor
+{
+public:
+
+    GifCompositor(
+        std::shared_ptr<IGifFrameSource> source,
+        std::unique_ptr<IPixelBackend> backend);
+
+    // Reads the global metadata and rewinds to the start of the animation
+    void Reset();
+
+    // Composes the next frame to be displayed.  More than one raw frame may
+    // be processed due to the use of zero delay intermediate frames; those
+    // are composed in one pass that skips what the displayed frame does not
+    // show (see GifFrameRun).  Does nothing if !IsNextFrameReady.
+    void ComposeNextFrame();
+
+    // Whether the frames ComposeNextFrame needs are there.  Only a source
+    // whose data is still arriving (see GifDecoder::AppendBytes) can say no:
+    // its frames after the last one received are neither known to exist
+    // nor known to be past the end.  Asks the source again, and wraps to the
+    // first frame once the last frame turns out to have been composed
+    // already, so that IsLastFrame and EndOfAnimation catch up.
+    bool IsNextFrameReady();
+
+    // Composes raw frame uFrameIndex onto the frames before it, so that
+    // ComposeNextFrame continues with the frame after it.  Seek points are
+    // recorded while seeking, so only the first seek past a frame has to
+    // replay the animation up to it.
+    void SeekToFrame(unsigned int uFrameIndex);
+
+    // Keeps a snapshot seek point at least every cInterval raw frames.
+    // 0 only uses restart points.  Drops the seek points recorded so far.
+    void SetSeekInterval(unsigned int cInterval);
+
+    size_t GetSeekIndexSizeInBytes() const
+    {
+        return m_cbSeekPoints;
+    }
+
+    GifSurface GetComposedFrame()
+    {
+        return m_backend->GetSurface();
+    }
+
+    // The part of the composed frame that may differ from the previously
+    // composed frame: the disposed area of the previous frame, including
+    // disposal 3 restores, and the area of every frame overlaid since.
+    // Presenting only this rect gives the same result as presenting the
+    // whole frame.  Covers the whole canvas after Reset and SeekToFrame.
+    const GifRect& GetDirtyRect() const
+    {
+        return m_dirtyRect;
+    }
+
+    // With a source that finds frames lazily, cFrames grows as playback
+    // reaches new frames until fFrameCountPartial is cleared
+    const GifGlobalInfo& GetGlobalInfo() const
+    {
+        return m_globalInfo;
+    }
+
+    // Delay of the last composed frame, in ms
+    unsigned int GetFrameDelay() const
+    {
+        return m_uFrameDelay;
+    }
+
+    unsigned int GetNextFrameIndex() const
+    {
+        return m_uNextFrameIndex;
+    }
+
+    unsigned int GetLoopNumber() const
+    {
+        return m_uLoopNumber;
+    }
+
+    bool IsLastFrame() const
+    {
+        return (m_uNextFrameIndex == 0);
+    }
+
+    bool EndOfAnimation() const
+    {
+        return m_globalInfo.fHasLoop && IsLastFrame() && m_uLoopNumber == m_globalInfo.uTotalLoopCount + 1;
+    }
+
+    void SetFrameCacheMode(FRAME_CACHE_MODE mode, size_t cbBudget = DEFAULT_FRAME_CACHE_BUDGET);
+
+    // Packs the frames the cache holds with the GIF_FRAME_CODEC flags in
+    // uCodec, so that more of them fit the budget, and unpacks them again on
+    // a hit.  Drops the cached frames.
+    void SetFrameCacheCodec(unsigned int uCodec);
+    unsigned int GetFrameCacheCodec() const
+    {
+        return m_uFrameCacheCodec;
+    }
+
+    FrameCacheStats GetFrameCacheStats() const
+    {
+        return m_frameCache.GetStats();
+    }
+
+    // Looks up composed frames in store after the frame cache, and adds
+    // the frames it composes to it.  nullptr stops using a store.
+    void SetSharedFrameStore(std::shared_ptr<IGifSharedFrameStore> store)
+    {
+        m_sharedFrames = std::move(store);
+    }
+
+    IPixelBackend& GetBackend()
+    {
+        return *m_backend;
+    }
+
+private:
+
+    void DisposeCurrentFrame();
+    void OverlayNextFrame();
+    void ApplyRunStep(const GifFrameRunStep& step);
+    void StartLoop();
+    void DrawRawFrame(unsigned int uFrameIndex);
+    bool HasFrame(unsigned int uFrameIndex);
+    bool IsPastLastFrame(unsigned int uFrameIndex);
+    bool DiscoverRun(unsigned int uFirstFrameIndex);
+
+    void SaveState(GifCachedFrame& state);
+    void SavePackedState(GifCachedFrame& state, unsigned int uCodec);
+    void LoadState(const GifCachedFrame& state);
+    void ClearSeekIndex();
+    void UpdateSeekIndex();
+
+    bool RestoreCachedFrame();
+    void CacheComposedFrame(unsigned int uFirstFrameIndex, unsigned int cFramesComposed);
+    void UpdateSavedPixelsMax(const GifFrameInfo& frameInfo);
+
+private:
+
+    std::shared_ptr<IGifFrameSource>    m_source;
+    std::unique_ptr<IPixelBackend>      m_backend;
+    FrameCache<GifCachedFrame>          m_frameCache;
+    std::shared_ptr<IGifSharedFrameStore>   m_sharedFrames;
+    unsigned int                        m_uFrameCacheCodec;
+    GifSnapshot                         m_unpackedState;    // Frames being packed or unpacked, kept for its buffers
+    std::vector<uint8_t>                m_packScratch;
+
+    GifGlobalInfo   m_globalInfo;
+    GifRawFrame     m_rawFrame;
+    unsigned int    m_uNextFrameIndex;
+    unsigned int    m_uLoopNumber;      // The current animation loop number (e.g. 1 when the animation is first played)
+    unsigned int    m_uFrameDisposal;
+    unsigned int    m_uFrameDelay;
+    GifRect         m_framePosition;
+    GifRect         m_dirtyRect;
+    GifFrameRun     m_frameRun;
+
+    std::map<unsigned int, GifSeekPoint>    m_seekPoints;
+    unsigned int    m_cSeekInterval;
+    unsigned int    m_uSeekIndexEnd;    // Seek points are known up to this frame index
+    unsigned int    m_uLastSeekPoint;
+    size_t          m_cbSeekPoints;
+
+    // The largest area a disposal 3 frame saves, so far or, once the frame
+    // count is known, in the whole animation.  Cached frames keep room for
+    // it, so any spare the frame cache hands out can hold a saved frame.
+    size_t          m_cSavedPixelsMax;
+};
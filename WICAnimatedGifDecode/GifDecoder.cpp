@@ -0,0 +1,1326 @@
+#include "GifDecoder.h"
+#include "GifKernels.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+    const unsigned int LZW_MAX_CODES = 4096;
+    const unsigned int LZW_MAX_CODE_SIZE = 12;
+
+    // Signature, version and logical screen descriptor
+    const size_t HEADER_SIZE = 13;
+
+    // Interlaced images store every 8th row starting at row 0, then every
+    // 8th row starting at row 4, every 4th row starting at row 2 and finally
+    // every 2nd row starting at row 1
+    const unsigned int c_interlaceStart[] = { 0, 4, 2, 1 };
+    const unsigned int c_interlaceStep[] = { 8, 8, 4, 2 };
+
+    inline unsigned int ReadUInt16(const uint8_t* p)
+    {
+        return p[0] | (p[1] << 8);
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder::GifDecoder constructor                             *
+*                                                                 *
+******************************************************************/
+
+GifDecoder::GifDecoder() :
+    m_openMode(GOM_FULL),
+    m_cxTarget(0),
+    m_cyTarget(0),
+    m_pData(nullptr),
+    m_cbData(0),
+    m_fStreaming(false),
+    m_fStreamEnded(false),
+    m_fHeaderReady(false),
+    m_globalInfo(),
+    m_offGlobalPalette(0),
+    m_cGlobalColors(0),
+    m_cxScaled(0),
+    m_cyScaled(0),
+    m_offScan(0),
+    m_offScanResume(0),
+    m_fHasControl(false),
+    m_controlFlags(0),
+    m_uControlDelay(0),
+    m_controlTransparentIndex(0),
+    m_lzwPrefix(LZW_MAX_CODES),
+    m_lzwSuffix(LZW_MAX_CODES),
+    m_lzwFirst(LZW_MAX_CODES),
+    m_lzwLength(LZW_MAX_CODES)
+{
+}
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder::Open                                               *
+*                                                                 *
+*  Parses the header and logical screen descriptor.  Throws if    *
+*  the data is not a gif.  Frames are indexed on demand.          *
+*                                                                 *
+******************************************************************/
+
+void GifDecoder::Open(std::shared_ptr<GifByteSource> byteSource)
+{
+    m_byteSource = std::move(byteSource);
+    m_pData = m_byteSource->Data();
+    m_cbData = m_byteSource->Size();
+
+    m_streamData.clear();
+    m_streamData.shrink_to_fit();
+    m_fStreaming = false;
+    m_fStreamEnded = false;
+
+    StartFrames();
+}
+
+void GifDecoder::Open(std::shared_ptr<GifByteSource> byteSource, const GifFrameIndex& frameIndex)
+{
+    Open(std::move(byteSource));
+
+    if (!frameIndex.Matches(m_globalInfo.cxGifImage, m_globalInfo.cyGifImage, m_pData, m_cbData))
+    {
+        throw std::runtime_error("Frame index does not match the gif data");
+    }
+
+    m_frameIndex = frameIndex;
+    m_globalInfo.cFrames = m_frameIndex.Size();
+    m_globalInfo.uTotalLoopCount = m_frameIndex.GetTotalLoopCount();
+    m_globalInfo.fHasLoop = m_frameIndex.HasLoop();
+}
+
+void GifDecoder::Open(std::vector<uint8_t> data)
+{
+    Open(GifByteSource::FromVector(std::move(data)));
+}
+
+void GifDecoder::Open(const uint8_t* pData, size_t cbData)
+{
+    Open(GifByteSource::FromSpan(pData, cbData));
+}
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder::OpenStream                                         *
+*                                                                 *
+******************************************************************/
+
+void GifDecoder::OpenStream()
+{
+    m_byteSource.reset();
+    m_streamData.clear();
+    m_pData = nullptr;
+    m_cbData = 0;
+
+    m_fStreaming = true;
+    m_fStreamEnded = false;
+    m_fHeaderReady = false;
+    m_globalInfo = {};
+    m_frameIndex.Reset(0, 0, 0);
+}
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder::AppendBytes                                        *
+*                                                                 *
+*  Parses the header as soon as it and the global color table     *
+*  are complete.  Frames are indexed when they are asked for.     *
+*                                                                 *
+******************************************************************/
+
+void GifDecoder::AppendBytes(const uint8_t* pData, size_t cbData)
+{
+    if (!IsAwaitingData())
+    {
+        throw std::logic_error("The decoder is not reading a stream");
+    }
+
+    // Everything refers to the data by offset, so it can move
+    m_streamData.insert(m_streamData.end(), pData, pData + cbData);
+    m_pData = m_streamData.data();
+    m_cbData = m_streamData.size();
+
+    if (!m_fHeaderReady && m_cbData >= HEADER_SIZE)
+    {
+        auto packed = m_pData[10];
+        size_t cbGlobalPalette = (packed & 0x80) ? 3 * (2u << (packed & 0x07)) : 0;
+        if (m_cbData >= HEADER_SIZE + cbGlobalPalette)
+        {
+            StartFrames();
+        }
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder::EndStream                                          *
+*                                                                 *
+******************************************************************/
+
+void GifDecoder::EndStream()
+{
+    if (!IsAwaitingData())
+    {
+        throw std::logic_error("The decoder is not reading a stream");
+    }
+
+    m_fStreamEnded = true;
+    if (m_fHeaderReady)
+    {
+        m_frameIndex.SetDataSize(m_cbData);
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder::StartFrames                                        *
+*                                                                 *
+*  Parses the header and gets ready to index frames from the end  *
+*  of the global color table.                                     *
+*                                                                 *
+******************************************************************/
+
+void GifDecoder::StartFrames()
+{
+    m_fHeaderReady = false;
+    m_fHasControl = false;
+
+    ParseHeader();
+    ChooseScaledSize();
+    m_frameIndex.Reset(m_globalInfo.cxGifImage, m_globalInfo.cyGifImage, m_cbData);
+    m_frameOpaque.clear();
+    m_offScan = HEADER_SIZE + 3 * static_cast<size_t>(m_cGlobalColors);
+    m_offScanResume = 0;
+    m_fHeaderReady = true;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder::ParseHeader                                        *
+*                                                                 *
+*  Reads the header, logical screen descriptor and global color   *
+*  table, and derives the background color the same way           *
+*  DemoApp::GetBackgroundColor does.                              *
+*                                                                 *
+******************************************************************/
+
+void GifDecoder::ParseHeader()
+{
+    if (m_cbData < HEADER_SIZE || memcmp(m_pData, "GIF", 3) != 0)
+    {
+        throw std::runtime_error("Not a gif file");
+    }
+
+    m_globalInfo = {};
+    m_globalInfo.cxGifImage = ReadUInt16(m_pData + 6);
+    m_globalInfo.cyGifImage = ReadUInt16(m_pData + 8);
+    if (m_globalInfo.cxGifImage == 0 || m_globalInfo.cyGifImage == 0 ||
+        static_cast<uint64_t>(m_globalInfo.cxGifImage) * m_globalInfo.cyGifImage > GIF_MAX_CANVAS_PIXELS)
+    {
+        throw std::runtime_error("Invalid logical screen size");
+    }
+
+    auto packed = m_pData[10];
+    auto backgroundIndex = m_pData[11];
+    auto uPixelAspRatio = m_pData[12];
+
+    m_offGlobalPalette = 0;
+    m_cGlobalColors = 0;
+    if (packed & 0x80)
+    {
+        m_cGlobalColors = 2u << (packed & 0x07);
+        if (HEADER_SIZE + 3 * m_cGlobalColors > m_cbData)
+        {
+            throw std::runtime_error("Truncated global color table");
+        }
+        m_offGlobalPalette = HEADER_SIZE;
+    }
+
+    // Default to transparent if there is no global palette to take the color from
+    if (m_cGlobalColors > 0 && backgroundIndex < m_cGlobalColors)
+    {
+        auto pColor = m_pData + m_offGlobalPalette + 3 * backgroundIndex;
+        m_globalInfo.backgroundColor = 0xFF000000 | (pColor[0] << 16) | (pColor[1] << 8) | pColor[2];
+    }
+
+    CalculatePixelAspectSize(
+        m_globalInfo.cxGifImage,
+        m_globalInfo.cyGifImage,
+        uPixelAspRatio,
+        &m_globalInfo.cxGifImagePixel,
+        &m_globalInfo.cyGifImagePixel);
+}
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder::ChooseScaledSize                                   *
+*                                                                 *
+*  Fits the displayed size, which already has the pixel aspect    *
+*  ratio applied and is never larger than the logical screen,     *
+*  into the target size.                                          *
+*                                                                 *
+******************************************************************/
+
+void GifDecoder::ChooseScaledSize()
+{
+    m_cxScaled = 0;
+    m_cyScaled = 0;
+    if (m_cxTarget == 0 || m_cyTarget == 0)
+    {
+        return;
+    }
+
+    auto cxPixel = std::max(m_globalInfo.cxGifImagePixel, 1u);
+    auto cyPixel = std::max(m_globalInfo.cyGifImagePixel, 1u);
+    auto scale = std::min({ 1., static_cast<double>(m_cxTarget) / cxPixel, static_cast<double>(m_cyTarget) / cyPixel });
+    auto cx = std::max(static_cast<unsigned int>(cxPixel * scale + 0.5), 1u);
+    auto cy = std::max(static_cast<unsigned int>(cyPixel * scale + 0.5), 1u);
+
+    if (cx < m_globalInfo.cxGifImage || cy < m_globalInfo.cyGifImage)
+    {
+        m_cxScaled = cx;
+        m_cyScaled = cy;
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder::ScaleRect                                          *
+*                                                                 *
+*  Rounds every edge to the nearest scaled pixel, so that the     *
+*  scaled rect of a frame is the same for drawing and disposing   *
+*  it, and frames that share an edge still do when scaled.        *
+*                                                                 *
+******************************************************************/
+
+GifRect GifDecoder::ScaleRect(const GifRect& rect) const
+{
+    auto scale = [](unsigned int v, unsigned int cScaled, unsigned int c)
+    {
+        return static_cast<unsigned int>((2ull * v * cScaled + c) / (2ull * c));
+    };
+
+    GifRect scaledRect;
+    scaledRect.left = scale(rect.left, m_cxScaled, m_globalInfo.cxGifImage);
+    scaledRect.top = scale(rect.top, m_cyScaled, m_globalInfo.cyGifImage);
+    scaledRect.right = scale(rect.right, m_cxScaled, m_globalInfo.cxGifImage);
+    scaledRect.bottom = scale(rect.bottom, m_cyScaled, m_globalInfo.cyGifImage);
+    if (scaledRect.IsEmpty())
+    {
+        scaledRect = {};
+    }
+    return scaledRect;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder::SkipSubBlocks                                      *
+*                                                                 *
+*  Returns the offset just past the block terminator of the data  *
+*  sub-blocks starting at off, or SIZE_MAX if the data ends       *
+*  first.  Then pOffStopped, if given, gets the offset of the     *
+*  first sub-block that is not complete.                          *
+*                                                                 *
+******************************************************************/
+
+size_t GifDecoder::SkipSubBlocks(size_t off, size_t* pOffStopped) const
+{
+    while (off < m_cbData)
+    {
+        size_t cbBlock = m_pData[off];
+        if (cbBlock == 0)
+        {
+            return off + 1;
+        }
+        if (m_cbData - off <= cbBlock)
+        {
+            break;
+        }
+        off += 1 + cbBlock;
+    }
+
+    if (pOffStopped != nullptr)
+    {
+        *pOffStopped = off;
+    }
+    return SIZE_MAX;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder::ParseApplicationExtension                          *
+*                                                                 *
+*  Reads the loop count from a NETSCAPE2.0 or ANIMEXTS1.0         *
+*  application extension.  off points at the block size byte.     *
+*                                                                 *
+******************************************************************/
+
+void GifDecoder::ParseApplicationExtension(size_t off)
+{
+    const size_t cbApplication = 11;    // Length of the application block
+
+    if (off + 1 + cbApplication + 4 > m_cbData || m_pData[off] != cbApplication)
+    {
+        return;
+    }
+
+    auto pApplication = m_pData + off + 1;
+    if (memcmp(pApplication, "NETSCAPE2.0", cbApplication) != 0 &&
+        memcmp(pApplication, "ANIMEXTS1.0", cbApplication) != 0)
+    {
+        return;
+    }
+
+    //  The data is in the following format:
+    //  byte 0: extsize (must be > 1)
+    //  byte 1: loopType (1 == animated gif)
+    //  byte 2: loop count (least significant byte)
+    //  byte 3: loop count (most significant byte)
+    auto pData = pApplication + cbApplication;
+    if (pData[0] > 0 && pData[1] == 1)
+    {
+        m_globalInfo.uTotalLoopCount = ReadUInt16(pData + 2);
+
+        // If the total loop count is not zero, we then have a loop count
+        // If it is 0, then we repeat infinitely
+        if (m_globalInfo.uTotalLoopCount != 0)
+        {
+            m_globalInfo.fHasLoop = true;
+        }
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder::ScanFrames                                         *
+*                                                                 *
+*  Walks the block structure from where the last scan stopped     *
+*  until cFramesNeeded frames are indexed, recording where each   *
+*  frame's palette and image data live together with its          *
+*  metadata.  The scan is complete at the trailer, an unknown     *
+*  block or the end of the data.  A stream that has not ended     *
+*  stops before a block that has not fully arrived instead, and   *
+*  walks it again once there is more data.                        *
+*                                                                 *
+******************************************************************/
+
+void GifDecoder::ScanFrames(size_t cFramesNeeded)
+{
+    const GifRect screenRect = { 0, 0, m_globalInfo.cxGifImage, m_globalInfo.cyGifImage };
+
+    if (!m_fHeaderReady)
+    {
+        return;
+    }
+
+    bool fComplete = m_frameIndex.IsComplete();
+    bool fTruncated = false;
+    auto off = m_offScan;
+    auto offBlock = off;
+    size_t offResume = 0;
+    while (!fComplete && m_frameIndex.Size() < cFramesNeeded)
+    {
+        offBlock = off;
+        if (off >= m_cbData)
+        {
+            fTruncated = true;
+            break;
+        }
+
+        auto blockType = m_pData[off];
+
+        if (blockType == 0x21)  // Extension
+        {
+            if (off + 2 > m_cbData)
+            {
+                fTruncated = true;
+                break;
+            }
+
+            auto label = m_pData[off + 1];
+            off += 2;
+
+            if (label == 0xF9 && off + 5 <= m_cbData && m_pData[off] >= 4)
+            {
+                // Graphic Control Extension, applies to the next image only
+                m_fHasControl = true;
+                m_controlFlags = m_pData[off + 1];
+                m_uControlDelay = ReadUInt16(m_pData + off + 2);
+                m_controlTransparentIndex = m_pData[off + 4];
+            }
+            else if (label == 0xFF)
+            {
+                ParseApplicationExtension(off);
+            }
+
+            off = SkipSubBlocks(off);
+            if (off == SIZE_MAX)
+            {
+                fTruncated = true;
+                break;
+            }
+        }
+        else if (blockType == 0x2C)     // Image Descriptor
+        {
+            const size_t cbDescriptor = 10;
+            if (off + cbDescriptor > m_cbData)
+            {
+                fTruncated = true;
+                break;
+            }
+
+            FrameRecord record = {};
+            auto pDescriptor = m_pData + off;
+            record.imageRect.left = ReadUInt16(pDescriptor + 1);
+            record.imageRect.top = ReadUInt16(pDescriptor + 3);
+            record.imageRect.right = record.imageRect.left + ReadUInt16(pDescriptor + 5);
+            record.imageRect.bottom = record.imageRect.top + ReadUInt16(pDescriptor + 7);
+            auto packed = pDescriptor[9];
+            off += cbDescriptor;
+
+            if (packed & 0x80)
+            {
+                record.cLocalColors = 2u << (packed & 0x07);
+                record.offLocalPalette = off;
+                off += 3 * static_cast<size_t>(record.cLocalColors);
+            }
+
+            if (off >= m_cbData)
+            {
+                fTruncated = true;
+                break;
+            }
+
+            // A file that ends in the image data still gets the frame, a
+            // stream waits until the whole frame is there.  Waiting on a
+            // large frame arriving in small pieces walks on from where the
+            // last scan stopped rather than from the start of the frame.
+            record.offImageData = off;
+            auto offSubBlocks = (offBlock == m_offScan && m_offScanResume != 0) ? m_offScanResume : off + 1;
+            off = SkipSubBlocks(offSubBlocks, &offResume);
+            if (off == SIZE_MAX)
+            {
+                if (IsAwaitingData())
+                {
+                    fTruncated = true;
+                    break;
+                }
+                off = m_cbData;
+            }
+            offResume = 0;
+
+            record.info.rect = IntersectGifRect(record.imageRect, screenRect);
+            record.info.fInterlaced = (packed & 0x40) != 0;
+            if (m_fHasControl)
+            {
+                // Convert the delay retrieved in 10 ms units to a delay in 1 ms units
+                record.info.uDelay = m_uControlDelay * 10;
+
+                // Disposal values 4-7 are reserved, treat them like no disposal
+                // method was specified
+                auto uDisposal = (m_controlFlags >> 2) & 0x07;
+                record.info.uDisposal = (uDisposal <= GIF_DM_PREVIOUS) ? uDisposal : GIF_DM_UNDEFINED;
+                record.info.fTransparent = (m_controlFlags & 0x01) != 0;
+                record.info.transparentIndex = m_controlTransparentIndex;
+            }
+            else
+            {
+                // Possibly a single frame image (non-animated gif)
+                record.info.uDelay = 0;
+                record.info.uDisposal = GIF_DM_UNDEFINED;
+            }
+
+            m_frameIndex.Append(
+                record.info,
+                record.imageRect,
+                record.offImageData,
+                record.offLocalPalette,
+                record.cLocalColors);
+            m_fHasControl = false;
+        }
+        else if (blockType == 0x00)
+        {
+            // Stray block terminator, some encoders emit these
+            off++;
+        }
+        else
+        {
+            // Trailer or an unknown block
+            fComplete = true;
+        }
+    }
+
+    if (fTruncated)
+    {
+        off = offBlock;
+        fComplete = !IsAwaitingData();
+    }
+
+    m_offScan = off;
+    m_offScanResume = fComplete ? 0 : offResume;
+    if (fComplete && !m_frameIndex.IsComplete())
+    {
+        m_frameIndex.SetComplete(m_globalInfo.uTotalLoopCount, m_globalInfo.fHasLoop);
+        m_frameIndex.SetDataHash(m_pData);
+        m_globalInfo.cFrames = m_frameIndex.Size();
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder::GetFrameRecord                                     *
+*                                                                 *
+******************************************************************/
+
+GifDecoder::FrameRecord GifDecoder::GetFrameRecord(unsigned int uFrameIndex)
+{
+    if (uFrameIndex >= m_frameIndex.Size())
+    {
+        ScanFrames(static_cast<size_t>(uFrameIndex) + 1);
+        if (uFrameIndex >= m_frameIndex.Size())
+        {
+            throw std::out_of_range("Frame index out of range");
+        }
+    }
+
+    FrameRecord record;
+    m_frameIndex.GetFrameInfo(uFrameIndex, record.info);
+    record.imageRect = m_frameIndex.GetImageRect(uFrameIndex);
+    record.offImageData = m_frameIndex.GetImageDataOffset(uFrameIndex);
+    record.offLocalPalette = m_frameIndex.GetLocalPaletteOffset(uFrameIndex);
+    record.cLocalColors = m_frameIndex.GetLocalColorCount(uFrameIndex);
+    return record;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder::GetFrameIndex                                      *
+*                                                                 *
+******************************************************************/
+
+const GifFrameIndex& GifDecoder::GetFrameIndex()
+{
+    ScanFrames(SIZE_MAX);
+    return m_frameIndex;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder::GetReadyFrameCount                                 *
+*                                                                 *
+******************************************************************/
+
+unsigned int GifDecoder::GetReadyFrameCount()
+{
+    ScanFrames(SIZE_MAX);
+    return m_frameIndex.Size();
+}
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder::GetGlobalInfo                                      *
+*                                                                 *
+******************************************************************/
+
+void GifDecoder::GetGlobalInfo(GifGlobalInfo& globalInfo)
+{
+    if (!m_fHeaderReady)
+    {
+        // Only a stream gets here.  Once it has ended, this throws like
+        // Open does for data that is not a gif.
+        if (IsAwaitingData())
+        {
+            throw std::logic_error("The gif header has not arrived yet");
+        }
+        StartFrames();
+    }
+
+    // The frame count and loop count are only known once every block is
+    // seen.  A lazy open stops at the first frame, after the loop count of
+    // any gif that puts it up front as NETSCAPE2.0 specifies.
+    ScanFrames(m_openMode == GOM_LAZY ? 1 : SIZE_MAX);
+    CopyGlobalInfo(globalInfo);
+}
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder::DiscoverFrames                                     *
+*                                                                 *
+******************************************************************/
+
+void GifDecoder::DiscoverFrames(unsigned int cFramesNeeded, GifGlobalInfo& globalInfo)
+{
+    ScanFrames(cFramesNeeded);
+    CopyGlobalInfo(globalInfo);
+}
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder::CopyGlobalInfo                                     *
+*                                                                 *
+*  Until the scan is complete, the frame count is the number of   *
+*  frames indexed so far.  When scaling, the canvas is the scaled *
+*  one.                                                           *
+*                                                                 *
+******************************************************************/
+
+void GifDecoder::CopyGlobalInfo(GifGlobalInfo& globalInfo) const
+{
+    globalInfo = m_globalInfo;
+    if (m_cxScaled != 0)
+    {
+        // The pixel aspect ratio is part of the scaled size
+        globalInfo.cxGifImage = m_cxScaled;
+        globalInfo.cyGifImage = m_cyScaled;
+        globalInfo.cxGifImagePixel = m_cxScaled;
+        globalInfo.cyGifImagePixel = m_cyScaled;
+    }
+    if (!m_frameIndex.IsComplete())
+    {
+        globalInfo.cFrames = static_cast<unsigned int>(m_frameIndex.Size());
+        globalInfo.fFrameCountPartial = true;
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder::GetFrameInfo                                       *
+*                                                                 *
+******************************************************************/
+
+void GifDecoder::GetFrameInfo(unsigned int uFrameIndex, GifFrameInfo& frameInfo)
+{
+    frameInfo = GetFrameRecord(uFrameIndex).info;
+    if (m_cxScaled != 0)
+    {
+        frameInfo.rect = ScaleRect(frameInfo.rect);
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder::GetRawFrame                                        *
+*                                                                 *
+*  Decodes the visible part of a raw frame into a PBGRA bitmap    *
+*  with transparent pixels set to zero.  When scaling, the bitmap *
+*  covers the frame's scaled rect instead.                        *
+*                                                                 *
+******************************************************************/
+
+void GifDecoder::GetRawFrame(unsigned int uFrameIndex, GifRawFrame& rawFrame)
+{
+    auto record = GetFrameRecord(uFrameIndex);
+    auto rect = m_cxScaled != 0 ? ScaleRect(record.info.rect) : record.info.rect;
+
+    m_rawPixels.Resize(rect.Width(), rect.Height());
+    auto surface = m_rawPixels.Surface();
+    if (!surface.IsEmpty())
+    {
+        memset(surface.pPixels, 0, m_rawPixels.SizeInBytes());
+    }
+
+    LoadPalette(record, true);
+    if (m_cxScaled != 0)
+    {
+        DecodeScaledFrame(record, rect);
+    }
+    else
+    {
+        DecodeFrame(record, surface, false);
+    }
+
+    rawFrame.info = record.info;
+    rawFrame.info.rect = rect;
+    rawFrame.pixels = surface;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder::DrawRawFrame                                       *
+*                                                                 *
+*  Decodes a raw frame straight onto the composed frame, leaving  *
+*  the pixels under transparent indices untouched.  Scaled frames *
+*  can be partially transparent and go through GetRawFrame and    *
+*  the backend's blending instead.                                *
+*                                                                 *
+******************************************************************/
+
+bool GifDecoder::DrawRawFrame(unsigned int uFrameIndex, const GifSurface& surface)
+{
+    auto record = GetFrameRecord(uFrameIndex);
+
+    if (m_cxScaled != 0 || surface.cx < m_globalInfo.cxGifImage || surface.cy < m_globalInfo.cyGifImage)
+    {
+        return false;
+    }
+
+    LoadPalette(record, false);
+
+    // Offset the surface so that the frame's visible rect starts at its origin
+    auto dest = surface;
+    dest.pPixels = surface.Row(record.info.rect.top) + record.info.rect.left;
+    DecodeFrame(record, dest, record.info.fTransparent);
+
+    return true;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder::IsFrameOpaque                                      *
+*                                                                 *
+*  A frame without a transparent index is opaque when its data    *
+*  fills every row of the image.  Telling takes an LZW pass over  *
+*  the frame, so the answer is kept.                              *
+*                                                                 *
+******************************************************************/
+
+bool GifDecoder::IsFrameOpaque(unsigned int uFrameIndex)
+{
+    auto record = GetFrameRecord(uFrameIndex);
+    if (record.info.fTransparent)
+    {
+        return false;
+    }
+
+    if (uFrameIndex >= m_frameOpaque.size())
+    {
+        m_frameOpaque.resize(m_frameIndex.Size(), -1);
+    }
+
+    if (m_frameOpaque[uFrameIndex] < 0)
+    {
+        const unsigned int cxImage = record.imageRect.Width();
+        unsigned int cFullRows = 0;
+        auto countRow = [&](unsigned int yImage, const uint8_t* pIndices, unsigned int cPixels)
+        {
+            (void)yImage;
+            (void)pIndices;
+            cFullRows += (cPixels == cxImage) ? 1 : 0;
+        };
+
+        DecodeRows(record, countRow);
+        m_frameOpaque[uFrameIndex] = (cFullRows == record.imageRect.Height()) ? 1 : 0;
+    }
+    return m_frameOpaque[uFrameIndex] != 0;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder::GetIndexedFrame                                    *
+*                                                                 *
+*  Decodes the visible part of a raw frame into deinterlaced rows *
+*  of indices, recording how much of each row the data reached.   *
+*                                                                 *
+******************************************************************/
+
+void GifDecoder::GetIndexedFrame(unsigned int uFrameIndex, GifIndexedFrame& frame)
+{
+    if (m_cxScaled != 0)
+    {
+        throw std::logic_error("Scaled frames cannot be decoded to indices");
+    }
+
+    auto record = GetFrameRecord(uFrameIndex);
+    const auto& imageRect = record.imageRect;
+    const auto& visibleRect = record.info.rect;
+    const unsigned int xVisible = visibleRect.left - imageRect.left;
+    const unsigned int cxVisible = visibleRect.Width();
+
+    frame.info = record.info;
+    frame.indices.resize(static_cast<size_t>(cxVisible) * visibleRect.Height());
+    frame.rowLengths.assign(visibleRect.Height(), 0);
+
+    LoadPalette(record, false);
+    memcpy(frame.palette, m_palette, sizeof(m_palette));
+
+    auto copyRow = [&](unsigned int yImage, const uint8_t* pIndices, unsigned int cPixels)
+    {
+        auto yScreen = imageRect.top + yImage;
+        if (yScreen >= visibleRect.top && yScreen < visibleRect.bottom && cPixels > xVisible)
+        {
+            auto cCopy = std::min(cPixels - xVisible, cxVisible);
+            auto y = yScreen - visibleRect.top;
+            memcpy(frame.indices.data() + static_cast<size_t>(y) * cxVisible, pIndices + xVisible, cCopy);
+            frame.rowLengths[y] = cCopy;
+        }
+    };
+
+    DecodeRows(record, copyRow);
+}
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder::LoadPalette                                        *
+*                                                                 *
+*  Fills m_palette with the frame's local or the global color     *
+*  table as opaque PBGRA.  Indices past the end of the table are  *
+*  opaque black.                                                  *
+*                                                                 *
+******************************************************************/
+
+void GifDecoder::LoadPalette(const FrameRecord& record, bool fTransparentIsZero)
+{
+    auto offPalette = record.offLocalPalette;
+    auto cColors = record.cLocalColors;
+    if (offPalette == 0)
+    {
+        offPalette = m_offGlobalPalette;
+        cColors = m_cGlobalColors;
+    }
+
+    auto pColor = m_pData + offPalette;
+    for (unsigned int i = 0; i < 256; i++)
+    {
+        if (i < cColors)
+        {
+            m_palette[i] = 0xFF000000 | (pColor[0] << 16) | (pColor[1] << 8) | pColor[2];
+            pColor += 3;
+        }
+        else
+        {
+            m_palette[i] = 0xFF000000;
+        }
+    }
+
+    if (fTransparentIsZero && record.info.fTransparent)
+    {
+        m_palette[record.info.transparentIndex] = 0;
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder::DecodeRows                                         *
+*                                                                 *
+*  LZW decodes a frame into a row buffer and hands each completed *
+*  row to sink(yImage, pIndices, cPixels), with yImage relative   *
+*  to the image rect.  cPixels is the image width, except for the *
+*  last row of truncated data.  Rows come in interlaced order if  *
+*  the frame is interlaced.                                       *
+*                                                                 *
+******************************************************************/
+
+template <typename RowSink>
+void GifDecoder::DecodeRows(const FrameRecord& record, RowSink& sink)
+{
+    const auto& imageRect = record.imageRect;
+    const unsigned int cxImage = imageRect.Width();
+    const unsigned int cyImage = imageRect.Height();
+
+    if (cxImage == 0 || cyImage == 0 || record.info.rect.IsEmpty())
+    {
+        return;
+    }
+
+    // A row plus room for the longest string a single code can produce
+    m_rowIndices.resize(cxImage + LZW_MAX_CODES);
+    uint8_t* pRow = m_rowIndices.data();
+    unsigned int cBuffered = 0;
+
+    unsigned int cRowsDone = 0;
+    unsigned int uPass = 0;
+    unsigned int yImage = 0;
+
+    auto flushRow = [&](const uint8_t* pIndices, unsigned int cPixels)
+    {
+        sink(yImage, pIndices, cPixels);
+
+        cRowsDone++;
+        if (record.info.fInterlaced)
+        {
+            yImage += c_interlaceStep[uPass];
+            while (yImage >= cyImage && uPass < 3)
+            {
+                uPass++;
+                yImage = c_interlaceStart[uPass];
+            }
+        }
+        else
+        {
+            yImage++;
+        }
+    };
+
+    // Bit reader over the image data sub-blocks
+    size_t off = record.offImageData;
+    const unsigned int minCodeSize = m_pData[off++];
+    if (minCodeSize < 2 || minCodeSize > 8)
+    {
+        return;
+    }
+
+    size_t cbBlockLeft = 0;
+    uint32_t bitBuffer = 0;
+    unsigned int cBits = 0;
+
+    auto readCode = [&](unsigned int codeSize, unsigned int& code) -> bool
+    {
+        while (cBits < codeSize)
+        {
+            if (cbBlockLeft == 0)
+            {
+                if (off >= m_cbData || m_pData[off] == 0)
+                {
+                    return false;
+                }
+                cbBlockLeft = m_pData[off++];
+            }
+            if (off >= m_cbData)
+            {
+                return false;
+            }
+            bitBuffer |= static_cast<uint32_t>(m_pData[off++]) << cBits;
+            cBits += 8;
+            cbBlockLeft--;
+        }
+
+        code = bitBuffer & ((1u << codeSize) - 1);
+        bitBuffer >>= codeSize;
+        cBits -= codeSize;
+        return true;
+    };
+
+    const unsigned int clearCode = 1u << minCodeSize;
+    const unsigned int endCode = clearCode + 1;
+
+    auto pPrefix = m_lzwPrefix.data();
+    auto pSuffix = m_lzwSuffix.data();
+    auto pFirst = m_lzwFirst.data();
+    auto pLength = m_lzwLength.data();
+
+    for (unsigned int i = 0; i < clearCode; i++)
+    {
+        pPrefix[i] = 0;
+        pSuffix[i] = static_cast<uint8_t>(i);
+        pFirst[i] = static_cast<uint8_t>(i);
+        pLength[i] = 1;
+    }
+
+    unsigned int codeSize = minCodeSize + 1;
+    unsigned int nextCode = clearCode + 2;
+    int prevCode = -1;
+
+    // Writes the string for code to the row buffer, last index first
+    auto emit = [&](unsigned int code)
+    {
+        unsigned int cLength = pLength[code];
+        auto pOut = pRow + cBuffered + cLength;
+        for (unsigned int i = 0; i < cLength; i++)
+        {
+            *--pOut = pSuffix[code];
+            code = pPrefix[code];
+        }
+        cBuffered += cLength;
+
+        // The string may complete one or more rows
+        if (cBuffered >= cxImage)
+        {
+            unsigned int offRow = 0;
+            while (cBuffered - offRow >= cxImage && cRowsDone < cyImage)
+            {
+                flushRow(pRow + offRow, cxImage);
+                offRow += cxImage;
+            }
+
+            // Keep the start of the next row, or drop excess indices past the last row
+            cBuffered = (cRowsDone < cyImage) ? cBuffered - offRow : 0;
+            memmove(pRow, pRow + offRow, cBuffered);
+        }
+    };
+
+    unsigned int code;
+    while (cRowsDone < cyImage && readCode(codeSize, code))
+    {
+        if (code == clearCode)
+        {
+            codeSize = minCodeSize + 1;
+            nextCode = clearCode + 2;
+            prevCode = -1;
+            continue;
+        }
+
+        if (code == endCode)
+        {
+            break;
+        }
+
+        if (prevCode < 0)
+        {
+            // The first code after a clear must be a literal
+            if (code >= clearCode)
+            {
+                break;
+            }
+            emit(code);
+            prevCode = static_cast<int>(code);
+            continue;
+        }
+
+        bool fKwKwK = false;
+        uint8_t firstIndex;
+        if (code < nextCode)
+        {
+            firstIndex = pFirst[code];
+        }
+        else if (code == nextCode && nextCode < LZW_MAX_CODES)
+        {
+            // The code being defined right now: the previous string plus its own first index
+            firstIndex = pFirst[prevCode];
+            fKwKwK = true;
+        }
+        else
+        {
+            break;
+        }
+
+        if (!fKwKwK)
+        {
+            emit(code);
+        }
+
+        if (nextCode < LZW_MAX_CODES)
+        {
+            pPrefix[nextCode] = static_cast<uint16_t>(prevCode);
+            pSuffix[nextCode] = firstIndex;
+            pFirst[nextCode] = pFirst[prevCode];
+            pLength[nextCode] = static_cast<uint16_t>(pLength[prevCode] + 1);
+            nextCode++;
+
+            if (nextCode == (1u << codeSize) && codeSize < LZW_MAX_CODE_SIZE)
+            {
+                codeSize++;
+            }
+        }
+
+        if (fKwKwK)
+        {
+            emit(code);
+        }
+
+        prevCode = static_cast<int>(code);
+    }
+
+    // Truncated data, show the partial row that was decoded
+    if (cBuffered > 0 && cRowsDone < cyImage)
+    {
+        flushRow(pRow, cBuffered);
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder::DecodeFrame                                        *
+*                                                                 *
+*  Expands each decoded row through m_palette into dest, whose    *
+*  origin is the top left of the frame's visible rect.  If        *
+*  fMasked is set, pixels with the transparent index are skipped. *
+*                                                                 *
+******************************************************************/
+
+void GifDecoder::DecodeFrame(const FrameRecord& record, const GifSurface& dest, bool fMasked)
+{
+    const auto& imageRect = record.imageRect;
+    const auto& visibleRect = record.info.rect;
+
+    // Part of each image row that lands on the logical screen
+    const unsigned int xVisible = visibleRect.left - imageRect.left;
+    const unsigned int cxVisible = visibleRect.Width();
+    const uint8_t transparentIndex = record.info.transparentIndex;
+    const auto& kernels = GetGifKernels();
+
+    auto expandRow = [&](unsigned int yImage, const uint8_t* pIndices, unsigned int cPixels)
+    {
+        auto yScreen = imageRect.top + yImage;
+        if (yScreen >= visibleRect.top && yScreen < visibleRect.bottom && cPixels > xVisible)
+        {
+            auto cCopy = cPixels - xVisible;
+            if (cCopy > cxVisible)
+            {
+                cCopy = cxVisible;
+            }
+            auto pDest = dest.Row(yScreen - visibleRect.top);
+            if (fMasked)
+            {
+                kernels.ExpandIndicesMasked(pDest, pIndices + xVisible, cCopy, m_palette, transparentIndex);
+            }
+            else
+            {
+                kernels.ExpandIndices(pDest, pIndices + xVisible, cCopy, m_palette);
+            }
+        }
+    };
+
+    DecodeRows(record, expandRow);
+}
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder::DecodeScaledFrame                                  *
+*                                                                 *
+*  Box filters the frame's visible rect into m_rawPixels, which   *
+*  covers scaledRect, one decoded row at a time, so the frame is  *
+*  never held at full size.  A source pixel and a scaled pixel    *
+*  contribute by how much of each other they cover, along each    *
+*  axis with its own factor.  Premultiplied colors are averaged,  *
+*  so transparent pixels and rows missing from truncated data     *
+*  lower the alpha of the scaled pixels they fall in.  m_palette  *
+*  must map the transparent index to 0.                           *
+*                                                                 *
+******************************************************************/
+
+void GifDecoder::DecodeScaledFrame(const FrameRecord& record, const GifRect& scaledRect)
+{
+    const auto& imageRect = record.imageRect;
+    const auto& visibleRect = record.info.rect;
+    const unsigned int cxSource = visibleRect.Width();
+    const unsigned int cySource = visibleRect.Height();
+    const unsigned int cxDest = scaledRect.Width();
+    const unsigned int cyDest = scaledRect.Height();
+
+    if (cxSource == 0 || cySource == 0 || cxDest == 0 || cyDest == 0)
+    {
+        return;
+    }
+
+    // Along x a source pixel spans cxDest units and a scaled pixel cxSource
+    // units, so the overlaps of the source pixels in a scaled pixel add up
+    // to cxSource.  Likewise along y.  Scaled rects are never wider than
+    // their source, so every scaled pixel overlaps at least one source pixel.
+    m_scaleSpans.resize(cxDest);
+    for (unsigned int x = 0; x < cxDest; x++)
+    {
+        uint64_t start = static_cast<uint64_t>(x) * cxSource;
+        uint64_t end = start + cxSource;
+        auto& span = m_scaleSpans[x];
+        span.uFirst = static_cast<uint32_t>(start / cxDest);
+        span.uLast = static_cast<uint32_t>(std::min<uint64_t>((end - 1) / cxDest, cxSource - 1));
+        span.trimFirst = static_cast<uint32_t>(start - static_cast<uint64_t>(span.uFirst) * cxDest);
+        span.trimLast = static_cast<uint32_t>((static_cast<uint64_t>(span.uLast) + 1) * cxDest - end);
+    }
+
+    m_scalePrefix.resize(static_cast<size_t>(cxSource) + 1);
+    m_scaleRowSums.resize(2 * static_cast<size_t>(cxDest));
+    m_scaleSums.assign(4 * static_cast<size_t>(cxDest) * cyDest, 0);
+
+    // Blue, green, red and alpha in 16 bit lanes, so that one add sums a
+    // pixel into a running sum
+    for (unsigned int i = 0; i < 256; i++)
+    {
+        uint64_t pixel = m_palette[i];
+        m_scalePalette[i] = (pixel & 0xFF) | (pixel & 0xFF00) << 8 | (pixel & 0xFF0000) << 16 | (pixel & 0xFF000000) << 24;
+    }
+
+    const unsigned int xVisible = visibleRect.left - imageRect.left;
+
+    auto accumulateRow = [&](unsigned int yImage, const uint8_t* pIndices, unsigned int cPixels)
+    {
+        auto yScreen = imageRect.top + yImage;
+        if (yScreen < visibleRect.top || yScreen >= visibleRect.bottom)
+        {
+            return;
+        }
+
+        // Running sums of the lanes.  They carry from one lane into the next,
+        // but the difference of two of them is exact as long as each lane of
+        // it fits, which is up to 257 pixels.  Pixels past the end of
+        // truncated data are transparent.
+        unsigned int cCopy = cPixels > xVisible ? std::min(cPixels - xVisible, cxSource) : 0;
+        pIndices += xVisible;
+        auto pPrefix = m_scalePrefix.data();
+        uint64_t sum = 0;
+        pPrefix[0] = 0;
+        for (unsigned int u = 0; u < cCopy; u++)
+        {
+            sum += m_scalePalette[pIndices[u]];
+            pPrefix[u + 1] = sum;
+        }
+        for (unsigned int u = cCopy; u < cxSource; u++)
+        {
+            pPrefix[u + 1] = sum;
+        }
+
+        // Lanes from a difference of running sums, widened to blue and red,
+        // and green and alpha, side by side in 32 bit lanes
+        const uint64_t LOW_LANES = 0x0000FFFF0000FFFF;
+        auto sumPixels = [pPrefix](unsigned int uFirst, unsigned int uEnd, uint64_t& blueRed, uint64_t& greenAlpha)
+        {
+            auto lanes = pPrefix[uEnd] - pPrefix[uFirst];
+            blueRed = lanes & LOW_LANES;
+            greenAlpha = (lanes >> 16) & LOW_LANES;
+        };
+
+        // A scaled pixel takes the whole source pixels it overlaps, less the
+        // parts of its first and last one outside it.  Subtracting running
+        // sums rather than adding up each span keeps the loops free of
+        // branches that depend on the span lengths, other than for spans
+        // longer than 256 pixels.  No lane goes below zero or past
+        // 255 * 3 * cxSource.
+        auto pRowSums = m_scaleRowSums.data();
+        for (unsigned int x = 0; x < cxDest; x++)
+        {
+            const auto& span = m_scaleSpans[x];
+            uint64_t blueRed, greenAlpha;
+            sumPixels(span.uFirst, std::min(span.uFirst + 256, span.uLast + 1), blueRed, greenAlpha);
+            for (unsigned int u = span.uFirst + 256; u <= span.uLast; u += 256)
+            {
+                uint64_t blueRedRun, greenAlphaRun;
+                sumPixels(u, std::min(u + 256, span.uLast + 1), blueRedRun, greenAlphaRun);
+                blueRed += blueRedRun;
+                greenAlpha += greenAlphaRun;
+            }
+
+            uint64_t blueRedFirst, greenAlphaFirst, blueRedLast, greenAlphaLast;
+            sumPixels(span.uFirst, span.uFirst + 1, blueRedFirst, greenAlphaFirst);
+            sumPixels(span.uLast, span.uLast + 1, blueRedLast, greenAlphaLast);
+            pRowSums[2 * x] = blueRed * cxDest - blueRedFirst * span.trimFirst - blueRedLast * span.trimLast;
+            pRowSums[2 * x + 1] = greenAlpha * cxDest - greenAlphaFirst * span.trimFirst - greenAlphaLast * span.trimLast;
+        }
+
+        uint64_t start = static_cast<uint64_t>(yScreen - visibleRect.top) * cyDest;
+        uint64_t end = start + cyDest;
+        for (uint64_t yDest = start / cySource; yDest * cySource < end; yDest++)
+        {
+            auto overlap = std::min(end, (yDest + 1) * cySource) - std::max(start, yDest * cySource);
+            auto pSums = m_scaleSums.data() + 4 * yDest * cxDest;
+            for (unsigned int x = 0; x < cxDest; x++, pSums += 4)
+            {
+                auto blueRed = pRowSums[2 * x];
+                auto greenAlpha = pRowSums[2 * x + 1];
+                pSums[0] += (blueRed & 0xFFFFFFFF) * overlap;
+                pSums[1] += (greenAlpha & 0xFFFFFFFF) * overlap;
+                pSums[2] += (blueRed >> 32) * overlap;
+                pSums[3] += (greenAlpha >> 32) * overlap;
+            }
+        }
+    };
+
+    DecodeRows(record, accumulateRow);
+
+    auto surface = m_rawPixels.Surface();
+
+    // Multiplying by the reciprocal of the area rather than dividing by it
+    // keeps this pass from costing as much as the decode
+    const double scale = 1. / (static_cast<double>(cxSource) * cySource);
+    for (unsigned int y = 0; y < cyDest; y++)
+    {
+        auto pSums = m_scaleSums.data() + 4 * static_cast<size_t>(y) * cxDest;
+        auto pDest = surface.Row(y);
+        for (unsigned int x = 0; x < cxDest; x++, pSums += 4)
+        {
+            uint32_t pixel = 0;
+            for (int c = 0; c < 4; c++)
+            {
+                auto value = static_cast<uint32_t>(static_cast<double>(pSums[c]) * scale + .5);
+                pixel |= std::min(value, 255u) << (8 * c);
+            }
+            pDest[x] = pixel;
+        }
+    }
+}
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "GifByteSource.h"
+#include "GifFrameIndex.h"
+#include "GifFrameSource.h"
+
+// Largest logical screen the decoder accepts, in pixels (1 GB at 32bpp)
+const uint64_t GIF_MAX_CANVAS_PIXELS = 1ull << 28;
+
+// A raw frame LZW decoded to palette indices but not expanded yet, so that
+// frames can be decoded on other threads and drawn later
+struct GifIndexedFrame
+{
+    GifFrameInfo            info;           // rect is clipped to the logical screen, as in GifRawFrame
+    uint32_t                palette[256];   // Opaque PBGRA, black past the end of the color table
+    std::vector<uint8_t>    indices;        // info.rect.Width() per row
+    std::vector<uint32_t>   rowLengths;     // Indices decoded at the start of each row, fewer for damaged or truncated data
+};
+
+// How far GetGlobalInfo walks the block structure
+enum GIF_OPEN_MODE
+{
+    GOM_FULL,   // To the end, so the frame count is known up front
+    GOM_LAZY,   // Only to the first frame; later frames are found by GetFrameInfo and DiscoverFrames as playback reaches them
+};
+
+/******************************************************************
+*                                                                 *
+*  GifDecoder                                                     *
+*                                                                 *
+*  Platform independent GIF87a/GIF89a decoder.  Frames are LZW    *
+*  decoded one row at a time and expanded through the palette     *
+*  straight into the destination, with transparency handled in    *
+*  the same pass.                                                 *
+*                                                                 *
+*  The block structure is walked in place and only as far as the  *
+*  frames asked for so far; GetGlobalInfo walks it to the end to  *
+*  count the frames, unless the decoder is in GOM_LAZY mode.      *
+*  What the walk finds goes into a frame index that can be saved  *
+*  and handed to a later Open to skip the walk.                   *
+*                                                                 *
+*  Malformed input never reads outside the data: structural       *
+*  errors in the header throw, while damaged or truncated image   *
+*  data decodes as far as it can and leaves the remaining pixels  *
+*  untouched.                                                     *
+*                                                                 *
+*  With a target size, the decoder presents a smaller gif: the    *
+*  canvas is scaled down to fit, frame rects are snapped to it    *
+*  and frames are area averaged into them as they are decoded.    *
+*                                                                 *
+*  The data can also arrive over time (OpenStream, AppendBytes).  *
+*  A frame is only indexed once all of its image data is there,   *
+*  and the frame count stays partial until the stream has ended   *
+*  or the trailer has arrived.                                    *
+*                                                                 *
+******************************************************************/
+
+class GifDecoder : public IGifFrameSource
+{
+public:
+
+    GifDecoder();
+
+    // Applies to the following Opens.  Defaults to GOM_FULL.
+    void SetOpenMode(GIF_OPEN_MODE mode)
+    {
+        m_openMode = mode;
+    }
+
+    // Scales the canvas down to fit cxMax x cyMax, after correcting for the
+    // pixel aspect ratio, so that composing works on the smaller canvas.
+    // Frame rects are rounded to the nearest scaled pixel, so frames that
+    // share an edge still do, and a frame's pixels are averaged over the
+    // area of each scaled pixel as it is decoded.  Frames that are not
+    // fully opaque get partially transparent edges.  The canvas is only
+    // scaled when that makes it smaller; 0 x 0, the default, never does.
+    // Applies to the following Opens.
+    void SetTargetSize(unsigned int cxMax, unsigned int cyMax)
+    {
+        m_cxTarget = cxMax;
+        m_cyTarget = cyMax;
+    }
+
+    // Opens gif data from a mapped file, a buffer or a caller owned span
+    void Open(std::shared_ptr<GifByteSource> byteSource);
+
+    // Opens gif data together with a complete frame index saved from an
+    // earlier decoder.  Throws if the index does not match the data.
+    void Open(std::shared_ptr<GifByteSource> byteSource, const GifFrameIndex& frameIndex);
+
+    // Opens gif data owned by the decoder
+    void Open(std::vector<uint8_t> data);
+
+    // Opens gif data owned by the caller, which must outlive the decoder
+    void Open(const uint8_t* pData, size_t cbData);
+
+    // Opens gif data that arrives through AppendBytes, for example over a
+    // socket.  GetGlobalInfo can be called once IsHeaderReady.
+    void OpenStream();
+
+    // Adds the next bytes of the stream, copying them.  Like every other
+    // call, must not run at the same time as any other call on the decoder.
+    void AppendBytes(const uint8_t* pData, size_t cbData);
+
+    // No more bytes will arrive.  What is missing at the end is treated
+    // like a truncated file.
+    void EndStream();
+
+    // Whether the header and global color table have arrived.  Always
+    // true for data opened with Open.
+    bool IsHeaderReady() const
+    {
+        return m_fHeaderReady;
+    }
+
+    // Frames whose data has arrived so far, which are all the frames once
+    // the frame count is no longer partial
+    unsigned int GetReadyFrameCount();
+
+    void GetGlobalInfo(GifGlobalInfo& globalInfo) override;
+    void GetFrameInfo(unsigned int uFrameIndex, GifFrameInfo& frameInfo) override;
+    void DiscoverFrames(unsigned int cFramesNeeded, GifGlobalInfo& globalInfo) override;
+    void GetRawFrame(unsigned int uFrameIndex, GifRawFrame& rawFrame) override;
+    bool DrawRawFrame(unsigned int uFrameIndex, const GifSurface& surface) override;
+    bool IsFrameOpaque(unsigned int uFrameIndex) override;
+
+    // Decodes the raw frame to palette indices.  Expanding rowLengths[y]
+    // indices of each row through the palette, skipping the transparent
+    // index if info.fTransparent, is what DrawRawFrame does.  Not available
+    // with a target size.
+    void GetIndexedFrame(unsigned int uFrameIndex, GifIndexedFrame& frame);
+
+    // Indexes any frames not indexed yet and returns the index, which is
+    // only complete for a stream once it has ended
+    const GifFrameIndex& GetFrameIndex();
+
+    // The frames indexed so far, without looking for more
+    const GifFrameIndex& GetIndexedFrames() const
+    {
+        return m_frameIndex;
+    }
+
+private:
+
+    struct FrameRecord
+    {
+        GifFrameInfo    info;               // rect is clipped to the logical screen
+        GifRect         imageRect;          // rect as stored in the image descriptor
+        size_t          offImageData;       // Offset of the LZW minimum code size byte
+        size_t          offLocalPalette;    // 0 if the frame uses the global palette
+        unsigned int    cLocalColors;
+    };
+
+    void ParseHeader();
+    void StartFrames();
+    void ChooseScaledSize();
+    GifRect ScaleRect(const GifRect& rect) const;
+    bool IsAwaitingData() const
+    {
+        return m_fStreaming && !m_fStreamEnded;
+    }
+    void ScanFrames(size_t cFramesNeeded);
+    void CopyGlobalInfo(GifGlobalInfo& globalInfo) const;
+    FrameRecord GetFrameRecord(unsigned int uFrameIndex);
+    void ParseApplicationExtension(size_t off);
+    size_t SkipSubBlocks(size_t off, size_t* pOffStopped = nullptr) const;
+
+    void LoadPalette(const FrameRecord& record, bool fTransparentIsZero);
+    template <typename RowSink>
+    void DecodeRows(const FrameRecord& record, RowSink& sink);
+    void DecodeFrame(const FrameRecord& record, const GifSurface& dest, bool fMasked);
+    void DecodeScaledFrame(const FrameRecord& record, const GifRect& scaledRect);
+
+private:
+
+    GIF_OPEN_MODE                   m_openMode;
+    unsigned int                    m_cxTarget;
+    unsigned int                    m_cyTarget;
+    std::shared_ptr<GifByteSource>  m_byteSource;
+    const uint8_t*                  m_pData;
+    size_t                          m_cbData;
+    std::vector<uint8_t>            m_streamData;   // Bytes appended to a stream so far
+    bool                            m_fStreaming;
+    bool                            m_fStreamEnded;
+    bool                            m_fHeaderReady;
+
+    GifGlobalInfo   m_globalInfo;
+    size_t          m_offGlobalPalette;
+    unsigned int    m_cGlobalColors;
+    GifFrameIndex   m_frameIndex;
+    std::vector<int8_t> m_frameOpaque;  // Per frame once IsFrameOpaque has decoded it: 1 opaque, 0 not, -1 not known yet
+
+    // Size of the scaled canvas, 0 when not scaling.  m_globalInfo and the
+    // frame index keep the logical screen size.
+    unsigned int    m_cxScaled;
+    unsigned int    m_cyScaled;
+
+    // Where ScanFrames stopped, and the Graphic Control Extension it has
+    // seen for the next image
+    size_t          m_offScan;
+    size_t          m_offScanResume;    // Sub-block of the image data at m_offScan to walk on from while a stream waits for the rest, or 0
+    bool            m_fHasControl;
+    uint8_t         m_controlFlags;
+    unsigned int    m_uControlDelay;
+    uint8_t         m_controlTransparentIndex;
+
+    // Decode scratch, reused across frames
+    uint32_t                m_palette[256];
+    std::vector<uint8_t>    m_rowIndices;
+    std::vector<uint16_t>   m_lzwPrefix;
+    std::vector<uint8_t>    m_lzwSuffix;
+    std::vector<uint8_t>    m_lzwFirst;
+    std::vector<uint16_t>   m_lzwLength;
+    GifBitmap               m_rawPixels;
+
+    // Scaling scratch, reused across frames
+    struct ScaleSpan
+    {
+        uint32_t    uFirst;     // First and last source pixel a scaled pixel overlaps, from the left of the frame's visible rect
+        uint32_t    uLast;
+        uint32_t    trimFirst;  // Parts of the first and last source pixel outside the scaled pixel, in 1 / cxDest of a source pixel
+        uint32_t    trimLast;
+    };
+    std::vector<ScaleSpan>  m_scaleSpans;
+    uint64_t                m_scalePalette[256];    // The palette with its channels in 16 bit lanes, as the running sums hold them
+    std::vector<uint64_t>   m_scalePrefix;      // Running sums along a row of the visible rect
+    std::vector<uint64_t>   m_scaleRowSums;     // A row summed horizontally, two channels per element
+    std::vector<uint64_t>   m_scaleSums;        // Per channel sums of the rows weighted by their vertical overlap
+};
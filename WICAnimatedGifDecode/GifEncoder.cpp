@@ -0,0 +1,915 @@
+#include "GifEncoder.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+namespace
+{
+    const unsigned int MAX_GIF_SIZE = 65535;
+    const unsigned int MAX_GIF_DELAY = 65535;
+
+    // Colors a local table holds besides the transparent index, for frames
+    // split by color
+    const unsigned int SPLIT_GROUP_COLORS = 255;
+
+    const unsigned int INITIAL_COLOR_TABLE_BITS = 9;
+
+    // Bits of a color table with room for cColors, at least 1
+    unsigned int GetColorTableBits(size_t cColors)
+    {
+        unsigned int cBits = 1;
+        while ((static_cast<size_t>(1) << cBits) < cColors)
+        {
+            cBits++;
+        }
+        return cBits;
+    }
+
+    // Writes colors as RGB triplets, padded with black to 1 << cBits
+    void WriteColorTable(const std::vector<uint32_t>& colors, unsigned int cBits, std::vector<uint8_t>& data)
+    {
+        for (uint32_t color : colors)
+        {
+            data.push_back(static_cast<uint8_t>(color >> 16));
+            data.push_back(static_cast<uint8_t>(color >> 8));
+            data.push_back(static_cast<uint8_t>(color));
+        }
+        data.resize(data.size() + ((static_cast<size_t>(1) << cBits) - colors.size()) * 3, 0);
+    }
+
+    void WriteUInt16(unsigned int value, std::vector<uint8_t>& data)
+    {
+        data.push_back(static_cast<uint8_t>(value));
+        data.push_back(static_cast<uint8_t>(value >> 8));
+    }
+
+    uint64_t GetArea(const GifRect& rect)
+    {
+        return static_cast<uint64_t>(rect.Width()) * rect.Height();
+    }
+
+    // Undoes premultiplication, so that the palette holds the colors the
+    // decoder premultiplies back.  Pixels with alpha below 128 become 0.
+    inline uint32_t NormalizePixel(uint32_t pixel)
+    {
+        uint32_t a = pixel >> 24;
+        if (a == 0xFF)
+        {
+            return pixel;
+        }
+        if (a < 128)
+        {
+            return 0;
+        }
+
+        uint32_t r = std::min<uint32_t>(((pixel >> 16 & 0xFF) * 255 + a / 2) / a, 255);
+        uint32_t g = std::min<uint32_t>(((pixel >> 8 & 0xFF) * 255 + a / 2) / a, 255);
+        uint32_t b = std::min<uint32_t>(((pixel & 0xFF) * 255 + a / 2) / a, 255);
+        return 0xFF000000 | (r << 16) | (g << 8) | b;
+    }
+
+    // The nearest color of the 6x7x6 cube, which leaves room for the
+    // transparent index in 256 entries
+    inline uint32_t QuantizePixel(uint32_t pixel)
+    {
+        if (pixel == 0)
+        {
+            return 0;
+        }
+
+        uint32_t r = ((pixel >> 16 & 0xFF) * 5 + 127) / 255 * 51;
+        uint32_t g = (((pixel >> 8 & 0xFF) * 6 + 127) / 255 * 255 + 3) / 6;
+        uint32_t b = ((pixel & 0xFF) * 5 + 127) / 255 * 51;
+        return 0xFF000000 | (r << 16) | (g << 8) | b;
+    }
+
+    // Whether the opaque pixels have more than 256 colors.  Stops at the
+    // 257th.
+    bool HasMoreThan256Colors(const uint32_t* pPixels, size_t cPixels)
+    {
+        const unsigned int TABLE_BITS = 10;
+        const unsigned int TABLE_SIZE = 1 << TABLE_BITS;
+        uint32_t colors[TABLE_SIZE] = {};
+
+        unsigned int cColors = 0;
+        uint32_t lastColor = 0;
+        for (size_t i = 0; i < cPixels; i++)
+        {
+            uint32_t color = pPixels[i];
+            if (color == 0 || color == lastColor)
+            {
+                continue;
+            }
+            lastColor = color;
+
+            unsigned int uSlot = (color * 2654435761u) >> (32 - TABLE_BITS);
+            while (colors[uSlot] != 0 && colors[uSlot] != color)
+            {
+                uSlot = (uSlot + 1) & (TABLE_SIZE - 1);
+            }
+            if (colors[uSlot] == 0)
+            {
+                if (++cColors > 256)
+                {
+                    return true;
+                }
+                colors[uSlot] = color;
+            }
+        }
+        return false;
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifEncoder::ColorTable                                         *
+*                                                                 *
+*  The distinct colors of a frame in the order they were first    *
+*  seen, with an open addressed table from color to index.  0 is  *
+*  never a color, as it marks empty slots.                        *
+*                                                                 *
+******************************************************************/
+
+class GifEncoder::ColorTable
+{
+public:
+
+    static const unsigned int NOT_FOUND = ~0u;
+
+    ColorTable() :
+        m_cBits(INITIAL_COLOR_TABLE_BITS),
+        m_keys(static_cast<size_t>(1) << INITIAL_COLOR_TABLE_BITS),
+        m_indices(static_cast<size_t>(1) << INITIAL_COLOR_TABLE_BITS)
+    {
+    }
+
+    // Returns the index of color, adding it if it is new
+    unsigned int Add(uint32_t color)
+    {
+        size_t uSlot = Probe(color);
+        if (m_keys[uSlot] == 0)
+        {
+            // Keep the table at most half full
+            if ((m_colors.size() + 1) * 2 > m_keys.size())
+            {
+                Grow();
+                uSlot = Probe(color);
+            }
+            m_keys[uSlot] = color;
+            m_indices[uSlot] = static_cast<uint32_t>(m_colors.size());
+            m_colors.push_back(color);
+        }
+        return m_indices[uSlot];
+    }
+
+    unsigned int Find(uint32_t color) const
+    {
+        size_t uSlot = Probe(color);
+        return m_keys[uSlot] != 0 ? m_indices[uSlot] : NOT_FOUND;
+    }
+
+    const std::vector<uint32_t>& Colors() const
+    {
+        return m_colors;
+    }
+
+private:
+
+    size_t Probe(uint32_t color) const
+    {
+        size_t mask = m_keys.size() - 1;
+        size_t uSlot = static_cast<size_t>((color * 0x9E3779B97F4A7C15ull) >> (64 - m_cBits));
+        while (m_keys[uSlot] != 0 && m_keys[uSlot] != color)
+        {
+            uSlot = (uSlot + 1) & mask;
+        }
+        return uSlot;
+    }
+
+    void Grow()
+    {
+        m_cBits++;
+        m_keys.assign(static_cast<size_t>(1) << m_cBits, 0);
+        m_indices.resize(m_keys.size());
+        for (size_t i = 0; i < m_colors.size(); i++)
+        {
+            size_t uSlot = Probe(m_colors[i]);
+            m_keys[uSlot] = m_colors[i];
+            m_indices[uSlot] = static_cast<uint32_t>(i);
+        }
+    }
+
+private:
+
+    unsigned int            m_cBits;
+    std::vector<uint32_t>   m_keys;
+    std::vector<uint32_t>   m_indices;
+    std::vector<uint32_t>   m_colors;
+};
+
+/******************************************************************
+*                                                                 *
+*  GifEncoder::GifEncoder constructor                             *
+*                                                                 *
+******************************************************************/
+
+GifEncoder::GifEncoder(unsigned int cx, unsigned int cy, unsigned int cThreads) :
+    m_cx(cx),
+    m_cy(cy),
+    m_fHasLoop(false),
+    m_uLoopCount(0),
+    m_fQuantize(false),
+    m_fTransparent(false),
+    m_threadPool(cThreads),
+    m_stats()
+{
+    if (cx == 0 || cy == 0 || cx > MAX_GIF_SIZE || cy > MAX_GIF_SIZE)
+    {
+        throw std::invalid_argument("The gif size must be 1 to 65535 pixels each way");
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifEncoder::~GifEncoder destructor                             *
+*                                                                 *
+******************************************************************/
+
+GifEncoder::~GifEncoder() = default;
+
+/******************************************************************
+*                                                                 *
+*  GifEncoder::SetLoopCount                                       *
+*                                                                 *
+******************************************************************/
+
+void GifEncoder::SetLoopCount(bool fHasLoop, unsigned int uLoopCount)
+{
+    if (fHasLoop && (uLoopCount == 0 || uLoopCount > MAX_GIF_DELAY))
+    {
+        throw std::invalid_argument("The loop count must be 1 to 65535");
+    }
+    m_fHasLoop = fHasLoop;
+    m_uLoopCount = fHasLoop ? uLoopCount : 0;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifEncoder::SetQuantize                                        *
+*                                                                 *
+******************************************************************/
+
+void GifEncoder::SetQuantize(bool fQuantize)
+{
+    m_fQuantize = fQuantize;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifEncoder::AddFrame                                           *
+*                                                                 *
+*  The frame is drawn either over the frame before as it is, or   *
+*  over it with its rect disposed to the background, whichever    *
+*  leaves the smaller rect to write.  Pixels that turn            *
+*  transparent can only be written by disposing to the            *
+*  background, so if the frame before does not cover them its     *
+*  rect grows to, with the new pixels keeping what is under them. *
+*                                                                 *
+******************************************************************/
+
+void GifEncoder::AddFrame(const GifSurface& frame, unsigned int uDelay)
+{
+    if (frame.cx != m_cx || frame.cy != m_cy || frame.pPixels == nullptr)
+    {
+        throw std::invalid_argument("The frame must be the size of the gif");
+    }
+
+    unsigned int uDelayUnits = std::min((uDelay + 5) / 10, MAX_GIF_DELAY);
+    m_stats.cFramesAdded++;
+
+    NormalizeFrame(frame);
+
+    if (m_frames.empty())
+    {
+        // The background of a gif with transparent pixels is transparent,
+        // and opaque frames cover the whole canvas
+        m_canvas.assign(m_frame.size(), 0);
+
+        GifRect rect;
+        GifRect clearRect;
+        CompareWithBase(m_canvas, rect, clearRect);
+        StoreFrame(rect, m_canvas, uDelayUnits);
+        m_canvas.swap(m_frame);
+        return;
+    }
+
+    Frame& last = m_frames.back();
+    if (m_frame == m_canvas)
+    {
+        last.uDelay = std::min(last.uDelay + uDelayUnits, MAX_GIF_DELAY);
+        m_stats.cFramesMerged++;
+        return;
+    }
+
+    GifRect rect;
+    GifRect clearRect;
+    bool fCanKeep = CompareWithBase(m_canvas, rect, clearRect);
+    const std::vector<uint32_t>* pBase = &m_canvas;
+    unsigned int uDisposal = GIF_DM_NONE;
+
+    if (m_fTransparent)
+    {
+        GifRect backgroundRect;
+        if (!fCanKeep)
+        {
+            ExpandLastFrame(UnionGifRect(last.rect, clearRect));
+        }
+
+        m_base = m_canvas;
+        for (unsigned int y = last.rect.top; y < last.rect.bottom; y++)
+        {
+            std::fill_n(m_base.begin() + static_cast<size_t>(y) * m_cx + last.rect.left, last.rect.Width(), 0u);
+        }
+        CompareWithBase(m_base, backgroundRect, clearRect);
+
+        if (!fCanKeep || GetArea(backgroundRect) < GetArea(rect))
+        {
+            rect = backgroundRect;
+            pBase = &m_base;
+            uDisposal = GIF_DM_BACKGROUND;
+        }
+    }
+
+    last.uDisposal = uDisposal;
+    StoreFrame(rect, *pBase, uDelayUnits);
+    m_canvas.swap(m_frame);
+}
+
+/******************************************************************
+*                                                                 *
+*  GifEncoder::NormalizeFrame                                     *
+*                                                                 *
+******************************************************************/
+
+void GifEncoder::NormalizeFrame(const GifSurface& frame)
+{
+    m_frame.resize(static_cast<size_t>(m_cx) * m_cy);
+
+    bool fTransparent = false;
+    for (unsigned int y = 0; y < m_cy; y++)
+    {
+        const uint32_t* pSource = frame.Row(y);
+        uint32_t* pDest = m_frame.data() + static_cast<size_t>(y) * m_cx;
+        for (unsigned int x = 0; x < m_cx; x++)
+        {
+            pDest[x] = NormalizePixel(pSource[x]);
+            fTransparent |= pDest[x] == 0;
+        }
+    }
+    m_fTransparent |= fTransparent;
+
+    if (m_fQuantize && HasMoreThan256Colors(m_frame.data(), m_frame.size()))
+    {
+        for (uint32_t& pixel : m_frame)
+        {
+            pixel = QuantizePixel(pixel);
+        }
+        m_stats.cFramesQuantized++;
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifEncoder::CompareWithBase                                    *
+*                                                                 *
+*  Finds the rect of the pixels of the frame being added that     *
+*  differ from base, and the rect of those that are transparent   *
+*  over a pixel of base that is not.  Returns whether there are   *
+*  none of the latter, so that the frame can be drawn over base.  *
+*                                                                 *
+******************************************************************/
+
+bool GifEncoder::CompareWithBase(const std::vector<uint32_t>& base, GifRect& rect, GifRect& clearRect) const
+{
+    rect = GifRect();
+    clearRect = GifRect();
+
+    for (unsigned int y = 0; y < m_cy; y++)
+    {
+        const uint32_t* pFrame = m_frame.data() + static_cast<size_t>(y) * m_cx;
+        const uint32_t* pBase = base.data() + static_cast<size_t>(y) * m_cx;
+        if (memcmp(pFrame, pBase, m_cx * sizeof(uint32_t)) == 0)
+        {
+            continue;
+        }
+
+        unsigned int xLeft = 0;
+        while (pFrame[xLeft] == pBase[xLeft])
+        {
+            xLeft++;
+        }
+        unsigned int xRight = m_cx;
+        while (pFrame[xRight - 1] == pBase[xRight - 1])
+        {
+            xRight--;
+        }
+        rect = UnionGifRect(rect, { xLeft, y, xRight, y + 1 });
+
+        for (unsigned int x = xLeft; x < xRight; x++)
+        {
+            if (pFrame[x] == 0 && pBase[x] != 0)
+            {
+                clearRect = UnionGifRect(clearRect, { x, y, x + 1, y + 1 });
+            }
+        }
+    }
+
+    return clearRect.IsEmpty();
+}
+
+/******************************************************************
+*                                                                 *
+*  GifEncoder::StoreFrame                                         *
+*                                                                 *
+******************************************************************/
+
+void GifEncoder::StoreFrame(const GifRect& rect, const std::vector<uint32_t>& base, unsigned int uDelay)
+{
+    Frame frame;
+    frame.rect = rect;
+    frame.uDelay = uDelay;
+    frame.uDisposal = GIF_DM_NONE;
+
+    // A frame identical to what it is drawn over still needs an image
+    if (frame.rect.IsEmpty())
+    {
+        frame.rect = { 0, 0, 1, 1 };
+    }
+
+    frame.pixels.Resize(frame.rect.Width(), frame.rect.Height());
+    frame.unchanged.resize(static_cast<size_t>(frame.rect.Width()) * frame.rect.Height());
+
+    GifSurface pixels = frame.pixels.Surface();
+    bool fUnchanged = false;
+    for (unsigned int y = 0; y < pixels.cy; y++)
+    {
+        size_t iCanvas = static_cast<size_t>(frame.rect.top + y) * m_cx + frame.rect.left;
+        const uint32_t* pFrame = m_frame.data() + iCanvas;
+        const uint32_t* pBase = base.data() + iCanvas;
+        uint32_t* pDest = pixels.Row(y);
+        uint8_t* pUnchanged = frame.unchanged.data() + static_cast<size_t>(y) * pixels.cx;
+        memcpy(pDest, pFrame, pixels.cx * sizeof(uint32_t));
+        for (unsigned int x = 0; x < pixels.cx; x++)
+        {
+            pUnchanged[x] = pFrame[x] == pBase[x] && pFrame[x] != 0;
+            fUnchanged |= pUnchanged[x] != 0;
+        }
+    }
+    if (!fUnchanged)
+    {
+        frame.unchanged.clear();
+    }
+
+    m_frames.push_back(std::move(frame));
+}
+
+/******************************************************************
+*                                                                 *
+*  GifEncoder::ExpandLastFrame                                    *
+*                                                                 *
+*  Outside its old rect the frame showed what was under it, so    *
+*  the new pixels are unchanged.                                  *
+*                                                                 *
+******************************************************************/
+
+void GifEncoder::ExpandLastFrame(const GifRect& rect)
+{
+    Frame& last = m_frames.back();
+
+    GifBitmap pixels(rect.Width(), rect.Height());
+    std::vector<uint8_t> unchanged(static_cast<size_t>(rect.Width()) * rect.Height());
+    GifSurface dest = pixels.Surface();
+    for (unsigned int y = 0; y < dest.cy; y++)
+    {
+        const uint32_t* pCanvas = m_canvas.data() + static_cast<size_t>(rect.top + y) * m_cx + rect.left;
+        uint8_t* pUnchanged = unchanged.data() + static_cast<size_t>(y) * dest.cx;
+        memcpy(dest.Row(y), pCanvas, dest.cx * sizeof(uint32_t));
+        for (unsigned int x = 0; x < dest.cx; x++)
+        {
+            pUnchanged[x] = pCanvas[x] != 0;
+        }
+    }
+
+    const uint32_t* pSource = last.pixels.Pixels();
+    unsigned int cxSource = last.pixels.Width();
+    for (unsigned int y = 0; y < last.pixels.Height(); y++)
+    {
+        unsigned int xDest = last.rect.left - rect.left;
+        unsigned int yDest = last.rect.top - rect.top + y;
+        memcpy(dest.Row(yDest) + xDest, pSource + static_cast<size_t>(y) * cxSource, cxSource * sizeof(uint32_t));
+
+        uint8_t* pUnchanged = unchanged.data() + static_cast<size_t>(yDest) * dest.cx + xDest;
+        if (last.unchanged.empty())
+        {
+            std::fill_n(pUnchanged, cxSource, static_cast<uint8_t>(0));
+        }
+        else
+        {
+            memcpy(pUnchanged, last.unchanged.data() + static_cast<size_t>(y) * cxSource, cxSource);
+        }
+    }
+
+    last.rect = rect;
+    last.pixels = std::move(pixels);
+    last.unchanged = std::move(unchanged);
+}
+
+/******************************************************************
+*                                                                 *
+*  GifEncoder::Finish                                             *
+*                                                                 *
+*  Gathers the colors of every frame, picks the global colors,    *
+*  then indexes and compresses each frame as a task of its own    *
+*  with the LZW encoder of the worker running it.                 *
+*                                                                 *
+******************************************************************/
+
+std::vector<uint8_t> GifEncoder::Finish()
+{
+    if (m_frames.empty())
+    {
+        throw std::logic_error("A gif needs at least one frame");
+    }
+
+    // The decoder shows a frame without delay together with the frame after
+    // it, so only the last frame can keep a delay of 0
+    for (size_t i = 0; i + 1 < m_frames.size(); i++)
+    {
+        m_frames[i].uDelay = std::max(m_frames[i].uDelay, 1u);
+    }
+
+    std::vector<ColorTable> frameColors(m_frames.size());
+    for (size_t i = 0; i < m_frames.size(); i++)
+    {
+        m_threadPool.Submit([this, &frameColors, i](unsigned int)
+        {
+            const GifBitmap& pixels = m_frames[i].pixels;
+            const uint32_t* pPixels = pixels.Pixels();
+            size_t cPixels = static_cast<size_t>(pixels.Width()) * pixels.Height();
+            uint32_t lastColor = 0;
+            for (size_t iPixel = 0; iPixel < cPixels; iPixel++)
+            {
+                if (pPixels[iPixel] != 0 && pPixels[iPixel] != lastColor)
+                {
+                    lastColor = pPixels[iPixel];
+                    frameColors[i].Add(lastColor);
+                }
+            }
+        });
+    }
+    m_threadPool.Wait();
+
+    // Without transparent pixels every frame can use the global colors,
+    // but the background of a gif with a global table is one of its
+    // colors, so transparent gifs only have local tables
+    if (!m_fTransparent)
+    {
+        ChooseGlobalPalette(frameColors);
+    }
+
+    std::vector<std::vector<Image>> frameImages(m_frames.size());
+    std::vector<GifLzwEncoder> lzwEncoders(m_threadPool.GetThreadCount());
+    for (size_t i = 0; i < m_frames.size(); i++)
+    {
+        m_threadPool.Submit([this, &frameColors, &frameImages, &lzwEncoders, i](unsigned int uWorker)
+        {
+            MakeImages(m_frames[i], frameColors[i], frameImages[i]);
+            for (Image& image : frameImages[i])
+            {
+                WriteImage(image, lzwEncoders[uWorker]);
+            }
+        });
+    }
+    m_threadPool.Wait();
+
+    std::vector<uint8_t> data;
+    WriteHeader(data);
+    for (const std::vector<Image>& images : frameImages)
+    {
+        if (images.size() > 1)
+        {
+            m_stats.cFramesSplit++;
+        }
+        for (const Image& image : images)
+        {
+            data.insert(data.end(), image.data.begin(), image.data.end());
+            m_stats.cImages++;
+            m_stats.cLocalPalettes += image.palette.empty() ? 0 : 1;
+            m_stats.cPixelsWritten += GetArea(image.rect);
+        }
+    }
+    data.push_back(0x3B);
+
+    m_stats.cGlobalColors = static_cast<unsigned int>(m_globalPalette.size());
+    m_stats.cbOutput = data.size();
+
+    m_frames.clear();
+    m_frames.shrink_to_fit();
+    return data;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifEncoder::ChooseGlobalPalette                                *
+*                                                                 *
+*  Takes the 255 colors found in the most frames, leaving the     *
+*  last entry for the transparent index.  Frames whose colors are *
+*  all among them need no local table.  Without any such frames   *
+*  there is no global table.                                      *
+*                                                                 *
+******************************************************************/
+
+void GifEncoder::ChooseGlobalPalette(const std::vector<ColorTable>& frameColors)
+{
+    // Frames with more colors are split and get local tables anyway
+    std::unordered_map<uint32_t, unsigned int> frameCounts;
+    for (const ColorTable& colors : frameColors)
+    {
+        if (colors.Colors().size() <= SPLIT_GROUP_COLORS)
+        {
+            for (uint32_t color : colors.Colors())
+            {
+                frameCounts[color]++;
+            }
+        }
+    }
+    if (frameCounts.empty())
+    {
+        return;
+    }
+
+    std::vector<std::pair<uint32_t, unsigned int>> counts(frameCounts.begin(), frameCounts.end());
+    auto itEnd = counts.begin() + std::min<size_t>(counts.size(), SPLIT_GROUP_COLORS);
+    std::partial_sort(counts.begin(), itEnd, counts.end(),
+        [](const std::pair<uint32_t, unsigned int>& a, const std::pair<uint32_t, unsigned int>& b)
+        {
+            return a.second != b.second ? a.second > b.second : a.first < b.first;
+        });
+
+    std::unique_ptr<ColorTable> globalColors(new ColorTable());
+    for (auto it = counts.begin(); it != itEnd; ++it)
+    {
+        globalColors->Add(it->first);
+    }
+
+    for (const ColorTable& colors : frameColors)
+    {
+        if (std::all_of(colors.Colors().begin(), colors.Colors().end(),
+            [&globalColors](uint32_t color) { return globalColors->Find(color) != ColorTable::NOT_FOUND; }))
+        {
+            m_globalPalette = globalColors->Colors();
+            m_globalColors = std::move(globalColors);
+            return;
+        }
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifEncoder::MakeImages                                         *
+*                                                                 *
+*  Indexes a frame into the global colors, a local table, or for  *
+*  more than 255 colors one image per 255, each transparent where *
+*  the others draw.  The images but the last have no delay, so    *
+*  the decoder shows them at once, and the last covers the whole  *
+*  frame so that the frame's disposal applies to all of it.       *
+*                                                                 *
+******************************************************************/
+
+void GifEncoder::MakeImages(const Frame& frame, const ColorTable& colors, std::vector<Image>& images) const
+{
+    const uint32_t* pPixels = frame.pixels.Pixels();
+    const uint8_t* pUnchanged = frame.unchanged.empty() ? nullptr : frame.unchanged.data();
+    unsigned int cx = frame.pixels.Width();
+    unsigned int cy = frame.pixels.Height();
+    size_t cPixels = static_cast<size_t>(cx) * cy;
+    size_t cColors = colors.Colors().size();
+    bool fHasTransparent = std::find(pPixels, pPixels + cPixels, 0u) != pPixels + cPixels;
+
+    bool fGlobal = m_globalColors && cColors <= m_globalPalette.size();
+    for (size_t i = 0; fGlobal && i < cColors; i++)
+    {
+        fGlobal = m_globalColors->Find(colors.Colors()[i]) != ColorTable::NOT_FOUND;
+    }
+
+    if (fGlobal || cColors + (fHasTransparent ? 1 : 0) <= 256)
+    {
+        const ColorTable& table = fGlobal ? *m_globalColors : colors;
+
+        images.resize(1);
+        Image& image = images[0];
+        image.rect = frame.rect;
+        image.uDelay = frame.uDelay;
+        image.uDisposal = frame.uDisposal;
+        if (!fGlobal)
+        {
+            image.palette = colors.Colors();
+        }
+        image.fTransparent = fHasTransparent;
+        image.transparentIndex = static_cast<uint8_t>(table.Colors().size() & 0xFF);
+
+        image.indices.resize(cPixels);
+        uint32_t lastColor = 0;
+        uint8_t lastIndex = image.transparentIndex;
+        for (size_t i = 0; i < cPixels; i++)
+        {
+            if (pPixels[i] != lastColor)
+            {
+                lastColor = pPixels[i];
+                lastIndex = lastColor != 0 ? static_cast<uint8_t>(table.Find(lastColor)) : image.transparentIndex;
+            }
+            image.indices[i] = lastIndex;
+        }
+
+        // 256 colors leave no index for the unchanged pixels
+        if (pUnchanged != nullptr && table.Colors().size() < 256)
+        {
+            image.keepIndices = image.indices;
+            for (size_t i = 0; i < cPixels; i++)
+            {
+                if (pUnchanged[i])
+                {
+                    image.keepIndices[i] = image.transparentIndex;
+                }
+            }
+        }
+        return;
+    }
+
+    size_t cGroups = (cColors + SPLIT_GROUP_COLORS - 1) / SPLIT_GROUP_COLORS;
+    std::vector<GifRect> groupRects(cGroups);
+    for (unsigned int y = 0; y < cy; y++)
+    {
+        const uint32_t* pRow = pPixels + static_cast<size_t>(y) * cx;
+        for (unsigned int x = 0; x < cx; x++)
+        {
+            if (pRow[x] != 0)
+            {
+                GifRect& groupRect = groupRects[colors.Find(pRow[x]) / SPLIT_GROUP_COLORS];
+                groupRect = UnionGifRect(groupRect, { x, y, x + 1, y + 1 });
+            }
+        }
+    }
+
+    images.resize(cGroups);
+    for (size_t iGroup = 0; iGroup < cGroups; iGroup++)
+    {
+        Image& image = images[iGroup];
+        bool fLast = iGroup + 1 == cGroups;
+        GifRect rect = fLast ? GifRect{ 0, 0, cx, cy } : groupRects[iGroup];
+
+        image.rect = { frame.rect.left + rect.left, frame.rect.top + rect.top, frame.rect.left + rect.right, frame.rect.top + rect.bottom };
+        image.uDelay = fLast ? frame.uDelay : 0;
+        image.uDisposal = fLast ? frame.uDisposal : static_cast<unsigned int>(GIF_DM_NONE);
+
+        size_t iFirstColor = iGroup * SPLIT_GROUP_COLORS;
+        size_t cGroupColors = std::min<size_t>(cColors - iFirstColor, SPLIT_GROUP_COLORS);
+        image.palette.assign(colors.Colors().begin() + iFirstColor, colors.Colors().begin() + iFirstColor + cGroupColors);
+        image.fTransparent = true;
+        image.transparentIndex = static_cast<uint8_t>(cGroupColors);
+
+        image.indices.resize(GetArea(rect));
+        if (pUnchanged != nullptr)
+        {
+            image.keepIndices.resize(image.indices.size());
+        }
+        size_t iIndex = 0;
+        for (unsigned int y = rect.top; y < rect.bottom; y++)
+        {
+            size_t iRow = static_cast<size_t>(y) * cx;
+            for (unsigned int x = rect.left; x < rect.right; x++, iIndex++)
+            {
+                uint32_t pixel = pPixels[iRow + x];
+                size_t iColor = pixel != 0 ? colors.Find(pixel) : ColorTable::NOT_FOUND;
+                image.indices[iIndex] = iColor - iFirstColor < cGroupColors ?
+                    static_cast<uint8_t>(iColor - iFirstColor) : image.transparentIndex;
+                if (pUnchanged != nullptr)
+                {
+                    image.keepIndices[iIndex] = pUnchanged[iRow + x] ? image.transparentIndex : image.indices[iIndex];
+                }
+            }
+        }
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifEncoder::WriteImage                                         *
+*                                                                 *
+*  Writes the graphic control extension, image descriptor, local  *
+*  color table and image data, then frees the indices.  An image  *
+*  with unchanged pixels is compressed both with them as they are *
+*  and with them transparent, and the smaller is kept: runs of    *
+*  transparent pixels compress well over a still background, but  *
+*  break up the repeats of noisy or dithered content.             *
+*                                                                 *
+******************************************************************/
+
+void GifEncoder::WriteImage(Image& image, GifLzwEncoder& lzwEncoder) const
+{
+    // The global table always has room for the transparent index
+    bool fGlobal = image.palette.empty();
+    size_t cColors = fGlobal ? m_globalPalette.size() : image.palette.size();
+    unsigned int cTableBits = GetColorTableBits(cColors + (fGlobal || image.fTransparent ? 1 : 0));
+    std::vector<uint8_t> lzwData;
+    lzwEncoder.Encode(image.indices.data(), image.indices.size(), std::max(cTableBits, 2u), lzwData);
+
+    bool fTransparent = image.fTransparent;
+    if (!image.keepIndices.empty())
+    {
+        unsigned int cKeepTableBits = GetColorTableBits(cColors + 1);
+        std::vector<uint8_t> keepData;
+        lzwEncoder.Encode(image.keepIndices.data(), image.keepIndices.size(), std::max(cKeepTableBits, 2u), keepData);
+
+        size_t cbTable = fGlobal ? 0 : static_cast<size_t>(3) << cTableBits;
+        size_t cbKeepTable = fGlobal ? 0 : static_cast<size_t>(3) << cKeepTableBits;
+        if (keepData.size() + cbKeepTable <= lzwData.size() + cbTable)
+        {
+            lzwData.swap(keepData);
+            cTableBits = cKeepTableBits;
+            fTransparent = true;
+        }
+    }
+    std::vector<uint8_t>().swap(image.indices);
+    std::vector<uint8_t>().swap(image.keepIndices);
+
+    std::vector<uint8_t>& data = image.data;
+
+    data.push_back(0x21);
+    data.push_back(0xF9);
+    data.push_back(4);
+    data.push_back(static_cast<uint8_t>(image.uDisposal << 2 | (fTransparent ? 1 : 0)));
+    WriteUInt16(image.uDelay, data);
+    data.push_back(fTransparent ? image.transparentIndex : 0);
+    data.push_back(0);
+
+    data.push_back(0x2C);
+    WriteUInt16(image.rect.left, data);
+    WriteUInt16(image.rect.top, data);
+    WriteUInt16(image.rect.Width(), data);
+    WriteUInt16(image.rect.Height(), data);
+
+    if (fGlobal)
+    {
+        data.push_back(0);
+    }
+    else
+    {
+        data.push_back(static_cast<uint8_t>(0x80 | (cTableBits - 1)));
+        WriteColorTable(image.palette, cTableBits, data);
+    }
+
+    data.insert(data.end(), lzwData.begin(), lzwData.end());
+}
+
+/******************************************************************
+*                                                                 *
+*  GifEncoder::WriteHeader                                        *
+*                                                                 *
+*  Header, logical screen descriptor, global color table and the  *
+*  NETSCAPE2.0 loop extension.                                    *
+*                                                                 *
+******************************************************************/
+
+void GifEncoder::WriteHeader(std::vector<uint8_t>& data) const
+{
+    const uint8_t HEADER[] = { 'G', 'I', 'F', '8', '9', 'a' };
+    data.insert(data.end(), HEADER, HEADER + sizeof(HEADER));
+
+    WriteUInt16(m_cx, data);
+    WriteUInt16(m_cy, data);
+    if (m_globalPalette.empty())
+    {
+        data.push_back(0);
+    }
+    else
+    {
+        unsigned int cTableBits = GetColorTableBits(m_globalPalette.size() + 1);
+        data.push_back(static_cast<uint8_t>(0x80 | (cTableBits - 1) << 4 | (cTableBits - 1)));
+    }
+    data.push_back(0);      // Background color index
+    data.push_back(0);      // Pixel aspect ratio
+
+    if (!m_globalPalette.empty())
+    {
+        WriteColorTable(m_globalPalette, GetColorTableBits(m_globalPalette.size() + 1), data);
+    }
+
+    const uint8_t LOOP_EXTENSION[] = { 0x21, 0xFF, 0x0B, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0', 0x03, 0x01 };
+    data.insert(data.end(), LOOP_EXTENSION, LOOP_EXTENSION + sizeof(LOOP_EXTENSION));
+    WriteUInt16(m_uLoopCount, data);
+    data.push_back(0);
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "GifLzwEncoder.h"
+#include "GifThreadPool.h"
+#include "GifTypes.h"
+
+struct GifEncoderStats
+{
+    unsigned int    cFramesAdded;
+    unsigned int    cFramesMerged;      // Frames identical to the one before, added to its delay
+    unsigned int    cFramesSplit;       // Frames with more than 256 colors, written as several
+    unsigned int    cFramesQuantized;   // Frames with more than 256 colors, mapped to the color cube
+    unsigned int    cImages;            // Image descriptors written
+    unsigned int    cLocalPalettes;
+    unsigned int    cGlobalColors;      // 0 without a global color table
+    uint64_t        cPixelsWritten;     // Pixels of every image written
+    size_t          cbOutput;
+};
+
+/******************************************************************
+*                                                                 *
+*  GifEncoder                                                     *
+*                                                                 *
+*  Writes a GIF89a from composed frames, such as the frames of a  *
+*  GifCompositor after cropping, scaling or dropping frames.      *
+*  Each frame is compared with the one before: only the rect that *
+*  changed is written, unchanged pixels in it are transparent,    *
+*  and the frame before is disposed to the background when that   *
+*  makes the rect smaller or pixels must turn transparent.  A     *
+*  global color table is used for the colors most frames share.   *
+*  The frames are LZW compressed in parallel by Finish.           *
+*                                                                 *
+*  Opaque and fully transparent pixels decode back as they were   *
+*  added.  A frame with more than 256 colors is written as a run  *
+*  of images shown at once, unless SetQuantize maps it to fewer.  *
+*                                                                 *
+******************************************************************/
+
+class GifEncoder
+{
+public:
+
+    // cThreads == 0 uses one thread per hardware thread
+    GifEncoder(unsigned int cx, unsigned int cy, unsigned int cThreads = 0);
+    ~GifEncoder();
+
+    GifEncoder(const GifEncoder&) = delete;
+    GifEncoder& operator=(const GifEncoder&) = delete;
+
+    // As in GifGlobalInfo: with fHasLoop the animation plays uLoopCount
+    // times, otherwise it loops forever, which is the default
+    void SetLoopCount(bool fHasLoop, unsigned int uLoopCount);
+
+    // Frames with more than 256 colors are mapped to a 6x7x6 color cube
+    // instead of being split, which is lossy but keeps them small, as for
+    // frames scaled down with filtering
+    void SetQuantize(bool fQuantize);
+
+    // Adds a cx by cy frame of premultiplied pixels shown for uDelay ms,
+    // rounded to 10 ms units.  Only the last frame can have no delay.
+    // Pixels with alpha below 128 become transparent, others opaque.
+    void AddFrame(const GifSurface& frame, unsigned int uDelay);
+
+    // Compresses the frames and returns the file.  The encoder is done
+    // with after this.
+    std::vector<uint8_t> Finish();
+
+    const GifEncoderStats& GetStats() const
+    {
+        return m_stats;
+    }
+
+private:
+
+    // A frame as it will be written: its rect of the canvas and its pixels
+    // there, 0 where transparent.  unchanged marks the pixels equal to what
+    // they are drawn over, which may be written as transparent instead, and
+    // is empty if there are none.
+    struct Frame
+    {
+        GifRect                 rect;
+        GifBitmap               pixels;
+        std::vector<uint8_t>    unchanged;
+        unsigned int            uDelay;         // In 10 ms units
+        unsigned int            uDisposal;
+    };
+
+    // One image of a frame, as split for its colors, ready to write
+    struct Image
+    {
+        GifRect                 rect;
+        unsigned int            uDelay;
+        unsigned int            uDisposal;
+        std::vector<uint32_t>   palette;        // Local colors, empty to use the global ones
+        bool                    fTransparent;   // Whether indices uses transparentIndex
+        uint8_t                 transparentIndex;
+        std::vector<uint8_t>    indices;
+        std::vector<uint8_t>    keepIndices;    // With the unchanged pixels transparent, empty if none are
+        std::vector<uint8_t>    data;           // Encoded blocks, from the control extension on
+    };
+
+    class ColorTable;
+
+    void NormalizeFrame(const GifSurface& frame);
+    bool CompareWithBase(const std::vector<uint32_t>& base, GifRect& rect, GifRect& clearRect) const;
+    void StoreFrame(const GifRect& rect, const std::vector<uint32_t>& base, unsigned int uDelay);
+    void ExpandLastFrame(const GifRect& rect);
+    void ChooseGlobalPalette(const std::vector<ColorTable>& frameColors);
+    void MakeImages(const Frame& frame, const ColorTable& colors, std::vector<Image>& images) const;
+    void WriteImage(Image& image, GifLzwEncoder& lzwEncoder) const;
+    void WriteHeader(std::vector<uint8_t>& data) const;
+
+private:
+
+    unsigned int            m_cx;
+    unsigned int            m_cy;
+    bool                    m_fHasLoop;
+    unsigned int            m_uLoopCount;
+    bool                    m_fQuantize;
+    bool                    m_fTransparent;     // Some frame has transparent pixels, so the background must be too
+    std::vector<uint32_t>   m_canvas;           // The last frame added, as the decoder will show it
+    std::vector<uint32_t>   m_frame;            // The frame being added, normalized
+    std::vector<uint32_t>   m_base;             // What the frame being added is drawn over
+    std::vector<Frame>      m_frames;
+    std::vector<uint32_t>   m_globalPalette;
+    std::unique_ptr<ColorTable> m_globalColors;     // Index of each color of m_globalPalette
+    GifThreadPool           m_threadPool;
+    GifEncoderStats         m_stats;
+};
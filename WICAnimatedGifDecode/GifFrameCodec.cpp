@@ -0,0 +1,401 @@
+#include "GifFrameCodec.h"
+#include "GifKernels.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+    // Open addressed table of the colors seen so far.  Four times as many
+    // slots as a palette can have colors keeps the probe sequences short.
+    const unsigned int COLOR_TABLE_BITS = 10;
+    const unsigned int COLOR_TABLE_SIZE = 1 << COLOR_TABLE_BITS;
+
+    // LZ4 block format limits: matches are at least MIN_MATCH bytes, the
+    // last LAST_LITERALS bytes are literals, and no match starts within
+    // MATCH_FIND_LIMIT bytes of the end
+    const size_t MIN_MATCH = 4;
+    const size_t LAST_LITERALS = 5;
+    const size_t MATCH_FIND_LIMIT = 12;
+    const size_t MAX_OFFSET = 65535;
+    const unsigned int LZ_HASH_BITS = 12;
+
+    inline uint32_t Read32(const uint8_t* p)
+    {
+        uint32_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    inline unsigned int HashColor(uint32_t color)
+    {
+        return (color * 2654435761u) >> (32 - COLOR_TABLE_BITS);
+    }
+
+    inline unsigned int HashSequence(uint32_t sequence)
+    {
+        return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+    }
+
+    uint8_t* WriteLength(uint8_t* pDest, size_t cb)
+    {
+        while (cb >= 255)
+        {
+            *pDest++ = 255;
+            cb -= 255;
+        }
+        *pDest++ = static_cast<uint8_t>(cb);
+        return pDest;
+    }
+
+    uint8_t* WriteSequence(uint8_t* pDest, const uint8_t* pLiterals, size_t cLiterals, size_t offset, size_t cbMatch)
+    {
+        uint8_t* pToken = pDest++;
+        *pToken = static_cast<uint8_t>(std::min<size_t>(cLiterals, 15) << 4);
+        if (cLiterals >= 15)
+        {
+            pDest = WriteLength(pDest, cLiterals - 15);
+        }
+        if (cLiterals > 0)
+        {
+            memcpy(pDest, pLiterals, cLiterals);
+            pDest += cLiterals;
+        }
+
+        if (cbMatch == 0)
+        {
+            // The last sequence has no match
+            return pDest;
+        }
+
+        *pDest++ = static_cast<uint8_t>(offset);
+        *pDest++ = static_cast<uint8_t>(offset >> 8);
+        cbMatch -= MIN_MATCH;
+        *pToken |= static_cast<uint8_t>(std::min<size_t>(cbMatch, 15));
+        if (cbMatch >= 15)
+        {
+            pDest = WriteLength(pDest, cbMatch - 15);
+        }
+        return pDest;
+    }
+
+    bool ReadLength(const uint8_t*& pSource, const uint8_t* pSourceEnd, size_t& cb)
+    {
+        uint8_t b;
+        do
+        {
+            if (pSource == pSourceEnd)
+            {
+                return false;
+            }
+            b = *pSource++;
+            cb += b;
+        } while (b == 255);
+        return true;
+    }
+
+    // Maps the pixels to indices into at most 256 colors.  pIndices gets a
+    // byte per pixel.  Returns false if there are more colors.
+    bool IndexColors(const GifSurface& surface, uint32_t* pPalette, unsigned int& cColors, uint8_t* pIndices)
+    {
+        uint32_t colors[COLOR_TABLE_SIZE];
+        int16_t indices[COLOR_TABLE_SIZE];
+        std::fill(indices, indices + COLOR_TABLE_SIZE, static_cast<int16_t>(-1));
+
+        cColors = 0;
+        uint32_t lastColor = 0;
+        uint8_t lastIndex = 0;
+        bool fHasLast = false;
+        for (unsigned int y = 0; y < surface.cy; y++)
+        {
+            const uint32_t* pRow = surface.Row(y);
+            for (unsigned int x = 0; x < surface.cx; x++)
+            {
+                uint32_t color = pRow[x];
+
+                // Gif frames are mostly runs of one color
+                if (fHasLast && color == lastColor)
+                {
+                    *pIndices++ = lastIndex;
+                    continue;
+                }
+
+                unsigned int uSlot = HashColor(color);
+                while (indices[uSlot] >= 0 && colors[uSlot] != color)
+                {
+                    uSlot = (uSlot + 1) & (COLOR_TABLE_SIZE - 1);
+                }
+                if (indices[uSlot] < 0)
+                {
+                    if (cColors == 256)
+                    {
+                        return false;
+                    }
+                    colors[uSlot] = color;
+                    indices[uSlot] = static_cast<int16_t>(cColors);
+                    pPalette[cColors++] = color;
+                }
+
+                lastColor = color;
+                lastIndex = static_cast<uint8_t>(indices[uSlot]);
+                fHasLast = true;
+                *pIndices++ = lastIndex;
+            }
+        }
+        return true;
+    }
+
+    // Writes the pixels as colors and indices, or as they are
+    void PackStage(const GifSurface& surface, unsigned int uCodec, GifPackedPixels& packed, std::vector<uint8_t>& stage)
+    {
+        size_t cPixels = static_cast<size_t>(surface.cx) * surface.cy;
+        packed.uCodec = GFC_NONE;
+        packed.cColors = 0;
+
+        if (uCodec & GFC_PALETTE)
+        {
+            uint32_t palette[256];
+            unsigned int cColors = 0;
+            stage.resize(sizeof(palette) + cPixels);
+            if (IndexColors(surface, palette, cColors, stage.data() + sizeof(palette)))
+            {
+                // Move the indices down to just after the colors used
+                size_t cbPalette = cColors * sizeof(uint32_t);
+                memcpy(stage.data(), palette, cbPalette);
+                memmove(stage.data() + cbPalette, stage.data() + sizeof(palette), cPixels);
+                stage.resize(cbPalette + cPixels);
+                packed.uCodec = GFC_PALETTE;
+                packed.cColors = cColors;
+                return;
+            }
+        }
+
+        stage.resize(cPixels * sizeof(uint32_t));
+        for (unsigned int y = 0; y < surface.cy; y++)
+        {
+            memcpy(stage.data() + static_cast<size_t>(y) * surface.cx * sizeof(uint32_t),
+                surface.Row(y), surface.cx * sizeof(uint32_t));
+        }
+    }
+
+    // Expands the colors and indices or copies the pixels in stage
+    void UnpackStage(const GifPackedPixels& packed, const uint8_t* pStage, const GifSurface& surface)
+    {
+        if (packed.uCodec & GFC_PALETTE)
+        {
+            // The kernels may read any of the 256 entries
+            uint32_t palette[256] = {};
+            memcpy(palette, pStage, packed.cColors * sizeof(uint32_t));
+            const uint8_t* pIndices = pStage + packed.cColors * sizeof(uint32_t);
+
+            const auto& kernels = GetGifKernels();
+            for (unsigned int y = 0; y < packed.cy; y++)
+            {
+                kernels.ExpandIndices(surface.Row(y), pIndices + static_cast<size_t>(y) * packed.cx, packed.cx, palette);
+            }
+            return;
+        }
+
+        for (unsigned int y = 0; y < packed.cy; y++)
+        {
+            memcpy(surface.Row(y), pStage + static_cast<size_t>(y) * packed.cx * sizeof(uint32_t),
+                packed.cx * sizeof(uint32_t));
+        }
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  PackGifPixels                                                  *
+*                                                                 *
+*  Writes the palettized or plain pixels straight into the packed *
+*  data, or into scratch when they are to be compressed from      *
+*  there.  Data that does not compress is kept uncompressed.      *
+*                                                                 *
+******************************************************************/
+
+void PackGifPixels(const GifSurface& surface, unsigned int uCodec, GifPackedPixels& packed, std::vector<uint8_t>& scratch)
+{
+    packed.cx = surface.cx;
+    packed.cy = surface.cy;
+    packed.cbUnpacked = 0;
+
+    if (!(uCodec & GFC_LZ))
+    {
+        PackStage(surface, uCodec, packed, packed.data);
+        return;
+    }
+
+    PackStage(surface, uCodec, packed, scratch);
+    packed.data.resize(GetGifLzBound(scratch.size()));
+    size_t cbCompressed = CompressGifLz(scratch.data(), scratch.size(), packed.data.data());
+    if (cbCompressed >= scratch.size())
+    {
+        packed.data.assign(scratch.begin(), scratch.end());
+        return;
+    }
+
+    packed.data.resize(cbCompressed);
+    packed.uCodec |= GFC_LZ;
+    packed.cbUnpacked = scratch.size();
+}
+
+/******************************************************************
+*                                                                 *
+*  UnpackGifPixels                                                *
+*                                                                 *
+******************************************************************/
+
+void UnpackGifPixels(const GifPackedPixels& packed, const GifSurface& surface, std::vector<uint8_t>& scratch)
+{
+    if (!(packed.uCodec & GFC_LZ))
+    {
+        UnpackStage(packed, packed.data.data(), surface);
+        return;
+    }
+
+    scratch.resize(packed.cbUnpacked);
+    if (!DecompressGifLz(packed.data.data(), packed.data.size(), scratch.data(), scratch.size()))
+    {
+        // Only packed data is unpacked, so this is a bug rather than bad input
+        throw std::logic_error("Corrupt packed frame");
+    }
+    UnpackStage(packed, scratch.data(), surface);
+}
+
+/******************************************************************
+*                                                                 *
+*  GetGifLzBound                                                  *
+*                                                                 *
+******************************************************************/
+
+size_t GetGifLzBound(size_t cbSource)
+{
+    return cbSource + cbSource / 255 + 16;
+}
+
+/******************************************************************
+*                                                                 *
+*  CompressGifLz                                                  *
+*                                                                 *
+*  Looks up each position's next 4 bytes in a table of the last   *
+*  position they were seen at, and extends a match as far as it   *
+*  goes.  Positions without a match are skipped faster the longer *
+*  the search has gone without one, as LZ4 does.                  *
+*                                                                 *
+******************************************************************/
+
+size_t CompressGifLz(const uint8_t* pSource, size_t cbSource, uint8_t* pDest)
+{
+    uint8_t* pOut = pDest;
+    size_t iAnchor = 0;
+
+    if (cbSource > MATCH_FIND_LIMIT)
+    {
+        uint32_t positions[1 << LZ_HASH_BITS] = {};
+        size_t iMatchFindEnd = cbSource - MATCH_FIND_LIMIT;
+        size_t iMatchEnd = cbSource - LAST_LITERALS;
+        size_t i = 0;
+        unsigned int cMisses = 0;
+
+        while (i < iMatchFindEnd)
+        {
+            uint32_t sequence = Read32(pSource + i);
+            unsigned int uHash = HashSequence(sequence);
+            size_t iCandidate = positions[uHash];
+            positions[uHash] = static_cast<uint32_t>(i);
+
+            if (iCandidate >= i || i - iCandidate > MAX_OFFSET || Read32(pSource + iCandidate) != sequence)
+            {
+                i += 1 + (cMisses++ >> 6);
+                continue;
+            }
+            cMisses = 0;
+
+            size_t cbMatch = MIN_MATCH;
+            while (i + cbMatch < iMatchEnd && pSource[iCandidate + cbMatch] == pSource[i + cbMatch])
+            {
+                cbMatch++;
+            }
+
+            pOut = WriteSequence(pOut, pSource + iAnchor, i - iAnchor, i - iCandidate, cbMatch);
+            i += cbMatch;
+            iAnchor = i;
+        }
+    }
+
+    return WriteSequence(pOut, pSource + iAnchor, cbSource - iAnchor, 0, 0) - pDest;
+}
+
+/******************************************************************
+*                                                                 *
+*  DecompressGifLz                                                *
+*                                                                 *
+*  Overlapping matches, such as runs of one pixel, are copied in  *
+*  chunks that double as the copied pattern grows.                *
+*                                                                 *
+******************************************************************/
+
+bool DecompressGifLz(const uint8_t* pSource, size_t cbSource, uint8_t* pDest, size_t cbDest)
+{
+    const uint8_t* pSourceEnd = pSource + cbSource;
+    uint8_t* pOut = pDest;
+    uint8_t* pOutEnd = pDest + cbDest;
+
+    while (pSource < pSourceEnd)
+    {
+        uint8_t token = *pSource++;
+
+        size_t cLiterals = token >> 4;
+        if (cLiterals == 15 && !ReadLength(pSource, pSourceEnd, cLiterals))
+        {
+            return false;
+        }
+        if (cLiterals > static_cast<size_t>(pSourceEnd - pSource) || cLiterals > static_cast<size_t>(pOutEnd - pOut))
+        {
+            return false;
+        }
+        if (cLiterals > 0)
+        {
+            memcpy(pOut, pSource, cLiterals);
+            pSource += cLiterals;
+            pOut += cLiterals;
+        }
+
+        if (pSource == pSourceEnd)
+        {
+            break;
+        }
+
+        if (pSourceEnd - pSource < 2)
+        {
+            return false;
+        }
+        size_t offset = pSource[0] | (static_cast<size_t>(pSource[1]) << 8);
+        pSource += 2;
+
+        size_t cbMatch = token & 0x0F;
+        if (cbMatch == 15 && !ReadLength(pSource, pSourceEnd, cbMatch))
+        {
+            return false;
+        }
+        cbMatch += MIN_MATCH;
+
+        if (offset == 0 || offset > static_cast<size_t>(pOut - pDest) || cbMatch > static_cast<size_t>(pOutEnd - pOut))
+        {
+            return false;
+        }
+
+        const uint8_t* pMatch = pOut - offset;
+        while (cbMatch > 0)
+        {
+            size_t cbChunk = std::min(static_cast<size_t>(pOut - pMatch), cbMatch);
+            memcpy(pOut, pMatch, cbChunk);
+            pOut += cbChunk;
+            cbMatch -= cbChunk;
+        }
+    }
+
+    return pOut == pOutEnd;
+}
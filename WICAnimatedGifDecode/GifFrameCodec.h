@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "GifTypes.h"
+
+// Ways of packing the composed frames held by the frame cache, combined as
+// flags.  GFC_DELTA is applied by the compositor, the others by
+// PackGifPixels.
+enum GIF_FRAME_CODEC
+{
+    GFC_NONE = 0,
+    GFC_DELTA = 0x1,        // Only the dirty rect, restored over the frame displayed before it
+    GFC_PALETTE = 0x2,      // 8 bit indices into the frame's colors, when it has at most 256
+    GFC_LZ = 0x4,           // LZ4 block compression
+    GFC_ALL = GFC_DELTA | GFC_PALETTE | GFC_LZ
+};
+
+// Pixels packed by PackGifPixels
+struct GifPackedPixels
+{
+    std::vector<uint8_t>    data;
+    unsigned int            cx;
+    unsigned int            cy;
+    unsigned int            uCodec;     // GFC_PALETTE and GFC_LZ as applied, which can be fewer than asked for
+    unsigned int            cColors;    // With GFC_PALETTE, data starts with this many colors
+    size_t                  cbUnpacked; // With GFC_LZ, the size of data before compression
+
+    size_t SizeInBytes() const
+    {
+        return data.size();
+    }
+};
+
+// Packs the pixels of surface with the GFC_PALETTE and GFC_LZ flags of
+// uCodec.  A palette is only used if the pixels have at most 256 colors, and
+// LZ only if it makes the data smaller.  scratch is working memory, kept by
+// the caller so that packing does not allocate once it has grown.
+void PackGifPixels(const GifSurface& surface, unsigned int uCodec, GifPackedPixels& packed, std::vector<uint8_t>& scratch);
+
+// Unpacks into the top left packed.cx by packed.cy pixels of surface
+void UnpackGifPixels(const GifPackedPixels& packed, const GifSurface& surface, std::vector<uint8_t>& scratch);
+
+// The most bytes CompressGifLz writes for cbSource bytes
+size_t GetGifLzBound(size_t cbSource);
+
+// Compresses to the LZ4 block format, greedily matching 4 byte sequences
+// found through a hash table.  pDest must have room for
+// GetGifLzBound(cbSource) bytes.  Returns the compressed size.
+size_t CompressGifLz(const uint8_t* pSource, size_t cbSource, uint8_t* pDest);
+
+// Decompresses an LZ4 block that must expand to exactly cbDest bytes.
+// Returns false if the block is malformed.
+bool DecompressGifLz(const uint8_t* pSource, size_t cbSource, uint8_t* pDest, size_t cbDest);
@@ -0,0 +1,409 @@
+#include "GifFrameIndex.h"
+
+#include <stdexcept>
+
+namespace
+{
+    const uint8_t c_indexMagic[4] = { 'G', 'I', 'F', 'X' };
+    const uint32_t c_indexVersion = 2;
+    const size_t c_cbHeader = 13;           // Header and logical screen descriptor
+    const size_t c_cbImageDescriptor = 10;
+
+    // FNV-1a, continuing from hash
+    uint64_t HashBytes(uint64_t hash, const uint8_t* pData, size_t cbData)
+    {
+        for (size_t i = 0; i < cbData; i++)
+        {
+            hash = (hash ^ pData[i]) * 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    const uint64_t c_hashSeed = 0xcbf29ce484222325ull;
+
+    void WriteUInt(std::vector<uint8_t>& data, uint64_t value, unsigned int cb)
+    {
+        for (unsigned int i = 0; i < cb; i++)
+        {
+            data.push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    // Bounds checked little endian reader over a serialized index
+    class IndexReader
+    {
+    public:
+
+        IndexReader(const uint8_t* pData, size_t cbData) :
+            m_pData(pData),
+            m_cbData(cbData),
+            m_off(0)
+        {
+        }
+
+        uint64_t ReadUInt(unsigned int cb)
+        {
+            if (m_cbData - m_off < cb)
+            {
+                throw std::runtime_error("Truncated frame index");
+            }
+
+            uint64_t value = 0;
+            for (unsigned int i = 0; i < cb; i++)
+            {
+                value |= static_cast<uint64_t>(m_pData[m_off + i]) << (8 * i);
+            }
+            m_off += cb;
+            return value;
+        }
+
+        size_t Remaining() const
+        {
+            return m_cbData - m_off;
+        }
+
+    private:
+
+        const uint8_t*  m_pData;
+        size_t          m_cbData;
+        size_t          m_off;
+    };
+}
+
+/******************************************************************
+*                                                                 *
+*  GifFrameIndex::GifFrameIndex constructor                       *
+*                                                                 *
+******************************************************************/
+
+GifFrameIndex::GifFrameIndex()
+{
+    Reset(0, 0, 0);
+}
+
+/******************************************************************
+*                                                                 *
+*  GifFrameIndex::Reset                                           *
+*                                                                 *
+******************************************************************/
+
+void GifFrameIndex::Reset(unsigned int cxScreen, unsigned int cyScreen, size_t cbData)
+{
+    m_cxScreen = cxScreen;
+    m_cyScreen = cyScreen;
+    m_cbData = cbData;
+    m_fComplete = false;
+    m_uTotalLoopCount = 0;
+    m_fHasLoop = false;
+    m_dataHash = 0;
+
+    m_imageRects.clear();
+    m_delays.clear();
+    m_flags.clear();
+    m_transparentIndices.clear();
+    m_offImageData.clear();
+    m_offLocalPalettes.clear();
+    m_cLocalColors.clear();
+}
+
+/******************************************************************
+*                                                                 *
+*  GifFrameIndex::Append                                          *
+*                                                                 *
+******************************************************************/
+
+void GifFrameIndex::Append(
+    const GifFrameInfo& info,
+    const GifRect& imageRect,
+    size_t offImageData,
+    size_t offLocalPalette,
+    unsigned int cLocalColors)
+{
+    uint8_t flags = static_cast<uint8_t>(info.uDisposal & FIF_DISPOSAL_MASK);
+    if (info.fTransparent)
+    {
+        flags |= FIF_TRANSPARENT;
+    }
+    if (info.fInterlaced)
+    {
+        flags |= FIF_INTERLACED;
+    }
+
+    m_imageRects.push_back(imageRect);
+    m_delays.push_back(info.uDelay);
+    m_flags.push_back(flags);
+    m_transparentIndices.push_back(info.transparentIndex);
+    m_offImageData.push_back(offImageData);
+    m_offLocalPalettes.push_back(offLocalPalette);
+    m_cLocalColors.push_back(static_cast<uint16_t>(cLocalColors));
+}
+
+/******************************************************************
+*                                                                 *
+*  GifFrameIndex::SetComplete                                     *
+*                                                                 *
+******************************************************************/
+
+void GifFrameIndex::SetComplete(unsigned int uTotalLoopCount, bool fHasLoop)
+{
+    m_fComplete = true;
+    m_uTotalLoopCount = uTotalLoopCount;
+    m_fHasLoop = fHasLoop;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifFrameIndex::SetDataHash                                     *
+*                                                                 *
+******************************************************************/
+
+void GifFrameIndex::SetDataHash(const uint8_t* pData)
+{
+    m_dataHash = HashData(pData);
+}
+
+/******************************************************************
+*                                                                 *
+*  GifFrameIndex::HashData                                        *
+*                                                                 *
+*  Only the header and the image descriptor and LZW minimum code  *
+*  size in front of each frame's image data are hashed, which are *
+*  the pages a decode reads anyway, rather than the whole file.   *
+*                                                                 *
+******************************************************************/
+
+uint64_t GifFrameIndex::HashData(const uint8_t* pData) const
+{
+    auto hash = HashBytes(c_hashSeed, pData, c_cbHeader);
+    for (unsigned int i = 0; i < Size(); i++)
+    {
+        auto offDescriptor = (m_offLocalPalettes[i] != 0 ? m_offLocalPalettes[i] : m_offImageData[i]) - c_cbImageDescriptor;
+        hash = HashBytes(hash, pData + offDescriptor, c_cbImageDescriptor);
+        hash = HashBytes(hash, pData + m_offImageData[i], 1);
+    }
+    return hash;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifFrameIndex::GetFrameInfo                                    *
+*                                                                 *
+******************************************************************/
+
+void GifFrameIndex::GetFrameInfo(unsigned int uFrameIndex, GifFrameInfo& frameInfo) const
+{
+    auto flags = m_flags[uFrameIndex];
+
+    frameInfo.rect = IntersectGifRect(m_imageRects[uFrameIndex], { 0, 0, m_cxScreen, m_cyScreen });
+    frameInfo.uDelay = m_delays[uFrameIndex];
+    frameInfo.uDisposal = flags & FIF_DISPOSAL_MASK;
+    frameInfo.fTransparent = (flags & FIF_TRANSPARENT) != 0;
+    frameInfo.transparentIndex = m_transparentIndices[uFrameIndex];
+    frameInfo.fInterlaced = (flags & FIF_INTERLACED) != 0;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifFrameIndex::Matches                                         *
+*                                                                 *
+*  The same checks the block scan makes, so that decoding from a  *
+*  loaded index never reads outside the data, then the hash of    *
+*  the blocks the index points at.                                *
+*                                                                 *
+******************************************************************/
+
+bool GifFrameIndex::Matches(unsigned int cxScreen, unsigned int cyScreen, const uint8_t* pData, size_t cbData) const
+{
+    if (!m_fComplete || cxScreen != m_cxScreen || cyScreen != m_cyScreen || cbData != m_cbData || cbData < c_cbHeader)
+    {
+        return false;
+    }
+
+    for (unsigned int i = 0; i < Size(); i++)
+    {
+        if (m_offImageData[i] >= cbData || (m_flags[i] & FIF_DISPOSAL_MASK) > GIF_DM_PREVIOUS)
+        {
+            return false;
+        }
+
+        // A local palette sits between the image descriptor and the image data
+        auto offPalette = m_offLocalPalettes[i];
+        if (offPalette != 0 &&
+            (m_cLocalColors[i] > 256 || offPalette > m_offImageData[i] ||
+             3u * m_cLocalColors[i] > m_offImageData[i] - offPalette))
+        {
+            return false;
+        }
+
+        // Each image descriptor follows the header
+        auto offDescriptor = offPalette != 0 ? offPalette : m_offImageData[i];
+        if (offDescriptor < c_cbHeader + c_cbImageDescriptor)
+        {
+            return false;
+        }
+    }
+
+    return HashData(pData) == m_dataHash;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifFrameIndex::Serialize                                       *
+*                                                                 *
+*  Layout: magic, version, data size, data hash, screen size,     *
+*  loop count, loop flag and frame count, then each array in      *
+*  turn and a hash of everything before it.  Rects are stored     *
+*  the way the image descriptor stores them.                      *
+*                                                                 *
+******************************************************************/
+
+void GifFrameIndex::Serialize(std::vector<uint8_t>& data) const
+{
+    if (!m_fComplete)
+    {
+        throw std::logic_error("Only a complete frame index can be serialized");
+    }
+
+    auto offStart = data.size();
+    data.insert(data.end(), c_indexMagic, c_indexMagic + sizeof(c_indexMagic));
+    WriteUInt(data, c_indexVersion, 4);
+    WriteUInt(data, m_cbData, 8);
+    WriteUInt(data, m_dataHash, 8);
+    WriteUInt(data, m_cxScreen, 2);
+    WriteUInt(data, m_cyScreen, 2);
+    WriteUInt(data, m_uTotalLoopCount, 2);
+    WriteUInt(data, m_fHasLoop ? 1 : 0, 1);
+    WriteUInt(data, Size(), 4);
+
+    for (const auto& rect : m_imageRects)
+    {
+        WriteUInt(data, rect.left, 2);
+        WriteUInt(data, rect.top, 2);
+        WriteUInt(data, rect.Width(), 2);
+        WriteUInt(data, rect.Height(), 2);
+    }
+    for (auto delay : m_delays)
+    {
+        WriteUInt(data, delay, 4);
+    }
+    data.insert(data.end(), m_flags.begin(), m_flags.end());
+    data.insert(data.end(), m_transparentIndices.begin(), m_transparentIndices.end());
+    for (auto off : m_offImageData)
+    {
+        WriteUInt(data, off, 8);
+    }
+    for (auto off : m_offLocalPalettes)
+    {
+        WriteUInt(data, off, 8);
+    }
+    for (auto cColors : m_cLocalColors)
+    {
+        WriteUInt(data, cColors, 2);
+    }
+
+    WriteUInt(data, HashBytes(c_hashSeed, data.data() + offStart, data.size() - offStart), 8);
+}
+
+/******************************************************************
+*                                                                 *
+*  GifFrameIndex::Deserialize                                     *
+*                                                                 *
+******************************************************************/
+
+void GifFrameIndex::Deserialize(const uint8_t* pData, size_t cbData)
+{
+    const size_t cbPerFrame = 8 + 4 + 1 + 1 + 8 + 8 + 2;
+    const size_t cbChecksum = 8;
+
+    if (cbData < cbChecksum)
+    {
+        throw std::runtime_error("Truncated frame index");
+    }
+    cbData -= cbChecksum;
+    if (IndexReader(pData + cbData, cbChecksum).ReadUInt(cbChecksum) != HashBytes(c_hashSeed, pData, cbData))
+    {
+        throw std::runtime_error("Corrupted frame index");
+    }
+
+    IndexReader reader(pData, cbData);
+    for (auto magic : c_indexMagic)
+    {
+        if (reader.ReadUInt(1) != magic)
+        {
+            throw std::runtime_error("Not a frame index");
+        }
+    }
+    if (reader.ReadUInt(4) != c_indexVersion)
+    {
+        throw std::runtime_error("Unsupported frame index version");
+    }
+
+    auto cbGifData = reader.ReadUInt(8);
+    auto dataHash = reader.ReadUInt(8);
+    auto cxScreen = static_cast<unsigned int>(reader.ReadUInt(2));
+    auto cyScreen = static_cast<unsigned int>(reader.ReadUInt(2));
+    auto uTotalLoopCount = static_cast<unsigned int>(reader.ReadUInt(2));
+    auto fHasLoop = reader.ReadUInt(1) != 0;
+    auto cFrames = static_cast<unsigned int>(reader.ReadUInt(4));
+    if (reader.Remaining() / cbPerFrame < cFrames)
+    {
+        throw std::runtime_error("Truncated frame index");
+    }
+
+    Reset(cxScreen, cyScreen, static_cast<size_t>(cbGifData));
+
+    std::vector<GifFrameInfo> infos(cFrames);
+    for (auto& info : infos)
+    {
+        auto& rect = info.rect;
+        rect.left = static_cast<unsigned int>(reader.ReadUInt(2));
+        rect.top = static_cast<unsigned int>(reader.ReadUInt(2));
+        rect.right = rect.left + static_cast<unsigned int>(reader.ReadUInt(2));
+        rect.bottom = rect.top + static_cast<unsigned int>(reader.ReadUInt(2));
+    }
+    for (auto& info : infos)
+    {
+        info.uDelay = static_cast<unsigned int>(reader.ReadUInt(4));
+    }
+    for (auto& info : infos)
+    {
+        auto flags = reader.ReadUInt(1);
+        info.uDisposal = flags & FIF_DISPOSAL_MASK;
+        info.fTransparent = (flags & FIF_TRANSPARENT) != 0;
+        info.fInterlaced = (flags & FIF_INTERLACED) != 0;
+    }
+    for (auto& info : infos)
+    {
+        info.transparentIndex = static_cast<uint8_t>(reader.ReadUInt(1));
+    }
+
+    std::vector<uint64_t> offImageData(cFrames);
+    std::vector<uint64_t> offLocalPalettes(cFrames);
+    for (auto& off : offImageData)
+    {
+        off = reader.ReadUInt(8);
+    }
+    for (auto& off : offLocalPalettes)
+    {
+        off = reader.ReadUInt(8);
+    }
+
+    for (unsigned int i = 0; i < cFrames; i++)
+    {
+        auto cLocalColors = static_cast<unsigned int>(reader.ReadUInt(2));
+        Append(
+            infos[i],
+            infos[i].rect,
+            static_cast<size_t>(offImageData[i]),
+            static_cast<size_t>(offLocalPalettes[i]),
+            cLocalColors);
+    }
+
+    if (reader.Remaining() != 0)
+    {
+        throw std::runtime_error("Corrupted frame index");
+    }
+
+    SetComplete(uTotalLoopCount, fHasLoop);
+    m_dataHash = dataHash;
+}
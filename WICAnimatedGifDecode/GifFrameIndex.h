@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "GifTypes.h"
+
+/******************************************************************
+*                                                                 *
+*  GifFrameIndex                                                  *
+*                                                                 *
+*  Per frame metadata and block offsets, kept as one flat array   *
+*  per field so a frame lookup is a handful of array reads.  The  *
+*  index is built by walking the block structure once and can be  *
+*  serialized, so it can be stored next to the gif and loaded     *
+*  instead of walking the file again.                             *
+*                                                                 *
+******************************************************************/
+
+class GifFrameIndex
+{
+public:
+
+    GifFrameIndex();
+
+    // Empties the index for cbData bytes of gif data with the given logical
+    // screen size
+    void Reset(unsigned int cxScreen, unsigned int cyScreen, size_t cbData);
+
+    // imageRect is the rect stored in the image descriptor, before clipping
+    // to the logical screen.  offLocalPalette is 0 for the global palette.
+    void Append(
+        const GifFrameInfo& info,
+        const GifRect& imageRect,
+        size_t offImageData,
+        size_t offLocalPalette,
+        unsigned int cLocalColors);
+
+    // Records the size of gif data that arrived as a stream, once it has ended
+    void SetDataSize(size_t cbData)
+    {
+        m_cbData = cbData;
+    }
+
+    // Marks every frame as indexed and records what was learned on the way
+    void SetComplete(unsigned int uTotalLoopCount, bool fHasLoop);
+
+    // Hashes the header and the image descriptors of the gif data the
+    // complete index was built from, so that a loaded index can be told
+    // apart from one saved for another file of the same size
+    void SetDataHash(const uint8_t* pData);
+
+    unsigned int Size() const
+    {
+        return static_cast<unsigned int>(m_delays.size());
+    }
+
+    bool IsComplete() const
+    {
+        return m_fComplete;
+    }
+
+    unsigned int GetTotalLoopCount() const
+    {
+        return m_uTotalLoopCount;
+    }
+
+    bool HasLoop() const
+    {
+        return m_fHasLoop;
+    }
+
+    // Frame metadata with the rect clipped to the logical screen
+    void GetFrameInfo(unsigned int uFrameIndex, GifFrameInfo& frameInfo) const;
+
+    const GifRect& GetImageRect(unsigned int uFrameIndex) const
+    {
+        return m_imageRects[uFrameIndex];
+    }
+
+    size_t GetImageDataOffset(unsigned int uFrameIndex) const
+    {
+        return static_cast<size_t>(m_offImageData[uFrameIndex]);
+    }
+
+    size_t GetLocalPaletteOffset(unsigned int uFrameIndex) const
+    {
+        return static_cast<size_t>(m_offLocalPalettes[uFrameIndex]);
+    }
+
+    unsigned int GetLocalColorCount(unsigned int uFrameIndex) const
+    {
+        return m_cLocalColors[uFrameIndex];
+    }
+
+    // Checks that the index was built for this gif data, of this size and
+    // screen size, and that every block it points at lies within the data
+    bool Matches(unsigned int cxScreen, unsigned int cyScreen, const uint8_t* pData, size_t cbData) const;
+
+    // Appends the complete index in a portable little endian layout
+    void Serialize(std::vector<uint8_t>& data) const;
+
+    // Replaces the index with a serialized one.  Throws std::runtime_error
+    // if the data is not a complete serialized index or fails its checksum.
+    void Deserialize(const uint8_t* pData, size_t cbData);
+
+private:
+
+    uint64_t HashData(const uint8_t* pData) const;
+
+private:
+
+    // Flag bits in m_flags
+    enum
+    {
+        FIF_DISPOSAL_MASK   = 0x07,
+        FIF_TRANSPARENT     = 0x08,
+        FIF_INTERLACED      = 0x10
+    };
+
+private:
+
+    unsigned int    m_cxScreen;
+    unsigned int    m_cyScreen;
+    uint64_t        m_cbData;           // Bytes of gif data the offsets were taken from
+    bool            m_fComplete;
+    unsigned int    m_uTotalLoopCount;
+    bool            m_fHasLoop;
+    uint64_t        m_dataHash;         // See SetDataHash
+
+    std::vector<GifRect>    m_imageRects;
+    std::vector<uint32_t>   m_delays;           // ms
+    std::vector<uint8_t>    m_flags;
+    std::vector<uint8_t>    m_transparentIndices;
+    std::vector<uint64_t>   m_offImageData;     // Offset of the LZW minimum code size byte
+    std::vector<uint64_t>   m_offLocalPalettes;
+    std::vector<uint16_t>   m_cLocalColors;
+};
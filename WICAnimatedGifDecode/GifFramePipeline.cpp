@@ -0,0 +1,289 @@
+#include "GifFramePipeline.h"
+
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include "GifTrace.h"
+
+namespace
+{
+    void CopySurface(const GifSurface& source, GifBitmap& dest)
+    {
+        if (dest.Width() != source.cx || dest.Height() != source.cy)
+        {
+            dest.Resize(source.cx, source.cy);
+        }
+        auto destSurface = dest.Surface();
+        for (unsigned int y = 0; y < source.cy; y++)
+        {
+            memcpy(destSurface.Row(y), source.Row(y), source.cx * sizeof(uint32_t));
+        }
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifFramePipeline::GifFramePipeline constructor                 *
+*                                                                 *
+******************************************************************/
+
+GifFramePipeline::GifFramePipeline(std::unique_ptr<GifCompositor> compositor, unsigned int cDepth) :
+    m_compositor(std::move(compositor)),
+    m_fCancelled(false),
+    m_fWorkerDone(false),
+    m_ring(cDepth),
+    m_uHead(0),
+    m_cReady(0),
+    m_fAcquired(false)
+{
+    if (cDepth == 0)
+    {
+        throw std::invalid_argument("The pipeline needs room for at least one frame");
+    }
+
+    StartWorker();
+}
+
+/******************************************************************
+*                                                                 *
+*  GifFramePipeline::~GifFramePipeline destructor                 *
+*                                                                 *
+******************************************************************/
+
+GifFramePipeline::~GifFramePipeline()
+{
+    StopWorker();
+}
+
+/******************************************************************
+*                                                                 *
+*  GifFramePipeline::AcquireFrame                                 *
+*                                                                 *
+******************************************************************/
+
+const GifPipelineFrame* GifFramePipeline::AcquireFrame()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    if (m_fAcquired)
+    {
+        throw std::logic_error("The acquired frame has not been released");
+    }
+
+    if (m_cReady == 0 && !m_fWorkerDone)
+    {
+        GIF_TRACE_SCOPE(GTS_WAIT, 0);
+        auto waitStart = std::chrono::steady_clock::now();
+        m_frameReady.wait(lock, [this] { return m_cReady > 0 || m_fWorkerDone; });
+        m_stallHistogram.Record(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - waitStart).count());
+    }
+    else
+    {
+        m_stallHistogram.Record(0);
+    }
+
+    if (m_cReady == 0)
+    {
+        // The worker finished without composing another frame, either past
+        // the last frame or because composing failed
+        if (m_error)
+        {
+            std::rethrow_exception(m_error);
+        }
+        return nullptr;
+    }
+
+    m_fAcquired = true;
+    return &m_ring[m_uHead];
+}
+
+/******************************************************************
+*                                                                 *
+*  GifFramePipeline::ReleaseFrame                                 *
+*                                                                 *
+******************************************************************/
+
+void GifFramePipeline::ReleaseFrame()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        if (!m_fAcquired)
+        {
+            throw std::logic_error("No frame has been acquired");
+        }
+
+        m_fAcquired = false;
+        m_uHead = (m_uHead + 1) % m_ring.size();
+        m_cReady--;
+    }
+    m_slotFree.notify_one();
+}
+
+/******************************************************************
+*                                                                 *
+*  GifFramePipeline::Restart                                      *
+*                                                                 *
+******************************************************************/
+
+void GifFramePipeline::Restart()
+{
+    StopWorker();
+
+    m_uHead = 0;
+    m_cReady = 0;
+    m_fAcquired = false;
+    m_fCancelled = false;
+    m_fWorkerDone = false;
+    m_error = nullptr;
+    m_compositor->Reset();
+
+    StartWorker();
+}
+
+/******************************************************************
+*                                                                 *
+*  GifFramePipeline::SetFrameCacheMode                            *
+*                                                                 *
+******************************************************************/
+
+void GifFramePipeline::SetFrameCacheMode(FRAME_CACHE_MODE mode, size_t cbBudget)
+{
+    std::lock_guard<std::mutex> lock(m_compositorLock);
+    m_compositor->SetFrameCacheMode(mode, cbBudget);
+}
+
+/******************************************************************
+*                                                                 *
+*  GifFramePipeline::SetSharedFrameStore                          *
+*                                                                 *
+******************************************************************/
+
+void GifFramePipeline::SetSharedFrameStore(std::shared_ptr<IGifSharedFrameStore> store)
+{
+    std::lock_guard<std::mutex> lock(m_compositorLock);
+    m_compositor->SetSharedFrameStore(std::move(store));
+}
+
+/******************************************************************
+*                                                                 *
+*  GifFramePipeline::GetFrameCacheStats                           *
+*                                                                 *
+******************************************************************/
+
+FrameCacheStats GifFramePipeline::GetFrameCacheStats()
+{
+    std::lock_guard<std::mutex> lock(m_compositorLock);
+    return m_compositor->GetFrameCacheStats();
+}
+
+/******************************************************************
+*                                                                 *
+*  GifFramePipeline::GetStallHistogram                            *
+*                                                                 *
+******************************************************************/
+
+GifLatencyHistogram GifFramePipeline::GetStallHistogram() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_stallHistogram;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifFramePipeline::StartWorker                                  *
+*                                                                 *
+******************************************************************/
+
+void GifFramePipeline::StartWorker()
+{
+    m_worker = std::thread(&GifFramePipeline::WorkerMain, this);
+}
+
+/******************************************************************
+*                                                                 *
+*  GifFramePipeline::StopWorker                                   *
+*                                                                 *
+*  Cancels the worker.  It checks for cancellation between        *
+*  frames, so this waits for at most one frame to be composed.    *
+*                                                                 *
+******************************************************************/
+
+void GifFramePipeline::StopWorker()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_fCancelled = true;
+    }
+    m_slotFree.notify_one();
+
+    if (m_worker.joinable())
+    {
+        m_worker.join();
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifFramePipeline::WorkerMain                                   *
+*                                                                 *
+*  Composes into the slot after the newest ready frame.  The slot *
+*  is not visible to the presenter until m_cReady is increased,   *
+*  so composing and copying happen without holding m_lock.        *
+*                                                                 *
+******************************************************************/
+
+void GifFramePipeline::WorkerMain()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    for (;;)
+    {
+        // Back-pressure: wait for the presenter to release a frame
+        m_slotFree.wait(lock, [this] { return m_fCancelled || m_cReady < m_ring.size(); });
+        if (m_fCancelled)
+        {
+            break;
+        }
+
+        auto& frame = m_ring[(m_uHead + m_cReady) % m_ring.size()];
+        lock.unlock();
+
+        try
+        {
+            std::lock_guard<std::mutex> compositorLock(m_compositorLock);
+
+            auto uFrameIndex = m_compositor->GetNextFrameIndex();
+            m_compositor->ComposeNextFrame();
+            {
+                GIF_TRACE_SCOPE(GTS_COPY, uFrameIndex);
+                CopySurface(m_compositor->GetComposedFrame(), frame.composedFrame);
+            }
+            frame.dirtyRect = m_compositor->GetDirtyRect();
+            frame.uFrameDelay = m_compositor->GetFrameDelay();
+            frame.uNextFrameIndex = m_compositor->GetNextFrameIndex();
+            frame.uLoopNumber = m_compositor->GetLoopNumber();
+            frame.fLastFrame = m_compositor->EndOfAnimation() || m_compositor->GetGlobalInfo().cFrames <= 1;
+        }
+        catch (...)
+        {
+            lock.lock();
+            m_error = std::current_exception();
+            break;
+        }
+
+        lock.lock();
+        m_cReady++;
+        m_frameReady.notify_one();
+
+        if (frame.fLastFrame)
+        {
+            break;
+        }
+    }
+
+    m_fWorkerDone = true;
+    m_frameReady.notify_one();
+}
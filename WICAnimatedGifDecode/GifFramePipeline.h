@@ -0,0 +1,98 @@
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "GifCompositor.h"
+#include "GifLatencyHistogram.h"
+
+// Composed frames kept ready ahead of the one being displayed
+const unsigned int DEFAULT_PIPELINE_DEPTH = 3;
+
+// A composed frame and the compositor state right after composing it
+struct GifPipelineFrame
+{
+    GifBitmap       composedFrame;
+    GifRect         dirtyRect;          // Relative to the previous frame from the pipeline
+    unsigned int    uFrameDelay;
+    unsigned int    uNextFrameIndex;
+    unsigned int    uLoopNumber;
+    bool            fLastFrame;         // No frames follow this one
+};
+
+/******************************************************************
+*                                                                 *
+*  GifFramePipeline                                               *
+*                                                                 *
+*  Composes frames ahead of time on a worker thread.  The worker  *
+*  owns the compositor and fills a ring of up to cDepth composed  *
+*  frames, blocking while the ring is full, so the presenter only *
+*  has to pick up the next ready frame when it is due.            *
+*                                                                 *
+*  The worker stops after the last frame of a finite animation,   *
+*  or after the only frame of a still image.                      *
+*                                                                 *
+******************************************************************/
+
+class GifFramePipeline
+{
+public:
+
+    GifFramePipeline(std::unique_ptr<GifCompositor> compositor, unsigned int cDepth = DEFAULT_PIPELINE_DEPTH);
+
+    // Cancels composing and waits for the worker to finish the frame it is on
+    ~GifFramePipeline();
+
+    GifFramePipeline(const GifFramePipeline&) = delete;
+    GifFramePipeline& operator=(const GifFramePipeline&) = delete;
+
+    // Returns the next composed frame, waiting for the worker if it is not
+    // ready yet, or nullptr if no more frames will come.  Rethrows what the
+    // compositor threw once the frames before the failure are used up.  The frame stays
+    // valid until ReleaseFrame, which must be called before the next
+    // AcquireFrame.
+    const GifPipelineFrame* AcquireFrame();
+    void ReleaseFrame();
+
+    // Drops the frames composed so far and starts again from the first frame
+    void Restart();
+
+    // Forwarded to the compositor, between frames
+    void SetFrameCacheMode(FRAME_CACHE_MODE mode, size_t cbBudget = DEFAULT_FRAME_CACHE_BUDGET);
+    void SetSharedFrameStore(std::shared_ptr<IGifSharedFrameStore> store);
+    FrameCacheStats GetFrameCacheStats();
+
+    // Time the presenter spent waiting in AcquireFrame for frames that were
+    // not ready
+    GifLatencyHistogram GetStallHistogram() const;
+
+private:
+
+    void StartWorker();
+    void StopWorker();
+    void WorkerMain();
+
+private:
+
+    std::unique_ptr<GifCompositor>  m_compositor;
+    std::mutex                      m_compositorLock;   // Held by the worker while composing
+
+    mutable std::mutex              m_lock;
+    std::condition_variable         m_frameReady;
+    std::condition_variable         m_slotFree;
+    std::thread                     m_worker;
+    bool                            m_fCancelled;
+    bool                            m_fWorkerDone;      // The worker composed its last frame
+    std::exception_ptr              m_error;            // Why the worker stopped early, rethrown by AcquireFrame
+
+    std::vector<GifPipelineFrame>   m_ring;
+    size_t                          m_uHead;            // Oldest composed frame
+    size_t                          m_cReady;           // Composed frames, including an acquired one
+    bool                            m_fAcquired;
+
+    GifLatencyHistogram             m_stallHistogram;
+};
@@ -0,0 +1,151 @@
+#include "GifFrameRun.h"
+
+#include <cstring>
+#include <stdexcept>
+
+/******************************************************************
+*                                                                 *
+*  GifFrameRun::Plan                                              *
+*                                                                 *
+*  Collects the frames of the run, then walks them backwards so   *
+*  that every frame is checked against the pixels that later      *
+*  frames overwrite, kept as a mask over the frames' bounds.      *
+*                                                                 *
+******************************************************************/
+
+void GifFrameRun::Plan(
+    unsigned int uFirstFrameIndex,
+    unsigned int cFrames,
+    const FrameInfoReader& readFrameInfo,
+    const FrameOpaqueReader& isFrameOpaque)
+{
+    m_steps.clear();
+    m_cSkipped = 0;
+
+    // Same stopping rule as composing one frame at a time: stop after a
+    // frame with a delay, or after the last frame
+    for (auto uFrameIndex = uFirstFrameIndex; uFrameIndex < cFrames; uFrameIndex++)
+    {
+        GifFrameRunStep step;
+        step.uFrameIndex = uFrameIndex;
+        step.action = GIF_RUN_SKIP;
+        readFrameInfo(uFrameIndex, step.info);
+        m_steps.push_back(step);
+
+        if (step.info.uDelay != 0)
+        {
+            break;
+        }
+    }
+
+    if (m_steps.empty())
+    {
+        throw std::out_of_range("Frame index out of range");
+    }
+
+    // Nothing to plan for a single frame
+    if (m_steps.size() == 1)
+    {
+        m_steps[0].action = GIF_RUN_OVERLAY;
+        return;
+    }
+
+    m_maskRect = {};
+    for (const auto& step : m_steps)
+    {
+        m_maskRect = UnionGifRect(m_maskRect, step.info.rect);
+    }
+    m_coverMask.assign(static_cast<size_t>(m_maskRect.Width()) * m_maskRect.Height(), 0);
+
+    // The displayed frame overwrites its rect unless it has transparent
+    // pixels or its data ends early.  With disposal 3 the canvas under it
+    // is saved first and restored afterwards, so it cannot hide earlier
+    // frames.
+    auto& displayedStep = m_steps.back();
+    displayedStep.action = GIF_RUN_OVERLAY;
+    if (!displayedStep.info.fTransparent && displayedStep.info.uDisposal != GIF_DM_PREVIOUS &&
+        isFrameOpaque(displayedStep.uFrameIndex))
+    {
+        AddCover(displayedStep.info.rect);
+    }
+
+    for (auto i = m_steps.size() - 1; i-- > 0;)
+    {
+        auto& step = m_steps[i];
+        const auto& rect = step.info.rect;
+
+        switch (step.info.uDisposal)
+        {
+        case GIF_DM_UNDEFINED:
+        case GIF_DM_NONE:
+            if (!IsCovered(rect))
+            {
+                step.action = GIF_RUN_DRAW;
+
+                // Only frames before this one can be hidden by it
+                if (i > 0 && !step.info.fTransparent && isFrameOpaque(step.uFrameIndex))
+                {
+                    AddCover(rect);
+                }
+            }
+            break;
+        case GIF_DM_BACKGROUND:
+            if (!IsCovered(rect))
+            {
+                step.action = GIF_RUN_CLEAR;
+                AddCover(rect);
+            }
+            break;
+        case GIF_DM_PREVIOUS:
+            break;
+        default:
+            throw std::runtime_error("Invalid disposal method");
+        }
+
+        if (step.action != GIF_RUN_DRAW)
+        {
+            m_cSkipped++;
+        }
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifFrameRun::IsCovered                                         *
+*                                                                 *
+******************************************************************/
+
+bool GifFrameRun::IsCovered(const GifRect& rect) const
+{
+    if (rect.IsEmpty())
+    {
+        return true;
+    }
+
+    auto cx = m_maskRect.Width();
+    for (auto y = rect.top; y < rect.bottom; y++)
+    {
+        auto pRow = m_coverMask.data() + static_cast<size_t>(y - m_maskRect.top) * cx + (rect.left - m_maskRect.left);
+        if (memchr(pRow, 0, rect.Width()) != nullptr)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifFrameRun::AddCover                                          *
+*                                                                 *
+******************************************************************/
+
+void GifFrameRun::AddCover(const GifRect& rect)
+{
+    auto cx = m_maskRect.Width();
+    for (auto y = rect.top; y < rect.bottom; y++)
+    {
+        auto pRow = m_coverMask.data() + static_cast<size_t>(y - m_maskRect.top) * cx + (rect.left - m_maskRect.left);
+        memset(pRow, 1, rect.Width());
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "GifTypes.h"
+
+enum GIF_RUN_ACTION
+{
+    GIF_RUN_SKIP = 0,       // The frame leaves no trace on the displayed frame
+    GIF_RUN_DRAW = 1,       // Draw the raw frame, nothing disposes it within the run
+    GIF_RUN_CLEAR = 2,      // Clear the frame's rect to the background (drawn, then disposed 2)
+    GIF_RUN_OVERLAY = 3     // The displayed frame: overlay it as usual, saving first for disposal 3
+};
+
+struct GifFrameRunStep
+{
+    unsigned int    uFrameIndex;
+    GifFrameInfo    info;
+    GIF_RUN_ACTION  action;
+};
+
+/******************************************************************
+*                                                                 *
+*  GifFrameRun                                                    *
+*                                                                 *
+*  Plans the composition of one displayed frame: a run of zero    *
+*  delay intermediate frames ending with the first frame that has *
+*  a delay, or with the last frame.  Only the net effect of the   *
+*  intermediate frames on the displayed frame is kept:            *
+*                                                                 *
+*  - A disposal 3 frame is restored right after it is drawn, so   *
+*    it is skipped along with its save.                           *
+*  - A disposal 2 frame turns into a clear of its rect, without   *
+*    decoding it.                                                 *
+*  - A frame whose rect is overwritten later in the run by an     *
+*    opaque frame or a clear is skipped.  A frame only counts as  *
+*    opaque when its source says so (IGifFrameSource::            *
+*    IsFrameOpaque): without a transparent index, a frame whose   *
+*    data ends early still leaves pixels it never reached.        *
+*                                                                 *
+*  The displayed frame itself is overlaid as usual, and the       *
+*  caller still clears the canvas when the run starts a new loop. *
+*                                                                 *
+******************************************************************/
+
+class GifFrameRun
+{
+public:
+
+    using FrameInfoReader = std::function<void(unsigned int uFrameIndex, GifFrameInfo& frameInfo)>;
+    using FrameOpaqueReader = std::function<bool(unsigned int uFrameIndex)>;
+
+    // Plans the run starting at uFirstFrameIndex of an animation with
+    // cFrames frames.  The last step is always GIF_RUN_OVERLAY.
+    // isFrameOpaque is only asked about frames without a transparent index
+    // that would hide earlier frames of the run.
+    void Plan(
+        unsigned int uFirstFrameIndex,
+        unsigned int cFrames,
+        const FrameInfoReader& readFrameInfo,
+        const FrameOpaqueReader& isFrameOpaque);
+
+    const std::vector<GifFrameRunStep>& GetSteps() const
+    {
+        return m_steps;
+    }
+
+    // Intermediate frames the plan does not decode
+    unsigned int GetSkippedFrameCount() const
+    {
+        return m_cSkipped;
+    }
+
+private:
+
+    bool IsCovered(const GifRect& rect) const;
+    void AddCover(const GifRect& rect);
+
+private:
+
+    std::vector<GifFrameRunStep>    m_steps;
+    std::vector<uint8_t>            m_coverMask;    // Pixels written later in the run, over m_maskRect
+    GifRect                         m_maskRect;     // Bounds of the run's frames
+    unsigned int                    m_cSkipped;
+};
@@ -0,0 +1,89 @@
+#include "GifFrameSource.h"
+
+#include <stdexcept>
+
+/******************************************************************
+*                                                                 *
+*  MemoryFrameSource::MemoryFrameSource constructor               *
+*                                                                 *
+******************************************************************/
+
+MemoryFrameSource::MemoryFrameSource(const GifGlobalInfo& globalInfo) :
+    m_globalInfo(globalInfo)
+{
+    m_globalInfo.cFrames = 0;
+    m_globalInfo.fFrameCountPartial = false;
+}
+
+/******************************************************************
+*                                                                 *
+*  MemoryFrameSource::AddFrame                                    *
+*                                                                 *
+******************************************************************/
+
+void MemoryFrameSource::AddFrame(const GifFrameInfo& info, std::vector<uint32_t> pixels)
+{
+    if (pixels.size() != static_cast<size_t>(info.rect.Width()) * info.rect.Height())
+    {
+        throw std::invalid_argument("Frame pixels do not match the frame rect");
+    }
+
+    bool fOpaque = true;
+    for (auto pixel : pixels)
+    {
+        fOpaque &= (pixel >> 24) == 0xFF;
+    }
+
+    m_frames.push_back({ info, std::move(pixels), fOpaque });
+    m_globalInfo.cFrames = static_cast<unsigned int>(m_frames.size());
+}
+
+/******************************************************************
+*                                                                 *
+*  MemoryFrameSource::GetGlobalInfo                               *
+*                                                                 *
+******************************************************************/
+
+void MemoryFrameSource::GetGlobalInfo(GifGlobalInfo& globalInfo)
+{
+    globalInfo = m_globalInfo;
+}
+
+/******************************************************************
+*                                                                 *
+*  MemoryFrameSource::GetFrameInfo                                *
+*                                                                 *
+******************************************************************/
+
+void MemoryFrameSource::GetFrameInfo(unsigned int uFrameIndex, GifFrameInfo& frameInfo)
+{
+    frameInfo = m_frames.at(uFrameIndex).info;
+}
+
+/******************************************************************
+*                                                                 *
+*  MemoryFrameSource::GetRawFrame                                 *
+*                                                                 *
+******************************************************************/
+
+void MemoryFrameSource::GetRawFrame(unsigned int uFrameIndex, GifRawFrame& rawFrame)
+{
+    auto& frame = m_frames.at(uFrameIndex);
+
+    rawFrame.info = frame.info;
+    rawFrame.pixels.pPixels = frame.pixels.data();
+    rawFrame.pixels.stride = frame.info.rect.Width();
+    rawFrame.pixels.cx = frame.info.rect.Width();
+    rawFrame.pixels.cy = frame.info.rect.Height();
+}
+
+/******************************************************************
+*                                                                 *
+*  MemoryFrameSource::IsFrameOpaque                               *
+*                                                                 *
+******************************************************************/
+
+bool MemoryFrameSource::IsFrameOpaque(unsigned int uFrameIndex)
+{
+    return m_frames.at(uFrameIndex).fOpaque;
+}
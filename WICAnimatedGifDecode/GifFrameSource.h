@@ -0,0 +1,94 @@
+#pragma once
+
+#include "GifTypes.h"
+
+/******************************************************************
+*                                                                 *
+*  IGifFrameSource                                                *
+*                                                                 *
+*  Supplies raw frames and metadata to the compositor, the way    *
+*  DemoApp gets them from its IWICBitmapDecoder.                  *
+*                                                                 *
+******************************************************************/
+
+class IGifFrameSource
+{
+public:
+
+    virtual ~IGifFrameSource() = default;
+
+    virtual void GetGlobalInfo(GifGlobalInfo& globalInfo) = 0;
+    virtual void GetFrameInfo(unsigned int uFrameIndex, GifFrameInfo& frameInfo) = 0;
+
+    // Sources that find frames as playback reaches them set
+    // fFrameCountPartial in GetGlobalInfo.  This looks for frames until
+    // cFramesNeeded are known or there are no more, and updates globalInfo,
+    // which may also pick up a loop count found on the way.
+    virtual void DiscoverFrames(unsigned int cFramesNeeded, GifGlobalInfo& globalInfo)
+    {
+        (void)cFramesNeeded;
+        GetGlobalInfo(globalInfo);
+    }
+
+    // Decodes the raw frame.  The pixels stay valid until the next call.
+    virtual void GetRawFrame(unsigned int uFrameIndex, GifRawFrame& rawFrame) = 0;
+
+    // Decodes the raw frame straight onto a composed frame in system memory,
+    // blending it the same way IPixelBackend::DrawFrame would.  Sources that
+    // can avoid the intermediate raw frame override this; returning false
+    // makes the compositor fall back to GetRawFrame.
+    virtual bool DrawRawFrame(unsigned int uFrameIndex, const GifSurface& surface)
+    {
+        (void)uFrameIndex;
+        (void)surface;
+        return false;
+    }
+
+    // Whether drawing the raw frame writes every pixel of its rect with an
+    // opaque color.  A frame without a transparent index is not opaque when
+    // its image data ends early.  Frames that an opaque frame covers within
+    // a run of zero delay frames are skipped (see GifFrameRun), so sources
+    // that cannot tell say no.
+    virtual bool IsFrameOpaque(unsigned int uFrameIndex)
+    {
+        (void)uFrameIndex;
+        return false;
+    }
+};
+
+/******************************************************************
+*                                                                 *
+*  MemoryFrameSource                                              *
+*                                                                 *
+*  A frame source over frames that were decoded elsewhere and     *
+*  handed over as PBGRA pixels plus their metadata.               *
+*                                                                 *
+******************************************************************/
+
+class MemoryFrameSource : public IGifFrameSource
+{
+public:
+
+    explicit MemoryFrameSource(const GifGlobalInfo& globalInfo);
+
+    // Adds a raw frame.  pixels holds info.rect.Width() * info.rect.Height()
+    // tightly packed PBGRA pixels.
+    void AddFrame(const GifFrameInfo& info, std::vector<uint32_t> pixels);
+
+    void GetGlobalInfo(GifGlobalInfo& globalInfo) override;
+    void GetFrameInfo(unsigned int uFrameIndex, GifFrameInfo& frameInfo) override;
+    void GetRawFrame(unsigned int uFrameIndex, GifRawFrame& rawFrame) override;
+    bool IsFrameOpaque(unsigned int uFrameIndex) override;
+
+private:
+
+    struct Frame
+    {
+        GifFrameInfo            info;
+        std::vector<uint32_t>   pixels;
+        bool                    fOpaque;    // Every pixel has an alpha of 0xFF
+    };
+
+    GifGlobalInfo       m_globalInfo;
+    std::vector<Frame>  m_frames;
+};
@@ -0,0 +1,167 @@
+#include "GifKernels.h"
+
+#include <initializer_list>
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <intrin.h>
+#define GIF_KERNELS_X86 1
+#elif defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#define GIF_KERNELS_X86 1
+#endif
+
+namespace
+{
+    void ExpandIndicesScalar(
+        uint32_t* pDest,
+        const uint8_t* pIndices,
+        unsigned int cPixels,
+        const uint32_t* pPalette)
+    {
+        for (unsigned int i = 0; i < cPixels; i++)
+        {
+            pDest[i] = pPalette[pIndices[i]];
+        }
+    }
+
+    void ExpandIndicesMaskedScalar(
+        uint32_t* pDest,
+        const uint8_t* pIndices,
+        unsigned int cPixels,
+        const uint32_t* pPalette,
+        uint8_t transparentIndex)
+    {
+        for (unsigned int i = 0; i < cPixels; i++)
+        {
+            auto index = pIndices[i];
+            if (index != transparentIndex)
+            {
+                pDest[i] = pPalette[index];
+            }
+        }
+    }
+
+    void FillPixelsScalar(uint32_t* pDest, unsigned int cPixels, uint32_t color)
+    {
+        for (unsigned int i = 0; i < cPixels; i++)
+        {
+            pDest[i] = color;
+        }
+    }
+
+    const GifKernels c_scalarKernels =
+    {
+        GKI_SCALAR,
+        ExpandIndicesScalar,
+        ExpandIndicesMaskedScalar,
+        FillPixelsScalar
+    };
+
+#if GIF_KERNELS_X86
+    void CpuId(int leaf, int subleaf, unsigned int regs[4])
+    {
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuidex(info, leaf, subleaf);
+        for (int i = 0; i < 4; i++)
+        {
+            regs[i] = static_cast<unsigned int>(info[i]);
+        }
+#else
+        __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+    }
+
+    bool CpuSupportsSse2()
+    {
+        unsigned int regs[4];
+        CpuId(1, 0, regs);
+        return (regs[3] & (1u << 26)) != 0;
+    }
+
+    bool CpuSupportsAvx2()
+    {
+        unsigned int regs[4];
+        CpuId(0, 0, regs);
+        if (regs[0] < 7)
+        {
+            return false;
+        }
+
+        // The OS must save the YMM registers (OSXSAVE and XCR0 bits 1 and 2)
+        CpuId(1, 0, regs);
+        bool fOsxsave = (regs[2] & (1u << 27)) != 0;
+        bool fAvx = (regs[2] & (1u << 28)) != 0;
+        if (!fOsxsave || !fAvx)
+        {
+            return false;
+        }
+
+#if defined(_MSC_VER)
+        auto xcr0 = _xgetbv(0);
+#else
+        unsigned int xcr0Low, xcr0High;
+        __asm__("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+        auto xcr0 = xcr0Low;
+#endif
+        if ((xcr0 & 0x6) != 0x6)
+        {
+            return false;
+        }
+
+        CpuId(7, 0, regs);
+        return (regs[1] & (1u << 5)) != 0;
+    }
+#endif
+
+    const GifKernels& SelectGifKernels()
+    {
+        for (auto isa : { GKI_AVX2, GKI_NEON, GKI_SSE2 })
+        {
+            auto pKernels = GetGifKernelsForIsa(isa);
+            if (pKernels != nullptr)
+            {
+                return *pKernels;
+            }
+        }
+        return c_scalarKernels;
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GetGifKernelsForIsa                                            *
+*                                                                 *
+******************************************************************/
+
+const GifKernels* GetGifKernelsForIsa(GIF_KERNEL_ISA isa)
+{
+    switch (isa)
+    {
+    case GKI_SCALAR:
+        return &c_scalarKernels;
+#if GIF_KERNELS_X86
+    case GKI_SSE2:
+        return CpuSupportsSse2() ? GetGifKernelsSse2() : nullptr;
+    case GKI_AVX2:
+        return CpuSupportsAvx2() ? GetGifKernelsAvx2() : nullptr;
+#endif
+    case GKI_NEON:
+        // NEON is part of the baseline on the architectures it is compiled for
+        return GetGifKernelsNeon();
+    default:
+        return nullptr;
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GetGifKernels                                                  *
+*                                                                 *
+******************************************************************/
+
+const GifKernels& GetGifKernels()
+{
+    static const GifKernels& s_kernels = SelectGifKernels();
+    return s_kernels;
+}
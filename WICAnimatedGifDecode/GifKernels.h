@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+
+// Pixel kernels used when composing frames on the CPU.  Every kernel has a
+// scalar reference implementation; vectorized versions must produce exactly
+// the same pixels.  GetGifKernels picks the fastest set the CPU supports the
+// first time it is called.
+
+enum GIF_KERNEL_ISA
+{
+    GKI_SCALAR = 0,
+    GKI_SSE2 = 1,
+    GKI_AVX2 = 2,
+    GKI_NEON = 3
+};
+
+struct GifKernels
+{
+    GIF_KERNEL_ISA isa;
+
+    // pDest[i] = pPalette[pIndices[i]]
+    void (*ExpandIndices)(
+        uint32_t* pDest,
+        const uint8_t* pIndices,
+        unsigned int cPixels,
+        const uint32_t* pPalette);
+
+    // Same as ExpandIndices, but pixels whose index is transparentIndex keep
+    // their current value
+    void (*ExpandIndicesMasked)(
+        uint32_t* pDest,
+        const uint8_t* pIndices,
+        unsigned int cPixels,
+        const uint32_t* pPalette,
+        uint8_t transparentIndex);
+
+    // pDest[i] = color
+    void (*FillPixels)(
+        uint32_t* pDest,
+        unsigned int cPixels,
+        uint32_t color);
+};
+
+// The kernels for the best instruction set this CPU supports
+const GifKernels& GetGifKernels();
+
+// The kernels for a specific instruction set, or nullptr if it is not
+// compiled in or not supported by this CPU
+const GifKernels* GetGifKernelsForIsa(GIF_KERNEL_ISA isa);
+
+// Per instruction set implementations, each defined in its own translation
+// unit so it can be built with the matching compiler flags.  They return
+// nullptr when the target architecture does not have the instruction set.
+const GifKernels* GetGifKernelsSse2();
+const GifKernels* GetGifKernelsAvx2();
+const GifKernels* GetGifKernelsNeon();
@@ -0,0 +1,123 @@
+#include "GifKernels.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+
+#include <immintrin.h>
+
+namespace
+{
+    // Eight palette lookups per gather; transparency is checked 32 indices
+    // at a time so fully transparent or fully opaque runs take a fast path
+
+    inline __m256i GatherColors(const uint8_t* pIndices, const uint32_t* pPalette, __m256i* pIndices32)
+    {
+        *pIndices32 = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pIndices)));
+        return _mm256_i32gather_epi32(reinterpret_cast<const int*>(pPalette), *pIndices32, 4);
+    }
+
+    void ExpandIndicesAvx2(
+        uint32_t* pDest,
+        const uint8_t* pIndices,
+        unsigned int cPixels,
+        const uint32_t* pPalette)
+    {
+        unsigned int i = 0;
+        for (; i + 8 <= cPixels; i += 8)
+        {
+            __m256i indices32;
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(pDest + i), GatherColors(pIndices + i, pPalette, &indices32));
+        }
+        for (; i < cPixels; i++)
+        {
+            pDest[i] = pPalette[pIndices[i]];
+        }
+    }
+
+    void ExpandIndicesMaskedAvx2(
+        uint32_t* pDest,
+        const uint8_t* pIndices,
+        unsigned int cPixels,
+        const uint32_t* pPalette,
+        uint8_t transparentIndex)
+    {
+        const __m256i transparent8 = _mm256_set1_epi8(static_cast<char>(transparentIndex));
+        const __m256i transparent32 = _mm256_set1_epi32(transparentIndex);
+
+        unsigned int i = 0;
+        for (; i + 32 <= cPixels; i += 32)
+        {
+            __m256i indices = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pIndices + i));
+            auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(indices, transparent8)));
+
+            if (mask == 0xFFFFFFFF)
+            {
+                continue;
+            }
+
+            for (unsigned int j = 0; j < 32; j += 8)
+            {
+                auto subMask = (mask >> j) & 0xFF;
+                if (subMask == 0xFF)
+                {
+                    continue;
+                }
+
+                auto pOut = reinterpret_cast<__m256i*>(pDest + i + j);
+                __m256i indices32;
+                __m256i colors = GatherColors(pIndices + i + j, pPalette, &indices32);
+                if (subMask != 0)
+                {
+                    __m256i isTransparent = _mm256_cmpeq_epi32(indices32, transparent32);
+                    colors = _mm256_blendv_epi8(colors, _mm256_loadu_si256(pOut), isTransparent);
+                }
+                _mm256_storeu_si256(pOut, colors);
+            }
+        }
+
+        for (; i < cPixels; i++)
+        {
+            auto index = pIndices[i];
+            if (index != transparentIndex)
+            {
+                pDest[i] = pPalette[index];
+            }
+        }
+    }
+
+    void FillPixelsAvx2(uint32_t* pDest, unsigned int cPixels, uint32_t color)
+    {
+        const __m256i colors = _mm256_set1_epi32(static_cast<int>(color));
+
+        unsigned int i = 0;
+        for (; i + 8 <= cPixels; i += 8)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(pDest + i), colors);
+        }
+        for (; i < cPixels; i++)
+        {
+            pDest[i] = color;
+        }
+    }
+
+    const GifKernels c_avx2Kernels =
+    {
+        GKI_AVX2,
+        ExpandIndicesAvx2,
+        ExpandIndicesMaskedAvx2,
+        FillPixelsAvx2
+    };
+}
+
+const GifKernels* GetGifKernelsAvx2()
+{
+    return &c_avx2Kernels;
+}
+
+#else
+
+const GifKernels* GetGifKernelsAvx2()
+{
+    return nullptr;
+}
+
+#endif
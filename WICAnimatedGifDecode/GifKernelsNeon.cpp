@@ -0,0 +1,135 @@
+#include "GifKernels.h"
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+
+#include <arm_neon.h>
+
+namespace
+{
+    // NEON has no 256 entry table lookup for 32-bit values, so palette
+    // lookups stay scalar.  Transparency is checked 16 indices at a time.
+
+    inline uint32x4_t LoadColors(const uint8_t* pIndices, const uint32_t* pPalette)
+    {
+        uint32_t colors[4] =
+        {
+            pPalette[pIndices[0]],
+            pPalette[pIndices[1]],
+            pPalette[pIndices[2]],
+            pPalette[pIndices[3]]
+        };
+        return vld1q_u32(colors);
+    }
+
+    void ExpandIndicesNeon(
+        uint32_t* pDest,
+        const uint8_t* pIndices,
+        unsigned int cPixels,
+        const uint32_t* pPalette)
+    {
+        unsigned int i = 0;
+        for (; i + 4 <= cPixels; i += 4)
+        {
+            vst1q_u32(pDest + i, LoadColors(pIndices + i, pPalette));
+        }
+        for (; i < cPixels; i++)
+        {
+            pDest[i] = pPalette[pIndices[i]];
+        }
+    }
+
+    void ExpandIndicesMaskedNeon(
+        uint32_t* pDest,
+        const uint8_t* pIndices,
+        unsigned int cPixels,
+        const uint32_t* pPalette,
+        uint8_t transparentIndex)
+    {
+        const uint8x16_t transparent = vdupq_n_u8(transparentIndex);
+
+        unsigned int i = 0;
+        for (; i + 16 <= cPixels; i += 16)
+        {
+            uint8x16_t isTransparent = vceqq_u8(vld1q_u8(pIndices + i), transparent);
+
+            if (vminvq_u8(isTransparent) == 0xFF)
+            {
+                continue;
+            }
+
+            if (vmaxvq_u8(isTransparent) == 0)
+            {
+                for (unsigned int j = 0; j < 16; j += 4)
+                {
+                    vst1q_u32(pDest + i + j, LoadColors(pIndices + i + j, pPalette));
+                }
+                continue;
+            }
+
+            // Sign extend the byte mask to one 32-bit mask per pixel
+            int8x16_t mask8 = vreinterpretq_s8_u8(isTransparent);
+            int16x8_t mask16Low = vmovl_s8(vget_low_s8(mask8));
+            int16x8_t mask16High = vmovl_s8(vget_high_s8(mask8));
+            uint32x4_t masks[4] =
+            {
+                vreinterpretq_u32_s32(vmovl_s16(vget_low_s16(mask16Low))),
+                vreinterpretq_u32_s32(vmovl_s16(vget_high_s16(mask16Low))),
+                vreinterpretq_u32_s32(vmovl_s16(vget_low_s16(mask16High))),
+                vreinterpretq_u32_s32(vmovl_s16(vget_high_s16(mask16High)))
+            };
+
+            for (unsigned int j = 0; j < 4; j++)
+            {
+                auto pOut = pDest + i + 4 * j;
+                uint32x4_t colors = LoadColors(pIndices + i + 4 * j, pPalette);
+                vst1q_u32(pOut, vbslq_u32(masks[j], vld1q_u32(pOut), colors));
+            }
+        }
+
+        for (; i < cPixels; i++)
+        {
+            auto index = pIndices[i];
+            if (index != transparentIndex)
+            {
+                pDest[i] = pPalette[index];
+            }
+        }
+    }
+
+    void FillPixelsNeon(uint32_t* pDest, unsigned int cPixels, uint32_t color)
+    {
+        const uint32x4_t colors = vdupq_n_u32(color);
+
+        unsigned int i = 0;
+        for (; i + 4 <= cPixels; i += 4)
+        {
+            vst1q_u32(pDest + i, colors);
+        }
+        for (; i < cPixels; i++)
+        {
+            pDest[i] = color;
+        }
+    }
+
+    const GifKernels c_neonKernels =
+    {
+        GKI_NEON,
+        ExpandIndicesNeon,
+        ExpandIndicesMaskedNeon,
+        FillPixelsNeon
+    };
+}
+
+const GifKernels* GetGifKernelsNeon()
+{
+    return &c_neonKernels;
+}
+
+#else
+
+const GifKernels* GetGifKernelsNeon()
+{
+    return nullptr;
+}
+
+#endif
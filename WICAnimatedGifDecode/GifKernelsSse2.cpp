@@ -0,0 +1,139 @@
+#include "GifKernels.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+
+#include <emmintrin.h>
+
+namespace
+{
+    // SSE2 has no gather, so palette lookups stay scalar.  The win comes
+    // from checking 16 indices for transparency at once: runs of
+    // transparent pixels (common in delta frames) are skipped entirely and
+    // fully opaque runs skip the per pixel compare.
+
+    inline __m128i LoadColors(const uint8_t* pIndices, const uint32_t* pPalette)
+    {
+        return _mm_setr_epi32(
+            static_cast<int>(pPalette[pIndices[0]]),
+            static_cast<int>(pPalette[pIndices[1]]),
+            static_cast<int>(pPalette[pIndices[2]]),
+            static_cast<int>(pPalette[pIndices[3]]));
+    }
+
+    void ExpandIndicesSse2(
+        uint32_t* pDest,
+        const uint8_t* pIndices,
+        unsigned int cPixels,
+        const uint32_t* pPalette)
+    {
+        unsigned int i = 0;
+        for (; i + 4 <= cPixels; i += 4)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pDest + i), LoadColors(pIndices + i, pPalette));
+        }
+        for (; i < cPixels; i++)
+        {
+            pDest[i] = pPalette[pIndices[i]];
+        }
+    }
+
+    void ExpandIndicesMaskedSse2(
+        uint32_t* pDest,
+        const uint8_t* pIndices,
+        unsigned int cPixels,
+        const uint32_t* pPalette,
+        uint8_t transparentIndex)
+    {
+        const __m128i transparent = _mm_set1_epi8(static_cast<char>(transparentIndex));
+
+        unsigned int i = 0;
+        for (; i + 16 <= cPixels; i += 16)
+        {
+            __m128i indices = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pIndices + i));
+            __m128i isTransparent = _mm_cmpeq_epi8(indices, transparent);
+            int mask = _mm_movemask_epi8(isTransparent);
+
+            if (mask == 0xFFFF)
+            {
+                continue;
+            }
+
+            if (mask == 0)
+            {
+                for (unsigned int j = 0; j < 16; j += 4)
+                {
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(pDest + i + j), LoadColors(pIndices + i + j, pPalette));
+                }
+                continue;
+            }
+
+            // Widen the byte mask to one 32-bit mask per pixel
+            __m128i mask16Low = _mm_unpacklo_epi8(isTransparent, isTransparent);
+            __m128i mask16High = _mm_unpackhi_epi8(isTransparent, isTransparent);
+            __m128i masks[4] =
+            {
+                _mm_unpacklo_epi16(mask16Low, mask16Low),
+                _mm_unpackhi_epi16(mask16Low, mask16Low),
+                _mm_unpacklo_epi16(mask16High, mask16High),
+                _mm_unpackhi_epi16(mask16High, mask16High)
+            };
+
+            for (unsigned int j = 0; j < 4; j++)
+            {
+                auto pOut = reinterpret_cast<__m128i*>(pDest + i + 4 * j);
+                __m128i colors = LoadColors(pIndices + i + 4 * j, pPalette);
+                __m128i dest = _mm_loadu_si128(pOut);
+                __m128i result = _mm_or_si128(
+                    _mm_and_si128(masks[j], dest),
+                    _mm_andnot_si128(masks[j], colors));
+                _mm_storeu_si128(pOut, result);
+            }
+        }
+
+        for (; i < cPixels; i++)
+        {
+            auto index = pIndices[i];
+            if (index != transparentIndex)
+            {
+                pDest[i] = pPalette[index];
+            }
+        }
+    }
+
+    void FillPixelsSse2(uint32_t* pDest, unsigned int cPixels, uint32_t color)
+    {
+        const __m128i colors = _mm_set1_epi32(static_cast<int>(color));
+
+        unsigned int i = 0;
+        for (; i + 4 <= cPixels; i += 4)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pDest + i), colors);
+        }
+        for (; i < cPixels; i++)
+        {
+            pDest[i] = color;
+        }
+    }
+
+    const GifKernels c_sse2Kernels =
+    {
+        GKI_SSE2,
+        ExpandIndicesSse2,
+        ExpandIndicesMaskedSse2,
+        FillPixelsSse2
+    };
+}
+
+const GifKernels* GetGifKernelsSse2()
+{
+    return &c_sse2Kernels;
+}
+
+#else
+
+const GifKernels* GetGifKernelsSse2()
+{
+    return nullptr;
+}
+
+#endif
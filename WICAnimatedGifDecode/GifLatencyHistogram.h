@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Histogram of latencies in power of two microsecond buckets: bucket 0
+// counts latencies under 1 us and bucket i counts latencies in
+// [2^(i-1), 2^i) us.  The last bucket also takes everything longer.
+class GifLatencyHistogram
+{
+public:
+
+    static const unsigned int BUCKET_COUNT = 32;
+
+    GifLatencyHistogram()
+    {
+        Clear();
+    }
+
+    void Clear()
+    {
+        for (auto& cSamples : m_buckets)
+        {
+            cSamples = 0;
+        }
+        m_cSamples = 0;
+        m_maxUs = 0;
+    }
+
+    void Record(int64_t latencyUs)
+    {
+        if (latencyUs < 0)
+        {
+            latencyUs = 0;
+        }
+
+        unsigned int uBucket = 0;
+        while (uBucket < BUCKET_COUNT - 1 && (static_cast<uint64_t>(1) << uBucket) <= static_cast<uint64_t>(latencyUs))
+        {
+            uBucket++;
+        }
+
+        m_buckets[uBucket]++;
+        m_cSamples++;
+        if (latencyUs > m_maxUs)
+        {
+            m_maxUs = latencyUs;
+        }
+    }
+
+    uint64_t GetCount() const
+    {
+        return m_cSamples;
+    }
+
+    uint64_t GetBucketCount(unsigned int uBucket) const
+    {
+        return m_buckets[uBucket];
+    }
+
+    // Exclusive upper bound of a bucket, in us
+    static int64_t GetBucketLimitUs(unsigned int uBucket)
+    {
+        return static_cast<int64_t>(1) << uBucket;
+    }
+
+    int64_t GetMaxUs() const
+    {
+        return m_maxUs;
+    }
+
+    // Upper bound of the bucket holding the given percentile (0-100), in us
+    int64_t GetPercentileUs(double percentile) const
+    {
+        auto cTarget = static_cast<uint64_t>(m_cSamples * percentile / 100.0);
+        uint64_t cSeen = 0;
+        for (unsigned int i = 0; i < BUCKET_COUNT; i++)
+        {
+            cSeen += m_buckets[i];
+            if (cSeen > cTarget || (cSeen == m_cSamples && m_cSamples > 0))
+            {
+                return i == BUCKET_COUNT - 1 ? m_maxUs : GetBucketLimitUs(i);
+            }
+        }
+        return 0;
+    }
+
+    void Merge(const GifLatencyHistogram& other)
+    {
+        for (unsigned int i = 0; i < BUCKET_COUNT; i++)
+        {
+            m_buckets[i] += other.m_buckets[i];
+        }
+        m_cSamples += other.m_cSamples;
+        if (other.m_maxUs > m_maxUs)
+        {
+            m_maxUs = other.m_maxUs;
+        }
+    }
+
+private:
+
+    uint64_t    m_buckets[BUCKET_COUNT];
+    uint64_t    m_cSamples;
+    int64_t     m_maxUs;
+};
@@ -0,0 +1,162 @@
+#include "GifLzwEncoder.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+    const unsigned int LZW_MAX_CODES = 4096;
+    const unsigned int LZW_TABLE_SIZE = 8192;       // Power of two, at least twice the codes
+}
+
+/******************************************************************
+*                                                                 *
+*  GifLzwEncoder::GifLzwEncoder constructor                       *
+*                                                                 *
+******************************************************************/
+
+GifLzwEncoder::GifLzwEncoder() :
+    m_keys(LZW_TABLE_SIZE),
+    m_codes(LZW_TABLE_SIZE),
+    m_bitBuffer(0),
+    m_cBits(0),
+    m_cMinCodeSize(8),
+    m_cCodeBits(9),
+    m_uClearCode(256),
+    m_uNextCode(258)
+{
+}
+
+/******************************************************************
+*                                                                 *
+*  GifLzwEncoder::Encode                                          *
+*                                                                 *
+*  The decoder adds a table entry one code later than the encoder *
+*  does, so the code size grows once the encoder has assigned the *
+*  code 1 << m_cCodeBits, not when it becomes the next code.      *
+*                                                                 *
+******************************************************************/
+
+void GifLzwEncoder::Encode(const uint8_t* pIndices, size_t cPixels, unsigned int cMinCodeSize, std::vector<uint8_t>& data)
+{
+    if (cMinCodeSize < 2 || cMinCodeSize > 8)
+    {
+        throw std::invalid_argument("The minimum code size must be 2 to 8");
+    }
+
+    m_cMinCodeSize = cMinCodeSize;
+    m_uClearCode = 1u << cMinCodeSize;
+    m_packed.clear();
+    m_bitBuffer = 0;
+    m_cBits = 0;
+
+    ResetTable();
+    WriteCode(m_uClearCode);
+
+    if (cPixels > 0)
+    {
+        unsigned int uPrefix = pIndices[0];
+
+        for (size_t i = 1; i < cPixels; i++)
+        {
+            uint8_t suffix = pIndices[i];
+            uint32_t key = ((uPrefix << 8) | suffix) + 1;   // 0 marks empty slots
+            uint32_t slot = (key * 2654435761u) >> 19;      // Top 13 bits
+
+            while (m_keys[slot] != 0 && m_keys[slot] != key)
+            {
+                slot = (slot + 1) & (LZW_TABLE_SIZE - 1);
+            }
+
+            if (m_keys[slot] == key)
+            {
+                uPrefix = m_codes[slot];
+                continue;
+            }
+
+            WriteCode(uPrefix);
+
+            if (m_uNextCode < LZW_MAX_CODES)
+            {
+                m_keys[slot] = key;
+                m_codes[slot] = static_cast<uint16_t>(m_uNextCode++);
+                if (m_uNextCode > (1u << m_cCodeBits) && m_cCodeBits < 12)
+                {
+                    m_cCodeBits++;
+                }
+            }
+            else
+            {
+                WriteCode(m_uClearCode);
+                ResetTable();
+            }
+
+            uPrefix = suffix;
+        }
+
+        WriteCode(uPrefix);
+    }
+
+    WriteCode(m_uClearCode + 1);   // End of information
+    if (m_cBits > 0)
+    {
+        m_packed.push_back(static_cast<uint8_t>(m_bitBuffer));
+    }
+
+    FlushBits(data);
+}
+
+/******************************************************************
+*                                                                 *
+*  GifLzwEncoder::ResetTable                                      *
+*                                                                 *
+******************************************************************/
+
+void GifLzwEncoder::ResetTable()
+{
+    std::fill(m_keys.begin(), m_keys.end(), 0u);
+    m_cCodeBits = m_cMinCodeSize + 1;
+    m_uNextCode = m_uClearCode + 2;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifLzwEncoder::WriteCode                                       *
+*                                                                 *
+******************************************************************/
+
+void GifLzwEncoder::WriteCode(unsigned int uCode)
+{
+    m_bitBuffer |= static_cast<uint32_t>(uCode) << m_cBits;
+    m_cBits += m_cCodeBits;
+
+    while (m_cBits >= 8)
+    {
+        m_packed.push_back(static_cast<uint8_t>(m_bitBuffer));
+        m_bitBuffer >>= 8;
+        m_cBits -= 8;
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifLzwEncoder::FlushBits                                       *
+*                                                                 *
+*  Appends the minimum code size and the packed codes as data     *
+*  sub-blocks, followed by the block terminator.                  *
+*                                                                 *
+******************************************************************/
+
+void GifLzwEncoder::FlushBits(std::vector<uint8_t>& data)
+{
+    data.push_back(static_cast<uint8_t>(m_cMinCodeSize));
+
+    for (size_t off = 0; off < m_packed.size(); off += 255)
+    {
+        size_t cbBlock = (std::min)(m_packed.size() - off, static_cast<size_t>(255));
+        data.push_back(static_cast<uint8_t>(cbBlock));
+        data.insert(data.end(), m_packed.begin() + off, m_packed.begin() + off + cbBlock);
+    }
+
+    data.push_back(0);
+}
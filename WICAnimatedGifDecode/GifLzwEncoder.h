@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/******************************************************************
+*                                                                 *
+*  GifLzwEncoder                                                  *
+*                                                                 *
+*  GIF flavored LZW: variable code size up to 12 bits, a clear    *
+*  code when the table is full, and output in 255 byte sub-blocks *
+*  starting with the minimum code size byte.                      *
+*                                                                 *
+******************************************************************/
+
+class GifLzwEncoder
+{
+public:
+
+    GifLzwEncoder();
+
+    // Appends the image data of cPixels color indices, each less than
+    // 1 << cMinCodeSize, to data
+    void Encode(const uint8_t* pIndices, size_t cPixels, unsigned int cMinCodeSize, std::vector<uint8_t>& data);
+
+private:
+
+    void ResetTable();
+    void WriteCode(unsigned int uCode);
+    void FlushBits(std::vector<uint8_t>& data);
+
+private:
+
+    std::vector<uint32_t>   m_keys;         // Hash table of prefix code << 8 | suffix, 0 for empty
+    std::vector<uint16_t>   m_codes;
+    std::vector<uint8_t>    m_packed;       // Codes packed into bytes, before splitting into sub-blocks
+    uint32_t                m_bitBuffer;
+    unsigned int            m_cBits;
+    unsigned int            m_cMinCodeSize;
+    unsigned int            m_cCodeBits;
+    unsigned int            m_uClearCode;
+    unsigned int            m_uNextCode;
+};
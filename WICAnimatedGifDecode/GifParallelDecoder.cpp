@@ -0,0 +1,494 @@
+#include "GifParallelDecoder.h"
+#include "GifKernels.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+namespace
+{
+    // Fewest pixels worth handing to another thread when drawing a frame
+    const unsigned int c_cMinBandPixels = 1u << 16;
+
+    // Draws rows yFirst to yLast of a frame onto dest, whose origin is the
+    // top left of the frame's rect
+    void DrawIndexedRows(
+        const GifIndexedFrame& frame,
+        const GifSurface& dest,
+        const uint32_t* pPalette,
+        bool fMasked,
+        unsigned int yFirst,
+        unsigned int yLast)
+    {
+        const unsigned int cx = frame.info.rect.Width();
+        const auto& kernels = GetGifKernels();
+
+        for (unsigned int y = yFirst; y < yLast; y++)
+        {
+            auto cPixels = frame.rowLengths[y];
+            if (cPixels == 0)
+            {
+                continue;
+            }
+
+            auto pIndices = frame.indices.data() + static_cast<size_t>(y) * cx;
+            if (fMasked)
+            {
+                kernels.ExpandIndicesMasked(dest.Row(y), pIndices, cPixels, pPalette, frame.info.transparentIndex);
+            }
+            else
+            {
+                kernels.ExpandIndices(dest.Row(y), pIndices, cPixels, pPalette);
+            }
+        }
+    }
+
+    // A frame drawn in bands of rows, claimed one at a time by the calling
+    // thread and the pool.  Helpers that start after every band is claimed
+    // return without touching the frame, which may be gone by then.
+    struct BandJob
+    {
+        const GifIndexedFrame*      pFrame;
+        GifSurface                  dest;
+        const uint32_t*             pPalette;
+        bool                        fMasked;
+        unsigned int                cBands;
+        unsigned int                cRowsPerBand;
+        std::atomic<unsigned int>   uNextBand;
+        std::atomic<unsigned int>   cBandsLeft;
+        std::mutex                  lock;
+        std::condition_variable     bandsDone;
+    };
+
+    void RunBands(BandJob& job)
+    {
+        for (;;)
+        {
+            auto uBand = job.uNextBand.fetch_add(1);
+            if (uBand >= job.cBands)
+            {
+                return;
+            }
+
+            auto cy = job.pFrame->info.rect.Height();
+            auto yFirst = uBand * job.cRowsPerBand;
+            DrawIndexedRows(*job.pFrame, job.dest, job.pPalette, job.fMasked, yFirst, std::min(yFirst + job.cRowsPerBand, cy));
+
+            if (job.cBandsLeft.fetch_sub(1) == 1)
+            {
+                std::lock_guard<std::mutex> lock(job.lock);
+                job.bandsDone.notify_all();
+            }
+        }
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifParallelDecoder::GifParallelDecoder constructor             *
+*                                                                 *
+*  Indexes the gif and opens a decoder per worker with the index, *
+*  so the workers do not walk the file again.                     *
+*                                                                 *
+******************************************************************/
+
+GifParallelDecoder::GifParallelDecoder(
+    std::shared_ptr<GifByteSource> byteSource,
+    unsigned int cThreads,
+    unsigned int cFramesAhead) :
+    m_uPlanNext(0),
+    m_uLastFrameIndex(~0u),
+    m_rawPalette(),
+    m_cDecodedAhead(0),
+    m_cMisses(0),
+    m_threadPool(cThreads)
+{
+    m_decoder.Open(byteSource);
+    m_decoder.GetGlobalInfo(m_globalInfo);
+    const auto& frameIndex = m_decoder.GetFrameIndex();
+
+    // Nothing has been submitted yet, so no worker can be using its decoder
+    m_workerDecoders.resize(m_threadPool.GetThreadCount());
+    for (auto& decoder : m_workerDecoders)
+    {
+        decoder = std::make_unique<GifDecoder>();
+        decoder->Open(byteSource, frameIndex);
+    }
+
+    m_cFramesAhead = cFramesAhead != 0 ? cFramesAhead : 2 * m_threadPool.GetThreadCount();
+}
+
+/******************************************************************
+*                                                                 *
+*  GifParallelDecoder::~GifParallelDecoder destructor             *
+*                                                                 *
+******************************************************************/
+
+GifParallelDecoder::~GifParallelDecoder()
+{
+    DropFramesAhead();
+    m_threadPool.Wait();
+}
+
+/******************************************************************
+*                                                                 *
+*  GifParallelDecoder::GetGlobalInfo                              *
+*                                                                 *
+******************************************************************/
+
+void GifParallelDecoder::GetGlobalInfo(GifGlobalInfo& globalInfo)
+{
+    globalInfo = m_globalInfo;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifParallelDecoder::GetFrameInfo                               *
+*                                                                 *
+******************************************************************/
+
+void GifParallelDecoder::GetFrameInfo(unsigned int uFrameIndex, GifFrameInfo& frameInfo)
+{
+    m_decoder.GetFrameInfo(uFrameIndex, frameInfo);
+}
+
+/******************************************************************
+*                                                                 *
+*  GifParallelDecoder::IsFrameOpaque                              *
+*                                                                 *
+*  Asked while planning runs, before the frames are decoded, so   *
+*  the decoder on the calling thread answers it.                  *
+*                                                                 *
+******************************************************************/
+
+bool GifParallelDecoder::IsFrameOpaque(unsigned int uFrameIndex)
+{
+    return m_decoder.IsFrameOpaque(uFrameIndex);
+}
+
+/******************************************************************
+*                                                                 *
+*  GifParallelDecoder::GetRawFrame                                *
+*                                                                 *
+*  Expands a frame decoded ahead into a raw frame, with the       *
+*  transparent pixels and those the data did not reach set to     *
+*  zero, as GifDecoder::GetRawFrame does.                         *
+*                                                                 *
+******************************************************************/
+
+void GifParallelDecoder::GetRawFrame(unsigned int uFrameIndex, GifRawFrame& rawFrame)
+{
+    auto slot = TakeDecodedFrame(uFrameIndex);
+    if (!slot)
+    {
+        m_cMisses++;
+        m_decoder.GetRawFrame(uFrameIndex, rawFrame);
+        return;
+    }
+
+    const auto& frame = slot->frame;
+    m_rawPixels.Resize(frame.info.rect.Width(), frame.info.rect.Height());
+    auto surface = m_rawPixels.Surface();
+    if (!surface.IsEmpty())
+    {
+        memset(surface.pPixels, 0, m_rawPixels.SizeInBytes());
+    }
+
+    memcpy(m_rawPalette, frame.palette, sizeof(m_rawPalette));
+    if (frame.info.fTransparent)
+    {
+        m_rawPalette[frame.info.transparentIndex] = 0;
+    }
+    DrawIndexedFrame(frame, surface, m_rawPalette, false);
+
+    rawFrame.info = frame.info;
+    rawFrame.pixels = surface;
+    m_freeSlots.push_back(std::move(slot));
+}
+
+/******************************************************************
+*                                                                 *
+*  GifParallelDecoder::DrawRawFrame                               *
+*                                                                 *
+*  Expands a frame decoded ahead onto the composed frame, leaving *
+*  the pixels under transparent indices untouched.                *
+*                                                                 *
+******************************************************************/
+
+bool GifParallelDecoder::DrawRawFrame(unsigned int uFrameIndex, const GifSurface& surface)
+{
+    if (surface.cx < m_globalInfo.cxGifImage || surface.cy < m_globalInfo.cyGifImage)
+    {
+        return false;
+    }
+
+    auto slot = TakeDecodedFrame(uFrameIndex);
+    if (!slot)
+    {
+        m_cMisses++;
+        return m_decoder.DrawRawFrame(uFrameIndex, surface);
+    }
+
+    const auto& frame = slot->frame;
+    auto dest = surface;
+    dest.pPixels = surface.Row(frame.info.rect.top) + frame.info.rect.left;
+    DrawIndexedFrame(frame, dest, frame.palette, frame.info.fTransparent);
+
+    m_freeSlots.push_back(std::move(slot));
+    return true;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifParallelDecoder::TakeDecodedFrame                           *
+*                                                                 *
+*  Returns the frame if it was decoded ahead, waiting for it if   *
+*  it is still being decoded, or nullptr if it was not expected.  *
+*  Frames expected before it were skipped by the compositor and   *
+*  are dropped.  A frame that was not expected restarts the plan  *
+*  after it, unless it falls between the last frame asked for and *
+*  the next one expected, as the frames a run skips do when they  *
+*  are replayed one by one while seeking.                         *
+*                                                                 *
+******************************************************************/
+
+std::shared_ptr<GifParallelDecoder::Slot> GifParallelDecoder::TakeDecodedFrame(unsigned int uFrameIndex)
+{
+    std::shared_ptr<Slot> slot;
+
+    auto it = std::find_if(m_framesAhead.begin(), m_framesAhead.end(),
+        [uFrameIndex](const std::shared_ptr<Slot>& ahead) { return ahead->uFrameIndex == uFrameIndex; });
+
+    if (it != m_framesAhead.end())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            for (auto itSkipped = m_framesAhead.begin(); itSkipped != it; ++itSkipped)
+            {
+                (*itSkipped)->fCancelled = true;
+                if ((*itSkipped)->fDone)
+                {
+                    m_freeSlots.push_back(std::move(*itSkipped));
+                }
+            }
+        }
+        slot = std::move(*it);
+        m_framesAhead.erase(m_framesAhead.begin(), it + 1);
+    }
+    else
+    {
+        bool fBetween = !m_framesAhead.empty() && m_uLastFrameIndex != ~0u &&
+            uFrameIndex > m_uLastFrameIndex && uFrameIndex < m_framesAhead.front()->uFrameIndex;
+        if (!fBetween && uFrameIndex < m_globalInfo.cFrames)
+        {
+            DropFramesAhead();
+            m_uPlanNext = (uFrameIndex + 1 < m_globalInfo.cFrames) ? uFrameIndex + 1 : 0;
+        }
+    }
+
+    m_uLastFrameIndex = uFrameIndex;
+    FillFramesAhead();
+
+    if (slot)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            m_frameDone.wait(lock, [&slot]() { return slot->fDone; });
+        }
+
+        if (slot->error)
+        {
+            auto error = slot->error;
+            slot->error = nullptr;
+            m_freeSlots.push_back(std::move(slot));
+            std::rethrow_exception(error);
+        }
+        m_cDecodedAhead++;
+    }
+    return slot;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifParallelDecoder::DropFramesAhead                            *
+*                                                                 *
+*  Forgets the frames expected next.  Workers skip those they     *
+*  have not started on.                                           *
+*                                                                 *
+******************************************************************/
+
+void GifParallelDecoder::DropFramesAhead()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        for (auto& slot : m_framesAhead)
+        {
+            slot->fCancelled = true;
+            if (slot->fDone)
+            {
+                m_freeSlots.push_back(std::move(slot));
+            }
+        }
+    }
+    m_framesAhead.clear();
+    m_plannedFrames.clear();
+}
+
+/******************************************************************
+*                                                                 *
+*  GifParallelDecoder::FillFramesAhead                            *
+*                                                                 *
+*  Submits the next planned frames until m_cFramesAhead are       *
+*  decoding or decoded.                                           *
+*                                                                 *
+******************************************************************/
+
+void GifParallelDecoder::FillFramesAhead()
+{
+    if (m_globalInfo.cFrames == 0)
+    {
+        return;
+    }
+
+    while (m_framesAhead.size() < m_cFramesAhead)
+    {
+        std::shared_ptr<Slot> slot;
+        if (!m_freeSlots.empty())
+        {
+            slot = std::move(m_freeSlots.back());
+            m_freeSlots.pop_back();
+        }
+        else
+        {
+            slot = std::make_shared<Slot>();
+        }
+
+        // No worker has this slot, so it can be set up without the lock
+        slot->uFrameIndex = PlanNextFrame();
+        slot->fDone = false;
+        slot->fCancelled = false;
+        slot->error = nullptr;
+        m_framesAhead.push_back(slot);
+
+        m_threadPool.Submit([this, slot](unsigned int uWorker)
+        {
+            DecodeSlot(uWorker, *slot);
+        });
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifParallelDecoder::PlanNextFrame                              *
+*                                                                 *
+*  Returns the next frame the compositor will draw, planning the  *
+*  next run when the last one is used up.  Plays on into the next *
+*  loop after the last frame.                                     *
+*                                                                 *
+******************************************************************/
+
+unsigned int GifParallelDecoder::PlanNextFrame()
+{
+    while (m_plannedFrames.empty())
+    {
+        m_frameRun.Plan(m_uPlanNext, m_globalInfo.cFrames,
+            [this](unsigned int uFrameIndex, GifFrameInfo& frameInfo) { m_decoder.GetFrameInfo(uFrameIndex, frameInfo); },
+            [this](unsigned int uFrameIndex) { return m_decoder.IsFrameOpaque(uFrameIndex); });
+
+        for (const auto& step : m_frameRun.GetSteps())
+        {
+            if (step.action == GIF_RUN_DRAW || step.action == GIF_RUN_OVERLAY)
+            {
+                m_plannedFrames.push_back(step.uFrameIndex);
+            }
+        }
+
+        auto uLast = m_frameRun.GetSteps().back().uFrameIndex;
+        m_uPlanNext = (uLast + 1 < m_globalInfo.cFrames) ? uLast + 1 : 0;
+    }
+
+    auto uFrameIndex = m_plannedFrames.front();
+    m_plannedFrames.pop_front();
+    return uFrameIndex;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifParallelDecoder::DecodeSlot                                 *
+*                                                                 *
+*  Runs on a worker, with the worker's own decoder.               *
+*                                                                 *
+******************************************************************/
+
+void GifParallelDecoder::DecodeSlot(unsigned int uWorker, Slot& slot)
+{
+    bool fCancelled;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        fCancelled = slot.fCancelled;
+    }
+
+    if (!fCancelled)
+    {
+        try
+        {
+            m_workerDecoders[uWorker]->GetIndexedFrame(slot.uFrameIndex, slot.frame);
+        }
+        catch (...)
+        {
+            slot.error = std::current_exception();
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        slot.fDone = true;
+    }
+    m_frameDone.notify_all();
+}
+
+/******************************************************************
+*                                                                 *
+*  GifParallelDecoder::DrawIndexedFrame                           *
+*                                                                 *
+*  Expands a decoded frame onto dest, whose origin is the top     *
+*  left of the frame's rect.  Large frames are split into bands   *
+*  of rows shared with the pool, with the calling thread drawing  *
+*  bands too, so it never waits for a band no one has started.    *
+*                                                                 *
+******************************************************************/
+
+void GifParallelDecoder::DrawIndexedFrame(const GifIndexedFrame& frame, const GifSurface& dest, const uint32_t* pPalette, bool fMasked)
+{
+    const unsigned int cy = frame.info.rect.Height();
+    const uint64_t cPixels = static_cast<uint64_t>(frame.info.rect.Width()) * cy;
+
+    auto cBands = static_cast<unsigned int>(std::min<uint64_t>(cPixels / c_cMinBandPixels, m_threadPool.GetThreadCount() + 1));
+    if (cBands <= 1 || m_threadPool.GetThreadCount() <= 1)
+    {
+        DrawIndexedRows(frame, dest, pPalette, fMasked, 0, cy);
+        return;
+    }
+
+    auto job = std::make_shared<BandJob>();
+    job->pFrame = &frame;
+    job->dest = dest;
+    job->pPalette = pPalette;
+    job->fMasked = fMasked;
+    job->cRowsPerBand = (cy + cBands - 1) / cBands;
+    job->cBands = (cy + job->cRowsPerBand - 1) / job->cRowsPerBand;
+    job->uNextBand = 0;
+    job->cBandsLeft = job->cBands;
+
+    for (unsigned int i = 1; i < job->cBands; i++)
+    {
+        m_threadPool.Submit([job](unsigned int)
+        {
+            RunBands(*job);
+        });
+    }
+    RunBands(*job);
+
+    std::unique_lock<std::mutex> lock(job->lock);
+    job->bandsDone.wait(lock, [&job]() { return job->cBandsLeft == 0; });
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "GifDecoder.h"
+#include "GifFrameRun.h"
+#include "GifThreadPool.h"
+
+/******************************************************************
+*                                                                 *
+*  GifParallelDecoder                                             *
+*                                                                 *
+*  A frame source that LZW decodes raw frames ahead of playback   *
+*  on a thread pool, for long gifs where decoding one frame at a  *
+*  time leaves the other cores idle.  Decoding a frame to indices *
+*  does not depend on any other frame; only drawing it does, and  *
+*  that still happens in order when the compositor asks for it.   *
+*                                                                 *
+*  The frames decoded ahead are the ones the compositor will      *
+*  draw: the source plans the runs that follow the last frame     *
+*  asked for the same way the compositor does (see GifFrameRun),  *
+*  so frames that a run skips or turns into a clear are never     *
+*  decoded.  A decoded frame is expanded onto the composed frame  *
+*  in bands of rows on the pool, as no two rows depend on each    *
+*  other.  Frames asked for out of order, by seeking or after a   *
+*  cache hit, are decoded on the calling thread and the frames    *
+*  ahead are planned again from there.                            *
+*                                                                 *
+*  The whole gif is indexed when it is opened, and each worker    *
+*  keeps a decoder opened with that index.  Frames are decoded at *
+*  the gif's own size; scaling goes through GifDecoder.  Like the *
+*  decoder, no two calls may run at the same time.                *
+*                                                                 *
+******************************************************************/
+
+class GifParallelDecoder : public IGifFrameSource
+{
+public:
+
+    // cThreads == 0 uses one thread per hardware thread.  cFramesAhead ==
+    // 0 keeps two frames decoding or decoded per thread.
+    explicit GifParallelDecoder(
+        std::shared_ptr<GifByteSource> byteSource,
+        unsigned int cThreads = 0,
+        unsigned int cFramesAhead = 0);
+
+    // Waits for the frames being decoded
+    ~GifParallelDecoder();
+
+    GifParallelDecoder(const GifParallelDecoder&) = delete;
+    GifParallelDecoder& operator=(const GifParallelDecoder&) = delete;
+
+    void GetGlobalInfo(GifGlobalInfo& globalInfo) override;
+    void GetFrameInfo(unsigned int uFrameIndex, GifFrameInfo& frameInfo) override;
+    void GetRawFrame(unsigned int uFrameIndex, GifRawFrame& rawFrame) override;
+    bool DrawRawFrame(unsigned int uFrameIndex, const GifSurface& surface) override;
+    bool IsFrameOpaque(unsigned int uFrameIndex) override;
+
+    unsigned int GetThreadCount() const
+    {
+        return m_threadPool.GetThreadCount();
+    }
+
+    // Frames decoded ahead that were asked for, and frames that were asked
+    // for out of order and decoded on the calling thread instead
+    unsigned int GetDecodedAheadCount() const
+    {
+        return m_cDecodedAhead;
+    }
+
+    unsigned int GetMissCount() const
+    {
+        return m_cMisses;
+    }
+
+private:
+
+    // A frame decoded, or being decoded, on the pool
+    struct Slot
+    {
+        unsigned int        uFrameIndex;
+        GifIndexedFrame     frame;
+        bool                fDone;          // Set by the worker under m_lock
+        bool                fCancelled;     // Not wanted any more; a worker that has not started skips it
+        std::exception_ptr  error;
+    };
+
+    std::shared_ptr<Slot> TakeDecodedFrame(unsigned int uFrameIndex);
+    void DropFramesAhead();
+    void FillFramesAhead();
+    unsigned int PlanNextFrame();
+    void DecodeSlot(unsigned int uWorker, Slot& slot);
+    void DrawIndexedFrame(const GifIndexedFrame& frame, const GifSurface& dest, const uint32_t* pPalette, bool fMasked);
+
+private:
+
+    GifDecoder                  m_decoder;          // Metadata and frames asked for out of order, on the calling thread
+    GifGlobalInfo               m_globalInfo;
+    unsigned int                m_cFramesAhead;
+
+    std::deque<std::shared_ptr<Slot>>   m_framesAhead;      // In the order they will be asked for
+    std::vector<std::shared_ptr<Slot>>  m_freeSlots;        // Done and no longer wanted, kept for their buffers
+    std::deque<unsigned int>            m_plannedFrames;    // Frames of the last planned run not submitted yet
+    unsigned int                m_uPlanNext;        // First frame of the next run to plan
+    unsigned int                m_uLastFrameIndex;  // Last frame asked for, or ~0u
+    GifFrameRun                 m_frameRun;
+
+    GifBitmap                   m_rawPixels;
+    uint32_t                    m_rawPalette[256];  // Palette with the transparent index set to 0, for GetRawFrame
+    unsigned int                m_cDecodedAhead;
+    unsigned int                m_cMisses;
+
+    std::mutex                  m_lock;
+    std::condition_variable     m_frameDone;
+
+    std::vector<std::unique_ptr<GifDecoder>>    m_workerDecoders;  // Indexed by worker
+
+    // Last, so the workers are joined before the state they use goes away
+    GifThreadPool               m_threadPool;
+};
@@ -0,0 +1,316 @@
+#include "GifPixelBackend.h"
+#include "GifKernels.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+    void CopyBitmap(GifBitmap& dest, const GifBitmap& source)
+    {
+        dest.Resize(source.Width(), source.Height());
+        if (source.SizeInBytes() != 0)
+        {
+            memcpy(dest.Surface().pPixels, source.Pixels(), source.SizeInBytes());
+        }
+    }
+
+    // Copies cx by cy pixels between surfaces
+    void CopyPixels(const GifSurface& dest, unsigned int xDest, unsigned int yDest,
+        const GifSurface& source, unsigned int xSource, unsigned int ySource,
+        unsigned int cx, unsigned int cy)
+    {
+        for (unsigned int y = 0; y < cy; y++)
+        {
+            memcpy(dest.Row(yDest + y) + xDest, source.Row(ySource + y) + xSource, cx * sizeof(uint32_t));
+        }
+    }
+
+    // Source-over blending of premultiplied pixels, which is what D2D does
+    // for DrawBitmap.  Gif pixels are either opaque or fully transparent, so
+    // the general case is only hit by other frame sources.
+    inline uint32_t BlendPixel(uint32_t source, uint32_t dest)
+    {
+        uint32_t a = source >> 24;
+        if (a == 0xFF)
+        {
+            return source;
+        }
+        if (a == 0)
+        {
+            return dest;
+        }
+
+        uint32_t invA = 255 - a;
+        uint32_t result = 0;
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            uint32_t s = (source >> shift) & 0xFF;
+            uint32_t d = (dest >> shift) & 0xFF;
+            uint32_t c = s + (d * invA + 127) / 255;
+            result |= (c > 255 ? 255 : c) << shift;
+        }
+        return result;
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  CpuPixelBackend::CpuPixelBackend constructor                   *
+*                                                                 *
+******************************************************************/
+
+CpuPixelBackend::CpuPixelBackend() :
+    m_target(),
+    m_cxTarget(0),
+    m_cyTarget(0),
+    m_savedRect(),
+    m_fHasSavedFrame(false)
+{
+}
+
+CpuPixelBackend::CpuPixelBackend(const GifSurface& target) :
+    m_target(target),
+    m_cxTarget(0),
+    m_cyTarget(0),
+    m_savedRect(),
+    m_fHasSavedFrame(false)
+{
+}
+
+/******************************************************************
+*                                                                 *
+*  CpuPixelBackend::Initialize                                    *
+*                                                                 *
+*  Allocates the composed frame, or checks that it fits in the    *
+*  target.  The saved pixels are allocated lazily, as only        *
+*  disposal 3 needs them.                                         *
+*                                                                 *
+******************************************************************/
+
+void CpuPixelBackend::Initialize(unsigned int cx, unsigned int cy)
+{
+    if (m_target.pPixels != nullptr)
+    {
+        if (cx > m_target.cx || cy > m_target.cy)
+        {
+            throw std::invalid_argument("The composed frame does not fit in the target surface");
+        }
+        m_cxTarget = cx;
+        m_cyTarget = cy;
+    }
+    else
+    {
+        m_composedFrame.Resize(cx, cy);
+    }
+    m_savedPixels = std::vector<uint32_t>();
+    m_fHasSavedFrame = false;
+}
+
+/******************************************************************
+*                                                                 *
+*  CpuPixelBackend::Clear                                         *
+*                                                                 *
+*  Fills the part of rect inside the composed frame with color.   *
+*                                                                 *
+******************************************************************/
+
+void CpuPixelBackend::Clear(const GifRect& rect, uint32_t color)
+{
+    auto surface = ComposedSurface();
+    auto clipped = IntersectGifRect(rect, { 0, 0, surface.cx, surface.cy });
+
+    const auto& kernels = GetGifKernels();
+    for (unsigned int y = clipped.top; y < clipped.bottom; y++)
+    {
+        kernels.FillPixels(surface.Row(y) + clipped.left, clipped.Width(), color);
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  CpuPixelBackend::DrawFrame                                     *
+*                                                                 *
+*  Blends the raw frame onto the composed frame at its position,  *
+*  clipped to the composed frame.                                 *
+*                                                                 *
+******************************************************************/
+
+void CpuPixelBackend::DrawFrame(const GifRawFrame& rawFrame)
+{
+    auto surface = ComposedSurface();
+    const auto& rect = rawFrame.info.rect;
+    auto clipped = IntersectGifRect(rect, { 0, 0, surface.cx, surface.cy });
+
+    // The raw frame pixels may be smaller than the rect it claims to cover
+    if (clipped.right > rect.left + rawFrame.pixels.cx)
+    {
+        clipped.right = rect.left + rawFrame.pixels.cx;
+    }
+    if (clipped.bottom > rect.top + rawFrame.pixels.cy)
+    {
+        clipped.bottom = rect.top + rawFrame.pixels.cy;
+    }
+
+    for (unsigned int y = clipped.top; y < clipped.bottom; y++)
+    {
+        auto pSource = rawFrame.pixels.Row(y - rect.top);
+        auto pDest = surface.Row(y);
+        for (unsigned int x = clipped.left; x < clipped.right; x++)
+        {
+            pDest[x] = BlendPixel(pSource[x - rect.left], pDest[x]);
+        }
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  CpuPixelBackend::SaveFrame                                     *
+*                                                                 *
+*  Saves a copy of the part of rect inside the composed frame.    *
+*                                                                 *
+******************************************************************/
+
+void CpuPixelBackend::SaveFrame(const GifRect& rect)
+{
+    auto surface = ComposedSurface();
+    m_savedRect = IntersectGifRect(rect, { 0, 0, surface.cx, surface.cy });
+
+    auto cPixels = static_cast<size_t>(m_savedRect.Width()) * m_savedRect.Height();
+    if (m_savedPixels.size() < cPixels)
+    {
+        m_savedPixels.resize(cPixels);
+    }
+
+    CopyPixels(SavedSurface(), 0, 0, surface, m_savedRect.left, m_savedRect.top,
+        m_savedRect.Width(), m_savedRect.Height());
+    m_fHasSavedFrame = true;
+}
+
+/******************************************************************
+*                                                                 *
+*  CpuPixelBackend::RestoreFrame                                  *
+*                                                                 *
+*  Copies the saved pixels back over the composed frame.          *
+*                                                                 *
+******************************************************************/
+
+void CpuPixelBackend::RestoreFrame()
+{
+    if (!m_fHasSavedFrame)
+    {
+        throw std::logic_error("No saved frame to restore");
+    }
+
+    CopyPixels(ComposedSurface(), m_savedRect.left, m_savedRect.top, SavedSurface(), 0, 0,
+        m_savedRect.Width(), m_savedRect.Height());
+}
+
+/******************************************************************
+*                                                                 *
+*  CpuPixelBackend::SaveSnapshot                                  *
+*                                                                 *
+******************************************************************/
+
+void CpuPixelBackend::SaveSnapshot(GifSnapshot& snapshot, bool fIncludeSavedFrame)
+{
+    if (m_target.pPixels != nullptr)
+    {
+        snapshot.composedFrame.Resize(m_cxTarget, m_cyTarget);
+        CopyPixels(snapshot.composedFrame.Surface(), 0, 0, ComposedSurface(), 0, 0, m_cxTarget, m_cyTarget);
+    }
+    else
+    {
+        CopyBitmap(snapshot.composedFrame, m_composedFrame);
+    }
+    snapshot.composedRect = { 0, 0, snapshot.composedFrame.Width(), snapshot.composedFrame.Height() };
+    snapshot.fHasSavedFrame = fIncludeSavedFrame && m_fHasSavedFrame;
+    if (snapshot.fHasSavedFrame)
+    {
+        snapshot.savedFrame.Resize(m_savedRect.Width(), m_savedRect.Height());
+        CopyPixels(snapshot.savedFrame.Surface(), 0, 0, SavedSurface(), 0, 0,
+            m_savedRect.Width(), m_savedRect.Height());
+        snapshot.savedRect = m_savedRect;
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  CpuPixelBackend::LoadSnapshot                                  *
+*                                                                 *
+******************************************************************/
+
+void CpuPixelBackend::LoadSnapshot(const GifSnapshot& snapshot)
+{
+    // Snapshots are taken at the size of the composed frame, and can cover
+    // only part of it
+    auto surface = ComposedSurface();
+    auto rect = IntersectGifRect(snapshot.composedRect, { 0, 0, surface.cx, surface.cy });
+    auto cx = std::min(rect.Width(), snapshot.composedFrame.Width());
+    auto cy = std::min(rect.Height(), snapshot.composedFrame.Height());
+    for (unsigned int y = 0; y < cy; y++)
+    {
+        memcpy(surface.Row(rect.top + y) + rect.left,
+            snapshot.composedFrame.Pixels() + static_cast<size_t>(y) * snapshot.composedFrame.Width(),
+            cx * sizeof(uint32_t));
+    }
+    m_fHasSavedFrame = snapshot.fHasSavedFrame;
+    if (snapshot.fHasSavedFrame)
+    {
+        m_savedRect = snapshot.savedRect;
+        auto cPixels = static_cast<size_t>(m_savedRect.Width()) * m_savedRect.Height();
+        if (m_savedPixels.size() < cPixels)
+        {
+            m_savedPixels.resize(cPixels);
+        }
+        // An empty saved rect has no pixels to copy, and memcpy must not be
+        // given the null pointers of empty buffers even for 0 bytes
+        if (cPixels)
+        {
+            memcpy(m_savedPixels.data(), snapshot.savedFrame.Pixels(), cPixels * sizeof(uint32_t));
+        }
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  CpuPixelBackend::GetSurface                                    *
+*                                                                 *
+******************************************************************/
+
+GifSurface CpuPixelBackend::GetSurface()
+{
+    return ComposedSurface();
+}
+
+/******************************************************************
+*                                                                 *
+*  CpuPixelBackend::ComposedSurface                               *
+*                                                                 *
+*  The composed frame: the top left of the target, or the         *
+*  backend's own bitmap.                                          *
+*                                                                 *
+******************************************************************/
+
+GifSurface CpuPixelBackend::ComposedSurface()
+{
+    if (m_target.pPixels != nullptr)
+    {
+        return { m_target.pPixels, m_target.stride, m_cxTarget, m_cyTarget };
+    }
+    return m_composedFrame.Surface();
+}
+
+/******************************************************************
+*                                                                 *
+*  CpuPixelBackend::SavedSurface                                  *
+*                                                                 *
+*  The saved pixels, tightly packed at the size of m_savedRect.   *
+*                                                                 *
+******************************************************************/
+
+GifSurface CpuPixelBackend::SavedSurface()
+{
+    return { m_savedPixels.data(), m_savedRect.Width(), m_savedRect.Width(), m_savedRect.Height() };
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "GifTypes.h"
+
+// The composed frame (and the area saved for disposal 3) captured at one
+// point of the animation
+struct GifSnapshot
+{
+    GifBitmap   composedFrame;
+    GifRect     composedRect;       // Where composedFrame goes.  Loading a snapshot leaves the
+                                    // pixels outside it as they are.
+    GifBitmap   savedFrame;         // The pixels under savedRect
+    GifRect     savedRect;
+    bool        fHasSavedFrame;
+
+    // Room kept for a saved frame counts whether or not one is saved
+    size_t SizeInBytes() const
+    {
+        return composedFrame.SizeInBytes() + savedFrame.CapacityInBytes();
+    }
+};
+
+/******************************************************************
+*                                                                 *
+*  IPixelBackend                                                  *
+*                                                                 *
+*  The pixel operations the compositor needs.  These map one to   *
+*  one to what DemoApp does with its D2D bitmap render target.    *
+*                                                                 *
+******************************************************************/
+
+class IPixelBackend
+{
+public:
+
+    virtual ~IPixelBackend() = default;
+
+    // (Re)creates the composed frame with the given size.  Contents are undefined.
+    virtual void Initialize(unsigned int cx, unsigned int cy) = 0;
+
+    // Replaces the pixels in rect with color (no blending)
+    virtual void Clear(const GifRect& rect, uint32_t color) = 0;
+
+    // Draws the raw frame at rawFrame.info.rect with source-over blending
+    virtual void DrawFrame(const GifRawFrame& rawFrame) = 0;
+
+    // Saves/restores a copy of the composed frame for disposal 3.  Only the
+    // frame's own rect is drawn between the two, so only the pixels in rect
+    // are saved and later restored.
+    virtual void SaveFrame(const GifRect& rect) = 0;
+    virtual void RestoreFrame() = 0;
+
+    // Copies the composed frame, and the saved frame if fIncludeSavedFrame
+    // is set, to or from a snapshot
+    virtual void SaveSnapshot(GifSnapshot& snapshot, bool fIncludeSavedFrame) = 0;
+    virtual void LoadSnapshot(const GifSnapshot& snapshot) = 0;
+
+    // CPU addressable view of the composed frame, or an empty surface if the
+    // backend does not keep its pixels in system memory.  Frame sources may
+    // draw raw frames straight into it.
+    virtual GifSurface GetSurface() = 0;
+};
+
+/******************************************************************
+*                                                                 *
+*  CpuPixelBackend                                                *
+*                                                                 *
+*  Headless backend composing into plain system memory, either    *
+*  its own bitmap or a surface owned by the caller, such as a     *
+*  slot of an atlas page.                                         *
+*                                                                 *
+******************************************************************/
+
+class CpuPixelBackend : public IPixelBackend
+{
+public:
+
+    CpuPixelBackend();
+
+    // Composes into the top left of target, which must outlive the backend.
+    // Initialize throws if the composed frame does not fit.
+    explicit CpuPixelBackend(const GifSurface& target);
+
+    void Initialize(unsigned int cx, unsigned int cy) override;
+    void Clear(const GifRect& rect, uint32_t color) override;
+    void DrawFrame(const GifRawFrame& rawFrame) override;
+    void SaveFrame(const GifRect& rect) override;
+    void RestoreFrame() override;
+    void SaveSnapshot(GifSnapshot& snapshot, bool fIncludeSavedFrame) override;
+    void LoadSnapshot(const GifSnapshot& snapshot) override;
+    GifSurface GetSurface() override;
+
+private:
+
+    GifSurface ComposedSurface();
+    GifSurface SavedSurface();
+
+private:
+
+    GifBitmap               m_composedFrame;    // Unused with a target
+    GifSurface              m_target;           // The caller's pixels, or empty
+    unsigned int            m_cxTarget;         // Size of the composed frame within m_target
+    unsigned int            m_cyTarget;
+    std::vector<uint32_t>   m_savedPixels;  // The pixels under m_savedRect for disposal 3 method.  Only
+                                            // grows, so it ends up sized to the largest rect saved.
+    GifRect                 m_savedRect;
+    bool                    m_fHasSavedFrame;
+};
@@ -0,0 +1,262 @@
+#include "GifPlaybackScheduler.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    int64_t ToMicroseconds(std::chrono::steady_clock::duration duration)
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    }
+
+    class SteadyPlaybackClock : public IGifPlaybackClock
+    {
+    public:
+
+        Clock::time_point Now() override
+        {
+            return Clock::now();
+        }
+
+        bool WaitUntil(
+            std::condition_variable& wake,
+            std::unique_lock<std::mutex>& lock,
+            Clock::time_point due,
+            const WakePredicate& fWake) override
+        {
+            return wake.wait_until(lock, due, fWake);
+        }
+    };
+}
+
+/******************************************************************
+*                                                                 *
+*  GifPlaybackScheduler::GifPlaybackScheduler constructor         *
+*                                                                 *
+******************************************************************/
+
+GifPlaybackScheduler::GifPlaybackScheduler(
+    DueCallback callback,
+    unsigned int cMaxConsecutiveDrops,
+    std::shared_ptr<IGifPlaybackClock> clock) :
+    m_callback(std::move(callback)),
+    m_cMaxConsecutiveDrops(cMaxConsecutiveDrops),
+    m_clock(clock ? std::move(clock) : std::make_shared<SteadyPlaybackClock>()),
+    m_fRunning(false),
+    m_uTimeline(0),
+    m_fArmed(false),
+    m_cConsecutiveDrops(0),
+    m_fPresentPending(false),
+    m_stats(),
+    m_sumLatenessUs(0),
+    m_sumSquaredLatenessUs(0)
+{
+}
+
+/******************************************************************
+*                                                                 *
+*  GifPlaybackScheduler::~GifPlaybackScheduler destructor         *
+*                                                                 *
+******************************************************************/
+
+GifPlaybackScheduler::~GifPlaybackScheduler()
+{
+    Stop();
+}
+
+/******************************************************************
+*                                                                 *
+*  GifPlaybackScheduler::Start                                    *
+*                                                                 *
+******************************************************************/
+
+void GifPlaybackScheduler::Start()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    m_uTimeline++;
+    m_frameStart = m_clock->Now();
+    m_fArmed = false;
+    m_cConsecutiveDrops = 0;
+    m_fPresentPending = false;
+    m_stats = {};
+    m_sumLatenessUs = 0;
+    m_sumSquaredLatenessUs = 0;
+    m_presentLatency.Clear();
+
+    if (!m_fRunning)
+    {
+        m_fRunning = true;
+        m_thread = std::thread(&GifPlaybackScheduler::ThreadMain, this);
+    }
+    m_wake.notify_one();
+}
+
+/******************************************************************
+*                                                                 *
+*  GifPlaybackScheduler::Stop                                     *
+*                                                                 *
+******************************************************************/
+
+void GifPlaybackScheduler::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!m_fRunning)
+        {
+            return;
+        }
+        m_fRunning = false;
+        m_fArmed = false;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+}
+
+/******************************************************************
+*                                                                 *
+*  GifPlaybackScheduler::FrameComposed                            *
+*                                                                 *
+*  Advances the timeline by the frame's delay.  A frame that ends *
+*  before it could be shown is dropped, unless too many frames    *
+*  were dropped in a row, in which case it is shown late and the  *
+*  timeline restarts from the present.                            *
+*                                                                 *
+******************************************************************/
+
+bool GifPlaybackScheduler::FrameComposed(unsigned int uDelay)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    auto now = m_clock->Now();
+    auto frameEnd = m_frameStart + std::chrono::milliseconds(uDelay);
+
+    if (now >= frameEnd && m_cConsecutiveDrops < m_cMaxConsecutiveDrops)
+    {
+        m_cConsecutiveDrops++;
+        m_stats.cFramesDropped++;
+        m_frameStart = frameEnd;
+        return false;
+    }
+
+    auto latenessUs = ToMicroseconds(now - m_frameStart);
+    m_stats.cFramesPresented++;
+    m_stats.lastLatenessUs = latenessUs;
+    m_stats.maxLatenessUs = std::max(m_stats.maxLatenessUs, latenessUs);
+    m_sumLatenessUs += static_cast<double>(latenessUs);
+    m_sumSquaredLatenessUs += static_cast<double>(latenessUs) * static_cast<double>(latenessUs);
+
+    if (now >= frameEnd)
+    {
+        m_stats.cResyncs++;
+        frameEnd = now + std::chrono::milliseconds(uDelay);
+    }
+
+    m_presentDue = m_frameStart;
+    m_fPresentPending = true;
+    m_cConsecutiveDrops = 0;
+    m_frameStart = frameEnd;
+    m_nextDue = frameEnd;
+    m_fArmed = true;
+    m_wake.notify_one();
+
+    return true;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifPlaybackScheduler::FramePresented                           *
+*                                                                 *
+******************************************************************/
+
+void GifPlaybackScheduler::FramePresented()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    if (m_fPresentPending)
+    {
+        m_presentLatency.Record(ToMicroseconds(m_clock->Now() - m_presentDue));
+        m_fPresentPending = false;
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifPlaybackScheduler::GetTimeline                              *
+*                                                                 *
+******************************************************************/
+
+unsigned int GifPlaybackScheduler::GetTimeline() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_uTimeline;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifPlaybackScheduler::GetStats                                 *
+*                                                                 *
+******************************************************************/
+
+GifPlaybackStats GifPlaybackScheduler::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    auto stats = m_stats;
+    if (stats.cFramesPresented > 0)
+    {
+        auto cFrames = static_cast<double>(stats.cFramesPresented);
+        stats.meanLatenessUs = m_sumLatenessUs / cFrames;
+        auto variance = m_sumSquaredLatenessUs / cFrames - stats.meanLatenessUs * stats.meanLatenessUs;
+        stats.jitterUs = std::sqrt(std::max(variance, 0.0));
+    }
+    return stats;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifPlaybackScheduler::GetLatencyHistogram                      *
+*                                                                 *
+******************************************************************/
+
+GifLatencyHistogram GifPlaybackScheduler::GetLatencyHistogram() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_presentLatency;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifPlaybackScheduler::ThreadMain                               *
+*                                                                 *
+******************************************************************/
+
+void GifPlaybackScheduler::ThreadMain()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    while (m_fRunning)
+    {
+        if (!m_fArmed)
+        {
+            m_wake.wait(lock);
+            continue;
+        }
+
+        // Wake up early if the deadline changes or playback stops
+        auto due = m_nextDue;
+        auto uTimeline = m_uTimeline;
+        if (m_clock->WaitUntil(m_wake, lock, due, [&] { return !m_fRunning || !m_fArmed || m_nextDue != due; }))
+        {
+            continue;
+        }
+
+        m_stats.maxWakeupLatenessUs = std::max(m_stats.maxWakeupLatenessUs, ToMicroseconds(m_clock->Now() - due));
+        m_fArmed = false;
+
+        lock.unlock();
+        m_callback(uTimeline);
+        lock.lock();
+    }
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "GifLatencyHistogram.h"
+
+// Most frames dropped in a row before a late frame is shown anyway and the
+// timeline is moved to the present
+const unsigned int DEFAULT_MAX_CONSECUTIVE_DROPS = 8;
+
+struct GifPlaybackStats
+{
+    uint64_t    cFramesPresented;
+    uint64_t    cFramesDropped;
+    uint64_t    cResyncs;           // Times playback fell so far behind that the timeline was moved
+    int64_t     lastLatenessUs;     // Drift of the last presented frame from the timeline
+    int64_t     maxLatenessUs;
+    double      meanLatenessUs;
+    double      jitterUs;           // Standard deviation of the lateness
+    int64_t     maxWakeupLatenessUs;    // How late the scheduler thread woke up after a deadline
+};
+
+/******************************************************************
+*                                                                 *
+*  IGifPlaybackClock                                              *
+*                                                                 *
+*  The time source of GifPlaybackScheduler.  The default one      *
+*  reads and waits on the steady clock; a test can pass one whose *
+*  time only moves when it says so.                               *
+*                                                                 *
+******************************************************************/
+
+class IGifPlaybackClock
+{
+public:
+
+    using Clock = std::chrono::steady_clock;
+    using WakePredicate = std::function<bool()>;
+
+    virtual ~IGifPlaybackClock() = default;
+
+    virtual Clock::time_point Now() = 0;
+
+    // Waits on wake, with lock held by the caller, until due or until
+    // fWake returns true.  Returns fWake's last result, like
+    // std::condition_variable::wait_until.
+    virtual bool WaitUntil(
+        std::condition_variable& wake,
+        std::unique_lock<std::mutex>& lock,
+        Clock::time_point due,
+        const WakePredicate& fWake) = 0;
+};
+
+/******************************************************************
+*                                                                 *
+*  GifPlaybackScheduler                                           *
+*                                                                 *
+*  Plays frames against an absolute timeline: frame n is due at   *
+*  the start time plus the delays of frames 0 to n-1, however     *
+*  long composing and presenting take, so playback never drifts.  *
+*  A thread waits on the monotonic clock and calls back when the  *
+*  next frame is due.  Frames whose display time has already      *
+*  passed once they are composed are dropped.                     *
+*                                                                 *
+*  The player calls Start, composes the first frame and reports   *
+*  it with FrameComposed.  From then on it composes a frame each  *
+*  time the due callback runs.                                    *
+*                                                                 *
+******************************************************************/
+
+class GifPlaybackScheduler
+{
+public:
+
+    using Clock = std::chrono::steady_clock;
+
+    // Called on the scheduler thread when the next frame is due.  uTimeline
+    // is the value GetTimeline returned after the Start it belongs to, so
+    // that a callback queued before a restart can be recognized.
+    using DueCallback = std::function<void(unsigned int uTimeline)>;
+
+    // A null clock uses the steady clock
+    explicit GifPlaybackScheduler(
+        DueCallback callback,
+        unsigned int cMaxConsecutiveDrops = DEFAULT_MAX_CONSECUTIVE_DROPS,
+        std::shared_ptr<IGifPlaybackClock> clock = nullptr);
+    ~GifPlaybackScheduler();
+
+    GifPlaybackScheduler(const GifPlaybackScheduler&) = delete;
+    GifPlaybackScheduler& operator=(const GifPlaybackScheduler&) = delete;
+
+    // Starts a new timeline at the current time and resets the statistics
+    void Start();
+
+    // Stops the thread.  No callbacks run after Stop returns, so it must not
+    // be called from the due callback.
+    void Stop();
+
+    // Reports that the frame due now has been composed and is displayed for
+    // uDelay ms.  Returns true if it should be presented, in which case the
+    // due callback runs when it ends.  Returns false if its display time
+    // has already passed; the caller should drop it and compose the next
+    // frame right away.
+    bool FrameComposed(unsigned int uDelay);
+
+    // Reports that the last frame FrameComposed accepted is on screen, and
+    // records how long after its due time that happened.  Later calls for
+    // the same frame, such as repaints, are ignored.
+    void FramePresented();
+
+    unsigned int GetTimeline() const;
+    GifPlaybackStats GetStats() const;
+    GifLatencyHistogram GetLatencyHistogram() const;
+
+private:
+
+    void ThreadMain();
+
+private:
+
+    DueCallback             m_callback;
+    const unsigned int      m_cMaxConsecutiveDrops;
+    std::shared_ptr<IGifPlaybackClock>  m_clock;
+
+    mutable std::mutex      m_lock;
+    std::condition_variable m_wake;
+    std::thread             m_thread;
+    bool                    m_fRunning;
+
+    unsigned int        m_uTimeline;
+    Clock::time_point   m_frameStart;       // When the frame being composed is due
+    Clock::time_point   m_nextDue;
+    bool                m_fArmed;           // Whether a due callback is pending
+    unsigned int        m_cConsecutiveDrops;
+    Clock::time_point   m_presentDue;       // When the frame waiting to be presented was due
+    bool                m_fPresentPending;
+
+    GifPlaybackStats    m_stats;
+    double              m_sumLatenessUs;
+    double              m_sumSquaredLatenessUs;
+    GifLatencyHistogram m_presentLatency;   // Due to presented, in us
+};
@@ -0,0 +1,190 @@
+#include "GifThreadPool.h"
+
+namespace
+{
+    // The pool and worker index of the current thread, so that tasks
+    // submitted from a task go to the submitting worker's own queue
+    thread_local const GifThreadPool* t_pPool = nullptr;
+    thread_local unsigned int t_uWorker = 0;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifThreadPool::GifThreadPool constructor                       *
+*                                                                 *
+******************************************************************/
+
+GifThreadPool::GifThreadPool(unsigned int cThreads) :
+    m_cQueued(0),
+    m_cPending(0),
+    m_fStopping(false),
+    m_uNextQueue(0)
+{
+    if (cThreads == 0)
+    {
+        cThreads = std::thread::hardware_concurrency();
+        if (cThreads == 0)
+        {
+            cThreads = 1;
+        }
+    }
+
+    for (unsigned int i = 0; i < cThreads; i++)
+    {
+        m_queues.push_back(std::make_unique<WorkerQueue>());
+    }
+
+    for (unsigned int i = 0; i < cThreads; i++)
+    {
+        m_threads.emplace_back(&GifThreadPool::WorkerMain, this, i);
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifThreadPool::~GifThreadPool destructor                       *
+*                                                                 *
+*  Finishes the queued tasks and joins the workers.               *
+*                                                                 *
+******************************************************************/
+
+GifThreadPool::~GifThreadPool()
+{
+    Wait();
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_fStopping = true;
+    }
+    m_workAvailable.notify_all();
+
+    for (auto& thread : m_threads)
+    {
+        thread.join();
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  GifThreadPool::Submit                                          *
+*                                                                 *
+******************************************************************/
+
+void GifThreadPool::Submit(Task task)
+{
+    unsigned int uQueue;
+    if (t_pPool == this)
+    {
+        uQueue = t_uWorker;
+    }
+    else
+    {
+        uQueue = m_uNextQueue++ % m_queues.size();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_queues[uQueue]->lock);
+        m_queues[uQueue]->tasks.push_back(std::move(task));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_cQueued++;
+        m_cPending++;
+    }
+    m_workAvailable.notify_one();
+}
+
+/******************************************************************
+*                                                                 *
+*  GifThreadPool::Wait                                            *
+*                                                                 *
+******************************************************************/
+
+void GifThreadPool::Wait()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_idle.wait(lock, [this] { return m_cPending == 0; });
+}
+
+/******************************************************************
+*                                                                 *
+*  GifThreadPool::TryPop                                          *
+*                                                                 *
+*  Takes the newest task from the worker's own queue, or steals   *
+*  the oldest task from the first other queue that has one.       *
+*                                                                 *
+******************************************************************/
+
+bool GifThreadPool::TryPop(unsigned int uWorker, Task& task)
+{
+    {
+        auto& queue = *m_queues[uWorker];
+        std::lock_guard<std::mutex> lock(queue.lock);
+        if (!queue.tasks.empty())
+        {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            return true;
+        }
+    }
+
+    auto cQueues = m_queues.size();
+    for (size_t i = 1; i < cQueues; i++)
+    {
+        auto& queue = *m_queues[(uWorker + i) % cQueues];
+        std::lock_guard<std::mutex> lock(queue.lock);
+        if (!queue.tasks.empty())
+        {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/******************************************************************
+*                                                                 *
+*  GifThreadPool::WorkerMain                                      *
+*                                                                 *
+******************************************************************/
+
+void GifThreadPool::WorkerMain(unsigned int uWorker)
+{
+    t_pPool = this;
+    t_uWorker = uWorker;
+
+    for (;;)
+    {
+        Task task;
+        if (TryPop(uWorker, task))
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+                m_cQueued--;
+            }
+
+            task(uWorker);
+
+            bool fIdle;
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+                fIdle = (--m_cPending == 0);
+            }
+            if (fIdle)
+            {
+                m_idle.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_workAvailable.wait(lock, [this] { return m_fStopping || m_cQueued > 0; });
+        if (m_fStopping && m_cQueued == 0)
+        {
+            return;
+        }
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/******************************************************************
+*                                                                 *
+*  GifThreadPool                                                  *
+*                                                                 *
+*  Fixed size work-stealing thread pool.  Each worker has its own *
+*  deque: it runs its own tasks newest first and, when it runs    *
+*  dry, steals the oldest task from another worker.  Tasks get    *
+*  the index of the worker running them, so callers can keep      *
+*  per-thread state without locking.  Tasks must not throw.       *
+*                                                                 *
+******************************************************************/
+
+class GifThreadPool
+{
+public:
+
+    using Task = std::function<void(unsigned int uWorker)>;
+
+    // cThreads == 0 uses one thread per hardware thread
+    explicit GifThreadPool(unsigned int cThreads = 0);
+    ~GifThreadPool();
+
+    GifThreadPool(const GifThreadPool&) = delete;
+    GifThreadPool& operator=(const GifThreadPool&) = delete;
+
+    // Queues a task.  Safe to call from any thread, including from a task.
+    void Submit(Task task);
+
+    // Blocks until every submitted task has finished
+    void Wait();
+
+    unsigned int GetThreadCount() const
+    {
+        return static_cast<unsigned int>(m_threads.size());
+    }
+
+private:
+
+    struct WorkerQueue
+    {
+        std::mutex          lock;
+        std::deque<Task>    tasks;
+    };
+
+    void WorkerMain(unsigned int uWorker);
+    bool TryPop(unsigned int uWorker, Task& task);
+
+private:
+
+    std::vector<std::unique_ptr<WorkerQueue>>   m_queues;
+    std::vector<std::thread>                    m_threads;
+
+    std::mutex              m_lock;
+    std::condition_variable m_workAvailable;
+    std::condition_variable m_idle;
+    size_t                  m_cQueued;      // Tasks waiting in a queue
+    size_t                  m_cPending;     // Tasks submitted but not finished
+    bool                    m_fStopping;
+
+    std::atomic<unsigned int> m_uNextQueue;
+};
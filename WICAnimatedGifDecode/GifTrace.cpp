@@ -0,0 +1,258 @@
+#include "GifTrace.h"
+
+#include <atomic>
+#include <thread>
+
+namespace
+{
+    const char* const STAGE_NAMES[GTS_COUNT] =
+    {
+        "compose",
+        "decode",
+        "convert",
+        "overlay",
+        "dispose",
+        "save",
+        "restore",
+        "cache",
+        "copy",
+        "wait",
+        "upload",
+        "render",
+    };
+
+#ifdef GIF_ENABLE_TRACING
+
+    // The stats of a stage, on a cache line of its own since the pipeline
+    // worker and the presenter update different stages at the same time
+    struct alignas(64) StageCounters
+    {
+        std::atomic<uint64_t>   cCalls;
+        std::atomic<uint64_t>   cTicks;
+    };
+
+    // A slot of the event ring.  uSequence is 0 while the slot is empty,
+    // 2n + 1 while event n is written to it and 2n + 2 once it holds event
+    // n, so that a reader can tell a slot that was overwritten while it
+    // was reading it.  The fields are atomics only so that reading a slot
+    // being written is not a data race; relaxed stores cost the same as
+    // plain ones.
+    struct TraceSlot
+    {
+        std::atomic<uint64_t>   uSequence;
+        std::atomic<uint64_t>   tStart;
+        std::atomic<uint64_t>   tEnd;
+        std::atomic<uint64_t>   uInfo;      // Frame index, stage << 32 and thread number << 40
+    };
+
+    StageCounters g_stages[GTS_COUNT];
+    TraceSlot g_ring[GIF_TRACE_RING_SIZE];
+    std::atomic<uint64_t> g_uNextEvent(0);
+    std::atomic<unsigned int> g_cThreads(0);
+
+    // Pairs a trace clock reading with a steady_clock one, to convert
+    // ticks to time later
+    struct ClockBase
+    {
+        uint64_t                                tTicks;
+        std::chrono::steady_clock::time_point   time;
+    };
+
+    const ClockBase g_clockBase = { ReadGifTraceClock(), std::chrono::steady_clock::now() };
+
+    // Small numbers are easier to read in a trace viewer than thread ids
+    unsigned int GetThreadNumber()
+    {
+        thread_local unsigned int t_uThread = ++g_cThreads;
+        return t_uThread;
+    }
+
+    // Measures the trace clock against steady_clock since g_clockBase.
+    // Waits until 10 ms have passed since then, which only happens when
+    // asking for stats right after the process started.
+    double GetNsPerTick()
+    {
+        const auto minElapsed = std::chrono::milliseconds(10);
+
+        auto elapsed = std::chrono::steady_clock::now() - g_clockBase.time;
+        if (elapsed < minElapsed)
+        {
+            std::this_thread::sleep_for(minElapsed - elapsed);
+        }
+
+        auto tTicks = ReadGifTraceClock();
+        elapsed = std::chrono::steady_clock::now() - g_clockBase.time;
+        if (tTicks <= g_clockBase.tTicks)
+        {
+            return 1.;
+        }
+        return std::chrono::duration<double, std::nano>(elapsed).count() / static_cast<double>(tTicks - g_clockBase.tTicks);
+    }
+
+    double TicksToUs(uint64_t tTicks, double nsPerTick)
+    {
+        return (static_cast<double>(tTicks) - static_cast<double>(g_clockBase.tTicks)) * nsPerTick / 1000.;
+    }
+
+#endif
+}
+
+/******************************************************************
+*                                                                 *
+*  IsGifTracingEnabled                                            *
+*                                                                 *
+******************************************************************/
+
+bool IsGifTracingEnabled()
+{
+#ifdef GIF_ENABLE_TRACING
+    return true;
+#else
+    return false;
+#endif
+}
+
+/******************************************************************
+*                                                                 *
+*  GetGifTraceStageName                                           *
+*                                                                 *
+******************************************************************/
+
+const char* GetGifTraceStageName(GIF_TRACE_STAGE stage)
+{
+    return static_cast<unsigned int>(stage) < GTS_COUNT ? STAGE_NAMES[stage] : "unknown";
+}
+
+/******************************************************************
+*                                                                 *
+*  RecordGifTraceEvent                                            *
+*                                                                 *
+*  Claims the next slot of the ring, overwriting the oldest event *
+*  once it is full.  Never blocks or allocates.                   *
+*                                                                 *
+******************************************************************/
+
+void RecordGifTraceEvent(GIF_TRACE_STAGE stage, unsigned int uFrame, uint64_t tStart, uint64_t tEnd)
+{
+#ifdef GIF_ENABLE_TRACING
+    auto& counters = g_stages[stage];
+    counters.cCalls.fetch_add(1, std::memory_order_relaxed);
+    counters.cTicks.fetch_add(tEnd - tStart, std::memory_order_relaxed);
+
+    auto uEvent = g_uNextEvent.fetch_add(1, std::memory_order_relaxed);
+    auto& slot = g_ring[uEvent & (GIF_TRACE_RING_SIZE - 1)];
+
+    slot.uSequence.store(2 * uEvent + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.tStart.store(tStart, std::memory_order_relaxed);
+    slot.tEnd.store(tEnd, std::memory_order_relaxed);
+    slot.uInfo.store(uFrame | static_cast<uint64_t>(stage) << 32 | static_cast<uint64_t>(GetThreadNumber()) << 40,
+        std::memory_order_relaxed);
+    slot.uSequence.store(2 * uEvent + 2, std::memory_order_release);
+#else
+    (void)stage;
+    (void)uFrame;
+    (void)tStart;
+    (void)tEnd;
+#endif
+}
+
+/******************************************************************
+*                                                                 *
+*  GetGifTraceStageStats                                          *
+*                                                                 *
+******************************************************************/
+
+GifTraceStageStats GetGifTraceStageStats(GIF_TRACE_STAGE stage)
+{
+    GifTraceStageStats stats = {};
+#ifdef GIF_ENABLE_TRACING
+    stats.cCalls = g_stages[stage].cCalls.load(std::memory_order_relaxed);
+    stats.totalNs = static_cast<uint64_t>(g_stages[stage].cTicks.load(std::memory_order_relaxed) * GetNsPerTick());
+#else
+    (void)stage;
+#endif
+    return stats;
+}
+
+/******************************************************************
+*                                                                 *
+*  ResetGifTrace                                                  *
+*                                                                 *
+******************************************************************/
+
+void ResetGifTrace()
+{
+#ifdef GIF_ENABLE_TRACING
+    for (auto& counters : g_stages)
+    {
+        counters.cCalls.store(0, std::memory_order_relaxed);
+        counters.cTicks.store(0, std::memory_order_relaxed);
+    }
+
+    // Mark the slots empty before restarting the event numbers, so that
+    // no slot claims to hold one of the new events
+    for (auto& slot : g_ring)
+    {
+        slot.uSequence.store(0, std::memory_order_relaxed);
+    }
+    g_uNextEvent.store(0, std::memory_order_release);
+#endif
+}
+
+/******************************************************************
+*                                                                 *
+*  WriteGifChromeTrace                                            *
+*                                                                 *
+*  Every event is a complete ("X") event named after its stage,   *
+*  with the raw frame index as an argument.  Timestamps are in us *
+*  since the process started.  Slots that are being written or    *
+*  get overwritten while they are read are left out.              *
+*                                                                 *
+******************************************************************/
+
+bool WriteGifChromeTrace(std::FILE* pFile)
+{
+    std::fprintf(pFile, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+
+#ifdef GIF_ENABLE_TRACING
+    auto nsPerTick = GetNsPerTick();
+    auto uEnd = g_uNextEvent.load(std::memory_order_acquire);
+    auto uEvent = uEnd > GIF_TRACE_RING_SIZE ? uEnd - GIF_TRACE_RING_SIZE : 0;
+    bool fFirst = true;
+
+    for (; uEvent < uEnd; uEvent++)
+    {
+        const auto& slot = g_ring[uEvent & (GIF_TRACE_RING_SIZE - 1)];
+
+        auto uSequence = slot.uSequence.load(std::memory_order_acquire);
+        if (uSequence != 2 * uEvent + 2)
+        {
+            continue;
+        }
+        auto tStart = slot.tStart.load(std::memory_order_relaxed);
+        auto tEnd = slot.tEnd.load(std::memory_order_relaxed);
+        auto uInfo = slot.uInfo.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.uSequence.load(std::memory_order_relaxed) != uSequence)
+        {
+            continue;
+        }
+
+        auto stage = static_cast<GIF_TRACE_STAGE>((uInfo >> 32) & 0xFF);
+        std::fprintf(pFile,
+            "%s\n{\"name\": \"%s\", \"cat\": \"gif\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, "
+            "\"pid\": 1, \"tid\": %u, \"args\": {\"frame\": %u}}",
+            fFirst ? "" : ",",
+            GetGifTraceStageName(stage),
+            TicksToUs(tStart, nsPerTick),
+            (tEnd - tStart) * nsPerTick / 1000.,
+            static_cast<unsigned int>(uInfo >> 40),
+            static_cast<unsigned int>(uInfo & 0xFFFFFFFF));
+        fFirst = false;
+    }
+#endif
+
+    std::fprintf(pFile, "\n]}\n");
+    return std::ferror(pFile) == 0;
+}
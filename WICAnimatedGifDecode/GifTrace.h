@@ -0,0 +1,129 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Stages of decoding, composing and presenting a frame.  Stages nest (a
+// compose includes the decodes and overlays it does), so their times are
+// inclusive and do not add up to the total.
+enum GIF_TRACE_STAGE
+{
+    GTS_COMPOSE,        // Composing a displayed frame, from the cache or not
+    GTS_DECODE,         // Decoding a raw frame, straight into the composed frame if the source can
+    GTS_CONVERT,        // Converting a decoded raw frame to premultiplied BGRA
+    GTS_OVERLAY,        // Drawing a raw frame onto the composed frame
+    GTS_DISPOSE,        // Disposing the previous frame
+    GTS_SAVE,           // Saving the area of a disposal 3 frame
+    GTS_RESTORE,        // Restoring the area saved for a disposal 3 frame
+    GTS_CACHE,          // Looking up or storing a composed frame in the frame cache
+    GTS_COPY,           // Copying a composed frame into the pipeline ring
+    GTS_WAIT,           // The presenter waiting for the pipeline worker
+    GTS_UPLOAD,         // Uploading a composed frame to the GPU
+    GTS_RENDER,         // Presenting a composed frame in the window
+    GTS_COUNT
+};
+
+// Time spent in a stage since the process started or ResetGifTrace
+struct GifTraceStageStats
+{
+    uint64_t    cCalls;
+    uint64_t    totalNs;
+};
+
+// Whether GifCore was built with GIF_ENABLE_TRACING.  Otherwise
+// GIF_TRACE_SCOPE compiles to nothing, all stats stay zero and traces
+// have no events.
+bool IsGifTracingEnabled();
+
+const char* GetGifTraceStageName(GIF_TRACE_STAGE stage);
+
+// Timestamp in trace clock ticks: the time stamp counter on x86, the
+// virtual counter on ARM64 and steady_clock nanoseconds elsewhere
+inline uint64_t ReadGifTraceClock()
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    return __rdtsc();
+#elif defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t uTicks;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(uTicks));
+    return uTicks;
+#else
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+// Adds a stage that ran from tStart to tEnd, in trace clock ticks, to the
+// stage stats and the event ring.  Safe to call from any thread.  uFrame
+// is the index of the raw frame the stage worked on, or of the first raw
+// frame of the composed frame, and 0 for stages not tied to a frame.
+void RecordGifTraceEvent(GIF_TRACE_STAGE stage, unsigned int uFrame, uint64_t tStart, uint64_t tEnd);
+
+GifTraceStageStats GetGifTraceStageStats(GIF_TRACE_STAGE stage);
+
+// Clears the stats and the event ring.  Events recorded at the same time
+// may survive.
+void ResetGifTrace();
+
+// Events kept in the ring; older events are overwritten
+const unsigned int GIF_TRACE_RING_SIZE = 1 << 16;
+
+// Writes the events in the ring, oldest first, in the Chrome trace event
+// format that chrome://tracing and Perfetto load.  Returns false if
+// writing failed.
+bool WriteGifChromeTrace(std::FILE* pFile);
+
+/******************************************************************
+*                                                                 *
+*  GifTraceScope                                                  *
+*                                                                 *
+*  Records the time from its construction to its destruction as   *
+*  one event.  Use GIF_TRACE_SCOPE rather than declaring one, so  *
+*  that builds without GIF_ENABLE_TRACING do not read the clock.  *
+*                                                                 *
+******************************************************************/
+
+class GifTraceScope
+{
+public:
+
+    GifTraceScope(GIF_TRACE_STAGE stage, unsigned int uFrame) :
+        m_stage(stage),
+        m_uFrame(uFrame),
+        m_tStart(ReadGifTraceClock())
+    {
+    }
+
+    ~GifTraceScope()
+    {
+        RecordGifTraceEvent(m_stage, m_uFrame, m_tStart, ReadGifTraceClock());
+    }
+
+    GifTraceScope(const GifTraceScope&) = delete;
+    GifTraceScope& operator=(const GifTraceScope&) = delete;
+
+private:
+
+    GIF_TRACE_STAGE m_stage;
+    unsigned int    m_uFrame;
+    uint64_t        m_tStart;
+};
+
+#define GIF_TRACE_CONCAT_(a, b) a##b
+#define GIF_TRACE_CONCAT(a, b) GIF_TRACE_CONCAT_(a, b)
+
+#ifdef GIF_ENABLE_TRACING
+#define GIF_TRACE_SCOPE(stage, uFrame) GifTraceScope GIF_TRACE_CONCAT(gifTraceScope, __LINE__)((stage), (uFrame))
+#else
+// Unevaluated, so nothing runs but variables only used for tracing still count as used
+#define GIF_TRACE_SCOPE(stage, uFrame) ((void)sizeof((stage), (uFrame)))
+#endif
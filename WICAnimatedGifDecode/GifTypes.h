@@ -0,0 +1,249 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Platform independent types shared by the gif compositor, its pixel
+// backends and frame sources.  Pixels are 32bpp premultiplied BGRA (the
+// format D2D composes in), stored as 0xAARRGGBB in a uint32_t.
+
+enum GIF_DISPOSAL_METHODS
+{
+    GIF_DM_UNDEFINED = 0,
+    GIF_DM_NONE = 1,
+    GIF_DM_BACKGROUND = 2,
+    GIF_DM_PREVIOUS = 3
+};
+
+struct GifRect
+{
+    unsigned int left;
+    unsigned int top;
+    unsigned int right;
+    unsigned int bottom;
+
+    unsigned int Width() const
+    {
+        return right > left ? right - left : 0;
+    }
+
+    unsigned int Height() const
+    {
+        return bottom > top ? bottom - top : 0;
+    }
+
+    bool IsEmpty() const
+    {
+        return right <= left || bottom <= top;
+    }
+};
+
+inline GifRect IntersectGifRect(const GifRect& a, const GifRect& b)
+{
+    GifRect rect;
+    rect.left = a.left > b.left ? a.left : b.left;
+    rect.top = a.top > b.top ? a.top : b.top;
+    rect.right = a.right < b.right ? a.right : b.right;
+    rect.bottom = a.bottom < b.bottom ? a.bottom : b.bottom;
+    if (rect.IsEmpty())
+    {
+        rect = {};
+    }
+    return rect;
+}
+
+// Smallest rect containing both rects, ignoring empty ones
+inline GifRect UnionGifRect(const GifRect& a, const GifRect& b)
+{
+    if (a.IsEmpty())
+    {
+        return b.IsEmpty() ? GifRect() : b;
+    }
+    if (b.IsEmpty())
+    {
+        return a;
+    }
+
+    GifRect rect;
+    rect.left = a.left < b.left ? a.left : b.left;
+    rect.top = a.top < b.top ? a.top : b.top;
+    rect.right = a.right > b.right ? a.right : b.right;
+    rect.bottom = a.bottom > b.bottom ? a.bottom : b.bottom;
+    return rect;
+}
+
+// Per frame metadata from the Image Descriptor (/imgdesc) and the optional
+// Graphic Control Extension (/grctlext)
+struct GifFrameInfo
+{
+    GifRect         rect;               // Left, Top, Width and Height in logical screen pixels
+    unsigned int    uDelay;             // Delay in 1 ms units
+    unsigned int    uDisposal;          // One of GIF_DISPOSAL_METHODS
+    bool            fTransparent;       // Whether transparentIndex is used
+    uint8_t         transparentIndex;
+    bool            fInterlaced;
+};
+
+// Metadata which pertains to the entire image
+struct GifGlobalInfo
+{
+    unsigned int    cFrames;
+    unsigned int    cxGifImage;
+    unsigned int    cyGifImage;
+    unsigned int    cxGifImagePixel;    // Width of the displayed image calculated using pixel aspect ratio
+    unsigned int    cyGifImagePixel;    // Height of the displayed image calculated using pixel aspect ratio
+    uint32_t        backgroundColor;    // Premultiplied BGRA
+    unsigned int    uTotalLoopCount;    // The number of loops for which the animation will be played
+    bool            fHasLoop;           // Whether the gif has a loop
+    bool            fFrameCountPartial; // cFrames only counts the frames found so far (see IGifFrameSource::DiscoverFrames)
+};
+
+// Converts a straight alpha ARGB color (a WICColor) to premultiplied BGRA
+inline uint32_t PremultiplyArgb(uint32_t argb)
+{
+    uint32_t a = argb >> 24;
+    if (a == 0xFF)
+    {
+        return argb;
+    }
+
+    uint32_t r = (((argb >> 16) & 0xFF) * a + 127) / 255;
+    uint32_t g = (((argb >> 8) & 0xFF) * a + 127) / 255;
+    uint32_t b = ((argb & 0xFF) * a + 127) / 255;
+    return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+// Calculates the displayed image size from the logical screen size and the
+// Logical Screen Descriptor pixel aspect ratio.  Only shrinks the image.
+inline void CalculatePixelAspectSize(
+    unsigned int cx,
+    unsigned int cy,
+    unsigned int uPixelAspRatio,
+    unsigned int* pcxPixel,
+    unsigned int* pcyPixel)
+{
+    if (uPixelAspRatio != 0)
+    {
+        // The value allows specifying widest pixel 4:1 to the tallest pixel
+        // of 1:4 in increments of 1/64th
+        float pixelAspRatio = (uPixelAspRatio + 15.f) / 64.f;
+
+        if (pixelAspRatio > 1.f)
+        {
+            *pcxPixel = cx;
+            *pcyPixel = static_cast<unsigned int>(cy / pixelAspRatio);
+        }
+        else
+        {
+            *pcxPixel = static_cast<unsigned int>(cx * pixelAspRatio);
+            *pcyPixel = cy;
+        }
+    }
+    else
+    {
+        // The value is 0, so its ratio is 1
+        *pcxPixel = cx;
+        *pcyPixel = cy;
+    }
+}
+
+// A non-owning view of 32bpp PBGRA pixels
+struct GifSurface
+{
+    uint32_t*       pPixels;
+    size_t          stride;             // In pixels
+    unsigned int    cx;
+    unsigned int    cy;
+
+    uint32_t* Row(unsigned int y) const
+    {
+        return pPixels + y * stride;
+    }
+
+    bool IsEmpty() const
+    {
+        return pPixels == nullptr || cx == 0 || cy == 0;
+    }
+};
+
+/******************************************************************
+*                                                                 *
+*  GifBitmap                                                      *
+*                                                                 *
+*  An owning, tightly packed 32bpp PBGRA bitmap                   *
+*                                                                 *
+******************************************************************/
+
+class GifBitmap
+{
+public:
+
+    GifBitmap() : m_cx(0), m_cy(0)
+    {
+    }
+
+    GifBitmap(unsigned int cx, unsigned int cy)
+    {
+        Resize(cx, cy);
+    }
+
+    void Resize(unsigned int cx, unsigned int cy)
+    {
+        m_cx = cx;
+        m_cy = cy;
+        m_pixels.resize(static_cast<size_t>(cx) * cy);
+    }
+
+    // Makes room for a bitmap of cPixels, so that resizing to one no larger
+    // does not allocate
+    void Reserve(size_t cPixels)
+    {
+        m_pixels.reserve(cPixels);
+    }
+
+    unsigned int Width() const
+    {
+        return m_cx;
+    }
+
+    unsigned int Height() const
+    {
+        return m_cy;
+    }
+
+    size_t SizeInBytes() const
+    {
+        return m_pixels.size() * sizeof(uint32_t);
+    }
+
+    size_t CapacityInBytes() const
+    {
+        return m_pixels.capacity() * sizeof(uint32_t);
+    }
+
+    GifSurface Surface()
+    {
+        return { m_pixels.data(), m_cx, m_cx, m_cy };
+    }
+
+    const uint32_t* Pixels() const
+    {
+        return m_pixels.data();
+    }
+
+private:
+
+    unsigned int            m_cx;
+    unsigned int            m_cy;
+    std::vector<uint32_t>   m_pixels;
+};
+
+// A raw frame (as read from the file, not composed) converted to PBGRA.
+// The pixels cover info.rect and are only valid until the next call into
+// the frame source that produced them.
+struct GifRawFrame
+{
+    GifFrameInfo    info;
+    GifSurface      pixels;
+};
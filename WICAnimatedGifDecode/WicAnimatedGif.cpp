@@ -14,13 +14,17 @@
 #include <commdlg.h>
 #include <d2d1.h>
 
+#include <algorithm>
+
 #include "WicAnimatedGif.h"
+#include "GifKernels.h"
+#include "GifTrace.h"
 
 using namespace winrt;
 
 #define EXTRA_GIF_DELAY 0
 
-const UINT DELAY_TIMER_ID = 1;    // Global ID for the timer, only one timer is used
+const UINT WM_FRAME_DUE = WM_APP + 1;  // Posted by the playback scheduler, wParam is the timeline
 
 // Utility inline functions
 
@@ -34,6 +38,21 @@ inline LONG RectHeight(RECT rc)
     return rc.bottom - rc.top;
 }
 
+inline UINT32 RectWidth(D2D1_RECT_U rc)
+{
+    return rc.right - rc.left;
+}
+
+inline UINT32 RectHeight(D2D1_RECT_U rc)
+{
+    return rc.bottom - rc.top;
+}
+
+inline bool IsSameSize(D2D1_SIZE_U a, D2D1_SIZE_U b)
+{
+    return a.width == b.width && a.height == b.height;
+}
+
 
 //                           Gif Animation Overview
 // In order to play a gif animation, raw frames (which are compressed frames 
@@ -87,6 +106,9 @@ int WINAPI wWinMain(
 
     check_hresult(CoInitializeEx(nullptr, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE));
 
+    // The composed frames of every native player share one budget
+    GifAssetCache::Shared().SetBudget(DEFAULT_ASSET_CACHE_BUDGET);
+
     DemoApp app;
     app.Initialize(hInstance);
 
@@ -110,8 +132,19 @@ int WINAPI wWinMain(
 *                                                                 *
 ******************************************************************/
 
-DemoApp::DemoApp()
+DemoApp::DemoApp() :
+    m_scheduler([this](unsigned int uTimeline)
+    {
+        PostMessage(m_hWnd, WM_FRAME_DUE, uTimeline, 0);
+    }),
+    m_rawSourceRect(D2D1::RectF(0.f, 0.f, 0.f, 0.f)),
+    m_savedRect(D2D1::RectU(0, 0, 0, 0)),
+    m_decoderBackend(DB_NATIVE),
+    m_uFrameCacheCodec(GFC_NONE),
+    m_fUploadFullFrame(true),
+    m_fLastFrame(false)
 {
+    m_frameCache.Configure(FCM_FULL, DEFAULT_FRAME_CACHE_BUDGET);
 }
 
 /******************************************************************
@@ -181,6 +214,42 @@ void DemoApp::Initialize(HINSTANCE hInstance)
     SelectAndDisplayGif();
 }
 
+/******************************************************************
+*                                                                 *
+*  DemoApp::SetFrameCacheMode                                     *
+*                                                                 *
+*  Selects how composed frames of the current animation are       *
+*  cached.  Frames the WIC decoder cached so far are dropped.     *
+*  The native compositor never caches frames itself: it is        *
+*  attached to the asset cache's store for the new mode, which    *
+*  other players share, or detached from it.                      *
+*                                                                 *
+******************************************************************/
+
+void DemoApp::SetFrameCacheMode(FRAME_CACHE_MODE mode, size_t cbBudget)
+{
+    m_frameCache.Configure(mode, cbBudget);
+    if (m_pipeline)
+    {
+        m_pipeline->SetSharedFrameStore(GetSharedFrameStore());
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  DemoApp::SetFrameCacheCodec                                    *
+*                                                                 *
+******************************************************************/
+
+void DemoApp::SetFrameCacheCodec(unsigned int uCodec)
+{
+    m_uFrameCacheCodec = uCodec;
+    if (m_pipeline)
+    {
+        m_pipeline->SetSharedFrameStore(GetSharedFrameStore());
+    }
+}
+
 /******************************************************************
 *                                                                 *
 *  DemoApp::CreateDeviceResources                                 *
@@ -233,6 +302,21 @@ void DemoApp::CreateDeviceResources()
             static_cast<float>(m_cxGifImage),
             static_cast<float>(m_cyGifImage)),
         m_frameComposeRT.put()));
+
+    // The native backend composes in system memory and uploads each
+    // composed frame into this bitmap
+    if (m_pipeline)
+    {
+        m_composedFrame = nullptr;
+        check_hresult(m_hwndRT->CreateBitmap(
+            D2D1::SizeU(m_cxGifImage, m_cyGifImage),
+            D2D1::BitmapProperties(
+                D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED),
+                DEFAULT_DPI,
+                DEFAULT_DPI),
+            m_composedFrame.put()));
+        m_fUploadFullFrame = true;
+    }
 }
 
 /******************************************************************
@@ -261,19 +345,54 @@ void DemoApp::OnRender()
             CalculateDrawRectangle(drawRect);
 
             // Get the bitmap to draw on the hwnd render target
-            check_hresult(m_frameComposeRT->GetBitmap(frameToRender.put()));
+            if (m_pipeline)
+            {
+                frameToRender = m_composedFrame;
+            }
+            else
+            {
+                check_hresult(m_frameComposeRT->GetBitmap(frameToRender.put()));
+            }
 
             // Draw the bitmap onto the calculated rectangle
+            GIF_TRACE_SCOPE(GTS_RENDER, m_uNextFrameIndex);
             m_hwndRT->BeginDraw();
 
             m_hwndRT->Clear(D2D1::ColorF(D2D1::ColorF::Black));
             m_hwndRT->DrawBitmap(frameToRender.get(), drawRect);
 
             check_hresult(m_hwndRT->EndDraw());
+            m_scheduler.FramePresented();
         }
     }
 }
 
+/******************************************************************
+*                                                                 *
+*  DemoApp::WriteTrace                                            *
+*                                                                 *
+*  In builds with GIF_ENABLE_TRACING, writes the recorded stage   *
+*  events to WicAnimatedGif.trace.json in the current directory,  *
+*  for chrome://tracing or Perfetto.                              *
+*                                                                 *
+******************************************************************/
+
+void DemoApp::WriteTrace()
+{
+    if (!IsGifTracingEnabled())
+    {
+        return;
+    }
+
+    FILE* pFile = nullptr;
+    if (_wfopen_s(&pFile, L"WicAnimatedGif.trace.json", L"w") != 0 || pFile == nullptr)
+    {
+        return;
+    }
+    WriteGifChromeTrace(pFile);
+    fclose(pFile);
+}
+
 /******************************************************************
 *                                                                 *
 *  DemoApp::GetFileOpen                                           *
@@ -427,17 +546,22 @@ LRESULT DemoApp::WndProc(
 
         case WM_DESTROY:
         {
+            m_scheduler.Stop();
+            WriteTrace();
             PostQuitMessage(0);
             return 0;
         }
         break;
 
-        case WM_TIMER:
+        case WM_FRAME_DUE:
         {
-            // Timer expired, display the next frame and set a new timer
-            // if needed
-            ComposeNextFrame();
-            InvalidateRect(hWnd, nullptr, FALSE);
+            // The next frame is due, display it unless the message was
+            // posted before playback was restarted
+            if (static_cast<unsigned int>(wParam) == m_scheduler.GetTimeline())
+            {
+                ComposeNextFrame();
+                InvalidateRect(hWnd, nullptr, FALSE);
+            }
         }
         break;
 
@@ -450,7 +574,7 @@ LRESULT DemoApp::WndProc(
         // In case of a device loss, recreate all the resources and start playing
         // gif from the beginning
         //
-        // In case of other errors from resize, paint, and timer event, we will
+        // In case of other errors from resize, paint, and frame due events, we will
         // try our best to continue displaying the animation
         if (error.code() == D2DERR_RECREATE_TARGET)
         {
@@ -601,86 +725,301 @@ void DemoApp::GetGlobalMetadata()
 
 /******************************************************************
 *                                                                 *
-*  DemoApp::GetRawFrame()                                         *
+*  DemoApp::MapGifFile()                                          *
 *                                                                 *
-*  Decodes the current raw frame, retrieves its timing            *
-*  information, disposal method, and frame dimension for          *
-*  rendering.  Raw frame is the frame read directly from the gif  *
-*  file without composing.                                        *
+*  Maps the gif file into memory.  Both decoder backends read     *
+*  the file straight from the mapping without copying it.         *
 *                                                                 *
 ******************************************************************/
 
-void DemoApp::GetRawFrame(UINT uFrameIndex)
+void DemoApp::MapGifFile(const WCHAR* pszFileName)
 {
-    com_ptr<IWICFormatConverter> converter;
-    com_ptr<IWICBitmapFrameDecode> wicFrame;
-    com_ptr<IWICMetadataQueryReader> frameMetadataQueryReader;
+    try
+    {
+        m_gifBytes = GifByteSource::MapFile(pszFileName);
+    }
+    catch (const std::runtime_error&)
+    {
+        throw_hresult(HRESULT_FROM_WIN32(ERROR_OPEN_FAILED));
+    }
 
-    PROPVARIANT propValue;
-    PropVariantInit(&propValue);
+    // WIC streams over memory take a DWORD size
+    if (m_gifBytes->Size() > MAXDWORD)
+    {
+        throw_hresult(E_OUTOFMEMORY);
+    }
+}
 
-    // Retrieve the current frame
-    check_hresult(m_decoder->GetFrame(uFrameIndex, wicFrame.put()));
-    // Format convert to 32bppPBGRA which D2D expects
-    check_hresult(m_wicFactory->CreateFormatConverter(converter.put()));
+/******************************************************************
+*                                                                 *
+*  DemoApp::LoadNativeDecoder()                                   *
+*                                                                 *
+*  Gets the mapped gif file from the process wide asset cache and *
+*  creates the compositor that plays it.  Fills in the same       *
+*  global metadata GetGlobalMetadata does.                        *
+*                                                                 *
+******************************************************************/
 
-    check_hresult(converter->Initialize(
-        wicFrame.get(),
-        GUID_WICPixelFormat32bppPBGRA,
-        WICBitmapDitherTypeNone,
-        nullptr,
-        0.f,
-        WICBitmapPaletteTypeCustom));
+void DemoApp::LoadNativeDecoder()
+{
+    // The asset finds frames as the players reach them, so the first frame
+    // shows without the gif being walked, and its frames are decoded and
+    // composed once for all of its players
+    std::shared_ptr<IGifFrameSource> source;
+    try
+    {
+        m_gifAsset = GifAssetCache::Shared().Acquire(m_gifBytes);
+        source = m_gifAsset->CreateFrameSource();
+    }
+    catch (const std::runtime_error&)
+    {
+        throw_hresult(WINCODEC_ERR_BADHEADER);
+    }
 
-    // Create a D2DBitmap from IWICBitmapSource
-    m_rawFrame = nullptr;
-    check_hresult(m_hwndRT->CreateBitmapFromWicBitmap(
-        converter.get(),
-        nullptr,
-        m_rawFrame.put()));
+    GifGlobalInfo globalInfo;
+    source->GetGlobalInfo(globalInfo);
+    m_cFrames = globalInfo.cFrames;
+    m_cxGifImage = globalInfo.cxGifImage;
+    m_cyGifImage = globalInfo.cyGifImage;
+    m_cxGifImagePixel = globalInfo.cxGifImagePixel;
+    m_cyGifImagePixel = globalInfo.cyGifImagePixel;
+    m_uTotalLoopCount = globalInfo.uTotalLoopCount;
+    m_fHasLoop = globalInfo.fHasLoop;
+
+    // Composed frames are cached in the asset cache rather than the
+    // compositor
+    auto compositor = std::make_unique<GifCompositor>(source, std::make_unique<CpuPixelBackend>());
+    compositor->SetFrameCacheMode(FCM_OFF);
+    compositor->SetSharedFrameStore(GetSharedFrameStore());
+
+    // The pipeline starts composing the first frames right away, while the
+    // window and device resources are set up
+    m_pipeline = std::make_unique<GifFramePipeline>(std::move(compositor));
+}
 
-    // Get Metadata Query Reader from the frame
-    check_hresult(wicFrame->GetMetadataQueryReader(frameMetadataQueryReader.put()));
+/******************************************************************
+*                                                                 *
+*  DemoApp::GetSharedFrameStore()                                 *
+*                                                                 *
+*  The asset cache's store of the current gif's composed frames   *
+*  with the player's cache mode and codec, or nullptr when        *
+*  caching is off.                                                *
+*                                                                 *
+******************************************************************/
 
-    // Get the Metadata for the current frame
-    check_hresult(frameMetadataQueryReader->GetMetadataByName(L"/imgdesc/Left", &propValue));
-    WINRT_VERIFY(propValue.vt == VT_UI2);
-    m_framePosition.left = static_cast<float>(propValue.uiVal);
-    PropVariantClear(&propValue);
+std::shared_ptr<IGifSharedFrameStore> DemoApp::GetSharedFrameStore()
+{
+    if (!m_gifAsset || m_frameCache.GetMode() == FCM_OFF)
+    {
+        return nullptr;
+    }
+    return m_gifAsset->GetComposedFrameStore(0, 0, m_frameCache.GetMode(), m_uFrameCacheCodec);
+}
 
-    check_hresult(frameMetadataQueryReader->GetMetadataByName(L"/imgdesc/Top", &propValue));
-    WINRT_VERIFY(propValue.vt == VT_UI2);
-    m_framePosition.top = static_cast<float>(propValue.uiVal);
-    PropVariantClear(&propValue);
+/******************************************************************
+*                                                                 *
+*  DemoApp::UploadComposedFrame()                                 *
+*                                                                 *
+*  Copies the part of a frame from the pipeline that changed      *
+*  into the bitmap that gets rendered, and picks up the animation *
+*  state.                                                         *
+*                                                                 *
+******************************************************************/
 
-    check_hresult(frameMetadataQueryReader->GetMetadataByName(L"/imgdesc/Width", &propValue));
-    WINRT_VERIFY(propValue.vt == VT_UI2);
-    m_framePosition.right = static_cast<float>(propValue.uiVal)
-        + m_framePosition.left;
-    PropVariantClear(&propValue);
+void DemoApp::UploadComposedFrame(const GifPipelineFrame& frame)
+{
+    GIF_TRACE_SCOPE(GTS_UPLOAD, m_uNextFrameIndex);
 
-    check_hresult(frameMetadataQueryReader->GetMetadataByName(L"/imgdesc/Height", &propValue));
-    WINRT_VERIFY(propValue.vt == VT_UI2);
-    m_framePosition.bottom = static_cast<float>(propValue.uiVal)
-        + m_framePosition.top;
-    PropVariantClear(&propValue);
+    const auto& surface = frame.composedFrame;
+
+    // Only the pixels that changed since the last composed frame need to be
+    // uploaded, unless the bitmap was just created
+    GifRect dirtyRect = frame.dirtyRect;
+    if (m_fUploadFullFrame)
+    {
+        dirtyRect = { 0, 0, surface.Width(), surface.Height() };
+        m_fUploadFullFrame = false;
+    }
+
+    if (!dirtyRect.IsEmpty())
+    {
+        D2D1_RECT_U destRect = D2D1::RectU(dirtyRect.left, dirtyRect.top, dirtyRect.right, dirtyRect.bottom);
+        check_hresult(m_composedFrame->CopyFromMemory(
+            &destRect,
+            surface.Pixels() + static_cast<size_t>(dirtyRect.top) * surface.Width() + dirtyRect.left,
+            static_cast<UINT32>(surface.Width() * sizeof(uint32_t))));
+    }
+
+    m_uNextFrameIndex = frame.uNextFrameIndex;
+    m_uLoopNumber = frame.uLoopNumber;
+    m_uFrameDelay = frame.uFrameDelay;
+    m_fLastFrame = frame.fLastFrame;
+}
+
+/******************************************************************
+*                                                                 *
+*  DemoApp::IndexWicFrames()                                      *
+*                                                                 *
+*  Reads the position, timing information and disposal method of  *
+*  the frames up to cFramesNeeded that are not indexed yet.       *
+*  Frames are indexed as playback first reaches them, so opening  *
+*  a long gif does not wait for the metadata of every frame, and  *
+*  playing a frame again never has to query its metadata again.   *
+*                                                                 *
+******************************************************************/
+
+void DemoApp::IndexWicFrames(UINT cFramesNeeded)
+{
+    cFramesNeeded = (std::min)(cFramesNeeded, m_cFrames);
 
-    // Get delay from the optional Graphic Control Extension
-    if (SUCCEEDED(frameMetadataQueryReader->GetMetadataByName(
-        L"/grctlext/Delay",
-        &propValue)))
+    for (auto uFrameIndex = static_cast<UINT>(m_frameIndex.Size()); uFrameIndex < cFramesNeeded; uFrameIndex++)
     {
+        com_ptr<IWICBitmapFrameDecode> wicFrame;
+        com_ptr<IWICMetadataQueryReader> frameMetadataQueryReader;
+        GifFrameInfo frameInfo = {};
+        GifRect imageRect = {};
+
+        PROPVARIANT propValue;
+        PropVariantInit(&propValue);
+
+        check_hresult(m_decoder->GetFrame(uFrameIndex, wicFrame.put()));
+
+        // Get Metadata Query Reader from the frame
+        check_hresult(wicFrame->GetMetadataQueryReader(frameMetadataQueryReader.put()));
+
+        // Get the Metadata for the current frame
+        check_hresult(frameMetadataQueryReader->GetMetadataByName(L"/imgdesc/Left", &propValue));
+        WINRT_VERIFY(propValue.vt == VT_UI2);
+        imageRect.left = propValue.uiVal;
+        PropVariantClear(&propValue);
+
+        check_hresult(frameMetadataQueryReader->GetMetadataByName(L"/imgdesc/Top", &propValue));
+        WINRT_VERIFY(propValue.vt == VT_UI2);
+        imageRect.top = propValue.uiVal;
+        PropVariantClear(&propValue);
+
+        check_hresult(frameMetadataQueryReader->GetMetadataByName(L"/imgdesc/Width", &propValue));
         WINRT_VERIFY(propValue.vt == VT_UI2);
-        // Convert the delay retrieved in 10 ms units to a delay in 1 ms units
-        check_hresult(UIntMult(propValue.uiVal, 10, &m_uFrameDelay));
+        imageRect.right = propValue.uiVal + imageRect.left;
+        PropVariantClear(&propValue);
+
+        check_hresult(frameMetadataQueryReader->GetMetadataByName(L"/imgdesc/Height", &propValue));
+        WINRT_VERIFY(propValue.vt == VT_UI2);
+        imageRect.bottom = propValue.uiVal + imageRect.top;
+        PropVariantClear(&propValue);
+
+        // Get delay from the optional Graphic Control Extension
+        if (SUCCEEDED(frameMetadataQueryReader->GetMetadataByName(
+            L"/grctlext/Delay",
+            &propValue)))
+        {
+            WINRT_VERIFY(propValue.vt == VT_UI2);
+            // Convert the delay retrieved in 10 ms units to a delay in 1 ms units
+            check_hresult(UIntMult(propValue.uiVal, 10, &frameInfo.uDelay));
+            PropVariantClear(&propValue);
+        }
+        else
+        {
+            // Failed to get delay from graphic control extension. Possibly a
+            // single frame image (non-animated gif)
+            frameInfo.uDelay = 0;
+        }
+
+        if (SUCCEEDED(frameMetadataQueryReader->GetMetadataByName(
+            L"/grctlext/Disposal",
+            &propValue)))
+        {
+            WINRT_VERIFY(propValue.vt == VT_UI1);
+            frameInfo.uDisposal = propValue.bVal;
+        }
+        else
+        {
+            // Failed to get the disposal method, use default. Possibly a 
+            // non-animated gif.
+            frameInfo.uDisposal = DM_UNDEFINED;
+        }
+
         PropVariantClear(&propValue);
+
+        // The WIC path only needs the rect, delay and disposal; block
+        // offsets are left at 0
+        m_frameIndex.Append(frameInfo, imageRect, 0, 0, 0);
     }
-    else
+
+    if (m_frameIndex.Size() == m_cFrames && !m_frameIndex.IsComplete())
+    {
+        m_frameIndex.SetComplete(m_uTotalLoopCount, m_fHasLoop);
+    }
+}
+
+/******************************************************************
+*                                                                 *
+*  DemoApp::GetRawFrame()                                         *
+*                                                                 *
+*  Decodes the current raw frame and looks up its timing          *
+*  information, disposal method, and frame dimension in the       *
+*  frame index.  Raw frame is the frame read directly from the    *
+*  gif file without composing.                                    *
+*                                                                 *
+*  The pixels land in m_rawFrame, which is reused for all frames, *
+*  so after the first loop only WIC's own frame object is         *
+*  allocated per frame.                                           *
+*                                                                 *
+******************************************************************/
+
+void DemoApp::GetRawFrame(UINT uFrameIndex)
+{
+    GIF_TRACE_SCOPE(GTS_DECODE, uFrameIndex);
+
+    com_ptr<IWICBitmapFrameDecode> wicFrame;
+    UINT cx = 0;
+    UINT cy = 0;
+    WICPixelFormatGUID pixelFormat;
+
+    // Retrieve the current frame
+    check_hresult(m_decoder->GetFrame(uFrameIndex, wicFrame.put()));
+    check_hresult(wicFrame->GetSize(&cx, &cy));
+    check_hresult(wicFrame->GetPixelFormat(&pixelFormat));
+
+    size_t cPixels = static_cast<size_t>(cx) * cy;
+    if (m_rawPixels.size() < cPixels)
+    {
+        m_rawPixels.resize(cPixels);
+    }
+
+    // Gif frames decode to 8bppIndexed, expand them to 32bppPBGRA which D2D
+    // expects without going through a format converter
+    {
+        GIF_TRACE_SCOPE(GTS_CONVERT, uFrameIndex);
+        if (pixelFormat == GUID_WICPixelFormat8bppIndexed)
+        {
+            ExpandIndexedFrame(wicFrame.get(), cx, cy);
+        }
+        else
+        {
+            ConvertFrame(wicFrame.get(), cx, cy);
+        }
+    }
+
+    EnsureRawFrame(cx, cy);
+    if (cPixels > 0)
     {
-        // Failed to get delay from graphic control extension. Possibly a
-        // single frame image (non-animated gif)
-        m_uFrameDelay = 0;
+        auto destRect = D2D1::RectU(0, 0, cx, cy);
+        check_hresult(m_rawFrame->CopyFromMemory(&destRect, m_rawPixels.data(), cx * sizeof(uint32_t)));
     }
+    m_rawSourceRect = D2D1::RectF(0.f, 0.f, static_cast<float>(cx), static_cast<float>(cy));
+
+    // Position, delay and disposal come from the frame index
+    IndexWicFrames(uFrameIndex + 1);
+    const auto& imageRect = m_frameIndex.GetImageRect(uFrameIndex);
+    m_framePosition.left = static_cast<float>(imageRect.left);
+    m_framePosition.top = static_cast<float>(imageRect.top);
+    m_framePosition.right = static_cast<float>(imageRect.right);
+    m_framePosition.bottom = static_cast<float>(imageRect.bottom);
+
+    GifFrameInfo frameInfo;
+    m_frameIndex.GetFrameInfo(uFrameIndex, frameInfo);
+    m_uFrameDelay = frameInfo.uDelay;
 
 #if EXTRA_GIF_DELAY
     // Insert an artificial delay to ensure rendering for gif with very small
@@ -696,21 +1035,140 @@ void DemoApp::GetRawFrame(UINT uFrameIndex)
     }
 #endif
 
-    if (SUCCEEDED(frameMetadataQueryReader->GetMetadataByName(
-        L"/grctlext/Disposal",
-        &propValue)))
+    m_uFrameDisposal = frameInfo.uDisposal;
+}
+
+/******************************************************************
+*                                                                 *
+*  DemoApp::ExpandIndexedFrame()                                  *
+*                                                                 *
+*  Looks up the frame's color indices in its palette, into        *
+*  m_rawPixels.  The palette and index buffers are reused.        *
+*                                                                 *
+******************************************************************/
+
+void DemoApp::ExpandIndexedFrame(IWICBitmapFrameDecode* pFrame, UINT cx, UINT cy)
+{
+    WICColor rgColors[256];
+    uint32_t rgPixelColors[256];
+    UINT cColorsCopied = 0;
+
+    if (!m_rawPalette)
     {
-        WINRT_VERIFY(propValue.vt == VT_UI1);
-        m_uFrameDisposal = propValue.bVal;
+        check_hresult(m_wicFactory->CreatePalette(m_rawPalette.put()));
     }
-    else
+    check_hresult(pFrame->CopyPalette(m_rawPalette.get()));
+    check_hresult(m_rawPalette->GetColors(ARRAYSIZE(rgColors), rgColors, &cColorsCopied));
+
+    // WICColor is 0xAARRGGBB like BGRA in memory, only premultiplying is
+    // left.  The transparent color has alpha 0, indices past the palette
+    // are left transparent.
+    for (UINT i = 0; i < ARRAYSIZE(rgPixelColors); i++)
+    {
+        uint32_t color = (i < cColorsCopied) ? rgColors[i] : 0;
+        uint32_t alpha = color >> 24;
+        if (alpha == 0)
+        {
+            color = 0;
+        }
+        else if (alpha < 255)
+        {
+            uint32_t r = ((color >> 16) & 0xFF) * alpha / 255;
+            uint32_t g = ((color >> 8) & 0xFF) * alpha / 255;
+            uint32_t b = (color & 0xFF) * alpha / 255;
+            color = (alpha << 24) | (r << 16) | (g << 8) | b;
+        }
+        rgPixelColors[i] = color;
+    }
+
+    size_t cPixels = static_cast<size_t>(cx) * cy;
+    if (m_rawIndices.size() < cPixels)
     {
-        // Failed to get the disposal method, use default. Possibly a 
-        // non-animated gif.
-        m_uFrameDisposal = DM_UNDEFINED;
+        m_rawIndices.resize(cPixels);
+    }
+    if (cPixels == 0)
+    {
+        return;
     }
 
-    PropVariantClear(&propValue);
+    check_hresult(pFrame->CopyPixels(
+        nullptr,
+        cx,
+        static_cast<UINT>(cPixels),
+        m_rawIndices.data()));
+
+    // Both buffers are tightly packed, so the frame expands as one row
+    GetGifKernels().ExpandIndices(
+        m_rawPixels.data(),
+        m_rawIndices.data(),
+        static_cast<unsigned int>(cPixels),
+        rgPixelColors);
+}
+
+/******************************************************************
+*                                                                 *
+*  DemoApp::ConvertFrame()                                        *
+*                                                                 *
+*  Fallback for frames that do not decode to 8bppIndexed: format  *
+*  converts to 32bppPBGRA into m_rawPixels.                       *
+*                                                                 *
+******************************************************************/
+
+void DemoApp::ConvertFrame(IWICBitmapFrameDecode* pFrame, UINT cx, UINT cy)
+{
+    com_ptr<IWICFormatConverter> converter;
+
+    check_hresult(m_wicFactory->CreateFormatConverter(converter.put()));
+    check_hresult(converter->Initialize(
+        pFrame,
+        GUID_WICPixelFormat32bppPBGRA,
+        WICBitmapDitherTypeNone,
+        nullptr,
+        0.f,
+        WICBitmapPaletteTypeCustom));
+
+    size_t cPixels = static_cast<size_t>(cx) * cy;
+    if (cPixels == 0)
+    {
+        return;
+    }
+
+    check_hresult(converter->CopyPixels(
+        nullptr,
+        cx * sizeof(uint32_t),
+        static_cast<UINT>(cPixels * sizeof(uint32_t)),
+        reinterpret_cast<BYTE*>(m_rawPixels.data())));
+}
+
+/******************************************************************
+*                                                                 *
+*  DemoApp::EnsureRawFrame()                                      *
+*                                                                 *
+*  Makes sure the raw frame bitmap can hold a cx by cy frame.     *
+*  Like the disposal 3 bitmap it only grows.                      *
+*                                                                 *
+******************************************************************/
+
+void DemoApp::EnsureRawFrame(UINT32 cx, UINT32 cy)
+{
+    auto rawSize = D2D1::SizeU(0, 0);
+    if (m_rawFrame)
+    {
+        rawSize = m_rawFrame->GetPixelSize();
+        if (rawSize.width >= cx && rawSize.height >= cy)
+        {
+            return;
+        }
+    }
+
+    m_rawFrame = nullptr;
+    check_hresult(m_frameComposeRT->CreateBitmap(
+        D2D1::SizeU((std::max)((std::max)(rawSize.width, cx), 1u), (std::max)((std::max)(rawSize.height, cy), 1u)),
+        D2D1::BitmapProperties(
+            D2D1::PixelFormat(DXGI_FORMAT_B8G8R8A8_UNORM, D2D1_ALPHA_MODE_PREMULTIPLIED),
+            DEFAULT_DPI,
+            DEFAULT_DPI),
+        m_rawFrame.put()));
 }
 
 /******************************************************************
@@ -827,21 +1285,30 @@ void DemoApp::CalculateDrawRectangle(D2D1_RECT_F& drawRect)
 *                                                                 *
 *  DemoApp::RestoreSavedFrame()                                   *
 *                                                                 *
-*  Copys the saved frame to the frame in the bitmap render        *
+*  Copys the saved area back to the frame in the bitmap render    *
 *  target.                                                        *
 *                                                                 *
 ******************************************************************/
 
 void DemoApp::RestoreSavedFrame()
 {
+    GIF_TRACE_SCOPE(GTS_RESTORE, m_uNextFrameIndex);
+
     com_ptr<ID2D1Bitmap> frameToCopyTo = nullptr;
 
+    if (RectWidth(m_savedRect) == 0 || RectHeight(m_savedRect) == 0)
+    {
+        return;
+    }
+
     WINRT_VERIFY(m_savedFrame.get());
 
     check_hresult(m_frameComposeRT->GetBitmap(frameToCopyTo.put()));
 
-    // Copy the whole bitmap
-    check_hresult(frameToCopyTo->CopyFromBitmap(nullptr, m_savedFrame.get(), nullptr));
+    // Copy back only the area that was saved
+    auto destPoint = D2D1::Point2U(m_savedRect.left, m_savedRect.top);
+    auto sourceRect = D2D1::RectU(0, 0, RectWidth(m_savedRect), RectHeight(m_savedRect));
+    check_hresult(frameToCopyTo->CopyFromBitmap(&destPoint, m_savedFrame.get(), &sourceRect));
 }
 
 /******************************************************************
@@ -882,6 +1349,8 @@ void DemoApp::ClearCurrentFrameArea()
 
 void DemoApp::DisposeCurrentFrame()
 {
+    GIF_TRACE_SCOPE(GTS_DISPOSE, m_uNextFrameIndex);
+
     switch (m_uFrameDisposal)
     {
     case DM_UNDEFINED:
@@ -904,6 +1373,79 @@ void DemoApp::DisposeCurrentFrame()
     }
 }
 
+/******************************************************************
+*                                                                 *
+*  DemoApp::ApplyFrameRun()                                       *
+*                                                                 *
+*  Draws the zero delay intermediate frames of the planned run    *
+*  in a single BeginDraw/EndDraw.  Frames the displayed frame     *
+*  does not show are skipped, disposal 2 frames only clear their  *
+*  area and disposal 3 frames need no saved frame.                *
+*                                                                 *
+******************************************************************/
+
+void DemoApp::ApplyFrameRun()
+{
+    const auto& steps = m_frameRun.GetSteps();
+    if (steps.size() < 2)
+    {
+        return;
+    }
+
+    m_frameComposeRT->BeginDraw();
+
+    for (size_t i = 0; i + 1 < steps.size(); i++)
+    {
+        const auto& step = steps[i];
+
+        // If starting a new animation loop, draw background and increase
+        // loop count
+        if (step.uFrameIndex == 0)
+        {
+            m_frameComposeRT->Clear(m_backgroundColor);
+            m_uLoopNumber++;
+        }
+
+        switch (step.action)
+        {
+        case GIF_RUN_DRAW:
+        {
+            GetRawFrame(step.uFrameIndex);
+
+            GIF_TRACE_SCOPE(GTS_OVERLAY, step.uFrameIndex);
+            m_frameComposeRT->DrawBitmap(
+                m_rawFrame.get(),
+                m_framePosition,
+                1.f,
+                D2D1_BITMAP_INTERPOLATION_MODE_LINEAR,
+                m_rawSourceRect);
+        }
+        break;
+        case GIF_RUN_CLEAR:
+        {
+            auto clearRect = D2D1::RectF(
+                static_cast<float>(step.info.rect.left),
+                static_cast<float>(step.info.rect.top),
+                static_cast<float>(step.info.rect.right),
+                static_cast<float>(step.info.rect.bottom));
+            m_frameComposeRT->PushAxisAlignedClip(
+                &clearRect,
+                D2D1_ANTIALIAS_MODE_PER_PRIMITIVE);
+            m_frameComposeRT->Clear(m_backgroundColor);
+            m_frameComposeRT->PopAxisAlignedClip();
+        }
+        break;
+        default:
+            break;
+        }
+    }
+
+    check_hresult(m_frameComposeRT->EndDraw());
+
+    // The displayed frame follows the intermediate frames
+    m_uNextFrameIndex = steps.back().uFrameIndex;
+}
+
 /******************************************************************
 *                                                                 *
 *  DemoApp::OverlayNextFrame()                                    *
@@ -918,34 +1460,46 @@ void DemoApp::OverlayNextFrame()
 {
     // Get Frame information
     GetRawFrame(m_uNextFrameIndex);
-    // For disposal 3 method, we would want to save a copy of the current
-    // composed frame
-    if (m_uFrameDisposal == DM_PREVIOUS)
-    {
-        SaveComposedFrame();
-    }
-
-    // Start producing the next bitmap
-    m_frameComposeRT->BeginDraw();
 
     // If starting a new animation loop
     if (m_uNextFrameIndex == 0)
     {
-        // Draw background and increase loop count
+        // Draw background and increase loop count.  This happens before the
+        // frame is saved, so that disposing a disposal 3 first frame restores
+        // the background rather than the last frame of the previous loop.
+        m_frameComposeRT->BeginDraw();
         m_frameComposeRT->Clear(m_backgroundColor);
+        check_hresult(m_frameComposeRT->EndDraw());
         m_uLoopNumber++;
     }
 
-    // Produce the next frame
-    m_frameComposeRT->DrawBitmap(
-        m_rawFrame.get(),
-        m_framePosition);
+    // For disposal 3 method, we would want to save a copy of the current
+    // composed frame
+    if (m_uFrameDisposal == DM_PREVIOUS)
+    {
+        SaveComposedFrame();
+    }
 
-    check_hresult(m_frameComposeRT->EndDraw());
+    // Start producing the next bitmap.  D2D draws at EndDraw, so that is
+    // part of the overlay time.
+    {
+        GIF_TRACE_SCOPE(GTS_OVERLAY, m_uNextFrameIndex);
+        m_frameComposeRT->BeginDraw();
+
+        // Produce the next frame
+        m_frameComposeRT->DrawBitmap(
+            m_rawFrame.get(),
+            m_framePosition,
+            1.f,
+            D2D1_BITMAP_INTERPOLATION_MODE_LINEAR,
+            m_rawSourceRect);
+
+        check_hresult(m_frameComposeRT->EndDraw());
+    }
 
-    // To improve performance and avoid decoding/composing this frame in the 
-    // following animation loops, the composed frame can be cached here in system 
-    // or video memory.
+    // Composed frames are cached by ComposeNextFrame once the whole run of
+    // zero delay frames has been overlaid, so the following animation loops
+    // can skip decoding and composing.
 
     // Increase the frame index by 1
     m_uNextFrameIndex = (++m_uNextFrameIndex) % m_cFrames;
@@ -955,33 +1509,206 @@ void DemoApp::OverlayNextFrame()
 *                                                                 *
 *  DemoApp::SaveComposedFrame()                                   *
 *                                                                 *
-*  Saves the current composed frame in the bitmap render target   *
-*  into a temporary bitmap. Initializes the temporary bitmap if   *
-*  needed.                                                        *
+*  Saves the area of the current composed frame that the next     *
+*  raw frame covers into a temporary bitmap.  Only that area      *
+*  changes before the frame is disposed.                          *
 *                                                                 *
 ******************************************************************/
 
 void DemoApp::SaveComposedFrame()
 {
+    GIF_TRACE_SCOPE(GTS_SAVE, m_uNextFrameIndex);
+
     com_ptr<ID2D1Bitmap> frameToBeSaved;
 
     check_hresult(m_frameComposeRT->GetBitmap(frameToBeSaved.put()));
-    // Create the temporary bitmap if it hasn't been created yet 
-    if (m_savedFrame == nullptr)
+
+    // Clip the frame position to the composed frame
+    auto bitmapSize = frameToBeSaved->GetPixelSize();
+    m_savedRect = D2D1::RectU(
+        (std::min)(static_cast<UINT32>(m_framePosition.left), bitmapSize.width),
+        (std::min)(static_cast<UINT32>(m_framePosition.top), bitmapSize.height),
+        (std::min)(static_cast<UINT32>(m_framePosition.right), bitmapSize.width),
+        (std::min)(static_cast<UINT32>(m_framePosition.bottom), bitmapSize.height));
+
+    if (RectWidth(m_savedRect) == 0 || RectHeight(m_savedRect) == 0)
+    {
+        return;
+    }
+
+    EnsureSavedFrame(frameToBeSaved.get(), RectWidth(m_savedRect), RectHeight(m_savedRect));
+
+    auto destPoint = D2D1::Point2U(0, 0);
+    check_hresult(m_savedFrame->CopyFromBitmap(&destPoint, frameToBeSaved.get(), &m_savedRect));
+}
+
+/******************************************************************
+*                                                                 *
+*  DemoApp::EnsureSavedFrame()                                    *
+*                                                                 *
+*  Makes sure the temporary bitmap for disposal 3 can hold a cx   *
+*  by cy area.  The bitmap is reused and only grows, so it ends   *
+*  up sized to the largest frame saved.                           *
+*                                                                 *
+******************************************************************/
+
+void DemoApp::EnsureSavedFrame(ID2D1Bitmap* pComposedFrame, UINT32 cx, UINT32 cy)
+{
+    auto savedSize = D2D1::SizeU(0, 0);
+    if (m_savedFrame)
+    {
+        savedSize = m_savedFrame->GetPixelSize();
+        if (savedSize.width >= cx && savedSize.height >= cy)
+        {
+            return;
+        }
+    }
+
+    m_savedFrame = CreateBitmapLike(
+        pComposedFrame,
+        D2D1::SizeU((std::max)(savedSize.width, cx), (std::max)(savedSize.height, cy)));
+}
+
+/******************************************************************
+*                                                                 *
+*  DemoApp::CreateBitmapLike()                                    *
+*                                                                 *
+*  Creates an uninitialized bitmap with the same DPI and pixel    *
+*  format as the given bitmap, and the same size unless another   *
+*  one is given.                                                  *
+*                                                                 *
+******************************************************************/
+
+com_ptr<ID2D1Bitmap> DemoApp::CreateBitmapLike(ID2D1Bitmap* pBitmap)
+{
+    return CreateBitmapLike(pBitmap, pBitmap->GetPixelSize());
+}
+
+com_ptr<ID2D1Bitmap> DemoApp::CreateBitmapLike(ID2D1Bitmap* pBitmap, D2D1_SIZE_U bitmapSize)
+{
+    com_ptr<ID2D1Bitmap> bitmap;
+
+    D2D1_BITMAP_PROPERTIES bitmapProp;
+    pBitmap->GetDpi(&bitmapProp.dpiX, &bitmapProp.dpiY);
+    bitmapProp.pixelFormat = pBitmap->GetPixelFormat();
+
+    check_hresult(m_frameComposeRT->CreateBitmap(
+        bitmapSize,
+        bitmapProp,
+        bitmap.put()));
+
+    return bitmap;
+}
+
+/******************************************************************
+*                                                                 *
+*  DemoApp::RestoreCachedFrame()                                  *
+*                                                                 *
+*  Looks up the composed frame that starts at the next frame      *
+*  index in the frame cache.  On a hit, copies it (and the saved  *
+*  frame for disposal 3) into the compose render target and       *
+*  advances the animation state as if the frame had been          *
+*  composed.                                                      *
+*                                                                 *
+******************************************************************/
+
+bool DemoApp::RestoreCachedFrame()
+{
+    GIF_TRACE_SCOPE(GTS_CACHE, m_uNextFrameIndex);
+
+    auto cachedFrame = m_frameCache.Lookup(m_uNextFrameIndex);
+    if (cachedFrame == nullptr)
+    {
+        return false;
+    }
+
+    com_ptr<ID2D1Bitmap> frameToCopyTo;
+    check_hresult(m_frameComposeRT->GetBitmap(frameToCopyTo.put()));
+    check_hresult(frameToCopyTo->CopyFromBitmap(nullptr, cachedFrame->composedFrame.get(), nullptr));
+
+    // The cached saved area is exactly the size of its rect
+    m_savedRect = cachedFrame->savedRect;
+    if (cachedFrame->savedFrame)
+    {
+        EnsureSavedFrame(frameToCopyTo.get(), RectWidth(m_savedRect), RectHeight(m_savedRect));
+        check_hresult(m_savedFrame->CopyFromBitmap(nullptr, cachedFrame->savedFrame.get(), nullptr));
+    }
+
+    // A composed frame starting at the first raw frame begins a new loop
+    if (m_uNextFrameIndex == 0)
+    {
+        m_uLoopNumber++;
+    }
+
+    m_framePosition = cachedFrame->framePosition;
+    m_uFrameDisposal = cachedFrame->uFrameDisposal;
+    m_uFrameDelay = cachedFrame->uFrameDelay;
+    m_uNextFrameIndex = cachedFrame->uNextFrameIndex;
+
+    return true;
+}
+
+/******************************************************************
+*                                                                 *
+*  DemoApp::CacheComposedFrame()                                  *
+*                                                                 *
+*  Copies the composed frame that was produced starting at        *
+*  uFirstFrameIndex into the frame cache, if the cache wants it.  *
+*                                                                 *
+******************************************************************/
+
+void DemoApp::CacheComposedFrame(unsigned int uFirstFrameIndex, unsigned int cFramesComposed)
+{
+    if (!m_frameCache.ShouldCache(uFirstFrameIndex))
+    {
+        return;
+    }
+
+    GIF_TRACE_SCOPE(GTS_CACHE, uFirstFrameIndex);
+
+    com_ptr<ID2D1Bitmap> composedFrame;
+    check_hresult(m_frameComposeRT->GetBitmap(composedFrame.put()));
+
+    auto bitmapSize = composedFrame->GetPixelSize();
+    size_t cbFrame = static_cast<size_t>(bitmapSize.width) * bitmapSize.height * 4;
+
+    // Reuse the bitmaps of the frame the cache evicted last when they fit
+    auto cachedFrame = m_frameCache.TakeSpareFrame();
+    if (!cachedFrame.composedFrame || !IsSameSize(cachedFrame.composedFrame->GetPixelSize(), bitmapSize))
     {
-        auto bitmapSize = frameToBeSaved->GetPixelSize();
-        D2D1_BITMAP_PROPERTIES bitmapProp;
-        frameToBeSaved->GetDpi(&bitmapProp.dpiX, &bitmapProp.dpiY);
-        bitmapProp.pixelFormat = frameToBeSaved->GetPixelFormat();
+        cachedFrame.composedFrame = CreateBitmapLike(composedFrame.get());
+    }
+    check_hresult(cachedFrame.composedFrame->CopyFromBitmap(nullptr, composedFrame.get(), nullptr));
+    size_t cbSize = cbFrame;
 
-        check_hresult(m_frameComposeRT->CreateBitmap(
-            bitmapSize,
-            bitmapProp,
-            m_savedFrame.put()));
+    // Disposing a disposal 3 frame needs the area saved before it was overlaid
+    cachedFrame.savedRect = D2D1::RectU(0, 0, 0, 0);
+    if (m_uFrameDisposal == DM_PREVIOUS && m_savedFrame &&
+        RectWidth(m_savedRect) > 0 && RectHeight(m_savedRect) > 0)
+    {
+        auto savedSize = D2D1::SizeU(RectWidth(m_savedRect), RectHeight(m_savedRect));
+        auto sourceRect = D2D1::RectU(0, 0, savedSize.width, savedSize.height);
+        auto destPoint = D2D1::Point2U(0, 0);
+
+        if (!cachedFrame.savedFrame || !IsSameSize(cachedFrame.savedFrame->GetPixelSize(), savedSize))
+        {
+            cachedFrame.savedFrame = CreateBitmapLike(m_savedFrame.get(), savedSize);
+        }
+        check_hresult(cachedFrame.savedFrame->CopyFromBitmap(&destPoint, m_savedFrame.get(), &sourceRect));
+        cachedFrame.savedRect = m_savedRect;
+        cbSize += static_cast<size_t>(savedSize.width) * savedSize.height * 4;
     }
+    else
+    {
+        cachedFrame.savedFrame = nullptr;
+    }
+
+    cachedFrame.framePosition = m_framePosition;
+    cachedFrame.uFrameDisposal = m_uFrameDisposal;
+    cachedFrame.uFrameDelay = m_uFrameDelay;
+    cachedFrame.uNextFrameIndex = m_uNextFrameIndex;
 
-    // Copy the whole bitmap
-    check_hresult(m_savedFrame->CopyFromBitmap(nullptr, frameToBeSaved.get(), nullptr));
+    m_frameCache.Insert(uFirstFrameIndex, std::move(cachedFrame), cbSize, cFramesComposed);
 }
 
 /******************************************************************
@@ -1006,17 +1733,42 @@ void DemoApp::SelectAndDisplayGif()
         m_uFrameDisposal = DM_NONE;  // No previous frame, use disposal none
         m_uLoopNumber = 0;
         m_fHasLoop = false;
+        m_fLastFrame = false;
         m_savedFrame = nullptr;
+        m_rawFrame = nullptr;
+        m_frameCache.Clear();
 
         // Create a decoder for the gif file
         m_decoder = nullptr;
-        check_hresult(m_wicFactory->CreateDecoderFromFilename(
-            szFileName,
-            nullptr,
-            GENERIC_READ,
-            WICDecodeMetadataCacheOnLoad,
-            m_decoder.put()));
-        GetGlobalMetadata();
+        m_pipeline = nullptr;   // Cancels composing ahead for the previous file
+        m_gifAsset = nullptr;
+        m_composedFrame = nullptr;
+        m_gifBytes = nullptr;
+
+        MapGifFile(szFileName);
+
+        if (m_decoderBackend == DB_NATIVE)
+        {
+            LoadNativeDecoder();
+        }
+        else
+        {
+            // The stream reads from the mapping, which stays alive with the decoder
+            com_ptr<IWICStream> stream;
+            check_hresult(m_wicFactory->CreateStream(stream.put()));
+            check_hresult(stream->InitializeFromMemory(
+                const_cast<BYTE*>(m_gifBytes->Data()),
+                static_cast<DWORD>(m_gifBytes->Size())));
+            // Frame metadata is read as playback reaches each frame, see
+            // IndexWicFrames
+            check_hresult(m_wicFactory->CreateDecoderFromStream(
+                stream.get(),
+                nullptr,
+                WICDecodeMetadataCacheOnDemand,
+                m_decoder.put()));
+            GetGlobalMetadata();
+            m_frameIndex.Reset(m_cxGifImage, m_cyGifImage, 0);
+        }
 
         rcClient.right = m_cxGifImagePixel;
         rcClient.bottom = m_cyGifImagePixel;
@@ -1047,6 +1799,7 @@ void DemoApp::SelectAndDisplayGif()
         // the animation from the first frame
         if (m_cFrames > 0)
         {
+            m_scheduler.Start();
             ComposeNextFrame();
             InvalidateRect(m_hWnd, nullptr, FALSE);
         }
@@ -1057,11 +1810,9 @@ void DemoApp::SelectAndDisplayGif()
 *                                                                 *
 *  DemoApp::ComposeNextFrame()                                    *
 *                                                                 *
-*  Composes the next frame by first disposing the current frame   *
-*  and then overlaying the next frame. More than one frame may    *
-*  be processed in order to produce the next frame to be          *
-*  displayed due to the use of zero delay intermediate frames.    *
-*  Also, sets a timer that is equal to the delay of the frame.    *
+*  Composes the frame that is due and schedules the one after it  *
+*  on the playback timeline.  Frames that are already over by the *
+*  time they are composed are skipped.                            *
 *                                                                 *
 ******************************************************************/
 
@@ -1070,30 +1821,92 @@ void DemoApp::ComposeNextFrame()
     // Check to see if the render targets are initialized
     if (m_hwndRT && m_frameComposeRT)
     {
-        // First, kill the timer since the delay is no longer valid
-        KillTimer(m_hWnd, DELAY_TIMER_ID);
+        for (;;)
+        {
+            ComposeDisplayedFrame();
 
-        // Compose one frame
-        DisposeCurrentFrame();
-        OverlayNextFrame();
+            // Stop scheduling frames at the end of the animation
+            if (m_fLastFrame)
+            {
+                break;
+            }
 
-        // Keep composing frames until we see a frame with delay greater than
-        // 0 (0 delay frames are the invisible intermediate frames), or until
-        // we have reached the very last frame.
-        while (m_uFrameDelay == 0 && !IsLastFrame())
-        {
-            DisposeCurrentFrame();
-            OverlayNextFrame();
+            // Schedule the next frame against the playback timeline.  If this
+            // frame's display time has already passed, skip presenting it and
+            // compose the next one right away to catch up.
+            if (m_scheduler.FrameComposed(m_uFrameDelay))
+            {
+                break;
+            }
         }
+    }
+}
 
-        // If we have more frames to play, set the timer according to the delay.
-        // Set the timer regardless of whether we succeeded in composing a frame
-        // to try our best to continue displaying the animation.
-        if (!EndOfAnimation() && m_cFrames > 1)
+/******************************************************************
+*                                                                 *
+*  DemoApp::ComposeDisplayedFrame()                               *
+*                                                                 *
+*  Composes the next frame to be displayed.  More than one raw    *
+*  frame may be processed due to the use of zero delay            *
+*  intermediate frames.                                           *
+*                                                                 *
+******************************************************************/
+
+void DemoApp::ComposeDisplayedFrame()
+{
+    GIF_TRACE_SCOPE(GTS_COMPOSE, m_uNextFrameIndex);
+
+    if (m_pipeline)
+    {
+        // The pipeline composed this frame ahead of time, and the native
+        // compositor does its own frame caching.  There is no frame past
+        // the end of the animation.
+        auto pFrame = m_pipeline->AcquireFrame();
+        if (pFrame)
         {
-            // Set the timer according to the delay
-            SetTimer(m_hWnd, DELAY_TIMER_ID, m_uFrameDelay, nullptr);
+            UploadComposedFrame(*pFrame);
+            m_pipeline->ReleaseFrame();
         }
+        else
+        {
+            m_fLastFrame = true;
+        }
+    }
+    // Reuse the composed frame from an earlier loop if we have one
+    else if (!RestoreCachedFrame())
+    {
+        auto uFirstFrameIndex = m_uNextFrameIndex;
+
+        DisposeCurrentFrame();
+
+        // Plan the run of frames up to the first frame with delay greater
+        // than 0 (0 delay frames are the invisible intermediate frames), or
+        // up to the very last frame.  The intermediate frames are composed
+        // in one pass, then the displayed frame is overlaid.
+        m_frameRun.Plan(m_uNextFrameIndex, m_cFrames,
+            [this](unsigned int uFrameIndex, GifFrameInfo& frameInfo)
+            {
+                IndexWicFrames(uFrameIndex + 1);
+                m_frameIndex.GetFrameInfo(uFrameIndex, frameInfo);
+#if EXTRA_GIF_DELAY
+                // Every frame gets displayed, see GetRawFrame
+                frameInfo.uDelay = 1;
+#endif
+            },
+            // WIC does not say whether a frame's data ended early, so no
+            // frame is taken to hide the frames before it
+            [](UINT) { return false; });
+        ApplyFrameRun();
+        OverlayNextFrame();
+
+        CacheComposedFrame(uFirstFrameIndex, static_cast<unsigned int>(m_frameRun.GetSteps().size()));
+    }
+
+    // The WIC decoder counts the frames at open.  The pipeline knows
+    // whether another frame follows even when frames are found lazily.
+    if (!m_pipeline)
+    {
+        m_fLastFrame = EndOfAnimation() || m_cFrames <= 1;
     }
 }
 
@@ -1111,15 +1924,24 @@ void DemoApp::RecoverDeviceResources()
     m_hwndRT = nullptr;
     m_frameComposeRT = nullptr;
     m_savedFrame = nullptr;
+    m_rawFrame = nullptr;
+    m_frameCache.Clear();   // Cached bitmaps belong to the lost device
+    m_composedFrame = nullptr;
+    if (m_pipeline)
+    {
+        m_pipeline->Restart();
+    }
 
     m_uNextFrameIndex = 0;
     m_uFrameDisposal = DM_NONE;  // No previous frames. Use disposal none.
     m_uLoopNumber = 0;
+    m_fLastFrame = false;
 
     CreateDeviceResources();
     if (m_cFrames > 0)
     {
         // Load the first frame
+        m_scheduler.Start();
         ComposeNextFrame();
         InvalidateRect(m_hWnd, nullptr, FALSE);
     }
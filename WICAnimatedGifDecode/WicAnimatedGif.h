@@ -9,9 +9,34 @@
 #pragma once
 
 //#include "resource.h"
+#include "FrameCache.h"
+#include "GifAssetCache.h"
+#include "GifDecoder.h"
+#include "GifFramePipeline.h"
+#include "GifFrameRun.h"
+#include "GifPlaybackScheduler.h"
 
 const float DEFAULT_DPI = 96.f;   // Default DPI that maps image resolution directly to screen resoltuion
 
+enum DECODER_BACKEND
+{
+    DB_WIC = 0,     // IWICBitmapDecoder, palette expansion and D2D composition
+    DB_NATIVE = 1   // GifDecoder and GifCompositor composing in system memory
+};
+
+// A composed frame together with the state needed to continue composing
+// from it, as stored in the composed frame cache
+struct CachedComposedFrame
+{
+    winrt::com_ptr<ID2D1Bitmap> composedFrame;
+    winrt::com_ptr<ID2D1Bitmap> savedFrame;     // Only set if the last raw frame uses disposal 3
+    D2D1_RECT_U                 savedRect;      // Where savedFrame goes back in the composed frame
+    D2D1_RECT_F                 framePosition;
+    unsigned int                uFrameDisposal;
+    unsigned int                uFrameDelay;
+    unsigned int                uNextFrameIndex;
+};
+
 /******************************************************************
 *                                                                 *
 *  DemoApp                                                        *
@@ -27,6 +52,39 @@ public:
 
     void Initialize(HINSTANCE hInstance);
 
+    // Selects how composed frames are cached for the current animation.
+    // Takes effect immediately.  The WIC decoder drops any frames cached
+    // so far.  The native decoder caches frames in the process wide asset
+    // cache, which other players share, under its budget rather than
+    // cbBudget.
+    void SetFrameCacheMode(FRAME_CACHE_MODE mode, size_t cbBudget = DEFAULT_FRAME_CACHE_BUDGET);
+
+    // Selects the GIF_FRAME_CODEC flags the native decoder's composed
+    // frames are cached with.  Takes effect immediately.
+    void SetFrameCacheCodec(unsigned int uCodec);
+    FrameCacheStats GetFrameCacheStats()
+    {
+        return m_pipeline ? m_pipeline->GetFrameCacheStats() : m_frameCache.GetStats();
+    }
+
+    GifPlaybackStats GetPlaybackStats() const
+    {
+        return m_scheduler.GetStats();
+    }
+
+    // Time from each frame being due to it being on screen
+    GifLatencyHistogram GetPresentLatencyHistogram() const
+    {
+        return m_scheduler.GetLatencyHistogram();
+    }
+
+    // Selects how gif files are decoded and composed.  Takes effect with the
+    // next file that is opened.
+    void SetDecoderBackend(DECODER_BACKEND backend)
+    {
+        m_decoderBackend = backend;
+    }
+
 private:
 
     enum DISPOSAL_METHODS
@@ -42,22 +100,40 @@ private:
 
     void OnResize(UINT uWidth, UINT uHeight);
     void OnRender();
+    void WriteTrace();
 
     bool    GetFileOpen(WCHAR* pszFileName, DWORD cchFileName);
     void SelectAndDisplayGif();
 
     void GetRawFrame(UINT uFrameIndex);
+    void ExpandIndexedFrame(IWICBitmapFrameDecode* pFrame, UINT cx, UINT cy);
+    void ConvertFrame(IWICBitmapFrameDecode* pFrame, UINT cx, UINT cy);
+    void EnsureRawFrame(UINT32 cx, UINT32 cy);
     void GetGlobalMetadata();
+    void IndexWicFrames(UINT cFramesNeeded);
     void GetBackgroundColor(IWICMetadataQueryReader* pMetadataQueryReader);
 
+    void MapGifFile(const WCHAR* pszFileName);
+    void LoadNativeDecoder();
+    std::shared_ptr<IGifSharedFrameStore> GetSharedFrameStore();
+    void UploadComposedFrame(const GifPipelineFrame& frame);
+
     void ComposeNextFrame();
+    void ComposeDisplayedFrame();
     void DisposeCurrentFrame();
+    void ApplyFrameRun();
     void OverlayNextFrame();
 
     void SaveComposedFrame();
     void RestoreSavedFrame();
     void ClearCurrentFrameArea();
 
+    bool RestoreCachedFrame();
+    void CacheComposedFrame(unsigned int uFirstFrameIndex, unsigned int cFramesComposed);
+    void EnsureSavedFrame(ID2D1Bitmap* pComposedFrame, UINT32 cx, UINT32 cy);
+    winrt::com_ptr<ID2D1Bitmap> CreateBitmapLike(ID2D1Bitmap* pBitmap);
+    winrt::com_ptr<ID2D1Bitmap> CreateBitmapLike(ID2D1Bitmap* pBitmap, D2D1_SIZE_U bitmapSize);
+
     bool IsLastFrame()
     {
         return (m_uNextFrameIndex == 0);
@@ -80,18 +156,37 @@ private:
     winrt::com_ptr<ID2D1Factory> m_d2dFactory;
     winrt::com_ptr<ID2D1HwndRenderTarget> m_hwndRT;
     winrt::com_ptr<ID2D1BitmapRenderTarget> m_frameComposeRT;
-    winrt::com_ptr<ID2D1Bitmap> m_rawFrame;
+    winrt::com_ptr<ID2D1Bitmap> m_rawFrame;            // Reused for every raw frame, grown to the largest one
+    D2D1_RECT_F                 m_rawSourceRect;       // The area of m_rawFrame holding the current raw frame
     winrt::com_ptr<ID2D1Bitmap> m_savedFrame;          // The temporary bitmap used for disposal 3 method
+    D2D1_RECT_U                 m_savedRect;           // The area of the composed frame held in m_savedFrame
     D2D1_COLOR_F                m_backgroundColor;
+    FrameCache<CachedComposedFrame> m_frameCache;
 
     winrt::com_ptr<IWICImagingFactory> m_wicFactory;
+    std::shared_ptr<GifByteSource> m_gifBytes;      // The mapped gif file, declared first so it outlives the decoders
     winrt::com_ptr<IWICBitmapDecoder> m_decoder;
+    winrt::com_ptr<IWICPalette> m_rawPalette;       // Reused for the palette of every raw frame
+    std::vector<uint8_t> m_rawIndices;              // Color indices of the raw frame, only grows
+    std::vector<uint32_t> m_rawPixels;              // The raw frame in 32bppPBGRA, only grows
+    GifFrameIndex m_frameIndex;     // Frame metadata for the WIC decoder, read once as playback reaches each frame
+    GifFrameRun m_frameRun;         // The run of zero delay frames being composed
+
+    GifPlaybackScheduler            m_scheduler;        // Posts WM_FRAME_DUE when the next frame is due
+
+    DECODER_BACKEND                 m_decoderBackend;
+    std::shared_ptr<GifAsset>       m_gifAsset;         // Shared with every other player of the same gif
+    unsigned int                    m_uFrameCacheCodec; // GIF_FRAME_CODEC flags of the native frames put in the asset cache
+    std::unique_ptr<GifFramePipeline> m_pipeline;       // Composes native frames ahead on a worker thread
+    winrt::com_ptr<ID2D1Bitmap>     m_composedFrame;    // The native composed frame uploaded for rendering
+    bool                            m_fUploadFullFrame; // m_composedFrame was recreated and holds no pixels yet
 
     unsigned int    m_uNextFrameIndex;
     unsigned int    m_uTotalLoopCount;  // The number of loops for which the animation will be played
     unsigned int    m_uLoopNumber;      // The current animation loop number (e.g. 1 when the animation is first played)
     bool            m_fHasLoop;         // Whether the gif has a loop
-    unsigned int    m_cFrames;
+    unsigned int    m_cFrames;          // With the native decoder, only the frames found before the first frame was shown
+    bool            m_fLastFrame;       // No frame follows the one composed last
     unsigned int    m_uFrameDisposal;
     unsigned int    m_uFrameDelay;
     unsigned int    m_cxGifImage;